@@ -0,0 +1,841 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <sys/stat.h>
+#include "fs.h"
+#include "compress.h"
+
+#define BENCH_IMAGE "bench.bin"
+#define BENCH_BLOCKS 16384 // 64 MiB with 4 KiB blocks, room for two of the largest files
+#define BENCH_BYTES (16 << 20) // bytes created per file size, sets the number of rounds
+#define BENCH_MIN_ROUNDS 5
+#define BENCH_MAX_ROUNDS 200
+#define BENCH_DIR_ROUNDS 100
+#define BENCH_CSUM_BYTES (4 << 20) // file read back with and without checksums
+#define BENCH_CSUM_ROUNDS 40
+#define BENCH_CSUM_SSD_ROUNDS 10 // each round waits ~30 ms for the simulated SSD
+#define BENCH_LZ_BYTES (4 << 20) // file stored with and without compression
+#define BENCH_LZ_ROUNDS 20
+#define BENCH_LZ_SSD_ROUNDS 10
+#define BENCH_DEDUP_BYTES (1 << 20) // template copied over and over
+#define BENCH_DEDUP_COPIES 16
+#define BENCH_SMALL_DIRS 20 // directories of small config files, with and without packing
+#define BENCH_SMALL_FILES 50 // files in each, from 64 to 1000 bytes
+#define BENCH_SPARSE_BYTES (16 << 20) // file read and copied as holes and as data
+#define BENCH_SPARSE_WRITES 16 // blocks written into the holes
+#define BENCH_SPARSE_ROUNDS 10
+#define BENCH_DISCARD_FILES 32 // files written and removed again
+#define BENCH_PREALLOC_FILES 4 // files streamed in at the same time
+#define BENCH_PREALLOC_BYTES (4 << 20)
+#define BENCH_PREALLOC_CHUNK (64 << 10)
+#define BENCH_DISCARD_BYTES (1 << 20)
+#define BENCH_DELAY_FILES 4 // files growing side by side
+#define BENCH_DELAY_APPENDS 64 // appends to each of them
+#define BENCH_DELAY_PIECE 4096 // bytes added by every append
+#define BENCH_DELAY_TEMP 64 // files created and removed again
+#define BENCH_LOG_DIRS 8 // directories of small files updated at random
+#define BENCH_LOG_FILES 32 // files in each
+#define BENCH_LOG_UPDATES 1024 // appends to random files, with a sync every BENCH_LOG_SYNC
+#define BENCH_LOG_SYNC 16
+#define BENCH_SNAP_FILES 64 // files of a log-structured volume a snapshot is taken of
+#define BENCH_SNAP_BYTES (64 << 10)
+#define BENCH_SNAP_ROUNDS 20 // snapshots taken and deleted again
+#define BENCH_SNAP_CHANGED 8 // files rewritten once the snapshot is kept
+
+// In-process benchmark of the FS operations. Every operation is timed on its
+// own, the results are printed as one JSON document on stdout:
+//   {"image": ..., "block_size": ..., "no_blocks": ..., "results": [
+//     {"scenario": ..., "param": ..., "op": ..., "count": ...,
+//      "ops_per_sec": ..., "p50_us": ..., "p99_us": ...}, ...],
+//   "compression": [{"text": ..., "bytes": ..., "stored": ..., "blocks": ...,
+//      "ratio": ...}, ...],
+//   "dedup": [{"enabled": ..., "copies": ..., "blocks_used": ...}, ...],
+//   "packing": [{"enabled": ..., "files": ..., "blocks_used": ...}, ...],
+//   "sparse": [{"sparse": ..., "bytes": ..., "blocks_used": ...}, ...],
+//   "discard": {"files": ..., "bytes": ..., "host_written": ..., "host_removed": ...},
+//   "prealloc": [{"prealloc": ..., "files": ..., "worst_extents": ...}, ...],
+//   "delalloc": [{"delayed": ..., "files": ..., "worst_extents": ..., "temp_files": ...,
+//      "disk_writes": ...}, ...],
+//   "log": [{"log": ..., "updates": ..., "seeks": ..., "modelled_ms": ...}, ...],
+//   "snapshot": {"files": ..., "blocks": ..., "changed_files": ..., "own_blocks": ...}}
+// Output of the FS itself is thrown away while a benchmark runs.
+
+struct Result {
+    std::string scenario;
+    std::string param; // name of the swept parameter
+    unsigned long value;
+    std::string op;
+    std::vector<double> us; // latency of every call
+};
+
+static std::vector<Result> results;
+// size of each kind of text before and after compress_file()
+static std::vector<std::pair<std::string, std::pair<size_t, size_t>>> ratios;
+// blocks in use after the copies, without and with dedup
+static unsigned long dedupBlocks[2];
+// blocks in use after the small files, without and with packing
+static unsigned long packedBlocks[2];
+// blocks in use with the file written out and with it sparse
+static unsigned long sparseBlocks[2];
+// host space of the disk file with the files written and after they were removed
+static uint64_t hostBytes[2];
+// extents of the most fragmented file streamed in without and with prealloc
+static unsigned long preallocExtents[2];
+// extents of the most fragmented file grown by appends and blocks written for
+// files removed again, with the files on the disk first and delayed
+static unsigned long delayExtents[2];
+static unsigned long delayWrites[2];
+// seeks and modelled time of the simulated HDD for random updates, written in
+// place and to a log
+static unsigned long logSeeks[2];
+static double logModelledMs[2];
+// blocks in use when the snapshot was taken and blocks only it holds once
+// some of the files were rewritten
+static unsigned long snapBlocks;
+static unsigned long snapOwn;
+static std::stringstream discard;
+
+//Returns the result the next latency of op goes to
+static Result& result(const std::string& scenario, const std::string& param,
+    unsigned long value, const std::string& op)
+{
+    for (Result& r : results)
+    {
+        if (r.scenario == scenario && r.param == param && r.value == value && r.op == op)
+        {
+            return r;
+        }
+    }
+    results.push_back({scenario, param, value, op, {}});
+    return results.back();
+}
+
+//Runs one call and records how long it took
+template <typename F>
+static void timed(Result& r, F call)
+{
+    auto start = std::chrono::steady_clock::now();
+    call();
+    auto end = std::chrono::steady_clock::now();
+    discard.str("");
+    r.us.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+}
+
+//Text that create turns into a file of exactly size bytes, size is at least 2
+//since every line create reads ends with a newline and the empty line ends the input
+static std::string content(unsigned long size)
+{
+    std::string text;
+    while (text.size() < size)
+    {
+        unsigned long line = std::min(size - text.size(), 64UL);
+        text.append(line - 1, 'a' + text.size() % 26);
+        text += '\n';
+    }
+    return text + "\n";
+}
+
+//Text of about size bytes made of lines like those of a server log, or of random
+//letters that do not compress, ended with the empty line create waits for
+static std::string logText(unsigned long size, bool random)
+{
+    static const char *levels[] = {"INFO", "INFO", "INFO", "WARN", "DEBUG"};
+    static const char *events[] = {"handled request", "opened session", "closed session", "cache miss"};
+    uint64_t seed = 42;
+    auto next = [&] { seed = seed * 6364136223846793005ULL + 1442695040888963407ULL; return seed >> 33; };
+    std::string text;
+    char line[160];
+    while (text.size() < size)
+    {
+        if (random)
+        {
+            for (int i = 0; i < 63; i++)
+            {
+                line[i] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789+/"[next() % 64];
+            }
+            line[63] = '\0';
+        }
+        else
+        {
+            unsigned long n = text.size() / 80;
+            snprintf(line, sizeof(line), "2026-10-19 %02lu:%02lu:%02lu.%03lu %s worker-%lu %s id=%lu bytes=%lu",
+                n / 3600 % 24, n / 60 % 60, n % 60, next() % 1000, levels[next() % 5], next() % 16,
+                events[next() % 4], n, next() % 100000);
+        }
+        text += line;
+        text += '\n';
+    }
+    return text + "\n";
+}
+
+//Runs create with the file content coming from text instead of the keyboard
+static void create(Result& r, FS& fs, const std::string& path, const std::string& text)
+{
+    std::istringstream input(text);
+    std::streambuf* in = std::cin.rdbuf(input.rdbuf());
+    timed(r, [&] { fs.create(path); });
+    std::cin.rdbuf(in);
+}
+
+// create, cat, cp, append, mv and rm of files from a few bytes to several MiB
+static void fileSizes(FS& fs)
+{
+    const unsigned long sizes[] = {2, 512, 4096, 65536, 1 << 20, 4 << 20};
+    const std::string tiny = content(2);
+    for (unsigned long size : sizes)
+    {
+        fs.format(BENCH_BLOCKS, BLOCK_SIZE);
+        std::istringstream input(tiny);
+        std::streambuf* in = std::cin.rdbuf(input.rdbuf());
+        fs.create("t");
+        std::cin.rdbuf(in);
+
+        const std::string text = content(size);
+        unsigned long rounds = std::max((unsigned long)BENCH_MIN_ROUNDS,
+            std::min((unsigned long)BENCH_MAX_ROUNDS, BENCH_BYTES / size));
+        for (unsigned long i = 0; i < rounds; i++)
+        {
+            //Always removes the last entry of the directory
+            create(result("file_size", "bytes", size, "create"), fs, "f", text);
+            timed(result("file_size", "bytes", size, "cat"), [&] { fs.cat("f"); });
+            timed(result("file_size", "bytes", size, "cp"), [&] { fs.cp("f", "g"); });
+            timed(result("file_size", "bytes", size, "append"), [&] { fs.append("t", "g"); });
+            timed(result("file_size", "bytes", size, "mv"), [&] { fs.mv("g", "h"); });
+            timed(result("file_size", "bytes", size, "rm"), [&] { fs.rm("h"); });
+            timed(result("file_size", "bytes", size, "rm"), [&] { fs.rm("f"); });
+        }
+    }
+}
+
+// create, ls, mkdir and rm in a directory that is already partly full
+static void dirFill(FS& fs)
+{
+    const unsigned entries = BLOCK_SIZE / sizeof(dir_entry);
+    const unsigned percents[] = {0, 25, 50, 75, 95};
+    const std::string tiny = content(2);
+    for (unsigned percent : percents)
+    {
+        fs.format(BENCH_BLOCKS, BLOCK_SIZE);
+        unsigned fill = std::min(entries * percent / 100, entries - 2);
+        for (unsigned i = 0; i < fill; i++)
+        {
+            std::istringstream input(tiny);
+            std::streambuf* in = std::cin.rdbuf(input.rdbuf());
+            fs.create("fill" + std::to_string(i));
+            std::cin.rdbuf(in);
+        }
+        for (unsigned i = 0; i < BENCH_DIR_ROUNDS; i++)
+        {
+            create(result("dir_fill", "percent", percent, "create"), fs, "f", tiny);
+            timed(result("dir_fill", "percent", percent, "ls"), [&] { fs.ls(); });
+            timed(result("dir_fill", "percent", percent, "rm"), [&] { fs.rm("f"); });
+            timed(result("dir_fill", "percent", percent, "mkdir"), [&] { fs.mkdir("d"); });
+            timed(result("dir_fill", "percent", percent, "rm"), [&] { fs.rm("d"); });
+        }
+    }
+}
+
+// cd, pwd and cat through paths of increasing depth
+static void treeDepth(FS& fs)
+{
+    const unsigned depths[] = {1, 4, 16, 32};
+    const std::string tiny = content(2);
+    for (unsigned depth : depths)
+    {
+        fs.format(BENCH_BLOCKS, BLOCK_SIZE);
+        std::string path;
+        for (unsigned i = 0; i < depth; i++)
+        {
+            path += "/d" + std::to_string(i);
+            fs.mkdir(path);
+        }
+        std::istringstream input(tiny);
+        std::streambuf* in = std::cin.rdbuf(input.rdbuf());
+        fs.cd(path);
+        fs.create("f");
+        fs.cd("/");
+        std::cin.rdbuf(in);
+
+        for (unsigned i = 0; i < BENCH_DIR_ROUNDS; i++)
+        {
+            timed(result("tree_depth", "depth", depth, "cd"), [&] { fs.cd(path); });
+            timed(result("tree_depth", "depth", depth, "pwd"), [&] { fs.pwd(); });
+            timed(result("tree_depth", "depth", depth, "ls"), [&] { fs.ls(); });
+            timed(result("tree_depth", "depth", depth, "cd"), [&] { fs.cd("/"); });
+            timed(result("tree_depth", "depth", depth, "cat"), [&] { fs.cat(path + "/f"); });
+        }
+    }
+}
+
+// cat of a file that has to come from the disk, on a disk with and without
+// block checksums, and the speed of the checksum itself. The disk file sits in
+// the host page cache, which reads far faster than a device, so cat_ssd also
+// reads it through the simulated SSD.
+static void checksums(const std::string& image)
+{
+    //One image of each kind, so the rounds can take turns and see the same load
+    const std::string images[] = {image + ".plain", image + ".csum"};
+    const std::string text = content(BENCH_CSUM_BYTES);
+    for (unsigned enabled = 0; enabled <= 1; enabled++)
+    {
+        FS fs(images[enabled]);
+        fs.format(BENCH_BLOCKS, BLOCK_SIZE, enabled == 1 ? FORMAT_CHECKSUMS : 0);
+        std::istringstream input(text);
+        std::streambuf* in = std::cin.rdbuf(input.rdbuf());
+        fs.create("f");
+        std::cin.rdbuf(in);
+    }
+    for (unsigned i = 0; i < BENCH_CSUM_ROUNDS; i++)
+    {
+        for (unsigned enabled = 0; enabled <= 1; enabled++)
+        {
+            //A new FS starts with an empty cache, every block is read from the disk
+            FS fs(images[enabled]);
+            timed(result("checksums", "enabled", enabled, "cat"), [&] { fs.cat("f"); });
+        }
+    }
+    for (unsigned i = 0; i < BENCH_CSUM_SSD_ROUNDS; i++)
+    {
+        for (unsigned enabled = 0; enabled <= 1; enabled++)
+        {
+            FS fs(images[enabled]);
+            fs.device({"ssd"});
+            timed(result("checksums", "enabled", enabled, "cat_ssd"), [&] { fs.cat("f"); });
+        }
+    }
+    for (const std::string& name : images)
+    {
+        std::remove(name.c_str());
+    }
+
+    std::vector<uint8_t> data(1 << 20, 'x');
+    uint32_t sum = 0;
+    for (unsigned i = 0; i < BENCH_CSUM_ROUNDS; i++)
+    {
+        timed(result("checksums", "hardware", 0, "crc32c_1MiB"),
+            [&] { sum ^= crc32c_table(sum, data.data(), data.size()); });
+        if (crc32c_hardware())
+        {
+            timed(result("checksums", "hardware", 1, "crc32c_1MiB"),
+                [&] { sum ^= crc32c(sum, data.data(), data.size()); });
+        }
+    }
+    discard << sum;
+}
+
+// create and cat of a text file on a volume with and without compression, cat
+// from the disk and through the simulated SSD, the speed of the codec itself and
+// how far log text and random text shrink
+static void compression(const std::string& image)
+{
+    const std::string images[] = {image + ".plain", image + ".lz"};
+    const std::string text = logText(BENCH_LZ_BYTES, false);
+    for (unsigned enabled = 0; enabled <= 1; enabled++)
+    {
+        FS fs(images[enabled]);
+        fs.format(BENCH_BLOCKS, BLOCK_SIZE, enabled == 1 ? FORMAT_COMPRESS : 0);
+        for (unsigned i = 0; i < BENCH_LZ_ROUNDS; i++)
+        {
+            create(result("compression", "enabled", enabled, "create"), fs, "f", text);
+            if (i + 1 < BENCH_LZ_ROUNDS)
+            {
+                fs.rm("f");
+            }
+        }
+    }
+    for (unsigned i = 0; i < BENCH_LZ_ROUNDS; i++)
+    {
+        for (unsigned enabled = 0; enabled <= 1; enabled++)
+        {
+            FS fs(images[enabled]);
+            timed(result("compression", "enabled", enabled, "cat"), [&] { fs.cat("f"); });
+        }
+    }
+    for (unsigned i = 0; i < BENCH_LZ_SSD_ROUNDS; i++)
+    {
+        for (unsigned enabled = 0; enabled <= 1; enabled++)
+        {
+            FS fs(images[enabled]);
+            fs.device({"ssd"});
+            timed(result("compression", "enabled", enabled, "cat_ssd"), [&] { fs.cat("f"); });
+        }
+    }
+    for (const std::string& name : images)
+    {
+        std::remove(name.c_str());
+    }
+
+    for (unsigned random = 0; random <= 1; random++)
+    {
+        std::string plain = logText(1 << 20, random == 1);
+        plain.pop_back();
+        std::string packed = compress_file(plain), unpacked;
+        ratios.push_back(std::make_pair(random ? "random" : "log", std::make_pair(plain.size(), packed.size())));
+        for (unsigned i = 0; i < BENCH_LZ_ROUNDS; i++)
+        {
+            timed(result("compression", "random", random, "compress_1MiB"), [&] { packed = compress_file(plain); });
+            timed(result("compression", "random", random, "decompress_1MiB"), [&] {
+                unpacked.clear();
+                decompress_file(packed, plain.size(), unpacked);
+            });
+        }
+        discard << (unpacked == plain);
+    }
+}
+
+//Reads a counter from what a report of the FS printed, the number after label
+static unsigned long counter(const std::string& report, const std::string& label)
+{
+    size_t at = report.find(label);
+    return at == std::string::npos ? 0 : std::stoul(report.substr(at + label.size()));
+}
+
+// copies of one template with cp and with create on a volume with and without
+// deduplication, the blocks that end up used, and the speed of the
+// fingerprint with and without SIMD
+static void dedupCopies(const std::string& image)
+{
+    const std::string text = logText(BENCH_DEDUP_BYTES, false);
+    for (unsigned enabled = 0; enabled <= 1; enabled++)
+    {
+        FS fs(image);
+        fs.format(BENCH_BLOCKS, BLOCK_SIZE, enabled == 1 ? FORMAT_DEDUP : 0);
+        create(result("dedup", "enabled", enabled, "create"), fs, "t", text);
+        for (unsigned i = 0; i < BENCH_DEDUP_COPIES; i++)
+        {
+            timed(result("dedup", "enabled", enabled, "cp"), [&] { fs.cp("t", "c" + std::to_string(i)); });
+            create(result("dedup", "enabled", enabled, "create"), fs, "n" + std::to_string(i), text);
+        }
+        discard.str("");
+        fs.fsinfo();
+        dedupBlocks[enabled] = counter(discard.str(), "  used ");
+    }
+    std::remove(image.c_str());
+
+    std::vector<uint8_t> data(1 << 20, 'x');
+    uint64_t sum = 0;
+    for (unsigned i = 0; i < BENCH_LZ_ROUNDS; i++)
+    {
+        timed(result("dedup", "simd", 0, "hash128_1MiB"), [&] { sum ^= hash128_scalar(data.data(), data.size()).lo; });
+        timed(result("dedup", "simd", 1, "hash128_1MiB"), [&] { sum ^= hash128_of(data.data(), data.size()).lo; });
+    }
+    discard << sum;
+}
+
+// many small files in a few directories on a volume with and without packing,
+// created, then read back on a fresh mount so every block comes from the disk
+static void smallFiles(const std::string& image)
+{
+    for (unsigned enabled = 0; enabled <= 1; enabled++)
+    {
+        {
+            FS fs(image);
+            fs.format(BENCH_BLOCKS, BLOCK_SIZE, enabled == 1 ? FORMAT_PACK : 0);
+            for (unsigned d = 0; d < BENCH_SMALL_DIRS; d++)
+            {
+                std::string dir = "/d" + std::to_string(d);
+                fs.mkdir(dir);
+                for (unsigned f = 0; f < BENCH_SMALL_FILES; f++)
+                {
+                    unsigned long size = 64 + (d * BENCH_SMALL_FILES + f) * 397 % 937;
+                    create(result("small_files", "packed", enabled, "create"), fs,
+                        dir + "/c" + std::to_string(f), content(size));
+                }
+            }
+            discard.str("");
+            fs.fsinfo();
+            packedBlocks[enabled] = counter(discard.str(), "  used ");
+        }
+        FS fs(image);
+        for (unsigned d = 0; d < BENCH_SMALL_DIRS; d++)
+        {
+            for (unsigned f = 0; f < BENCH_SMALL_FILES; f++)
+            {
+                std::string path = "/d" + std::to_string(d) + "/c" + std::to_string(f);
+                timed(result("small_files", "packed", enabled, "cat"), [&] { fs.cat(path); });
+            }
+        }
+    }
+    std::remove(image.c_str());
+}
+
+// a file of mostly holes against one of the same size written out: cat, pread,
+// cp and get of each and the blocks each takes
+static void sparseFiles(const std::string& image)
+{
+    std::string host = image + ".get";
+    for (unsigned sparse = 0; sparse <= 1; sparse++)
+    {
+        FS fs(image);
+        fs.format(BENCH_BLOCKS, BLOCK_SIZE, 0);
+        unsigned long stride = BENCH_SPARSE_BYTES / BENCH_SPARSE_WRITES;
+        if (sparse == 1)
+        {
+            create(result("sparse", "sparse", 1, "create"), fs, "f", "\n");
+            timed(result("sparse", "sparse", 1, "truncate"), [&] { fs.truncate("f", BENCH_SPARSE_BYTES); });
+            int handle = fs.open("f");
+            for (unsigned i = 0; i < BENCH_SPARSE_WRITES; i++)
+            {
+                std::string data(BLOCK_SIZE, 'a' + i % 26);
+                timed(result("sparse", "sparse", 1, "pwrite"), [&] { fs.pwrite(handle, i * stride, data); });
+            }
+            fs.close(handle);
+        }
+        else
+        {
+            create(result("sparse", "sparse", 0, "create"), fs, "f", content(BENCH_SPARSE_BYTES));
+        }
+        discard.str("");
+        fs.fsinfo();
+        sparseBlocks[sparse] = counter(discard.str(), "  used ");
+
+        int handle = fs.open("f");
+        std::string data;
+        for (unsigned i = 0; i < BENCH_SPARSE_ROUNDS; i++)
+        {
+            timed(result("sparse", "sparse", sparse, "cat"), [&] { fs.cat("f"); });
+            for (unsigned w = 0; w < BENCH_SPARSE_WRITES; w++)
+            {
+                timed(result("sparse", "sparse", sparse, "pread"),
+                    [&] { fs.pread(handle, w * stride + stride / 2, BLOCK_SIZE, data); });
+            }
+            timed(result("sparse", "sparse", sparse, "cp"), [&] { fs.cp("f", "g"); });
+            fs.rm("g");
+            timed(result("sparse", "sparse", sparse, "get"), [&] { fs.get("f", host); });
+        }
+        fs.close(handle);
+    }
+    std::remove(host.c_str());
+    std::remove(image.c_str());
+}
+
+//Bytes the host has allocated for the file at path
+static uint64_t allocated(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? (uint64_t)st.st_blocks * 512 : 0;
+}
+
+// files written and removed again, the host space of the disk file after each
+// once the volume is unmounted
+static void discardSpace(const std::string& image)
+{
+    {
+        FS fs(image);
+        fs.format(BENCH_BLOCKS, BLOCK_SIZE, 0);
+        for (unsigned i = 0; i < BENCH_DISCARD_FILES; i++)
+        {
+            create(result("discard", "files", BENCH_DISCARD_FILES, "create"), fs,
+                "f" + std::to_string(i), content(BENCH_DISCARD_BYTES));
+        }
+    }
+    hostBytes[0] = allocated(image);
+    {
+        FS fs(image);
+        for (unsigned i = 0; i < BENCH_DISCARD_FILES; i++)
+        {
+            timed(result("discard", "files", BENCH_DISCARD_FILES, "rm"), [&] { fs.rm("f" + std::to_string(i)); });
+        }
+    }
+    hostBytes[1] = allocated(image);
+    std::remove(image.c_str());
+}
+
+// files streamed in a chunk at a time side by side through pwrite, as they
+// come and with their size reserved up front by fallocate
+static void preallocFiles(const std::string& image)
+{
+    for (unsigned prealloc = 0; prealloc <= 1; prealloc++)
+    {
+        FS fs(image);
+        fs.format(BENCH_BLOCKS, BLOCK_SIZE, 0);
+        std::vector<int> handles;
+        for (unsigned f = 0; f < BENCH_PREALLOC_FILES; f++)
+        {
+            std::string path = "s" + std::to_string(f);
+            if (prealloc == 1)
+            {
+                timed(result("prealloc", "prealloc", 1, "fallocate"), [&] { fs.fallocate(path, BENCH_PREALLOC_BYTES); });
+            }
+            else
+            {
+                create(result("prealloc", "prealloc", 0, "create"), fs, path, "\n");
+            }
+            handles.push_back(fs.open(path));
+        }
+        std::string chunk(BENCH_PREALLOC_CHUNK, 'p');
+        for (unsigned long at = 0; at < BENCH_PREALLOC_BYTES; at += BENCH_PREALLOC_CHUNK)
+        {
+            for (int handle : handles)
+            {
+                timed(result("prealloc", "prealloc", prealloc, "pwrite_64KiB"), [&] { fs.pwrite(handle, at, chunk); });
+            }
+        }
+        for (int handle : handles)
+        {
+            fs.close(handle);
+        }
+        discard.str("");
+        fs.fsinfo();
+        preallocExtents[prealloc] = std::max(1ul, counter(discard.str(), "Most fragmented\n"));
+        for (unsigned i = 0; i < BENCH_SPARSE_ROUNDS; i++)
+        {
+            timed(result("prealloc", "prealloc", prealloc, "cat"), [&] { fs.cat("s0"); });
+        }
+    }
+    std::remove(image.c_str());
+}
+
+// files grown side by side by small appends and short-lived files removed again,
+// once written to the disk before that happens and once delayed until sync
+static void delayedFiles(const std::string& image)
+{
+    for (unsigned delayed = 0; delayed <= 1; delayed++)
+    {
+        FS fs(image);
+        fs.format(BENCH_BLOCKS, BLOCK_SIZE, 0);
+        create(result("delalloc", "delayed", delayed, "create"), fs, "piece", content(BENCH_DELAY_PIECE));
+        for (unsigned f = 0; f < BENCH_DELAY_FILES; f++)
+        {
+            create(result("delalloc", "delayed", delayed, "create"), fs, "g" + std::to_string(f), content(2));
+        }
+        if (delayed == 0)
+        {
+            fs.sync();
+        }
+        for (unsigned i = 0; i < BENCH_DELAY_APPENDS; i++)
+        {
+            for (unsigned f = 0; f < BENCH_DELAY_FILES; f++)
+            {
+                timed(result("delalloc", "delayed", delayed, "append_4KiB"), [&] { fs.append("piece", "g" + std::to_string(f)); });
+            }
+        }
+        timed(result("delalloc", "delayed", delayed, "sync"), [&] { fs.sync(); });
+        discard.str("");
+        fs.fsinfo();
+        delayExtents[delayed] = std::max(1ul, counter(discard.str(), "Most fragmented\n"));
+
+        fs.stats(true);
+        for (unsigned i = 0; i < BENCH_DELAY_TEMP; i++)
+        {
+            std::string path = "t" + std::to_string(i);
+            create(result("delalloc", "delayed", delayed, "create_temp"), fs, path, content(4 * BENCH_DELAY_PIECE));
+            if (delayed == 0)
+            {
+                fs.sync();
+            }
+            timed(result("delalloc", "delayed", delayed, "rm_temp"), [&] { fs.rm(path); });
+        }
+        fs.sync();
+        discard.str("");
+        fs.stats();
+        delayWrites[delayed] = counter(discard.str(), "writes ");
+    }
+    std::remove(image.c_str());
+}
+
+// small files in many directories updated at random and synced often, once
+// written in place and once to the head of a log, through the simulated HDD
+static void logUpdates(const std::string& image)
+{
+    for (unsigned log = 0; log <= 1; log++)
+    {
+        FS fs(image);
+        fs.format(BENCH_BLOCKS, BLOCK_SIZE, log == 1 ? FORMAT_LOG : 0);
+        create(result("log", "log", log, "create"), fs, "piece", content(256));
+        for (unsigned d = 0; d < BENCH_LOG_DIRS; d++)
+        {
+            std::string dir = "d" + std::to_string(d);
+            fs.mkdir(dir);
+            for (unsigned f = 0; f < BENCH_LOG_FILES; f++)
+            {
+                create(result("log", "log", log, "create"), fs, dir + "/f" + std::to_string(f), content(3 * BLOCK_SIZE));
+            }
+        }
+        fs.sync();
+
+        fs.device({"hdd", "mode=virtual"});
+        fs.stats(true);
+        uint64_t seed = 7;
+        for (unsigned i = 0; i < BENCH_LOG_UPDATES; i++)
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            unsigned pick = (seed >> 33) % (BENCH_LOG_DIRS * BENCH_LOG_FILES);
+            std::string path = "d" + std::to_string(pick / BENCH_LOG_FILES) + "/f" + std::to_string(pick % BENCH_LOG_FILES);
+            timed(result("log", "log", log, "append_256B"), [&] { fs.append("piece", path); });
+            if ((i + 1) % BENCH_LOG_SYNC == 0)
+            {
+                timed(result("log", "log", log, "sync"), [&] { fs.sync(); });
+            }
+        }
+        discard.str("");
+        fs.stats();
+        std::string report = discard.str();
+        logSeeks[log] = counter(report, "seeks ");
+        size_t at = report.find("modelled time ");
+        logModelledMs[log] = at == std::string::npos ? 0 : std::stod(report.substr(at + 14));
+    }
+    std::remove(image.c_str());
+}
+
+// snapshots of a log-structured volume taken and deleted again, and what one
+// costs once a few of the files are rewritten
+static void snapshots(const std::string& image)
+{
+    {
+        FS fs(image);
+        fs.format(BENCH_BLOCKS, BLOCK_SIZE, FORMAT_LOG);
+        for (unsigned f = 0; f < BENCH_SNAP_FILES; f++)
+        {
+            create(result("snapshot", "files", BENCH_SNAP_FILES, "create"), fs, "f" + std::to_string(f), content(BENCH_SNAP_BYTES));
+        }
+        fs.sync();
+        for (unsigned i = 0; i < BENCH_SNAP_ROUNDS; i++)
+        {
+            timed(result("snapshot", "files", BENCH_SNAP_FILES, "snapshot_create"), [&] { fs.snapshot("create", "s"); });
+            timed(result("snapshot", "files", BENCH_SNAP_FILES, "snapshot_delete"), [&] { fs.snapshot("delete", "s"); });
+        }
+
+        fs.snapshot("create", "s");
+        for (unsigned f = 0; f < BENCH_SNAP_CHANGED; f++)
+        {
+            std::string path = "f" + std::to_string(f);
+            fs.rm(path);
+            create(result("snapshot", "files", BENCH_SNAP_FILES, "rewrite"), fs, path, content(BENCH_SNAP_BYTES));
+        }
+        discard.str("");
+        fs.snapshot("list");
+        //The last line is the snapshot, blocks and own blocks are its last two columns
+        std::string report = discard.str();
+        size_t own = report.rfind('\t');
+        size_t blocks = report.rfind('\t', own - 1);
+        snapBlocks = std::stoul(report.substr(blocks + 1));
+        snapOwn = std::stoul(report.substr(own + 1));
+    }
+    std::remove(image.c_str());
+}
+
+//Returns the latency below which fraction of the calls finished
+static double percentile(std::vector<double>& us, double fraction)
+{
+    size_t n = std::min(us.size() - 1, (size_t)(fraction * us.size()));
+    std::nth_element(us.begin(), us.begin() + n, us.end());
+    return us[n];
+}
+
+int
+main(int argc, char **argv)
+{
+    std::string image = argc > 1 ? argv[1] : BENCH_IMAGE;
+    std::streambuf* out = std::cout.rdbuf(discard.rdbuf());
+    {
+        FS fs(image);
+        fileSizes(fs);
+        dirFill(fs);
+        treeDepth(fs);
+    }
+    checksums(image);
+    compression(image);
+    dedupCopies(image);
+    smallFiles(image);
+    sparseFiles(image);
+    discardSpace(image);
+    preallocFiles(image);
+    delayedFiles(image);
+    logUpdates(image);
+    snapshots(image);
+    std::cout.rdbuf(out);
+    std::remove(image.c_str());
+
+    std::cout << "{\n";
+    std::cout << "  \"image\": \"" << image << "\",\n";
+    std::cout << "  \"block_size\": " << BLOCK_SIZE << ",\n";
+    std::cout << "  \"no_blocks\": " << BENCH_BLOCKS << ",\n";
+    std::cout << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        Result& r = results[i];
+        double total = 0;
+        for (double us : r.us)
+        {
+            total += us;
+        }
+        char line[512];
+        snprintf(line, sizeof(line),
+            "    {\"scenario\": \"%s\", \"param\": {\"%s\": %lu}, \"op\": \"%s\", \"count\": %zu, "
+            "\"ops_per_sec\": %.1f, \"p50_us\": %.2f, \"p99_us\": %.2f}%s\n",
+            r.scenario.c_str(), r.param.c_str(), r.value, r.op.c_str(), r.us.size(),
+            total > 0 ? r.us.size() * 1e6 / total : 0.0,
+            percentile(r.us, 0.50), percentile(r.us, 0.99),
+            i + 1 < results.size() ? "," : "");
+        std::cout << line;
+    }
+    std::cout << "  ],\n";
+    std::cout << "  \"compression\": [\n";
+    for (size_t i = 0; i < ratios.size(); i++)
+    {
+        size_t bytes = ratios[i].second.first, stored = ratios[i].second.second;
+        char line[256];
+        snprintf(line, sizeof(line),
+            "    {\"text\": \"%s\", \"bytes\": %zu, \"stored\": %zu, \"blocks\": %zu, \"ratio\": %.2f}%s\n",
+            ratios[i].first.c_str(), bytes, stored, (stored + BLOCK_SIZE - 1) / BLOCK_SIZE,
+            (double)bytes / stored, i + 1 < ratios.size() ? "," : "");
+        std::cout << line;
+    }
+    std::cout << "  ],\n";
+    std::cout << "  \"dedup\": [\n";
+    for (unsigned enabled = 0; enabled <= 1; enabled++)
+    {
+        std::cout << "    {\"enabled\": " << enabled << ", \"copies\": " << 2 * BENCH_DEDUP_COPIES + 1
+            << ", \"blocks_used\": " << dedupBlocks[enabled] << "}" << (enabled == 0 ? "," : "") << "\n";
+    }
+    std::cout << "  ],\n";
+    std::cout << "  \"packing\": [\n";
+    for (unsigned enabled = 0; enabled <= 1; enabled++)
+    {
+        std::cout << "    {\"enabled\": " << enabled << ", \"files\": " << BENCH_SMALL_DIRS * BENCH_SMALL_FILES
+            << ", \"blocks_used\": " << packedBlocks[enabled] << "}" << (enabled == 0 ? "," : "") << "\n";
+    }
+    std::cout << "  ],\n";
+    std::cout << "  \"sparse\": [\n";
+    for (unsigned sparse = 0; sparse <= 1; sparse++)
+    {
+        std::cout << "    {\"sparse\": " << sparse << ", \"bytes\": " << BENCH_SPARSE_BYTES
+            << ", \"blocks_used\": " << sparseBlocks[sparse] << "}" << (sparse == 0 ? "," : "") << "\n";
+    }
+    std::cout << "  ],\n";
+    std::cout << "  \"discard\": {\"files\": " << BENCH_DISCARD_FILES << ", \"bytes\": " << BENCH_DISCARD_BYTES
+        << ", \"host_written\": " << hostBytes[0] << ", \"host_removed\": " << hostBytes[1] << "},\n";
+    std::cout << "  \"prealloc\": [\n";
+    for (unsigned prealloc = 0; prealloc <= 1; prealloc++)
+    {
+        std::cout << "    {\"prealloc\": " << prealloc << ", \"files\": " << BENCH_PREALLOC_FILES
+            << ", \"worst_extents\": " << preallocExtents[prealloc] << "}" << (prealloc == 0 ? "," : "") << "\n";
+    }
+    std::cout << "  ],\n";
+    std::cout << "  \"delalloc\": [\n";
+    for (unsigned delayed = 0; delayed <= 1; delayed++)
+    {
+        std::cout << "    {\"delayed\": " << delayed << ", \"files\": " << BENCH_DELAY_FILES
+            << ", \"worst_extents\": " << delayExtents[delayed] << ", \"temp_files\": " << BENCH_DELAY_TEMP
+            << ", \"disk_writes\": " << delayWrites[delayed] << "}" << (delayed == 0 ? "," : "") << "\n";
+    }
+    std::cout << "  ],\n";
+    std::cout << "  \"log\": [\n";
+    for (unsigned log = 0; log <= 1; log++)
+    {
+        char line[160];
+        snprintf(line, sizeof(line), "    {\"log\": %u, \"updates\": %u, \"seeks\": %lu, \"modelled_ms\": %.3f}%s\n",
+            log, BENCH_LOG_UPDATES, logSeeks[log], logModelledMs[log], log == 0 ? "," : "");
+        std::cout << line;
+    }
+    std::cout << "  ],\n";
+    std::cout << "  \"snapshot\": {\"files\": " << BENCH_SNAP_FILES << ", \"blocks\": " << snapBlocks
+        << ", \"changed_files\": " << BENCH_SNAP_CHANGED << ", \"own_blocks\": " << snapOwn << "}\n";
+    std::cout << "}\n";
+    return 0;
+}
@@ -0,0 +1,475 @@
+#include <algorithm>
+#include <cstring>
+#include "cache.h"
+
+BlockCache::BlockCache(Disk& disk, unsigned capacity) : disk(disk), capacity(capacity), sched(disk)
+{
+    flusher = std::thread(&BlockCache::flusherLoop, this);
+    readahead = std::thread(&BlockCache::readaheadLoop, this);
+}
+
+BlockCache::~BlockCache()
+{
+    {
+        std::lock_guard<std::mutex> held(lock);
+        stopping = true;
+    }
+    flusherWake.notify_all();
+    raWake.notify_all();
+    flusher.join();
+    readahead.join();
+    writeBack(true);
+}
+
+void BlockCache::touch(CacheBlock& cb)
+{
+    lru.splice(lru.begin(), lru, cb.lru);
+}
+
+BlockCache::CacheBlock& BlockCache::insert(unsigned block_no)
+{
+    // only clean blocks can be dropped, dirty ones stay until the flusher took them
+    auto it = lru.end();
+    while (blocks.size() >= capacity && it != lru.begin())
+    {
+        --it;
+        auto found = blocks.find(*it);
+        if (!found->second.dirty)
+        {
+            blocks.erase(found);
+            it = lru.erase(it);
+            stats.evicted.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    CacheBlock& cb = blocks[block_no];
+    cb.data.resize(blockSize());
+    lru.push_front(block_no);
+    cb.lru = lru.begin();
+    return cb;
+}
+
+// reads one block, from memory if it is cached
+int
+BlockCache::read(unsigned block_no, uint8_t *blk)
+{
+    {
+        std::lock_guard<std::mutex> held(lock);
+        auto found = blocks.find(block_no);
+        if (found != blocks.end())
+        {
+            memcpy(blk, found->second.data.data(), blockSize());
+            touch(found->second);
+            stats.hits.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+    }
+
+    // a miss goes to the scheduler without ioLock, so the read is queued
+    // ahead of any background write-back instead of waiting for it
+    unsigned long seq;
+    {
+        std::lock_guard<std::mutex> held(lock);
+        seq = writeSeq;
+    }
+    stats.misses.fetch_add(1, std::memory_order_relaxed);
+    if (sched.io(IO_READ, block_no, 1, blk) == -1)
+    {
+        return -1;
+    }
+    std::lock_guard<std::mutex> held(lock);
+    auto found = blocks.find(block_no);
+    if (found != blocks.end())
+    {
+        // written or prefetched while we were reading, the cached copy is as new or newer
+        memcpy(blk, found->second.data.data(), blockSize());
+        touch(found->second);
+        return 0;
+    }
+    // after a write the block may have been written back and evicted while we
+    // were reading, what we read could then be older than the disk
+    if (writeSeq == seq)
+    {
+        CacheBlock& cb = insert(block_no);
+        memcpy(cb.data.data(), blk, blockSize());
+    }
+    return 0;
+}
+
+// writes one block to memory, it reaches the disk later
+int
+BlockCache::write(unsigned block_no, uint8_t *blk)
+{
+    if (block_no >= disk.get_no_blocks())
+    {
+        std::cout << "BlockCache::write - ERROR: Invalid block number (" << block_no << ")\n";
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> held(lock);
+    auto found = blocks.find(block_no);
+    CacheBlock& cb = found != blocks.end() ? found->second : insert(block_no);
+    touch(cb);
+    memcpy(cb.data.data(), blk, blockSize());
+    cb.version++;
+    writeSeq++;
+    if (!discards.empty())
+    {
+        discards.erase(block_no);
+    }
+    if (!cb.dirty)
+    {
+        cb.dirty = true;
+        cb.dirtied = std::chrono::steady_clock::now();
+        cb.dirtiedSeq = writeSeq;
+        dirtyCount++;
+    }
+
+    if (dirtyCount > dirtyLimit(dirtyBackgroundRatio))
+    {
+        flusherWake.notify_one();
+    }
+    // over the hard limit the writer waits for the flusher to catch up
+    while (dirtyCount > dirtyLimit(dirtyRatio) && !stopping)
+    {
+        flusherWake.notify_one();
+        cleaned.wait(held);
+    }
+    return 0;
+}
+
+int BlockCache::writeBack(bool all)
+{
+    struct Pending {
+        unsigned block_no;
+        unsigned long version;
+        std::vector<uint8_t> data;
+    };
+    std::vector<Pending> pending;
+    std::vector<unsigned> freed;
+
+    TRACE_SPAN("BlockCache::writeBack");
+    std::lock_guard<std::mutex> io(ioLock);
+    {
+        std::lock_guard<std::mutex> held(lock);
+        auto expired = std::chrono::steady_clock::now() - std::chrono::milliseconds(dirtyExpireMs);
+        // the FAT and directory blocks that free the discards go along even if
+        // they have not expired, the discards are punched after them
+        bool freeing = !discards.empty();
+        for (auto& entry : blocks)
+        {
+            if (entry.second.dirty && (all || entry.second.dirtied <= expired ||
+                (freeing && entry.second.dirtiedSeq <= discardSeq)))
+            {
+                pending.push_back({entry.first, entry.second.version, entry.second.data});
+            }
+        }
+        freed.assign(discards.begin(), discards.end());
+        discards.clear();
+    }
+    if (pending.empty() && freed.empty() && !disk.has_checksums())
+    {
+        return 0;
+    }
+
+    // the blocks about to change lose their checksums on the disk first, a
+    // crash while they are written leaves them unverified, not failing
+    for (Pending& p : pending)
+    {
+        disk.forget_checksums(p.block_no, 1, p.data.data());
+    }
+    bool unsummed = writeChecksums() == 0;
+
+    // the scheduler puts them in order and merges neighbouring blocks
+    std::vector<io_request> requests(pending.size());
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+        requests[i].op = IO_WRITE;
+        requests[i].block_no = pending[i].block_no;
+        requests[i].count = 1;
+        requests[i].data = pending[i].data.data();
+        requests[i].result = -1;
+        if (unsummed)
+        {
+            sched.submit(requests[i]);
+        }
+    }
+    unsigned failed = 0;
+    for (io_request& r : requests)
+    {
+        failed += (unsummed ? sched.wait(r) : r.result) == -1;
+    }
+    stats.writeBacks.fetch_add(pending.size() - failed, std::memory_order_relaxed);
+    stats.writeErrors.fetch_add(failed, std::memory_order_relaxed);
+    if (failed > 0)
+    {
+        //The FAT that frees them may not be on the disk, they wait for a
+        //write-back that gets everything there. One written again is cached
+        std::lock_guard<std::mutex> held(lock);
+        for (unsigned block_no : freed)
+        {
+            if (blocks.find(block_no) == blocks.end())
+            {
+                discards.insert(block_no);
+            }
+        }
+        freed.clear();
+    }
+    // a block written again since it was freed is dirty here and goes back to
+    // the disk with a later write-back
+    punch(freed);
+    // the map of a log-structured disk follows the blocks it moved
+    disk.sync_log();
+
+    // the checksums of the blocks just written follow them to the disk
+    writeChecksums();
+    if (pending.empty())
+    {
+        return 0;
+    }
+
+    {
+        // a block the disk did not take stays dirty and is tried again
+        std::lock_guard<std::mutex> held(lock);
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            Pending& p = pending[i];
+            auto found = blocks.find(p.block_no);
+            if (requests[i].result == 0 && found != blocks.end() && found->second.dirty &&
+                found->second.version == p.version)
+            {
+                found->second.dirty = false;
+                dirtyCount--;
+            }
+        }
+    }
+    cleaned.notify_all();
+    return failed > 0 ? -1 : (int)pending.size();
+}
+
+int BlockCache::writeChecksums()
+{
+    std::vector<unsigned> sumBlocks;
+    std::vector<uint8_t> sums;
+    if (disk.take_checksums(sumBlocks, sums) == 0)
+    {
+        return 0;
+    }
+    std::vector<io_request> sumRequests(sumBlocks.size());
+    for (size_t i = 0; i < sumBlocks.size(); i++)
+    {
+        sumRequests[i].op = IO_WRITE;
+        sumRequests[i].block_no = sumBlocks[i];
+        sumRequests[i].count = 1;
+        sumRequests[i].data = sums.data() + i * blockSize();
+        sched.submit(sumRequests[i]);
+    }
+    std::vector<unsigned> failed;
+    for (size_t i = 0; i < sumRequests.size(); i++)
+    {
+        if (sched.wait(sumRequests[i]) == -1)
+        {
+            failed.push_back(sumBlocks[i]);
+        }
+    }
+    disk.retake_checksums(failed);
+    return failed.empty() ? 0 : -1;
+}
+
+void BlockCache::flusherLoop()
+{
+    Tracer::name_thread("flusher");
+    std::unique_lock<std::mutex> held(lock);
+    while (!stopping)
+    {
+        // a writer over the limit may have asked while we were writing back, so
+        // the limit is checked before sleeping as well
+        flusherWake.wait_for(held, std::chrono::milliseconds(FLUSH_INTERVAL_MS), [this]
+        {
+            return stopping || dirtyCount > dirtyLimit(dirtyBackgroundRatio);
+        });
+        if (stopping)
+        {
+            break;
+        }
+        bool all = dirtyCount > dirtyLimit(dirtyBackgroundRatio);
+        if (dirtyCount == 0)
+        {
+            continue;
+        }
+        held.unlock();
+        writeBack(all);
+        held.lock();
+    }
+    cleaned.notify_all();
+}
+
+// queues blocks to be read into the cache in the background
+void BlockCache::prefetch(const std::vector<unsigned>& block_nos)
+{
+    std::lock_guard<std::mutex> held(lock);
+    for (unsigned block_no : block_nos)
+    {
+        if (raQueue.size() >= READAHEAD_MAX_QUEUE)
+        {
+            break;
+        }
+        if (block_no < disk.get_no_blocks() && blocks.find(block_no) == blocks.end())
+        {
+            raQueue.push_back(block_no);
+        }
+    }
+    raWake.notify_one();
+}
+
+void BlockCache::fetch(std::vector<unsigned>& block_nos)
+{
+    std::sort(block_nos.begin(), block_nos.end());
+    block_nos.erase(std::unique(block_nos.begin(), block_nos.end()), block_nos.end());
+
+    TRACE_SPAN("BlockCache::fetch");
+    std::lock_guard<std::mutex> io(ioLock);
+    {
+        // drop what got cached since it was queued
+        std::lock_guard<std::mutex> held(lock);
+        size_t kept = 0;
+        for (unsigned block_no : block_nos)
+        {
+            if (blocks.find(block_no) == blocks.end())
+            {
+                block_nos[kept++] = block_no;
+            }
+        }
+        block_nos.resize(kept);
+    }
+
+    // neighbouring blocks are merged into one disk request by the scheduler
+    std::vector<uint8_t> data(block_nos.size() * blockSize());
+    std::vector<io_request> requests(block_nos.size());
+    for (size_t i = 0; i < block_nos.size(); i++)
+    {
+        requests[i].op = IO_READ;
+        requests[i].block_no = block_nos[i];
+        requests[i].count = 1;
+        requests[i].data = data.data() + i * blockSize();
+        sched.submit(requests[i]);
+    }
+    for (io_request& r : requests)
+    {
+        sched.wait(r);
+    }
+
+    std::lock_guard<std::mutex> held(lock);
+    for (size_t i = 0; i < block_nos.size(); i++)
+    {
+        // a write that came in meanwhile is newer than what we read
+        if (requests[i].result == 0 && blocks.find(block_nos[i]) == blocks.end())
+        {
+            CacheBlock& cb = insert(block_nos[i]);
+            memcpy(cb.data.data(), requests[i].data, blockSize());
+            stats.prefetched.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+void BlockCache::readaheadLoop()
+{
+    Tracer::name_thread("readahead");
+    std::unique_lock<std::mutex> held(lock);
+    while (!stopping)
+    {
+        raWake.wait(held, [this] { return stopping || !raQueue.empty(); });
+        if (stopping)
+        {
+            break;
+        }
+        std::vector<unsigned> batch(raQueue.begin(), raQueue.end());
+        raQueue.clear();
+        held.unlock();
+        fetch(batch);
+        held.lock();
+    }
+}
+
+// forgets blocks the file system freed
+void BlockCache::discard(const std::vector<unsigned>& block_nos)
+{
+    if (!disk.can_discard())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> held(lock);
+    for (unsigned block_no : block_nos)
+    {
+        auto found = blocks.find(block_no);
+        if (found != blocks.end())
+        {
+            if (found->second.dirty)
+            {
+                dirtyCount--;
+            }
+            lru.erase(found->second.lru);
+            blocks.erase(found);
+        }
+        discards.insert(block_no);
+    }
+    discardSeq = writeSeq;
+    stats.discarded.fetch_add(block_nos.size(), std::memory_order_relaxed);
+}
+
+void BlockCache::punch(const std::vector<unsigned>& block_nos)
+{
+    // ioLock is held, no write-back or prefetch of these blocks is in flight
+    // and nothing else reads a free block, so the hole goes straight to the disk
+    for (size_t i = 0; i < block_nos.size();)
+    {
+        size_t run = 1;
+        while (i + run < block_nos.size() && block_nos[i + run] == block_nos[i] + run)
+        {
+            run++;
+        }
+        disk.discard(block_nos[i], run);
+        i += run;
+    }
+}
+
+// writes all dirty blocks to the disk
+int BlockCache::sync()
+{
+    return writeBack(true) == -1 ? -1 : 0;
+}
+
+// writes all dirty blocks and empties the cache, needed before the disk geometry changes
+void BlockCache::drop()
+{
+    writeBack(true);
+    std::lock_guard<std::mutex> io(ioLock);
+    std::lock_guard<std::mutex> held(lock);
+    raQueue.clear();
+    blocks.clear();
+    lru.clear();
+    dirtyCount = 0;
+    // reads still in flight must not put blocks of the old geometry back
+    writeSeq++;
+}
+
+void BlockCache::set_dirty_limits(unsigned expire_ms, unsigned background_ratio, unsigned ratio)
+{
+    std::lock_guard<std::mutex> held(lock);
+    dirtyExpireMs = expire_ms;
+    dirtyBackgroundRatio = background_ratio;
+    dirtyRatio = ratio;
+    flusherWake.notify_one();
+}
+
+unsigned BlockCache::get_dirty()
+{
+    std::lock_guard<std::mutex> held(lock);
+    return dirtyCount;
+}
+
+unsigned BlockCache::get_discards()
+{
+    std::lock_guard<std::mutex> held(lock);
+    return discards.size();
+}
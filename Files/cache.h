@@ -0,0 +1,123 @@
+#include <cstdint>
+#include <vector>
+#include <list>
+#include <deque>
+#include <set>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include "disk.h"
+#include "iosched.h"
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#define CACHE_BLOCKS 1024           // number of blocks kept in memory
+#define DIRTY_EXPIRE_MS 500         // dirty blocks older than this are written back
+#define DIRTY_BACKGROUND_RATIO 10   // % of the cache dirty before the flusher writes everything
+#define DIRTY_RATIO 40              // % of the cache dirty before writers have to wait
+#define FLUSH_INTERVAL_MS 100       // how often the flusher wakes up by itself
+#define READAHEAD_MAX_QUEUE 256     // prefetch requests beyond this are dropped
+
+// Write-back cache in front of the disk. Writes only touch memory, a
+// background thread writes dirty blocks back sorted and coalesced into runs.
+// A second thread reads prefetched blocks in ahead of the reader.
+class BlockCache {
+private:
+    struct CacheBlock {
+        std::vector<uint8_t> data;
+        bool dirty = false;
+        // bumped on every write so a block re-dirtied during write-back stays dirty
+        unsigned long version = 0;
+        std::chrono::steady_clock::time_point dirtied;
+        unsigned long dirtiedSeq = 0; // writeSeq when it became dirty
+        std::list<unsigned>::iterator lru;
+    };
+
+    Disk& disk;
+    unsigned capacity;
+    // every disk request goes through the scheduler
+    IoScheduler sched;
+    unsigned dirtyExpireMs = DIRTY_EXPIRE_MS;
+    unsigned dirtyBackgroundRatio = DIRTY_BACKGROUND_RATIO;
+    unsigned dirtyRatio = DIRTY_RATIO;
+
+    std::unordered_map<unsigned, CacheBlock> blocks;
+    std::list<unsigned> lru; // front is the most recently used block
+    unsigned dirtyCount = 0;
+    bool stopping = false;
+    // bumped by every write, a read that saw it change does not cache what it read
+    unsigned long writeSeq = 0;
+    // freed blocks to punch out of the disk file with the next write-back, a
+    // block written again in the meantime is taken out
+    std::set<unsigned> discards;
+    // writeSeq at the last discard, blocks dirtied before it hold the FAT and
+    // directories that free the discards and go to the disk with them
+    unsigned long discardSeq = 0;
+
+    // lock order is ioLock before lock, ioLock keeps write-back and readahead
+    // apart, foreground reads do not take it
+    std::mutex lock;
+    std::mutex ioLock;
+    std::condition_variable flusherWake;
+    std::condition_variable cleaned;
+    std::thread flusher;
+
+    CacheStats stats;
+
+    std::deque<unsigned> raQueue;
+    std::condition_variable raWake;
+    std::thread readahead;
+
+    void flusherLoop();
+    void readaheadLoop();
+    //Reads the blocks that are not cached yet, neighbouring blocks in one go
+    void fetch(std::vector<unsigned>& block_nos);
+    //Writes back expired dirty blocks, or all of them, returns number of blocks
+    //written or -1 if the disk failed to write one, which stays dirty
+    int writeBack(bool all);
+    //Writes the checksum region blocks that changed, returns -1 if one fails,
+    //it is written again with the next call
+    int writeChecksums();
+    //Punches the blocks out of the disk file, neighbouring blocks in one go
+    void punch(const std::vector<unsigned>& block_nos);
+    //Puts a block in the cache, evicting clean blocks if the cache is full
+    CacheBlock& insert(unsigned block_no);
+    void touch(CacheBlock& cb);
+    unsigned dirtyLimit(unsigned ratio) { return capacity * ratio / 100; }
+    // the disk geometry only changes while the cache is empty, see drop()
+    unsigned blockSize() { return disk.get_block_size(); }
+
+public:
+    BlockCache(Disk& disk, unsigned capacity = CACHE_BLOCKS);
+    ~BlockCache();
+    // reads one block, from memory if it is cached
+    int read(unsigned block_no, uint8_t *blk);
+    // writes one block to memory, it reaches the disk later
+    int write(unsigned block_no, uint8_t *blk);
+    // queues blocks to be read into the cache in the background
+    void prefetch(const std::vector<unsigned>& block_nos);
+    // forgets blocks the file system freed, cached copies are dropped even if
+    // dirty and the blocks are punched out of the disk file by the next
+    // write-back. It writes every block dirtied before the discard first, so
+    // the FAT that frees them reaches the disk first
+    void discard(const std::vector<unsigned>& block_nos);
+    // writes all dirty blocks to the disk, returns -1 if the disk failed to
+    // write one of them, it stays dirty and is tried again
+    int sync();
+    // writes all dirty blocks and empties the cache, needed before the disk geometry changes
+    void drop();
+    unsigned get_block_size() { return disk.get_block_size(); }
+    // dirty blocks older than expire_ms are written back, above background_ratio
+    // percent dirty everything is written back, above ratio percent writers wait
+    void set_dirty_limits(unsigned expire_ms, unsigned background_ratio, unsigned ratio);
+    unsigned get_dirty();
+    // freed blocks waiting for the next write-back to be punched out
+    unsigned get_discards();
+    CacheStats& get_stats() { return stats; }
+    IoScheduler& get_scheduler() { return sched; }
+};
+
+#endif // __CACHE_H__
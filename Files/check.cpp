@@ -0,0 +1,892 @@
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include "check.h"
+
+#define FSCK_METADATA UINT64_MAX // owner of the super block, root and FAT
+#define FSCK_DIR_OWNER (1ULL << 62) // set in the owner of a directory block
+#define FSCK_PACKED (UINT64_MAX - 1) // owner of a block small files are packed into
+
+//Owner of the blocks of entry index of the directory at dirBlock
+static uint64_t ownerId(unsigned dirBlock, unsigned index, uint8_t type)
+{
+    return (((uint64_t)dirBlock << 16 | index) + 1) | (type == TYPE_DIR ? FSCK_DIR_OWNER : 0);
+}
+
+WorkPool::WorkPool(unsigned threads)
+{
+    for (unsigned i = 0; i < std::max(threads, 1u); i++)
+    {
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+}
+
+// queues a task on the queue of worker
+void WorkPool::push(unsigned worker, const dir_task& task)
+{
+    pending.fetch_add(1);
+    Queue& q = *queues[worker];
+    std::lock_guard<std::mutex> held(q.lock);
+    q.tasks.push_back(task);
+}
+
+bool WorkPool::pop(unsigned worker, dir_task& task)
+{
+    {
+        Queue& q = *queues[worker];
+        std::lock_guard<std::mutex> held(q.lock);
+        if (!q.tasks.empty())
+        {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            return true;
+        }
+    }
+    for (unsigned i = 1; i < queues.size(); i++)
+    {
+        Queue& q = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> held(q.lock);
+        if (!q.tasks.empty())
+        {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+// runs work on every thread until all tasks, also those pushed by work, are done
+void WorkPool::run(const std::function<void(unsigned, dir_task&)>& work)
+{
+    auto loop = [this, &work](unsigned worker) {
+        dir_task task;
+        //A task only counts as done after the tasks it pushed are queued
+        while (pending.load() > 0)
+        {
+            if (pop(worker, task))
+            {
+                work(worker, task);
+                pending.fetch_sub(1);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    };
+    std::vector<std::thread> helpers;
+    for (unsigned i = 1; i < queues.size(); i++)
+    {
+        helpers.push_back(std::thread(loop, i));
+    }
+    loop(0);
+    for (std::thread& t : helpers)
+    {
+        t.join();
+    }
+}
+
+Checker::Checker(FS& fs, unsigned threads) : fs(fs)
+{
+    this->threads = threads > 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u);
+    noBlocks = fs.sb.no_blocks;
+    firstData = fs.dataStart();
+    shared = fs.sb.dedup_blocks > 0;
+    owner.reset(new std::atomic<uint64_t>[noBlocks]);
+}
+
+// checks the file system and prints what is wrong, with repair set fixes it too,
+// returns the number of problems found
+int Checker::run(bool repair)
+{
+    TRACE_SPAN("Checker::run");
+    auto start = std::chrono::steady_clock::now();
+    scan();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    char line[160];
+    snprintf(line, sizeof(line), "%lu directories, %lu files, %lu blocks in use, %u threads, %llu steals, %.1f ms\n",
+        dirs.load(), files.load(), blocks.load() + firstData, threads, (unsigned long long)steals, ms);
+    std::cout << line;
+    std::sort(issues.begin(), issues.end(), [](const fsck_issue& a, const fsck_issue& b) {
+        return a.path != b.path ? a.path < b.path : a.kind < b.kind;
+    });
+    for (fsck_issue& issue : issues)
+    {
+        print(issue);
+    }
+    if (!leaked.empty())
+    {
+        std::cout << "  " << leaked.size() << " blocks in use by no file or directory\n";
+    }
+    int found = issues.size() + leaked.size();
+    if (found == 0)
+    {
+        std::cout << "clean\n";
+        return 0;
+    }
+    std::cout << issues.size() << " bad entries, " << leaked.size() << " leaked blocks\n";
+    if (!repair)
+    {
+        return found;
+    }
+    if (fatUnreadable > 0)
+    {
+        //Chains through the missing part of the FAT can not be followed, a
+        //repair would cut or free blocks that are in use
+        std::cout << fatUnreadable << " FAT blocks can not be read, nothing is repaired\n";
+        return found;
+    }
+
+    //Fixing an entry can bring out another problem, e.g. below a directory
+    //that was cross-linked, so the disk is checked again after every round
+    unsigned pass = 1, fixed = 0;
+    while (!issues.empty() && pass < FSCK_PASSES)
+    {
+        fixed += repairEntries();
+        scan();
+        pass++;
+    }
+    //Blocks below a directory that can not be read are claimed by nobody
+    //but may well be in use, they are only freed once every directory is read
+    bool unreadable = std::any_of(issues.begin(), issues.end(), [](const fsck_issue& issue) {
+        return issue.kind == FSCK_UNREADABLE;
+    });
+    if (unreadable)
+    {
+        leaked.clear();
+    }
+    for (unsigned block : leaked)
+    {
+        fs.fat.set(block, FAT_FREE);
+    }
+    fs.fat.flush();
+    if (shared)
+    {
+        //Repairs cut and free chains, the references are counted again
+        fs.dedupMount();
+    }
+    if (fs.sb.pack_limit > 0)
+    {
+        fs.packMount();
+    }
+    fs.cache.sync();
+    if (fs.fat.get(fs.currentBlock) == FAT_FREE)
+    {
+        fs.currentBlock = ROOT_BLOCK;
+    }
+    fs.readDir(fs.currentBlock, fs.workingDirectory);
+
+    std::cout << "repaired " << fixed << " entries, freed " << leaked.size() << " blocks";
+    if (!issues.empty())
+    {
+        std::cout << ", " << issues.size() << " bad entries left after " << pass << " passes";
+    }
+    std::cout << "\n";
+    return found;
+}
+
+void Checker::scan()
+{
+    TRACE_SPAN("Checker::scan");
+    issues.clear();
+    leaked.clear();
+    dirs = 1;
+    files = 0;
+    blocks = 0;
+    packedUnits.clear();
+
+    //The walk reads a private copy of the FAT so the threads need no lock
+    fs.fat.flush();
+    unsigned perBlock = fs.blockSize / sizeof(int32_t);
+    table.resize((size_t)fs.sb.fat_blocks * perBlock);
+    fatUnreadable = 0;
+    for (unsigned i = 0; i < fs.sb.fat_blocks; i++)
+    {
+        if (fs.cache.read(fs.sb.fat_start + i, (uint8_t*)&table[(size_t)i * perBlock]) == -1)
+        {
+            //The blocks it covers look like chain ends, they are reported as
+            //leaked but never freed
+            std::cout << "Checker::scan - ERROR: Can't read FAT block " << fs.sb.fat_start + i << "\n";
+            std::fill(table.begin() + (size_t)i * perBlock, table.begin() + (size_t)(i + 1) * perBlock, FAT_EOF);
+            fatUnreadable++;
+        }
+    }
+    for (unsigned i = 0; i < noBlocks; i++)
+    {
+        owner[i].store(i < firstData ? FSCK_METADATA : 0, std::memory_order_relaxed);
+    }
+
+    WorkPool pool(threads);
+    dir_task root;
+    root.block = ROOT_BLOCK;
+    root.parent = ROOT_BLOCK;
+    root.path = "/";
+    pool.push(0, root);
+    pool.run([this, &pool](unsigned worker, dir_task& task) {
+        checkDir(pool, worker, task);
+    });
+    steals = pool.get_steals();
+
+    for (unsigned i = firstData; i < noBlocks; i++)
+    {
+        if (table[i] != FAT_FREE && owner[i].load(std::memory_order_relaxed) == 0)
+        {
+            leaked.push_back(i);
+        }
+    }
+}
+
+void Checker::checkDir(WorkPool& pool, unsigned worker, dir_task& task)
+{
+    std::vector<dir_entry> dir(fs.dirEntries);
+    if (fs.readDir(task.block, dir) == -1)
+    {
+        fsck_issue issue = {FSCK_UNREADABLE, task.path, task.block, 0, task.block, 0};
+        report(issue);
+        return;
+    }
+    bool root = task.block == ROOT_BLOCK;
+    if (!root && (dir[0].type != TYPE_DIR || strncmp(dir[0].file_name, "..", sizeof(dir[0].file_name)) != 0 ||
+        dir[0].first_blk != task.parent))
+    {
+        fsck_issue issue = {FSCK_BAD_PARENT, task.path, task.block, 0, task.parent, 0};
+        report(issue);
+    }
+
+    for (int i = 0; i < fs.dirEntries; i++)
+    {
+        dir_entry& entry = dir[i];
+        if (entry.type == TYPE_EMPTY)
+        {
+            continue;
+        }
+        std::string name(entry.file_name, strnlen(entry.file_name, sizeof(entry.file_name)));
+        if (name == ".." && entry.type == TYPE_DIR)
+        {
+            //Only ever leads back up, checked above
+            continue;
+        }
+        fsck_issue issue = {FSCK_BAD_NAME, (root ? "/" : task.path + "/") + name, task.block, (unsigned)i, 0, 0};
+        if (name.size() == sizeof(entry.file_name))
+        {
+            report(issue);
+        }
+        if (entry.type != TYPE_FILE && entry.type != TYPE_DIR)
+        {
+            issue.kind = FSCK_BAD_TYPE;
+            report(issue);
+            continue;
+        }
+
+        (entry.type == TYPE_DIR ? dirs : files)++;
+        if (entry.type == TYPE_FILE && (entry.flags & FLAG_DELAYED))
+        {
+            //The FS placed its own delayed files before the check, this one was
+            //left by a run that ended before it was placed
+            issue.kind = FSCK_LOST_DATA;
+            report(issue);
+            continue;
+        }
+        if (entry.type == TYPE_FILE && (entry.flags & FLAG_PACKED))
+        {
+            claimPacked(entry, issue);
+            continue;
+        }
+        uint64_t id = ownerId(task.block, i, entry.type);
+        if (!claimChain(id, entry.first_blk, issue))
+        {
+            continue;
+        }
+        if (entry.type == TYPE_DIR)
+        {
+            if (issue.length != 1)
+            {
+                //A directory is a single block
+                issue.kind = FSCK_BAD_CHAIN;
+                issue.block = entry.first_blk;
+                issue.length = 1;
+                report(issue);
+            }
+            dir_task sub;
+            sub.block = entry.first_blk;
+            sub.parent = task.block;
+            sub.path = issue.path;
+            pool.push(worker, sub);
+        }
+        else
+        {
+            if (issue.length != blocksNeeded(entry))
+            {
+                issue.kind = FSCK_BAD_SIZE;
+                report(issue);
+            }
+            if (entry.flags & FLAG_SPARSE)
+            {
+                claimSparse(id, entry, issue);
+            }
+        }
+    }
+}
+
+unsigned long Checker::blocksNeeded(const dir_entry& entry)
+{
+    if (entry.flags & FLAG_SPARSE)
+    {
+        return fs.mapBlocks(entry.size);
+    }
+    long bytes = fs.storedSize(entry);
+    if (bytes < 0)
+    {
+        return 0;
+    }
+    return std::max(1ul, ((unsigned long)bytes + fs.blockSize - 1) / fs.blockSize);
+}
+
+unsigned long Checker::chainBytes(const dir_entry& entry)
+{
+    //A block of a map stands for as many blocks as it has entries
+    return entry.flags & FLAG_SPARSE ? fs.blockSize / sizeof(uint32_t) * fs.blockSize : fs.blockSize;
+}
+
+bool Checker::claimChain(uint64_t id, unsigned first, fsck_issue& issue)
+{
+    unsigned long length = 0, claimedBlocks = 0;
+    unsigned block = first, last = 0;
+    while (true)
+    {
+        if (block < firstData || block >= noBlocks || table[block] == FAT_FREE)
+        {
+            issue.kind = FSCK_BAD_CHAIN;
+            issue.block = last;
+            issue.length = length;
+            break;
+        }
+        uint64_t claimed = 0;
+        if (!owner[block].compare_exchange_strong(claimed, id))
+        {
+            //Files on a deduplicating disk share the ends of their chains, the
+            //rest belongs to the file that got there first and is only counted
+            if (shared && claimed != id && !((claimed | id) & FSCK_DIR_OWNER))
+            {
+                unsigned long rest = 0;
+                if (sharedChain(block, rest, last))
+                {
+                    blocks += claimedBlocks;
+                    issue.length = length + rest;
+                    return true;
+                }
+                //Broken in the shared part, cut where the other file is cut
+                issue.kind = FSCK_BAD_CHAIN;
+                issue.block = last;
+                issue.length = length + rest;
+                break;
+            }
+            //Back at one of its own blocks the chain loops
+            issue.kind = claimed == id ? FSCK_BAD_CHAIN : FSCK_CROSS_LINK;
+            issue.block = claimed == id ? last : block;
+            issue.length = length;
+            break;
+        }
+        length++;
+        claimedBlocks++;
+        last = block;
+        if (table[block] == FAT_EOF)
+        {
+            blocks += claimedBlocks;
+            issue.length = length;
+            return true;
+        }
+        block = table[block];
+    }
+    blocks += claimedBlocks;
+    report(issue);
+    return false;
+}
+
+bool Checker::claimPacked(const dir_entry& entry, fsck_issue& issue)
+{
+    unsigned block = entry.first_blk;
+    unsigned perBlock = fs.blockSize / PACK_UNIT;
+    unsigned start = entry.flags >> PACK_SHIFT;
+    unsigned units = std::max(1u, (entry.size + PACK_UNIT - 1) / PACK_UNIT);
+    issue.block = block;
+    issue.length = 1;
+    if (block < firstData || block >= noBlocks || table[block] != FAT_EOF)
+    {
+        //A shared block is a chain of one, anything else can not be it
+        issue.kind = FSCK_BAD_CHAIN;
+        issue.length = 0;
+        report(issue);
+        return false;
+    }
+    if (start + units > perBlock)
+    {
+        issue.kind = FSCK_BAD_SIZE;
+        report(issue);
+        return false;
+    }
+    uint64_t claimed = 0;
+    if (!owner[block].compare_exchange_strong(claimed, FSCK_PACKED) && claimed != FSCK_PACKED)
+    {
+        issue.kind = FSCK_CROSS_LINK;
+        report(issue);
+        return false;
+    }
+    if (claimed == 0)
+    {
+        blocks++;
+    }
+
+    std::lock_guard<std::mutex> held(packedLock);
+    std::vector<bool>& taken = packedUnits[block];
+    taken.resize(perBlock, false);
+    bool overlaps = false;
+    for (unsigned u = start; u < start + units; u++)
+    {
+        overlaps = overlaps || taken[u];
+        taken[u] = true;
+    }
+    if (overlaps)
+    {
+        issue.kind = FSCK_CROSS_LINK;
+        report(issue);
+        return false;
+    }
+    return true;
+}
+
+bool Checker::claimSparse(uint64_t id, const dir_entry& entry, fsck_issue& issue)
+{
+    size_t perMap = fs.blockSize / sizeof(uint32_t);
+    uint64_t count = ((uint64_t)entry.size + fs.blockSize - 1) / fs.blockSize;
+    std::vector<uint32_t> map(perMap);
+    unsigned long maps = issue.length, bad = 0;
+    unsigned block = entry.first_blk;
+    bool crossed = false;
+    for (unsigned long m = 0; m < maps; m++)
+    {
+        fs.cache.read(block, (uint8_t*)map.data());
+        for (size_t i = 0; i < perMap; i++)
+        {
+            uint32_t data = map[i] & ~MAP_UNWRITTEN;
+            if (data == 0)
+            {
+                continue;
+            }
+            //A data block is a chain of one within the size, listed once
+            if (m * perMap + i >= count || data < firstData || data >= noBlocks || table[data] != FAT_EOF)
+            {
+                bad++;
+                continue;
+            }
+            uint64_t claimed = 0;
+            if (owner[data].compare_exchange_strong(claimed, id))
+            {
+                blocks++;
+            }
+            else if (claimed == id)
+            {
+                bad++;
+            }
+            else if (!crossed)
+            {
+                crossed = true;
+                fsck_issue cross = issue;
+                cross.kind = FSCK_CROSS_LINK;
+                cross.block = data;
+                report(cross);
+            }
+        }
+        block = table[block];
+    }
+    if (bad > 0)
+    {
+        fsck_issue broken = issue;
+        broken.kind = FSCK_BAD_MAP;
+        broken.length = bad;
+        report(broken);
+    }
+    return bad == 0 && !crossed;
+}
+
+bool Checker::sharedChain(unsigned block, unsigned long& length, unsigned& last)
+{
+    unsigned start = last;
+    for (length = 0; length < noBlocks; length++)
+    {
+        if (block < firstData || block >= noBlocks || table[block] == FAT_FREE)
+        {
+            return false;
+        }
+        last = block;
+        if (table[block] == FAT_EOF)
+        {
+            length++;
+            return true;
+        }
+        block = table[block];
+    }
+    //A loop, the file that owns it cuts it, this one is cut before
+    length = 0;
+    last = start;
+    return false;
+}
+
+void Checker::report(const fsck_issue& issue)
+{
+    std::lock_guard<std::mutex> held(issuesLock);
+    issues.push_back(issue);
+}
+
+void Checker::print(const fsck_issue& issue)
+{
+    std::cout << "  " << issue.path << ": ";
+    switch (issue.kind)
+    {
+        case FSCK_BAD_TYPE:
+        std::cout << "unknown type\n";
+        break;
+
+        case FSCK_BAD_NAME:
+        std::cout << "name is not terminated\n";
+        break;
+
+        case FSCK_BAD_CHAIN:
+        std::cout << "chain broken after " << issue.length << " blocks\n";
+        break;
+
+        case FSCK_BAD_SIZE:
+        std::cout << "size does not match its " << issue.length << " blocks\n";
+        break;
+
+        case FSCK_BAD_PARENT:
+        std::cout << "\"..\" does not lead to the parent directory\n";
+        break;
+
+        case FSCK_CROSS_LINK:
+        std::cout << "cross-linked at block " << issue.block << "\n";
+        break;
+
+        case FSCK_BAD_MAP:
+        std::cout << "block map has " << issue.length << " bad entries\n";
+        break;
+
+        case FSCK_LOST_DATA:
+        std::cout << "data was never written\n";
+        break;
+
+        case FSCK_UNREADABLE:
+        std::cout << "directory block " << issue.block << " can not be read\n";
+        break;
+    }
+}
+
+unsigned Checker::repairEntries()
+{
+    TRACE_SPAN("Checker::repairEntries");
+    std::map<unsigned, std::vector<fsck_issue*>> byDir;
+    for (fsck_issue& issue : issues)
+    {
+        byDir[issue.dirBlock].push_back(&issue);
+    }
+
+    unsigned fixed = 0;
+    std::vector<dir_entry> dir(fs.dirEntries);
+    for (auto& d : byDir)
+    {
+        //An unreadable directory can not be fixed, writing it back would wipe it
+        if (fs.readDir(d.first, dir) == -1)
+        {
+            continue;
+        }
+        std::vector<unsigned> removed;
+        for (fsck_issue* issue : d.second)
+        {
+            dir_entry& entry = dir[issue->index];
+            fixed++;
+            switch (issue->kind)
+            {
+                case FSCK_BAD_TYPE:
+                removed.push_back(issue->index);
+                break;
+
+                case FSCK_BAD_NAME:
+                entry.file_name[sizeof(entry.file_name) - 1] = '\0';
+                break;
+
+                case FSCK_BAD_CHAIN:
+                if (issue->length == 0)
+                {
+                    removed.push_back(issue->index);
+                    break;
+                }
+                fs.fat.set(issue->block, FAT_EOF);
+                if (entry.flags & FLAG_COMPRESSED)
+                {
+                    //A compressed stream cut short can not be read at all
+                    fs.freeChain(entry.first_blk);
+                    removed.push_back(issue->index);
+                }
+                else if (entry.type == TYPE_FILE)
+                {
+                    entry.size = std::min((unsigned long)entry.size, issue->length * chainBytes(entry));
+                }
+                break;
+
+                case FSCK_BAD_SIZE:
+                if (entry.flags & FLAG_PACKED)
+                {
+                    //Whatever would run past the end of the block is cut off
+                    unsigned start = entry.flags >> PACK_SHIFT;
+                    unsigned units = (unsigned)fs.blockSize / PACK_UNIT;
+                    if (start >= units)
+                    {
+                        removed.push_back(issue->index);
+                    }
+                    else
+                    {
+                        entry.size = std::min(entry.size, (uint32_t)(units - start) * PACK_UNIT);
+                    }
+                    break;
+                }
+                {
+                    //A chain longer than the size is cut, the rest is freed as leaked
+                    unsigned long need = blocksNeeded(entry);
+                    if (need == 0 || (issue->length < need && (entry.flags & FLAG_COMPRESSED)))
+                    {
+                        fs.freeChain(entry.first_blk);
+                        removed.push_back(issue->index);
+                    }
+                    else if (issue->length > need)
+                    {
+                        int block = entry.first_blk;
+                        for (unsigned long i = 1; i < need; i++)
+                        {
+                            block = fs.fat.get(block);
+                        }
+                        fs.fat.set(block, FAT_EOF);
+                    }
+                    else
+                    {
+                        entry.size = issue->length * chainBytes(entry);
+                    }
+                }
+                break;
+
+                case FSCK_BAD_PARENT:
+                if (strncmp(dir[0].file_name, "..", sizeof(dir[0].file_name)) != 0)
+                {
+                    //Makes room at the start for the ".." entry
+                    int slot = -1;
+                    for (int i = 1; i < fs.dirEntries && slot == -1; i++)
+                    {
+                        slot = dir[i].type == TYPE_EMPTY ? i : -1;
+                    }
+                    if (slot == -1)
+                    {
+                        std::cout << "  " << issue->path << ": directory is full, \"..\" left as it is\n";
+                        fixed--;
+                        break;
+                    }
+                    dir[slot] = dir[0];
+                }
+                memset(&dir[0], 0, sizeof(dir_entry));
+                strcpy(dir[0].file_name, "..");
+                dir[0].type = TYPE_DIR;
+                dir[0].access_rights = READWRITE;
+                dir[0].first_blk = issue->block;
+                break;
+
+                case FSCK_CROSS_LINK:
+                unshare(*issue, dir);
+                if (entry.flags & FLAG_SPARSE)
+                {
+                    unshareSparse(*issue, entry);
+                }
+                break;
+
+                case FSCK_BAD_MAP:
+                clearMap(entry);
+                break;
+
+                case FSCK_LOST_DATA:
+                //The name is all that is left, it stays as an empty file
+                if (fs.storeFile(std::string(), entry) == -1)
+                {
+                    removed.push_back(issue->index);
+                }
+                break;
+            }
+        }
+
+        //Entries are kept packed at the front, the last one takes the place of a removed one
+        std::sort(removed.rbegin(), removed.rend());
+        removed.erase(std::unique(removed.begin(), removed.end()), removed.end());
+        for (unsigned index : removed)
+        {
+            int last = fs.dirEntries - 1;
+            while (last > (int)index && dir[last].type == TYPE_EMPTY)
+            {
+                last--;
+            }
+            dir[index] = dir[last];
+            dir[last].type = TYPE_EMPTY;
+        }
+        fs.writeDirToDisk(d.first, dir);
+    }
+    fs.fat.flush();
+    return fixed;
+}
+
+void Checker::unshare(const fsck_issue& issue, std::vector<dir_entry>& dir)
+{
+    dir_entry& entry = dir[issue.index];
+    uint64_t id = ownerId(issue.dirBlock, issue.index, entry.type);
+    std::vector<uint8_t> buffer(fs.blockSize);
+    if (entry.flags & FLAG_PACKED)
+    {
+        //The file moves to the start of a block of its own and is no longer packed
+        int copy = fs.fat.findFree();
+        if (copy == FAT_EOF)
+        {
+            std::cout << "  " << issue.path << ": disk is full, left as it is\n";
+            return;
+        }
+        std::vector<uint8_t> out(fs.blockSize, 0);
+        size_t at = (size_t)(entry.flags >> PACK_SHIFT) * PACK_UNIT;
+        fs.cache.read(entry.first_blk, buffer.data());
+        memcpy(out.data(), buffer.data() + at, std::min((size_t)entry.size, fs.blockSize - at));
+        fs.cache.write(copy, out.data());
+        fs.fat.set(copy, FAT_EOF);
+        entry.first_blk = copy;
+        entry.flags = 0;
+        return;
+    }
+    int prev = FAT_EOF, block = entry.first_blk;
+    for (unsigned long n = 0; block >= (int)firstData && (unsigned)block < noBlocks && n < noBlocks; n++)
+    {
+        if (owner[block].load(std::memory_order_relaxed) != id)
+        {
+            int copy = fs.fat.findFree();
+            if (copy == FAT_EOF)
+            {
+                std::cout << "  " << issue.path << ": disk is full, cut at block " << n << "\n";
+                if (prev == FAT_EOF)
+                {
+                    entry.first_blk = FAT_EOF;
+                }
+                else
+                {
+                    fs.fat.set(prev, FAT_EOF);
+                }
+                return;
+            }
+            fs.cache.read(block, buffer.data());
+            fs.cache.write(copy, buffer.data());
+            fs.fat.set(copy, fs.fat.get(block));
+            if (prev == FAT_EOF)
+            {
+                entry.first_blk = copy;
+            }
+            else
+            {
+                fs.fat.set(prev, copy);
+            }
+            block = copy;
+        }
+        prev = block;
+        block = fs.fat.get(block);
+    }
+}
+
+void Checker::unshareSparse(const fsck_issue& issue, dir_entry& entry)
+{
+    uint64_t id = ownerId(issue.dirBlock, issue.index, entry.type);
+    size_t perMap = fs.blockSize / sizeof(uint32_t);
+    std::vector<uint32_t> map(perMap);
+    std::vector<uint8_t> buffer(fs.blockSize);
+    std::vector<int> maps;
+    fs.chainOf(entry.first_blk, maps);
+    for (int block : maps)
+    {
+        fs.cache.read(block, (uint8_t*)map.data());
+        bool dirty = false;
+        for (size_t i = 0; i < perMap; i++)
+        {
+            uint32_t data = map[i] & ~MAP_UNWRITTEN;
+            if (data == 0 || data >= noBlocks || owner[data].load(std::memory_order_relaxed) == id)
+            {
+                continue;
+            }
+            int copy = fs.fat.findFree();
+            if (copy == FAT_EOF)
+            {
+                //What can not be copied becomes a hole
+                std::cout << "  " << issue.path << ": disk is full, block " << data << " left out\n";
+                map[i] = 0;
+            }
+            else
+            {
+                //A reserved block has nothing to copy yet
+                if (!(map[i] & MAP_UNWRITTEN))
+                {
+                    fs.cache.read(data, buffer.data());
+                    fs.cache.write(copy, buffer.data());
+                }
+                fs.fat.set(copy, FAT_EOF);
+                map[i] = copy | (map[i] & MAP_UNWRITTEN);
+            }
+            dirty = true;
+        }
+        if (dirty)
+        {
+            fs.cache.write(block, (uint8_t*)map.data());
+        }
+    }
+}
+
+void Checker::clearMap(dir_entry& entry)
+{
+    size_t perMap = fs.blockSize / sizeof(uint32_t);
+    uint64_t count = ((uint64_t)entry.size + fs.blockSize - 1) / fs.blockSize;
+    std::vector<uint32_t> map(perMap);
+    std::vector<int> maps;
+    fs.chainOf(entry.first_blk, maps);
+    std::vector<bool> seen(noBlocks, false);
+    for (int block : maps)
+    {
+        seen[block] = true;
+    }
+    for (size_t m = 0; m < maps.size(); m++)
+    {
+        fs.cache.read(maps[m], (uint8_t*)map.data());
+        bool dirty = false;
+        for (size_t i = 0; i < perMap; i++)
+        {
+            uint32_t data = map[i] & ~MAP_UNWRITTEN;
+            if (data == 0)
+            {
+                continue;
+            }
+            if (m * perMap + i >= count || data < firstData || data >= noBlocks ||
+                fs.fat.get(data) != FAT_EOF || seen[data])
+            {
+                map[i] = 0;
+                dirty = true;
+                continue;
+            }
+            seen[data] = true;
+        }
+        if (dirty)
+        {
+            fs.cache.write(maps[m], (uint8_t*)map.data());
+        }
+    }
+}
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include "fs.h"
+
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+#define FSCK_PASSES 4 // check and repair rounds before giving up on a disk
+
+// kinds of problems the checker finds
+#define FSCK_BAD_TYPE 0 // type is none of file, directory or empty
+#define FSCK_BAD_NAME 1 // name is not terminated within the entry
+#define FSCK_BAD_CHAIN 2 // chain leaves the data blocks, runs into a free block or loops
+#define FSCK_BAD_SIZE 3 // size does not match the length of the chain
+#define FSCK_BAD_PARENT 4 // ".." is missing or does not lead to the parent
+#define FSCK_CROSS_LINK 5 // chain runs into a block of another chain
+#define FSCK_BAD_MAP 6 // block map of a sparse file points past its size, at a bad block or twice at one
+#define FSCK_LOST_DATA 7 // file was delayed and its data never reached the disk
+#define FSCK_UNREADABLE 8 // directory block can not be read, nothing below it is checked
+#define FSCK_KINDS 9
+
+// a directory waiting to be checked
+struct dir_task {
+    unsigned block;
+    unsigned parent; // block of the directory it is listed in
+    std::string path;
+};
+
+// one problem with a directory entry
+struct fsck_issue {
+    int kind;
+    std::string path;
+    unsigned dirBlock; // directory holding the entry
+    unsigned index; // of the entry in that directory
+    unsigned block; // last good block of a broken chain, shared block of a cross-link
+    unsigned long length; // good blocks of a broken chain, bad map entries, blocks of the chain otherwise
+};
+
+// Runs tasks on a fixed set of threads. Every thread has its own queue and
+// works from its back; a thread whose queue runs dry takes from the front of
+// another one, so a deep or wide directory keeps every thread busy.
+class WorkPool {
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<dir_task> tasks;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::atomic<long> pending{0}; // tasks pushed and not finished yet
+    std::atomic<uint64_t> steals{0};
+
+    //Takes a task for worker, its own newest first, then the oldest of another
+    bool pop(unsigned worker, dir_task& task);
+
+public:
+    WorkPool(unsigned threads);
+    unsigned size() { return queues.size(); }
+    // queues a task on the queue of worker
+    void push(unsigned worker, const dir_task& task);
+    // runs work on every thread until all tasks, also those pushed by work, are done
+    void run(const std::function<void(unsigned, dir_task&)>& work);
+    uint64_t get_steals() { return steals; }
+};
+
+// Checks the file system of a mounted FS. The directory tree is walked on a
+// WorkPool against a copy of the FAT; every entry is validated and every
+// block its chain reaches is claimed for it. A block claimed twice is
+// cross-linked, a used block nobody claims is leaked. Repairs are made on
+// one thread after the walk, then the disk is checked again.
+class Checker {
+private:
+    FS& fs;
+    unsigned threads;
+    unsigned noBlocks;
+    unsigned firstData; // blocks below are the super block, root, FAT, checksums and fingerprints
+    bool shared; // files may share the ends of their chains, see FS::Dedup
+    std::vector<int32_t> table; // copy of the FAT, only read while walking
+    unsigned fatUnreadable = 0; // FAT blocks the copy could not be read from
+    std::unique_ptr<std::atomic<uint64_t>[]> owner; // entry that claimed each block, 0 for none
+    std::mutex packedLock;
+    std::map<unsigned, std::vector<bool>> packedUnits; // units of each shared block packed files claimed
+    std::mutex issuesLock;
+    std::vector<fsck_issue> issues;
+    std::vector<unsigned> leaked;
+    std::atomic<unsigned long> dirs{0};
+    std::atomic<unsigned long> files{0};
+    std::atomic<unsigned long> blocks{0};
+    uint64_t steals = 0;
+
+    //Walks the whole tree, fills issues and leaked
+    void scan();
+    void checkDir(WorkPool& pool, unsigned worker, dir_task& task);
+    //Claims the chain starting at first for id, records a broken chain or a
+    //cross-link, returns false if it did
+    bool claimChain(uint64_t id, unsigned first, fsck_issue& issue);
+    //Claims the units of a packed file in its shared block, records a bad block,
+    //units past the end of the block or units another file took
+    bool claimPacked(const dir_entry& entry, fsck_issue& issue);
+    //Claims the data blocks the map of a sparse file points at, records bad
+    //entries and the first block another file took
+    bool claimSparse(uint64_t id, const dir_entry& entry, fsck_issue& issue);
+    //Follows the chain from a block claimed by another file, returns false if it
+    //is broken, length and last are then the blocks up to the break
+    bool sharedChain(unsigned block, unsigned long& length, unsigned& last);
+    //Blocks the chain of a file should have, 0 if a compressed file's stream can not be read
+    unsigned long blocksNeeded(const dir_entry& entry);
+    //Bytes of the file each block of its chain stands for
+    unsigned long chainBytes(const dir_entry& entry);
+    void report(const fsck_issue& issue);
+    void print(const fsck_issue& issue);
+    //Fixes the entries in issues, returns the number fixed
+    unsigned repairEntries();
+    //Gives the entry its own copy of every block of its chain it does not own,
+    //a packed file a block of its own
+    void unshare(const fsck_issue& issue, std::vector<dir_entry>& dir);
+    //Gives a sparse file its own copy of every data block it does not own
+    void unshareSparse(const fsck_issue& issue, dir_entry& entry);
+    //Turns the bad entries of the map of a sparse file into holes
+    void clearMap(dir_entry& entry);
+
+public:
+    Checker(FS& fs, unsigned threads = 0);
+    // checks the file system and prints what is wrong, with repair set fixes it too,
+    // returns the number of problems found
+    int run(bool repair);
+};
+
+#endif // __CHECK_H__
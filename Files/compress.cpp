@@ -0,0 +1,297 @@
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "compress.h"
+
+static uint32_t load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t load64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+//Copies length bytes 8 at a time, may write up to 7 bytes past the end
+static void wildCopy(uint8_t *dst, const uint8_t *src, size_t length)
+{
+    uint8_t *end = dst + length;
+    do
+    {
+        memcpy(dst, src, 8);
+        dst += 8;
+        src += 8;
+    } while (dst < end);
+}
+
+static uint8_t *writeLength(uint8_t *op, size_t n)
+{
+    while (n >= 255)
+    {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+//Writes one sequence, match is 0 for the last one which has literals only
+static uint8_t *writeSequence(uint8_t *op, const uint8_t *literals, size_t count, size_t offset, size_t match)
+{
+    size_t extra = match > 0 ? match - LZ_MIN_MATCH : 0;
+    *op++ = (uint8_t)(std::min(count, (size_t)15) << 4 | std::min(extra, (size_t)15));
+    if (count >= 15)
+    {
+        op = writeLength(op, count - 15);
+    }
+    memcpy(op, literals, count);
+    op += count;
+    if (match > 0)
+    {
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        if (extra >= 15)
+        {
+            op = writeLength(op, extra - 15);
+        }
+    }
+    return op;
+}
+
+size_t lz_compress(const uint8_t *in, size_t length, uint8_t *out)
+{
+    uint32_t table[1 << LZ_HASH_BITS] = {0}; // position + 1 of the last 4 bytes with each hash
+    uint8_t *op = out;
+    size_t pos = 0, anchor = 0;
+    while (pos + LZ_MIN_MATCH <= length)
+    {
+        uint32_t seq = load32(in + pos);
+        uint32_t hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = pos + 1;
+        if (candidate == 0 || pos - (candidate - 1) > LZ_MAX_OFFSET || load32(in + candidate - 1) != seq)
+        {
+            //Steps grow over data that does not match, so it is not searched byte by byte
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+        size_t ref = candidate - 1;
+        size_t match = LZ_MIN_MATCH;
+        while (pos + match + 8 <= length)
+        {
+            uint64_t diff = load64(in + ref + match) ^ load64(in + pos + match);
+            if (diff != 0)
+            {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                match += __builtin_ctzll(diff) / 8;
+#endif
+                break;
+            }
+            match += 8;
+        }
+        //The last few bytes, and on big-endian the 8 that differed
+        while (pos + match < length && in[ref + match] == in[pos + match])
+        {
+            match++;
+        }
+        op = writeSequence(op, in + anchor, pos - anchor, pos - ref, match);
+        pos += match;
+        anchor = pos;
+        if (pos + 2 <= length)
+        {
+            //The end of the match goes in the table too, runs often continue there
+            table[(load32(in + pos - 2) * 2654435761u) >> (32 - LZ_HASH_BITS)] = pos - 1;
+        }
+    }
+    op = writeSequence(op, in + anchor, length - anchor, 0, 0);
+    return op - out;
+}
+
+//Reads the rest of a length that did not fit its 4 bits, false if in runs out
+static bool readLength(const uint8_t *&ip, const uint8_t *end, size_t& n)
+{
+    uint8_t b;
+    do
+    {
+        if (ip >= end)
+        {
+            return false;
+        }
+        b = *ip++;
+        n += b;
+    } while (b == 255);
+    return true;
+}
+
+long lz_decompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity)
+{
+    const uint8_t *ip = in, *end = in + length;
+    size_t o = 0;
+    while (ip < end)
+    {
+        uint8_t token = *ip++;
+        size_t count = token >> 4;
+        if (count == 15 && !readLength(ip, end, count))
+        {
+            return -1;
+        }
+        if (count > (size_t)(end - ip) || count > capacity - o)
+        {
+            return -1;
+        }
+        //Close to either end the copy has to be exact
+        if (end - ip >= 8 && capacity - o >= 8 && count <= (size_t)(end - ip) - 8 && count <= capacity - o - 8)
+        {
+            wildCopy(out + o, ip, count);
+        }
+        else
+        {
+            memcpy(out + o, ip, count);
+        }
+        ip += count;
+        o += count;
+        if (ip == end)
+        {
+            break;
+        }
+
+        if (end - ip < 2)
+        {
+            return -1;
+        }
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && !readLength(ip, end, match))
+        {
+            return -1;
+        }
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > o || match > capacity - o)
+        {
+            return -1;
+        }
+        if (offset >= 8 && match + 8 <= capacity - o)
+        {
+            wildCopy(out + o, out + o - offset, match);
+        }
+        else if (offset >= match)
+        {
+            memcpy(out + o, out + o - offset, match);
+        }
+        else
+        {
+            //Overlapping, a short offset repeats the bytes before it
+            for (size_t i = 0; i < match; i++)
+            {
+                out[o + i] = out[o - offset + i];
+            }
+        }
+        o += match;
+    }
+    return o;
+}
+
+// packs text into a stream of groups of COMPRESS_GROUP bytes compressed one by one
+std::string compress_file(const std::string& text)
+{
+    compress_header header;
+    header.magic = COMPRESS_MAGIC;
+    header.groups = (text.size() + COMPRESS_GROUP - 1) / COMPRESS_GROUP;
+    std::vector<uint32_t> lengths(header.groups);
+    std::string data;
+    std::vector<uint8_t> packed(lz_bound(COMPRESS_GROUP));
+    for (uint32_t g = 0; g < header.groups; g++)
+    {
+        const uint8_t *group = (const uint8_t*)text.data() + (size_t)g * COMPRESS_GROUP;
+        size_t length = std::min((size_t)COMPRESS_GROUP, text.size() - (size_t)g * COMPRESS_GROUP);
+        size_t size = lz_compress(group, length, packed.data());
+        if (size < length)
+        {
+            data.append((const char*)packed.data(), size);
+            lengths[g] = size;
+        }
+        else
+        {
+            data.append((const char*)group, length);
+            lengths[g] = length | COMPRESS_RAW;
+        }
+    }
+    header.stored = sizeof(header) + lengths.size() * sizeof(uint32_t) + data.size();
+
+    std::string stream((const char*)&header, sizeof(header));
+    stream.append((const char*)lengths.data(), lengths.size() * sizeof(uint32_t));
+    return stream + data;
+}
+
+// unpacks a stream of a file of size bytes and appends it to text
+int decompress_file(const std::string& stream, size_t size, std::string& text)
+{
+    compress_header header;
+    if (compressed_size((const uint8_t*)stream.data(), stream.size()) != stream.size())
+    {
+        return -1;
+    }
+    memcpy(&header, stream.data(), sizeof(header));
+    size_t at = sizeof(header) + (size_t)header.groups * sizeof(uint32_t);
+    if (header.groups != (size + COMPRESS_GROUP - 1) / COMPRESS_GROUP || at > stream.size())
+    {
+        return -1;
+    }
+
+    const uint8_t *lengths = (const uint8_t*)stream.data() + sizeof(header);
+    size_t start = text.size();
+    text.resize(start + size);
+    uint8_t *out = (uint8_t*)&text[start];
+    for (uint32_t g = 0; g < header.groups; g++)
+    {
+        uint32_t length;
+        memcpy(&length, lengths + g * sizeof(uint32_t), sizeof(length));
+        size_t expected = std::min((size_t)COMPRESS_GROUP, size - (size_t)g * COMPRESS_GROUP);
+        size_t stored = length & ~COMPRESS_RAW;
+        if (stored > stream.size() - at)
+        {
+            text.resize(start);
+            return -1;
+        }
+        const uint8_t *group = (const uint8_t*)stream.data() + at;
+        if (length & COMPRESS_RAW)
+        {
+            if (stored != expected)
+            {
+                text.resize(start);
+                return -1;
+            }
+            memcpy(out, group, stored);
+        }
+        else if (lz_decompress(group, stored, out, expected) != (long)expected)
+        {
+            text.resize(start);
+            return -1;
+        }
+        out += expected;
+        at += stored;
+    }
+    return 0;
+}
+
+// bytes of the stream that starts with first, 0 if it is no stream
+size_t compressed_size(const uint8_t *first, size_t length)
+{
+    compress_header header;
+    if (length < sizeof(header))
+    {
+        return 0;
+    }
+    memcpy(&header, first, sizeof(header));
+    if (header.magic != COMPRESS_MAGIC || header.stored < sizeof(header) + (uint64_t)header.groups * sizeof(uint32_t))
+    {
+        return 0;
+    }
+    return header.stored;
+}
@@ -0,0 +1,44 @@
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12 // entries of the match finder, 4 bytes each on the stack
+#define LZ_MAX_OFFSET 65535
+
+#define COMPRESS_MAGIC 0x315a4c46 // "FLZ1"
+#define COMPRESS_GROUP 65536 // bytes of a file compressed together, matches stay inside their group
+#define COMPRESS_RAW 0x80000000 // set in a group length when the group did not shrink and is kept as it is
+
+// LZ77 in the block format of LZ4: every sequence is a token with the literal
+// and match length, the literals, a 16-bit offset and the rest of the lengths.
+// The last sequence has literals only. Greedy matching on a hash of 4 bytes,
+// which is fast and still does well on text.
+
+// worst case size of compressing length bytes
+inline size_t lz_bound(size_t length) { return length + length / 255 + 16; }
+// compresses length bytes into out, which holds lz_bound(length), returns the compressed size
+size_t lz_compress(const uint8_t *in, size_t length, uint8_t *out);
+// decompresses into out, returns the size or -1 if in is damaged or does not fit capacity
+long lz_decompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity);
+
+// starts the stream of a compressed file, followed by the length of every
+// group and then the groups
+struct compress_header {
+    uint32_t magic; // COMPRESS_MAGIC
+    uint32_t groups;
+    uint32_t stored; // bytes of the whole stream, this header included
+};
+
+// packs text into a stream of groups of COMPRESS_GROUP bytes compressed one by one
+std::string compress_file(const std::string& text);
+// unpacks a stream of a file of size bytes and appends it to text,
+// returns -1 if the stream is damaged
+int decompress_file(const std::string& stream, size_t size, std::string& text);
+// bytes of the stream that starts with first, 0 if it is no stream
+size_t compressed_size(const uint8_t *first, size_t length);
+
+#endif // __COMPRESS_H__
@@ -0,0 +1,213 @@
+#include <cstring>
+#include "crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86
+#endif
+
+#define CRC32C_POLY 0x82f63b78 // the Castagnoli polynomial, bit-reversed
+// bytes in each of the three lanes the hardware version runs, 3 long lanes
+// cover a 4 KiB block and 3 short ones a 1 KiB block up to the last 16 bytes
+#define CRC32C_LONG 1360
+#define CRC32C_SHORT 336
+
+// tables[0] is the usual byte-at-a-time table, tables[k] advances a byte
+// through k more zero bytes, so eight bytes are looked up at once
+struct Tables {
+    uint32_t t[8][256];
+
+    Tables()
+    {
+        for (unsigned i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            }
+            t[0][i] = crc;
+        }
+        for (unsigned i = 0; i < 256; i++)
+        {
+            for (int k = 1; k < 8; k++)
+            {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+static const Tables& tables()
+{
+    static const Tables built;
+    return built;
+}
+
+//Returns a times b modulo the polynomial, both bit-reversed like the crc
+static uint32_t multModP(uint32_t a, uint32_t b)
+{
+    uint32_t product = 0;
+    for (uint32_t m = 1u << 31; m != 0; m >>= 1)
+    {
+        if (a & m)
+        {
+            product ^= b;
+        }
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return product;
+}
+
+// Runs a crc through a number of zero bytes with four lookups, which is how
+// the lanes of the hardware version are put back together:
+// crc(A B) = zeros(crc(A), length of B) ^ crc(B) when B starts from 0
+struct ZeroShift {
+    uint32_t t[4][256];
+
+    ZeroShift(size_t bytes)
+    {
+        //x^(8 * bytes) mod P by squaring, x^0 is the top bit
+        uint32_t power = 1u << 31, square = 1u << 23; // x^8
+        for (size_t n = bytes; n > 0; n >>= 1)
+        {
+            if (n & 1)
+            {
+                power = multModP(square, power);
+            }
+            square = multModP(square, square);
+        }
+        for (unsigned k = 0; k < 4; k++)
+        {
+            for (unsigned i = 0; i < 256; i++)
+            {
+                t[k][i] = multModP(power, i << (8 * k));
+            }
+        }
+    }
+
+    uint32_t shift(uint32_t crc) const
+    {
+        return t[0][crc & 0xff] ^ t[1][(crc >> 8) & 0xff] ^ t[2][(crc >> 16) & 0xff] ^ t[3][crc >> 24];
+    }
+};
+
+#ifdef CRC32C_X86
+#ifdef __x86_64__
+//Runs three lanes of lane bytes side by side, the crc32 instruction takes
+//three cycles but a new one can start every cycle
+__attribute__((target("sse4.2")))
+static uint64_t crc32cLanes(uint64_t crc, const uint8_t *data, size_t lane, const ZeroShift& zeros)
+{
+    uint64_t crc1 = 0, crc2 = 0;
+    for (size_t at = 0; at < lane; at += 8)
+    {
+        uint64_t word0, word1, word2;
+        memcpy(&word0, data + at, 8);
+        memcpy(&word1, data + lane + at, 8);
+        memcpy(&word2, data + 2 * lane + at, 8);
+        crc = _mm_crc32_u64(crc, word0);
+        crc1 = _mm_crc32_u64(crc1, word1);
+        crc2 = _mm_crc32_u64(crc2, word2);
+    }
+    crc = zeros.shift(crc) ^ crc1;
+    return zeros.shift(crc) ^ crc2;
+}
+#endif
+
+//Compiled for SSE4.2 on its own, the rest of the program does not need it
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t *data, size_t length)
+{
+    crc = ~crc;
+#ifdef __x86_64__
+    static const ZeroShift longZeros(CRC32C_LONG), shortZeros(CRC32C_SHORT);
+    uint64_t wide = crc;
+    while (length >= 3 * CRC32C_LONG)
+    {
+        wide = crc32cLanes(wide, data, CRC32C_LONG, longZeros);
+        data += 3 * CRC32C_LONG;
+        length -= 3 * CRC32C_LONG;
+    }
+    while (length >= 3 * CRC32C_SHORT)
+    {
+        wide = crc32cLanes(wide, data, CRC32C_SHORT, shortZeros);
+        data += 3 * CRC32C_SHORT;
+        length -= 3 * CRC32C_SHORT;
+    }
+    while (length >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        wide = _mm_crc32_u64(wide, word);
+        data += 8;
+        length -= 8;
+    }
+    crc = (uint32_t)wide;
+#endif
+    while (length >= 4)
+    {
+        uint32_t word;
+        memcpy(&word, data, 4);
+        crc = _mm_crc32_u32(crc, word);
+        data += 4;
+        length -= 4;
+    }
+    while (length > 0)
+    {
+        crc = _mm_crc32_u8(crc, *data++);
+        length--;
+    }
+    return ~crc;
+}
+#endif
+
+typedef uint32_t (*crc32c_fn)(uint32_t, const uint8_t*, size_t);
+
+static crc32c_fn choose()
+{
+#ifdef CRC32C_X86
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return crc32cHardware;
+    }
+#endif
+    return crc32c_table;
+}
+
+uint32_t crc32c_table(uint32_t crc, const uint8_t *data, size_t length)
+{
+    const Tables& tab = tables();
+    crc = ~crc;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (length >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        word ^= crc;
+        crc = tab.t[7][word & 0xff] ^ tab.t[6][(word >> 8) & 0xff] ^
+            tab.t[5][(word >> 16) & 0xff] ^ tab.t[4][(word >> 24) & 0xff] ^
+            tab.t[3][(word >> 32) & 0xff] ^ tab.t[2][(word >> 40) & 0xff] ^
+            tab.t[1][(word >> 48) & 0xff] ^ tab.t[0][word >> 56];
+        data += 8;
+        length -= 8;
+    }
+#endif
+    while (length > 0)
+    {
+        crc = tab.t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        length--;
+    }
+    return ~crc;
+}
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t length)
+{
+    static const crc32c_fn impl = choose();
+    return impl(crc, data, length);
+}
+
+bool crc32c_hardware()
+{
+    return choose() != crc32c_table;
+}
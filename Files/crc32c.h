@@ -0,0 +1,16 @@
+#include <cstdint>
+#include <cstddef>
+
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+// CRC-32C (Castagnoli), the checksum of iSCSI, ext4 and btrfs. crc is what
+// the call for the data before returned, 0 for the first call.
+// Runs on the SSE4.2 crc32 instruction when the CPU has it.
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t length);
+// the table-driven version used without SSE4.2, 8 bytes per step
+uint32_t crc32c_table(uint32_t crc, const uint8_t *data, size_t length);
+// true if crc32c uses the crc32 instruction
+bool crc32c_hardware();
+
+#endif // __CRC32C_H__
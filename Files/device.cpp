@@ -0,0 +1,200 @@
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include "device.h"
+#include "iotrace.h"
+
+device_profile DeviceModel::hdd()
+{
+    device_profile p;
+    p.type = DEVICE_HDD;
+    p.mbPerSec = 150;
+    return p;
+}
+
+device_profile DeviceModel::ssd()
+{
+    device_profile p;
+    p.type = DEVICE_SSD;
+    p.mbPerSec = 2000;
+    return p;
+}
+
+void DeviceModel::set_profile(const device_profile& profile)
+{
+    std::lock_guard<std::mutex> held(lock);
+    this->profile = profile;
+    enabled = profile.type != DEVICE_NONE;
+    busyUntil = std::chrono::steady_clock::now();
+}
+
+device_profile DeviceModel::get_profile()
+{
+    std::lock_guard<std::mutex> held(lock);
+    return profile;
+}
+
+int DeviceModel::configure(const std::vector<std::string>& args)
+{
+    if (args.empty())
+    {
+        return -1;
+    }
+    device_profile p;
+    if (args[0] == "hdd")
+    {
+        p = hdd();
+    }
+    else if (args[0] == "ssd")
+    {
+        p = ssd();
+    }
+    else if (args[0] != "none")
+    {
+        std::cout << "ERROR: Unknown device " << args[0] << "\n";
+        return -1;
+    }
+
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        size_t equals = args[i].find('=');
+        std::string key = args[i].substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : args[i].substr(equals + 1);
+        char* end = nullptr;
+        double number = strtod(value.c_str(), &end);
+        bool numeric = !value.empty() && *end == '\0' && number >= 0;
+        if (key == "mode" && (value == "sleep" || value == "virtual"))
+        {
+            p.inject = value == "sleep";
+        }
+        else if (!numeric)
+        {
+            std::cout << "ERROR: Bad device setting " << args[i] << "\n";
+            return -1;
+        }
+        else if (key == "seek")
+        {
+            p.trackSeekUs = number * 1000;
+        }
+        else if (key == "fullseek")
+        {
+            p.fullSeekUs = number * 1000;
+        }
+        else if (key == "rpm" && number > 0)
+        {
+            p.rpm = (unsigned)number;
+        }
+        else if (key == "read")
+        {
+            p.readUs = number;
+        }
+        else if (key == "write")
+        {
+            p.writeUs = number;
+        }
+        else if (key == "qd" && number >= 1)
+        {
+            p.queueDepth = (unsigned)number;
+        }
+        else if (key == "rate" && number > 0)
+        {
+            p.mbPerSec = number;
+        }
+        else
+        {
+            std::cout << "ERROR: Bad device setting " << args[i] << "\n";
+            return -1;
+        }
+    }
+    set_profile(p);
+    return 0;
+}
+
+uint64_t DeviceModel::cost(uint8_t op, unsigned block_no, unsigned count, unsigned block_size, unsigned no_blocks)
+{
+    // MB/s is the same as bytes per microsecond
+    double us = (double)count * block_size / profile.mbPerSec;
+    if (profile.type == DEVICE_HDD)
+    {
+        if (block_no != head)
+        {
+            //Seek time grows with the square root of the distance, then wait half a turn on average
+            double distance = block_no > head ? block_no - head : head - block_no;
+            double fraction = no_blocks > 0 ? std::min(1.0, distance / no_blocks) : 1.0;
+            us += profile.trackSeekUs + (profile.fullSeekUs - profile.trackSeekUs) * std::sqrt(fraction);
+            us += 60e6 / profile.rpm / 2;
+            seeks.fetch_add(1, std::memory_order_relaxed);
+        }
+        head = block_no + count;
+    }
+    else if (profile.type == DEVICE_SSD)
+    {
+        unsigned rounds = (count + profile.queueDepth - 1) / profile.queueDepth;
+        us += rounds * (op == IO_WRITE ? profile.writeUs : profile.readUs);
+    }
+    return (uint64_t)(us * 1000);
+}
+
+// models one request, delays it if the profile injects delays, returns the modelled time
+uint64_t DeviceModel::access(uint8_t op, unsigned block_no, unsigned count, unsigned block_size, unsigned no_blocks)
+{
+    std::chrono::steady_clock::time_point done;
+    uint64_t ns;
+    bool inject;
+    {
+        std::lock_guard<std::mutex> held(lock);
+        if (profile.type == DEVICE_NONE)
+        {
+            return 0;
+        }
+        ns = cost(op, block_no, count, block_size, no_blocks);
+        inject = profile.inject;
+        //Queues behind the request the device is still busy with
+        auto now = std::chrono::steady_clock::now();
+        done = std::max(now, busyUntil) + std::chrono::nanoseconds(ns);
+        busyUntil = done;
+    }
+    modelledNs.fetch_add(ns, std::memory_order_relaxed);
+    requests.fetch_add(1, std::memory_order_relaxed);
+    if (inject)
+    {
+        std::this_thread::sleep_until(done);
+    }
+    return ns;
+}
+
+void DeviceModel::reset()
+{
+    modelledNs = 0;
+    requests = 0;
+    seeks = 0;
+}
+
+void DeviceModel::print(std::ostream& out)
+{
+    device_profile p = get_profile();
+    char line[256];
+    if (p.type == DEVICE_HDD)
+    {
+        snprintf(line, sizeof(line), "  hdd seek %.1f-%.1f ms, %u rpm, %.0f MB/s, %s\n",
+            p.trackSeekUs / 1000, p.fullSeekUs / 1000, p.rpm, p.mbPerSec, p.inject ? "sleep" : "virtual");
+    }
+    else if (p.type == DEVICE_SSD)
+    {
+        snprintf(line, sizeof(line), "  ssd read %.0f us, write %.0f us, queue depth %u, %.0f MB/s, %s\n",
+            p.readUs, p.writeUs, p.queueDepth, p.mbPerSec, p.inject ? "sleep" : "virtual");
+    }
+    else
+    {
+        snprintf(line, sizeof(line), "  none\n");
+    }
+    out << line;
+    if (p.type != DEVICE_NONE)
+    {
+        snprintf(line, sizeof(line), "  requests %llu  seeks %llu  modelled time %.3f ms\n",
+            (unsigned long long)requests.load(), (unsigned long long)seeks.load(), modelledNs.load() / 1e6);
+        out << line;
+    }
+}
@@ -0,0 +1,65 @@
+#include <iostream>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#ifndef __DEVICE_H__
+#define __DEVICE_H__
+
+#define DEVICE_NONE 0 // the disk file as it is, usually in the host page cache
+#define DEVICE_HDD 1
+#define DEVICE_SSD 2
+
+// costs of the simulated device, times in microseconds
+struct device_profile {
+    int type = DEVICE_NONE;
+    bool inject = true; // delay requests by the modelled time, otherwise only count it
+    // HDD
+    double trackSeekUs = 800; // seek to a neighbouring track
+    double fullSeekUs = 16000; // seek across the whole disk
+    unsigned rpm = 7200;
+    // SSD
+    double readUs = 80; // latency of one read
+    double writeUs = 250;
+    unsigned queueDepth = 32; // blocks of one request served in parallel
+    // both
+    double mbPerSec = 150; // transfer rate once the data is reached
+};
+
+// Models how long a request would take on a real device. An HDD pays a seek
+// growing with the square root of the distance plus half a rotation unless
+// the request starts where the last one ended. An SSD pays a fixed latency
+// for each queueDepth blocks. Both add the transfer time. The device serves
+// one request at a time, a request that arrives while it is busy waits.
+class DeviceModel {
+private:
+    device_profile profile;
+    std::atomic<bool> enabled{false}; // profile.type is not DEVICE_NONE
+    std::mutex lock;
+    unsigned head = 0; // block after the last request, where the HDD head is
+    std::chrono::steady_clock::time_point busyUntil;
+    std::atomic<uint64_t> modelledNs{0};
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> seeks{0};
+
+    uint64_t cost(uint8_t op, unsigned block_no, unsigned count, unsigned block_size, unsigned no_blocks);
+
+public:
+    static device_profile hdd();
+    static device_profile ssd();
+    void set_profile(const device_profile& profile);
+    device_profile get_profile();
+    bool active() { return enabled.load(std::memory_order_relaxed); }
+    // takes a profile name (none, hdd or ssd) followed by key=value overrides:
+    // seek=<ms> fullseek=<ms> rpm=<n> read=<us> write=<us> qd=<n> rate=<MB/s> mode=sleep|virtual
+    int configure(const std::vector<std::string>& args);
+    // models one request, delays it if the profile injects delays, returns the modelled time
+    uint64_t access(uint8_t op, unsigned block_no, unsigned count, unsigned block_size, unsigned no_blocks);
+    void reset();
+    void print(std::ostream& out);
+};
+
+#endif // __DEVICE_H__
@@ -1,27 +1,859 @@
 #include <iostream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+#include <algorithm>
 #include "disk.h"
 
-Disk::Disk()
+Disk::Disk(const std::string& name, unsigned no_blocks, unsigned block_size)
+    : name(name), no_blocks(no_blocks), block_size(block_size)
 {
     // first check if the disk file exists, otherwise create it.
-    if (!disk_file_exists(DISKNAME)) {
+    if (!disk_file_exists(name)) {
         std::cout << "No disk file found...\n";
-        std::cout << "Creating disk file: " << DISKNAME << std::endl;
-        std::ofstream f(DISKNAME, std::ios::binary | std::ios::out);
-        f.seekp((1<<23)-1);
-        f.write("", 1);
+        std::cout << "Creating disk file: " << name << std::endl;
+        std::ofstream f(name, std::ios::binary | std::ios::out);
+        f.close();
+        // the file starts out as one hole, blocks take host space once written
+        if (truncate(name.c_str(), (off_t)get_disk_size()) == -1)
+            std::cerr << "ERROR: Can't size diskfile: " << name << std::endl;
     }
     // the disk is simulated as a binary file
-    diskfile.open(DISKNAME, std::ios::in | std::ios::out | std::ios::binary);
+    diskfile.open(name, std::ios::in | std::ios::out | std::ios::binary);
     if (!diskfile.is_open()) {
-        std::cerr << "ERROR: Can't open diskfile: " << DISKNAME << ", exiting..."<< std::endl;
+        std::cerr << "ERROR: Can't open diskfile: " << name << ", exiting..."<< std::endl;
         exit(-1);
     }
+    holeFd = open(name.c_str(), O_RDWR);
+    // an existing file keeps its size until the file system knows its geometry
+    diskfile.seekg(0, std::ios_base::end);
+    this->no_blocks = (unsigned)(diskfile.tellg() / block_size);
+}
+
+// a view of a snapshot of base, nothing of the disk file is opened
+Disk::Disk(Disk& base, unsigned slot)
+    : name(base.name), no_blocks(base.logBlocks), block_size(base.block_size), base(&base), baseSlot(slot)
+{
+    punching = false;
+    std::lock_guard<std::mutex> held(base.logLock);
+    base.logSnapshots[slot].views++;
 }
 
 Disk::~Disk()
 {
+    if (base) {
+        std::lock_guard<std::mutex> held(base->logLock);
+        base->logSnapshots[baseSlot].views--;
+    }
+    set_log(0, 0, 0, false);
+    stop_recording();
     diskfile.close();
+    if (holeFd != -1)
+        close(holeFd);
+}
+
+bool
+Disk::valid_block_size(unsigned block_size)
+{
+    bool power_of_two = (block_size & (block_size - 1)) == 0;
+    return power_of_two && block_size >= MIN_BLOCK_SIZE && block_size <= MAX_BLOCK_SIZE;
+}
+
+// reads the disk file with another geometry, the file is not changed
+void
+Disk::set_geometry(unsigned no_blocks, unsigned block_size)
+{
+    this->no_blocks = no_blocks;
+    this->block_size = block_size;
+}
+
+// changes the geometry and grows or shrinks the disk file to match
+int
+Disk::resize(unsigned no_blocks, unsigned block_size)
+{
+    diskfile.close();
+    set_geometry(no_blocks, block_size);
+    if (truncate(name.c_str(), (off_t)get_disk_size()) == -1) {
+        std::cout << "Disk::resize - ERROR: Can't resize diskfile: " << name << "\n";
+    }
+    diskfile.open(name, std::ios::in | std::ios::out | std::ios::binary);
+    if (!diskfile.is_open()) {
+        std::cerr << "ERROR: Can't open diskfile: " << name << ", exiting..."<< std::endl;
+        exit(-1);
+    }
+    return 0;
+}
+
+// logs every request that reaches the disk to a binary trace file at path
+int
+Disk::start_recording(const std::string& path)
+{
+    stop_recording();
+    std::lock_guard<std::mutex> held(recordLock);
+    recordFile.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!recordFile.is_open()) {
+        std::cout << "Disk::start_recording - ERROR: Can't open trace file: " << path << "\n";
+        return -1;
+    }
+    iotrace_header header = {IOTRACE_MAGIC, IOTRACE_VERSION, block_size, no_blocks};
+    recordFile.write((char*)&header, sizeof(header));
+    recordBuffer.clear();
+    recordBuffer.reserve(IOTRACE_BUFFER);
+    recordStart = std::chrono::steady_clock::now();
+    recording = true;
+    return 0;
+}
+
+void
+Disk::stop_recording()
+{
+    std::lock_guard<std::mutex> held(recordLock);
+    if (!recording)
+        return;
+    recording = false;
+    flushRecords();
+    recordFile.close();
+}
+
+void
+Disk::logAccess(uint8_t op, unsigned block_no, unsigned count)
+{
+    if (!recording.load(std::memory_order_relaxed))
+        return;
+    std::lock_guard<std::mutex> held(recordLock);
+    if (!recording)
+        return;
+    iotrace_record r;
+    r.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - recordStart).count();
+    r.block_no = block_no;
+    r.op = op;
+    r.reserved = 0;
+    // the count field is 16 bits, longer runs become several records
+    while (count > 0) {
+        r.count = count > UINT16_MAX ? UINT16_MAX : count;
+        recordBuffer.push_back(r);
+        r.block_no += r.count;
+        count -= r.count;
+    }
+    if (recordBuffer.size() >= IOTRACE_BUFFER)
+        flushRecords();
+}
+
+void
+Disk::flushRecords()
+{
+    recordFile.write((char*)recordBuffer.data(), recordBuffer.size() * sizeof(iotrace_record));
+    recordFile.flush();
+    recordBuffer.clear();
+}
+
+// blocks a region needs to hold a checksum of each of no_blocks blocks
+unsigned
+Disk::checksum_blocks(unsigned no_blocks, unsigned block_size)
+{
+    uint64_t bytes = (uint64_t)no_blocks * sizeof(uint32_t);
+    return (unsigned)((bytes + block_size - 1) / block_size);
+}
+
+// keeps a checksum of every block outside the count blocks at start
+void
+Disk::set_checksums(unsigned start, unsigned count, const uint8_t *region)
+{
+    std::lock_guard<std::mutex> held(csumLock);
+    csumStart = start;
+    csumBlocks = count;
+    if (count == 0) {
+        csums.clear();
+        csumDirty.clear();
+        return;
+    }
+    csums.assign(no_blocks, 0);
+    if (region)
+        memcpy(csums.data(), region, csums.size() * sizeof(uint32_t));
+    // without a region the one on the disk is cleared with the next write-back
+    csumDirty.assign(count, region == nullptr);
+}
+
+// hands out the region blocks whose checksums changed so they can be written
+unsigned
+Disk::take_checksums(std::vector<unsigned>& block_nos, std::vector<uint8_t>& data)
+{
+    std::lock_guard<std::mutex> held(csumLock);
+    unsigned perBlock = block_size / sizeof(uint32_t);
+    unsigned taken = 0;
+    for (unsigned i = 0; i < csumDirty.size(); i++) {
+        if (!csumDirty[i])
+            continue;
+        csumDirty[i] = false;
+        block_nos.push_back(csumStart + i);
+        size_t at = data.size();
+        data.resize(at + block_size, 0);
+        size_t first = (size_t)i * perBlock;
+        size_t n = std::min((size_t)perBlock, csums.size() - first);
+        memcpy(data.data() + at, csums.data() + first, n * sizeof(uint32_t));
+        taken++;
+    }
+    return taken;
+}
+
+// hands the region blocks out again with the next take_checksums()
+void
+Disk::retake_checksums(const std::vector<unsigned>& block_nos)
+{
+    std::lock_guard<std::mutex> held(csumLock);
+    for (unsigned b : block_nos) {
+        if (b - csumStart < csumDirty.size())
+            csumDirty[b - csumStart] = true;
+    }
+}
+
+// forgets the checksums of the blocks blks changes
+void
+Disk::forget_checksums(unsigned block_no, unsigned count, const uint8_t *blks)
+{
+    if (csumBlocks.load(std::memory_order_relaxed) == 0)
+        return;
+    unsigned perBlock = block_size / sizeof(uint32_t);
+    for (unsigned i = 0; i < count; i++) {
+        unsigned b = block_no + i;
+        uint32_t crc = crc32c(0, blks + (size_t)i * block_size, block_size);
+        if (crc == 0)
+            crc = 1;
+        std::lock_guard<std::mutex> held(csumLock);
+        if (checksummed(b) && b < csums.size() && csums[b] != 0 && csums[b] != crc) {
+            csums[b] = 0;
+            csumDirty[b / perBlock] = true;
+        }
+    }
+}
+
+void
+Disk::updateChecksums(unsigned block_no, unsigned count, const uint8_t *blks)
+{
+    if (csumBlocks.load(std::memory_order_relaxed) == 0)
+        return;
+    unsigned perBlock = block_size / sizeof(uint32_t);
+    for (unsigned i = 0; i < count; i++) {
+        unsigned b = block_no + i;
+        uint32_t crc = crc32c(0, blks + (size_t)i * block_size, block_size);
+        // 0 stands for a block without a checksum, a real 0 is kept as 1
+        if (crc == 0)
+            crc = 1;
+        std::lock_guard<std::mutex> held(csumLock);
+        if (checksummed(b) && b < csums.size() && csums[b] != crc) {
+            csums[b] = crc;
+            csumDirty[b / perBlock] = true;
+        }
+    }
+}
+
+//Returns the first block that does not match its checksum, or -1
+long
+Disk::verifyChecksums(unsigned block_no, unsigned count, const uint8_t *blks)
+{
+    if (csumBlocks.load(std::memory_order_relaxed) == 0)
+        return -1;
+    std::vector<uint32_t> expected(count, 0);
+    {
+        std::lock_guard<std::mutex> held(csumLock);
+        for (unsigned i = 0; i < count; i++) {
+            unsigned b = block_no + i;
+            if (checksummed(b) && b < csums.size())
+                expected[i] = csums[b];
+        }
+    }
+    for (unsigned i = 0; i < count; i++) {
+        if (expected[i] == 0)
+            continue;
+        uint32_t crc = crc32c(0, blks + (size_t)i * block_size, block_size);
+        if (crc == 0)
+            crc = 1;
+        if (crc != expected[i])
+            return block_no + i;
+    }
+    return -1;
+}
+
+// blocks a region needs to hold the map of a log of no_blocks blocks
+unsigned
+Disk::log_map_blocks(unsigned no_blocks, unsigned block_size)
+{
+    uint64_t bytes = (uint64_t)no_blocks * sizeof(uint32_t);
+    return (unsigned)((bytes + block_size - 1) / block_size);
+}
+
+// blocks a log-structured disk of no_blocks blocks has for the file system,
+// 0 if it is too small to be one
+unsigned
+Disk::log_capacity(unsigned no_blocks, unsigned block_size)
+{
+    uint64_t maps = (uint64_t)log_map_blocks(no_blocks, block_size) * (1 + LOG_SNAPSHOTS);
+    if (no_blocks < maps + 1)
+        return 0;
+    unsigned segments = (no_blocks - 1 - maps) / LOG_SEGMENT_BLOCKS;
+    if (segments <= LOG_RESERVE_SEGMENTS + 1)
+        return 0;
+    // the slack keeps segments partly empty so cleaning one gains room, the
+    // reserve and the head are never filled by the file system
+    uint64_t slack = (uint64_t)segments * LOG_SEGMENT_BLOCKS * (100 - LOG_SLACK_PCT) / 100;
+    uint64_t spare = (uint64_t)(segments - LOG_RESERVE_SEGMENTS - 1) * LOG_SEGMENT_BLOCKS;
+    return 1 + (unsigned)std::min(slack, spare);
+}
+
+// makes the disk a log of logical blocks with its maps saved in the blocks from start
+void
+Disk::set_log(unsigned start, unsigned count, unsigned logical, bool load, unsigned slots, unsigned used)
+{
+    stopCleaner();
+    std::lock_guard<std::mutex> held(logLock);
+    if (is_log())
+        logSync();
+    logBlocks = 0;
+    logMap = LogMap();
+    logSnapshots.clear();
+    logOwner.clear();
+    logRefs.clear();
+    segLive.clear();
+    segFree.clear();
+    segDying.clear();
+    logHeld = 0;
+    logMapped = 0;
+    if (count == 0 || logical == 0)
+        return;
+    logSegments = (start - 1) / LOG_SEGMENT_BLOCKS;
+    logPerPage = block_size / sizeof(uint32_t);
+    unsigned end = 1 + logSegments * LOG_SEGMENT_BLOCKS;
+    logOwner.assign(end, 0);
+    logRefs.assign(end, 0);
+    segLive.assign(logSegments, 0);
+    logBlocks = logical;
+    logMap.start = start;
+    logLoad(logMap, count, load);
+    logSnapshots.resize(slots);
+    for (unsigned slot = 0; slot < slots; slot++) {
+        logSnapshots[slot].start = start + count * (1 + slot);
+        logSnapshots[slot].used = (used >> slot & 1) != 0;
+        if (logSnapshots[slot].used)
+            logLoad(logSnapshots[slot], count, load);
+    }
+    // whatever an older layout left in the log takes no space on the host
+    if (!load)
+        discardRaw(1, end - 1);
+    for (unsigned seg = 0; seg < logSegments; seg++) {
+        if (segLive[seg] == 0)
+            segFree.insert(seg);
+    }
+    // the first write moves the head to a free segment
+    headSeg = logSegments;
+    headUsed = LOG_SEGMENT_BLOCKS;
+    cleaner = std::thread(&Disk::cleanerLoop, this);
+}
+
+//Reads a map from its region, or starts it out empty, and counts the blocks it holds
+void
+Disk::logLoad(LogMap& map, unsigned count, bool load)
+{
+    std::vector<uint8_t> region((size_t)count * block_size, 0);
+    if (load && readRaw(map.start, count, region.data()) == -1)
+        std::fill(region.begin(), region.end(), 0);
+    // without a map to load the one on the disk is cleared with the next sync
+    map.dirty.assign(count, !load);
+    map.pages.resize(count);
+    for (unsigned i = 0; i < count; i++) {
+        MapPage page = std::make_shared<std::vector<uint32_t>>(logPerPage);
+        memcpy(page->data(), region.data() + (size_t)i * block_size, block_size);
+        for (unsigned j = 0; j < logPerPage; j++) {
+            unsigned b = i * logPerPage + j;
+            uint32_t p = (*page)[j];
+            // a damaged entry is dropped, the block reads as zeros
+            if (p != 0 && (b == 0 || b >= logBlocks || p >= logOwner.size() ||
+                (logOwner[p] != 0 && logOwner[p] != b))) {
+                (*page)[j] = 0;
+                map.dirty[i] = true;
+            }
+        }
+        if (&map != &logMap && *logMap.pages[i] == *page) {
+            map.pages[i] = logMap.pages[i];
+            continue;
+        }
+        for (unsigned j = 0; j < logPerPage; j++) {
+            uint32_t p = (*page)[j];
+            if (p != 0 && &map == &logMap)
+                logMapped++;
+            if (p != 0 && logRefs[p]++ == 0) {
+                logOwner[p] = i * logPerPage + j;
+                segLive[(p - 1) / LOG_SEGMENT_BLOCKS]++;
+                logHeld++;
+            }
+        }
+        map.pages[i] = page;
+    }
+}
+
+void
+Disk::sync_log()
+{
+    if (!is_log())
+        return;
+    std::lock_guard<std::mutex> held(logLock);
+    logSync();
+}
+
+void
+Disk::get_log_segments(unsigned& free, unsigned& total)
+{
+    std::lock_guard<std::mutex> held(logLock);
+    free = segFree.size() + segDying.size();
+    total = logSegments;
+}
+
+// makes snapshot slot share the live map as it is and saves it
+int
+Disk::take_snapshot(unsigned slot)
+{
+    if (!is_log())
+        return -1;
+    std::lock_guard<std::mutex> held(logLock);
+    if (slot >= logSnapshots.size() || logSnapshots[slot].used)
+        return -1;
+    // no block is copied, the live map copies a page when it first changes it.
+    // The page table is copied and the whole map saved to the slot, a snapshot
+    // costs a write of every page of the map
+    LogMap& snapshot = logSnapshots[slot];
+    snapshot.pages = logMap.pages;
+    snapshot.dirty.assign(snapshot.pages.size(), true);
+    snapshot.used = true;
+    logSync();
+    return 0;
+}
+
+// forgets snapshot slot, the blocks only it held are freed
+int
+Disk::drop_snapshot(unsigned slot)
+{
+    if (!is_log())
+        return -1;
+    std::lock_guard<std::mutex> held(logLock);
+    if (slot >= logSnapshots.size() || !logSnapshots[slot].used || logSnapshots[slot].views > 0)
+        return -1;
+    LogMap& snapshot = logSnapshots[slot];
+    for (MapPage& page : snapshot.pages) {
+        // a page another map shares keeps its blocks
+        if (page.use_count() > 1)
+            continue;
+        for (uint32_t p : *page) {
+            if (p != 0 && logRelease(p))
+                discardRaw(p, 1);
+        }
+    }
+    snapshot.pages.clear();
+    snapshot.dirty.clear();
+    snapshot.used = false;
+    return 0;
+}
+
+// blocks held by snapshot slot and by no other map
+unsigned long
+Disk::snapshot_blocks(unsigned slot)
+{
+    if (!is_log())
+        return 0;
+    std::lock_guard<std::mutex> held(logLock);
+    if (slot >= logSnapshots.size() || !logSnapshots[slot].used)
+        return 0;
+    LogMap& snapshot = logSnapshots[slot];
+    unsigned long own = 0;
+    for (unsigned i = 0; i < snapshot.pages.size(); i++) {
+        if (snapshot.pages[i].use_count() > 1)
+            continue;
+        for (unsigned j = 0; j < logPerPage; j++) {
+            uint32_t p = (*snapshot.pages[i])[j];
+            own += p != 0 && logRefs[p] == 1;
+        }
+    }
+    return own;
+}
+
+unsigned long
+Disk::log_pinned()
+{
+    std::lock_guard<std::mutex> held(logLock);
+    return logHeld - logMapped;
+}
+
+bool
+Disk::has_snapshots()
+{
+    std::lock_guard<std::mutex> held(logLock);
+    for (LogMap& map : logSnapshots) {
+        if (map.used)
+            return true;
+    }
+    return false;
+}
+
+bool
+Disk::has_views(int slot)
+{
+    std::lock_guard<std::mutex> held(logLock);
+    for (unsigned i = 0; i < logSnapshots.size(); i++) {
+        if (logSnapshots[i].views > 0 && (slot == -1 || (unsigned)slot == i))
+            return true;
+    }
+    return false;
+}
+
+void
+Disk::cleanerLoop()
+{
+    std::unique_lock<std::mutex> wait(cleanerLock);
+    while (!cleanerStop) {
+        cleanerWake.wait_for(wait, std::chrono::milliseconds(LOG_CLEAN_INTERVAL_MS));
+        if (cleanerStop)
+            break;
+        wait.unlock();
+        {
+            std::lock_guard<std::mutex> held(logLock);
+            size_t free = segFree.size() + segDying.size();
+            if (free * 100 < (size_t)logSegments * LOG_CLEAN_FREE_PCT) {
+                cleaning = true;
+                for (unsigned n = 0; n < LOG_CLEAN_BATCH; n++) {
+                    unsigned victim = logVictim();
+                    if (victim == logSegments)
+                        break;
+                    logClean(victim);
+                }
+                cleaning = false;
+            }
+            // emptied segments can only be written again once the map is saved
+            if (!segDying.empty())
+                logSync();
+        }
+        wait.lock();
+    }
+}
+
+void
+Disk::stopCleaner()
+{
+    {
+        std::lock_guard<std::mutex> held(cleanerLock);
+        cleanerStop = true;
+    }
+    cleanerWake.notify_all();
+    if (cleaner.joinable())
+        cleaner.join();
+    cleanerStop = false;
+}
+
+//Points block at disk block p in the live map, copying the page first if a snapshot shares it
+void
+Disk::logSet(unsigned block_no, uint32_t p)
+{
+    MapPage& page = logMap.pages[block_no / logPerPage];
+    if (page.use_count() > 1) {
+        page = std::make_shared<std::vector<uint32_t>>(*page);
+        // the blocks of the page are held by one more page now
+        for (uint32_t q : *page) {
+            if (q != 0)
+                logRefs[q]++;
+        }
+    }
+    (*page)[block_no % logPerPage] = p;
+    logMap.dirty[block_no / logPerPage] = true;
+}
+
+//Drops a page holding disk block p, returns true if that was the last one
+bool
+Disk::logRelease(uint32_t p)
+{
+    if (--logRefs[p] > 0)
+        return false;
+    logOwner[p] = 0;
+    logHeld--;
+    unsigned seg = (p - 1) / LOG_SEGMENT_BLOCKS;
+    if (--segLive[seg] == 0 && seg != headSeg)
+        segDying.push_back(seg);
+    return true;
+}
+
+//Gives block a new disk block at the head of the log, returns it or 0 if the log is full
+unsigned
+Disk::logPlace(unsigned block_no)
+{
+    unsigned p = logAlloc();
+    if (p == 0)
+        return 0;
+    logKill(block_no);
+    logSet(block_no, p);
+    logOwner[p] = block_no;
+    logRefs[p] = 1;
+    segLive[(p - 1) / LOG_SEGMENT_BLOCKS]++;
+    logHeld++;
+    logMapped++;
+    return p;
+}
+
+//Forgets the disk block of block in the live map, returns true if no snapshot holds it
+bool
+Disk::logKill(unsigned block_no)
+{
+    uint32_t p = logGet(logMap, block_no);
+    if (p == 0)
+        return false;
+    logSet(block_no, 0);
+    logMapped--;
+    return logRelease(p);
+}
+
+//Moves disk block p to the head of the log in every map that holds it
+unsigned
+Disk::logMove(uint32_t p)
+{
+    unsigned q = logAlloc();
+    if (q == 0)
+        return 0;
+    unsigned b = logOwner[p];
+    unsigned page = b / logPerPage;
+    // a page shared by several maps is changed once for all of them
+    for (int slot = -1; slot < (int)logSnapshots.size(); slot++) {
+        LogMap& map = slot < 0 ? logMap : logSnapshots[slot];
+        if (slot >= 0 && !map.used)
+            continue;
+        uint32_t& entry = (*map.pages[page])[b % logPerPage];
+        if (entry == p || entry == q) {
+            entry = q;
+            map.dirty[page] = true;
+        }
+    }
+    logOwner[q] = b;
+    logRefs[q] = logRefs[p];
+    segLive[(q - 1) / LOG_SEGMENT_BLOCKS]++;
+    logHeld++;
+    logRefs[p] = 1;
+    logRelease(p);
+    return q;
+}
+
+//Next disk block at the head of the log, moving on to a free segment when it is full
+unsigned
+Disk::logAlloc()
+{
+    if (headUsed == LOG_SEGMENT_BLOCKS) {
+        if (segFree.size() <= LOG_RESERVE_SEGMENTS && !cleaning)
+            logMakeRoom();
+        // only the cleaner may use the reserve, it needs it to make room
+        if (segFree.size() <= (cleaning ? 0u : (unsigned)LOG_RESERVE_SEGMENTS))
+            return 0;
+        // the log moves on in disk order so it is written mostly sequentially
+        auto next = segFree.upper_bound(headSeg);
+        if (next == segFree.end())
+            next = segFree.begin();
+        unsigned old = headSeg;
+        headSeg = *next;
+        headUsed = 0;
+        segFree.erase(next);
+        if (old < logSegments && segLive[old] == 0)
+            segDying.push_back(old);
+    }
+    return 1 + headSeg * LOG_SEGMENT_BLOCKS + headUsed++;
+}
+
+//Segment with the fewest blocks in use that has some not in use, logSegments for none
+unsigned
+Disk::logVictim()
+{
+    unsigned victim = logSegments;
+    for (unsigned seg = 0; seg < logSegments; seg++) {
+        if (seg == headSeg || segLive[seg] == 0 || segLive[seg] == LOG_SEGMENT_BLOCKS)
+            continue;
+        if (victim == logSegments || segLive[seg] < segLive[victim])
+            victim = seg;
+    }
+    return victim;
+}
+
+//Moves the blocks in use of a segment to the head of the log, emptying it
+void
+Disk::logClean(unsigned seg)
+{
+    TRACE_SPAN("Disk::logClean", seg);
+    unsigned first = 1 + seg * LOG_SEGMENT_BLOCKS;
+    std::vector<uint8_t> data((size_t)LOG_SEGMENT_BLOCKS * block_size);
+    if (readRaw(first, LOG_SEGMENT_BLOCKS, data.data()) == -1)
+        return;
+    std::vector<uint8_t> run((size_t)LOG_SEGMENT_BLOCKS * block_size);
+    unsigned runStart = 0, runLength = 0, moved = 0;
+    for (unsigned i = 0; i < LOG_SEGMENT_BLOCKS; i++) {
+        if (logOwner[first + i] == 0)
+            continue;
+        // a run ends with the head segment
+        if (headUsed == LOG_SEGMENT_BLOCKS && runLength > 0) {
+            writeRaw(runStart, runLength, run.data());
+            runLength = 0;
+        }
+        unsigned p = logMove(first + i);
+        if (p == 0)
+            break;
+        if (runLength == 0)
+            runStart = p;
+        memcpy(run.data() + (size_t)runLength * block_size, data.data() + (size_t)i * block_size, block_size);
+        runLength++;
+        moved++;
+    }
+    if (runLength > 0)
+        writeRaw(runStart, runLength, run.data());
+    stats.segmentsCleaned.fetch_add(1, std::memory_order_relaxed);
+    stats.blocksCleaned.fetch_add(moved, std::memory_order_relaxed);
+}
+
+//Cleans until more than the reserve is free, when the log runs out of segments
+void
+Disk::logMakeRoom()
+{
+    logSync();
+    cleaning = true;
+    while (segFree.size() <= LOG_RESERVE_SEGMENTS) {
+        unsigned victim = logVictim();
+        if (victim == logSegments)
+            break;
+        logClean(victim);
+        logSync();
+    }
+    cleaning = false;
+}
+
+//Saves the changed pages of the maps and frees the segments emptied before
+void
+Disk::logSync()
+{
+    std::vector<uint8_t> buffer;
+    for (int slot = -1; slot < (int)logSnapshots.size(); slot++) {
+        LogMap& map = slot < 0 ? logMap : logSnapshots[slot];
+        if (slot >= 0 && !map.used)
+            continue;
+        unsigned count = map.dirty.size();
+        for (unsigned i = 0; i < count; ) {
+            if (!map.dirty[i]) {
+                i++;
+                continue;
+            }
+            unsigned j = i;
+            buffer.clear();
+            while (j < count && map.dirty[j]) {
+                map.dirty[j] = false;
+                uint8_t *page = (uint8_t*)map.pages[j]->data();
+                buffer.insert(buffer.end(), page, page + block_size);
+                j++;
+            }
+            writeRaw(map.start + i, j - i, buffer.data());
+            i = j;
+        }
+    }
+    for (unsigned seg : segDying) {
+        if (segLive[seg] != 0 || seg == headSeg)
+            continue;
+        segFree.insert(seg);
+        discardRaw(1 + seg * LOG_SEGMENT_BLOCKS, LOG_SEGMENT_BLOCKS);
+    }
+    segDying.clear();
+}
+
+// writes blocks to the head of the log, a run at a time
+int
+Disk::logWrite(unsigned block_no, unsigned count, uint8_t *blks)
+{
+    if (block_no >= logBlocks || count > logBlocks - block_no) {
+        std::cout << "Disk::write_blocks - ERROR: Invalid block range (" << block_no << ", " << count << ")\n";
+        return -1;
+    }
+    std::lock_guard<std::mutex> held(logLock);
+    unsigned runStart = 0, runBlock = 0, runLength = 0;
+    int result = 0;
+    for (unsigned i = 0; i < count; i++) {
+        unsigned b = block_no + i;
+        unsigned p = 0;
+        if (b != 0) {
+            // making room may clean the segment the run is in, it is written first
+            if (headUsed == LOG_SEGMENT_BLOCKS && runLength > 0) {
+                result |= writeRaw(runBlock, runLength, blks + (size_t)runStart * block_size);
+                runLength = 0;
+            }
+            p = logPlace(b);
+            if (p == 0) {
+                if (runLength > 0)
+                    writeRaw(runBlock, runLength, blks + (size_t)runStart * block_size);
+                std::cout << "Disk::write_blocks - ERROR: The log is full\n";
+                return -1;
+            }
+        }
+        if (runLength > 0 && p == runBlock + runLength) {
+            runLength++;
+            continue;
+        }
+        if (runLength > 0)
+            result |= writeRaw(runBlock, runLength, blks + (size_t)runStart * block_size);
+        runStart = i;
+        runBlock = p;
+        runLength = 1;
+    }
+    if (runLength > 0)
+        result |= writeRaw(runBlock, runLength, blks + (size_t)runStart * block_size);
+    return result;
+}
+
+// reads blocks through a map, a block never written reads as zeros
+int
+Disk::logRead(LogMap& map, unsigned block_no, unsigned count, uint8_t *blks)
+{
+    if (block_no >= logBlocks || count > logBlocks - block_no) {
+        std::cout << "Disk::read_blocks - ERROR: Invalid block range (" << block_no << ", " << count << ")\n";
+        return -1;
+    }
+    std::lock_guard<std::mutex> held(logLock);
+    unsigned runStart = 0, runBlock = 0, runLength = 0;
+    int result = 0;
+    for (unsigned i = 0; i < count; i++) {
+        unsigned b = block_no + i;
+        unsigned p = b == 0 ? 0 : logGet(map, b);
+        if (runLength > 0 && (b == 0 || p != 0) && p == runBlock + runLength) {
+            runLength++;
+            continue;
+        }
+        if (runLength > 0)
+            result |= readRaw(runBlock, runLength, blks + (size_t)runStart * block_size);
+        runLength = 0;
+        if (b != 0 && p == 0) {
+            memset(blks + (size_t)i * block_size, 0, block_size);
+            continue;
+        }
+        runStart = i;
+        runBlock = p;
+        runLength = 1;
+    }
+    if (runLength > 0)
+        result |= readRaw(runBlock, runLength, blks + (size_t)runStart * block_size);
+    return result;
+}
+
+// drops blocks from the live map and punches out the disk blocks no snapshot holds
+int
+Disk::logDiscard(unsigned block_no, unsigned count)
+{
+    if (block_no >= logBlocks || count > logBlocks - block_no) {
+        std::cout << "Disk::discard - ERROR: Invalid block range (" << block_no << ", " << count << ")\n";
+        return -1;
+    }
+    std::lock_guard<std::mutex> held(logLock);
+    for (unsigned b = std::max(block_no, 1u); b < block_no + count; b++) {
+        uint32_t p = logGet(logMap, b);
+        if (p != 0 && logKill(b))
+            discardRaw(p, 1);
+    }
+    return 0;
 }
 
 bool
@@ -41,10 +873,30 @@ Disk::write(unsigned block_no, uint8_t *blk)
         std::cout << "Disk::write - ERROR: Invalid block number (" << block_no << ")\n";
         return -1;
     }
-    unsigned offset = block_no * BLOCK_SIZE;
+    if (base) {
+        std::cout << "Disk::write - ERROR: The disk is a read-only snapshot\n";
+        return -1;
+    }
+    if (is_log())
+        return logWrite(block_no, 1, blk);
+    TRACE_SPAN("Disk::write", block_no);
+    ScopeTimer timer(stats.writeLatency);
+    stats.writes.fetch_add(1, std::memory_order_relaxed);
+    stats.bytesWritten.fetch_add(block_size, std::memory_order_relaxed);
+    stats.flushes.fetch_add(1, std::memory_order_relaxed);
+    logAccess(IO_WRITE, block_no, 1);
+    if (device.active())
+        device.access(IO_WRITE, block_no, 1, block_size, no_blocks);
+    std::streamoff offset = (std::streamoff)block_no * block_size;
     diskfile.seekp(offset, std::ios_base::beg);
-    diskfile.write((char*)blk, BLOCK_SIZE);
+    diskfile.write((char*)blk, block_size);
     diskfile.flush();
+    if (!diskfile) {
+        diskfile.clear();
+        std::cout << "Disk::write - ERROR: Can't write block " << block_no << "\n";
+        return -1;
+    }
+    updateChecksums(block_no, 1, blk);
     return 0;
 }
 
@@ -59,8 +911,172 @@ Disk::read(unsigned block_no, uint8_t *blk)
         std::cout << "Disk::write - ERROR: Invalid block number (" << block_no << ")\n";
         return -1;
     }
-    unsigned offset = block_no * BLOCK_SIZE;
+    if (base)
+        return base->logRead(base->logSnapshots[baseSlot], block_no, 1, blk);
+    if (is_log())
+        return logRead(logMap, block_no, 1, blk);
+    TRACE_SPAN("Disk::read", block_no);
+    ScopeTimer timer(stats.readLatency);
+    stats.reads.fetch_add(1, std::memory_order_relaxed);
+    stats.bytesRead.fetch_add(block_size, std::memory_order_relaxed);
+    logAccess(IO_READ, block_no, 1);
+    if (device.active())
+        device.access(IO_READ, block_no, 1, block_size, no_blocks);
+    std::streamoff offset = (std::streamoff)block_no * block_size;
+    diskfile.seekg(offset, std::ios_base::beg);
+    diskfile.read((char*)blk, block_size);
+    if (verifyChecksums(block_no, 1, blk) != -1) {
+        stats.checksumErrors.fetch_add(1, std::memory_order_relaxed);
+        std::cout << "Disk::read - ERROR: Checksum mismatch in block " << block_no << "\n";
+        return -1;
+    }
+    return 0;
+}
+
+// writes count consecutive blocks starting at block_no with one seek and flush
+int
+Disk::write_blocks(unsigned block_no, unsigned count, uint8_t *blks)
+{
+    if (DEBUG)
+        std::cout << "Disk::write_blocks(" << block_no << ", " << count << ")\n";
+    // check if valid block range
+    if (block_no >= no_blocks || count > no_blocks - block_no) {
+        std::cout << "Disk::write_blocks - ERROR: Invalid block range (" << block_no << ", " << count << ")\n";
+        return -1;
+    }
+    if (base) {
+        std::cout << "Disk::write_blocks - ERROR: The disk is a read-only snapshot\n";
+        return -1;
+    }
+    if (is_log())
+        return logWrite(block_no, count, blks);
+    return writeRaw(block_no, count, blks);
+}
+
+int
+Disk::writeRaw(unsigned block_no, unsigned count, uint8_t *blks)
+{
+    TRACE_SPAN("Disk::write_blocks", block_no);
+    ScopeTimer timer(stats.writeLatency);
+    stats.writes.fetch_add(1, std::memory_order_relaxed);
+    stats.bytesWritten.fetch_add((uint64_t)count * block_size, std::memory_order_relaxed);
+    stats.flushes.fetch_add(1, std::memory_order_relaxed);
+    logAccess(IO_WRITE, block_no, count);
+    if (device.active())
+        device.access(IO_WRITE, block_no, count, block_size, no_blocks);
+    std::streamoff offset = (std::streamoff)block_no * block_size;
+    diskfile.seekp(offset, std::ios_base::beg);
+    diskfile.write((char*)blks, (std::streamsize)count * block_size);
+    diskfile.flush();
+    // the host file system refused it, the stream is cleared for the next request
+    if (!diskfile) {
+        diskfile.clear();
+        std::cout << "Disk::write_blocks - ERROR: Can't write blocks " << block_no << " to "
+                  << block_no + count - 1 << "\n";
+        return -1;
+    }
+    updateChecksums(block_no, count, blks);
+    return 0;
+}
+
+// reads count consecutive blocks starting at block_no
+int
+Disk::read_blocks(unsigned block_no, unsigned count, uint8_t *blks)
+{
+    if (DEBUG)
+        std::cout << "Disk::read_blocks(" << block_no << ", " << count << ")\n";
+    // check if valid block range
+    if (block_no >= no_blocks || count > no_blocks - block_no) {
+        std::cout << "Disk::read_blocks - ERROR: Invalid block range (" << block_no << ", " << count << ")\n";
+        return -1;
+    }
+    if (base)
+        return base->logRead(base->logSnapshots[baseSlot], block_no, count, blks);
+    if (is_log())
+        return logRead(logMap, block_no, count, blks);
+    return readRaw(block_no, count, blks);
+}
+
+int
+Disk::readRaw(unsigned block_no, unsigned count, uint8_t *blks)
+{
+    TRACE_SPAN("Disk::read_blocks", block_no);
+    ScopeTimer timer(stats.readLatency);
+    stats.reads.fetch_add(1, std::memory_order_relaxed);
+    stats.bytesRead.fetch_add((uint64_t)count * block_size, std::memory_order_relaxed);
+    logAccess(IO_READ, block_no, count);
+    if (device.active())
+        device.access(IO_READ, block_no, count, block_size, no_blocks);
+    std::streamoff offset = (std::streamoff)block_no * block_size;
     diskfile.seekg(offset, std::ios_base::beg);
-    diskfile.read((char*)blk, BLOCK_SIZE);
+    diskfile.read((char*)blks, (std::streamsize)count * block_size);
+    long bad = verifyChecksums(block_no, count, blks);
+    if (bad != -1) {
+        stats.checksumErrors.fetch_add(1, std::memory_order_relaxed);
+        std::cout << "Disk::read_blocks - ERROR: Checksum mismatch in block " << bad << "\n";
+        return -1;
+    }
     return 0;
 }
+
+// punches a hole in the disk file over count blocks starting at block_no
+int
+Disk::discard(unsigned block_no, unsigned count)
+{
+    if (DEBUG)
+        std::cout << "Disk::discard(" << block_no << ", " << count << ")\n";
+    // check if valid block range
+    if (block_no >= no_blocks || count > no_blocks - block_no) {
+        std::cout << "Disk::discard - ERROR: Invalid block range (" << block_no << ", " << count << ")\n";
+        return -1;
+    }
+    if (base)
+        return -1;
+    if (is_log())
+        return logDiscard(block_no, count);
+    return discardRaw(block_no, count);
+}
+
+int
+Disk::discardRaw(unsigned block_no, unsigned count)
+{
+    if (!punching.load(std::memory_order_relaxed) || holeFd == -1)
+        return -1;
+    TRACE_SPAN("Disk::discard", block_no);
+#ifdef FALLOC_FL_PUNCH_HOLE
+    off_t offset = (off_t)block_no * block_size;
+    off_t length = (off_t)count * block_size;
+    if (fallocate(holeFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == -1) {
+        if (errno == EOPNOTSUPP || errno == ENOSYS)
+            punching = false;
+        return -1;
+    }
+    stats.discards.fetch_add(1, std::memory_order_relaxed);
+    stats.bytesDiscarded.fetch_add(length, std::memory_order_relaxed);
+    // a hole reads as zeros, whatever checksum the block had no longer holds
+    if (csumBlocks.load(std::memory_order_relaxed) > 0) {
+        unsigned perBlock = block_size / sizeof(uint32_t);
+        std::lock_guard<std::mutex> held(csumLock);
+        for (unsigned b = block_no; b < block_no + count; b++) {
+            if (checksummed(b) && b < csums.size() && csums[b] != 0) {
+                csums[b] = 0;
+                csumDirty[b / perBlock] = true;
+            }
+        }
+    }
+    return 0;
+#else
+    punching = false;
+    return -1;
+#endif
+}
+
+// bytes of the disk file the host has space allocated for
+uint64_t
+Disk::get_host_bytes()
+{
+    struct stat st;
+    if (holeFd == -1 || fstat(holeFd, &st) == -1)
+        return get_disk_size();
+    return (uint64_t)st.st_blocks * 512;
+}
@@ -1,28 +1,239 @@
 #include <iostream>
 #include <fstream>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+#include "stats.h"
+#include "trace.h"
+#include "iotrace.h"
+#include "device.h"
+#include "crc32c.h"
 
 #ifndef __DISK_H__
 #define __DISK_H__
 
 #define DISKNAME "diskfile.bin"
-#define BLOCK_SIZE 4096
+#define BLOCK_SIZE 4096 // block size of a newly created disk
+#define NO_BLOCKS 2048 // number of blocks of a newly created disk
+#define MIN_BLOCK_SIZE 1024
+#define MAX_BLOCK_SIZE 65536
 #define DEBUG false
+#define LOG_SEGMENT_BLOCKS 64 // a log-structured disk is written and cleaned a segment at a time
+#define LOG_SLACK_PCT 20 // share of the log the file system can not fill, room for the cleaner to work
+#define LOG_RESERVE_SEGMENTS 2 // free segments only the cleaner may write to
+#define LOG_CLEAN_FREE_PCT 25 // the cleaner works while fewer segments than this are free
+#define LOG_CLEAN_INTERVAL_MS 100 // how often the cleaner wakes up
+#define LOG_CLEAN_BATCH 4 // segments cleaned each time it does
+#define LOG_SNAPSHOTS 4 // snapshots a log-structured disk keeps room for the maps of
 
 class Disk {
 private:
     std::fstream diskfile;
-    const unsigned no_blocks = 2048;
-    const unsigned disk_size = BLOCK_SIZE * no_blocks;
+    std::string name;
+    unsigned no_blocks;
+    unsigned block_size;
+    DiskStats stats;
     bool disk_file_exists (const std::string& name);
+
+    // block I/O trace, see start_recording()
+    std::atomic<bool> recording{false};
+    std::mutex recordLock;
+    std::ofstream recordFile;
+    std::vector<iotrace_record> recordBuffer;
+    std::chrono::steady_clock::time_point recordStart;
+    void logAccess(uint8_t op, unsigned block_no, unsigned count);
+    void flushRecords();
+
+    // simulated device the requests are delayed or accounted by
+    DeviceModel device;
+
+    // second handle on the disk file for punching holes, see discard()
+    int holeFd = -1;
+    std::atomic<bool> punching{true}; // cleared when the host file system can not punch holes
+
+    // CRC32C of every block, kept in memory and saved in a region of the
+    // disk itself, see set_checksums()
+    std::mutex csumLock;
+    unsigned csumStart = 0; // first block of the region
+    std::atomic<unsigned> csumBlocks{0}; // blocks of the region, 0 while checksums are off
+    std::vector<uint32_t> csums; // 0 where the block was not written since they were cleared
+    std::vector<bool> csumDirty; // region blocks changed since take_checksums()
+    bool checksummed(unsigned block_no) { return block_no - csumStart >= csumBlocks; }
+    void updateChecksums(unsigned block_no, unsigned count, const uint8_t *blks);
+    //Returns the first block that does not match its checksum, or -1
+    long verifyChecksums(unsigned block_no, unsigned count, const uint8_t *blks);
+
+    // log-structured layout, see set_log(). Block 0 stays where it is, every
+    // other block is written to the head of the log and found through the map
+    std::mutex logLock; // held around every access to the disk file while it is a log
+    std::atomic<unsigned> logBlocks{0}; // blocks the file system sees, 0 while blocks are written in place
+    unsigned logSegments = 0; // the log runs from block 1 up to the map
+    unsigned logPerPage = 0; // entries in a block of the map
+    // A map is kept a block of its region at a time. A snapshot shares the pages
+    // of the live map, the live map copies a page before it changes it
+    typedef std::shared_ptr<std::vector<uint32_t>> MapPage;
+    struct LogMap {
+        std::vector<MapPage> pages; // disk block of every block, 0 for one never written
+        std::vector<bool> dirty; // pages changed since they were saved
+        unsigned start = 0; // region it is saved in
+        bool used = false; // a snapshot slot holds a map
+        unsigned views = 0; // disks reading the snapshot, see Disk(Disk&, unsigned)
+    };
+    LogMap logMap; // the live map
+    std::vector<LogMap> logSnapshots; // slots for the maps of snapshots, after the live map
+    std::vector<uint32_t> logOwner; // block held by every disk block of the log, 0 for none
+    std::vector<uint8_t> logRefs; // pages holding every disk block, it is free at 0
+    unsigned long logHeld = 0; // disk blocks held by any map
+    unsigned long logMapped = 0; // blocks the live map holds a disk block for
+    std::vector<unsigned> segLive; // blocks still in use in every segment
+    std::set<unsigned> segFree; // segments that can be written
+    std::vector<unsigned> segDying; // emptied since the map was saved, free once it is
+    unsigned headSeg = 0; // segment the log is written to, logSegments for none
+    unsigned headUsed = 0; // blocks of it written
+    bool cleaning = false; // the cleaner is moving blocks, it may use the reserve
+    std::thread cleaner;
+    std::mutex cleanerLock; // guards cleanerStop
+    std::condition_variable cleanerWake;
+    bool cleanerStop = false;
+    // a view reads a snapshot of base and can not be written
+    Disk* base = nullptr;
+    unsigned baseSlot = 0;
+    void cleanerLoop();
+    void stopCleaner();
+    uint32_t logGet(LogMap& map, unsigned block_no) { return (*map.pages[block_no / logPerPage])[block_no % logPerPage]; }
+    //Points block at disk block p in the live map, copying the page first if a snapshot shares it
+    void logSet(unsigned block_no, uint32_t p);
+    //Reads a map from its region, or starts it out empty, and counts the blocks
+    //it holds. A page the same as that of the live map shares it
+    void logLoad(LogMap& map, unsigned count, bool load);
+    //Drops a page holding disk block p, returns true if that was the last one
+    bool logRelease(uint32_t p);
+    //Gives block a new disk block at the head of the log, returns it or 0 if the log is full
+    unsigned logPlace(unsigned block_no);
+    //Forgets the disk block of block in the live map, returns true if no snapshot holds it
+    bool logKill(unsigned block_no);
+    //Moves disk block p to the head of the log in every map that holds it,
+    //returns where it went or 0 if the log is full
+    unsigned logMove(uint32_t p);
+    //Next disk block at the head of the log, moving on to a free segment when it is
+    //full. Returns 0 if there is none
+    unsigned logAlloc();
+    //Segment with the fewest blocks in use that has some not in use, logSegments for none
+    unsigned logVictim();
+    //Moves the blocks in use of a segment to the head of the log, emptying it
+    void logClean(unsigned seg);
+    //Cleans until more than the reserve is free, when the log runs out of segments
+    void logMakeRoom();
+    //Saves the changed pages of the maps and frees the segments emptied before
+    void logSync();
+    int logWrite(unsigned block_no, unsigned count, uint8_t *blks);
+    int logRead(LogMap& map, unsigned block_no, unsigned count, uint8_t *blks);
+    int logDiscard(unsigned block_no, unsigned count);
+    //Requests on blocks of the disk file as they are, see write_blocks()
+    int writeRaw(unsigned block_no, unsigned count, uint8_t *blks);
+    int readRaw(unsigned block_no, unsigned count, uint8_t *blks);
+    int discardRaw(unsigned block_no, unsigned count);
 public:
-    Disk();
+    Disk(const std::string& name = DISKNAME, unsigned no_blocks = NO_BLOCKS, unsigned block_size = BLOCK_SIZE);
+    // a view of snapshot slot of the log-structured disk base, reads go through
+    // the map of the snapshot and writes fail
+    Disk(Disk& base, unsigned slot);
     ~Disk();
     unsigned get_no_blocks() { return no_blocks; }
-    unsigned get_disk_size() { return disk_size; }
+    unsigned get_block_size() { return block_size; }
+    uint64_t get_disk_size() { return (uint64_t)block_size * no_blocks; }
+    const std::string& get_name() { return name; }
+    // request counts and latencies of this disk
+    DiskStats& get_stats() { return stats; }
+    // true if block_size is a power of two between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE
+    static bool valid_block_size(unsigned block_size);
+    // reads the disk file with another geometry, the file is not changed
+    void set_geometry(unsigned no_blocks, unsigned block_size);
+    // changes the geometry and grows or shrinks the disk file to match
+    int resize(unsigned no_blocks, unsigned block_size);
+    // logs every request that reaches the disk to a binary trace file at path,
+    // see iotrace.h for the format and replay.cpp for a tool that replays it
+    int start_recording(const std::string& path);
+    void stop_recording();
+    bool is_recording() { return recording.load(std::memory_order_relaxed); }
+    // the simulated device latency model, off unless a profile is set
+    DeviceModel& get_device() { return device; }
+    // blocks a region needs to hold a checksum of each of no_blocks blocks
+    static unsigned checksum_blocks(unsigned no_blocks, unsigned block_size);
+    // keeps a checksum of every block outside the count blocks at start, computed
+    // on every write and verified on every read, a read that fails it returns -1.
+    // region holds the checksums saved there before, without it they start out
+    // unknown. count 0 turns checksums off.
+    void set_checksums(unsigned start, unsigned count, const uint8_t *region = nullptr);
+    bool has_checksums() { return csumBlocks > 0; }
+    // hands out the region blocks whose checksums changed so they can be
+    // written, returns the number of blocks
+    unsigned take_checksums(std::vector<unsigned>& block_nos, std::vector<uint8_t>& data);
+    // hands the region blocks out again with the next take_checksums(), writing
+    // them failed
+    void retake_checksums(const std::vector<unsigned>& block_nos);
+    // forgets the checksums of the count blocks at block_no that blks changes,
+    // the region is written with them unknown before blks so a crash in between
+    // leaves the blocks unverified instead of failing their old checksums
+    void forget_checksums(unsigned block_no, unsigned count, const uint8_t *blks);
+    // blocks a region needs to hold the map of a log of no_blocks blocks
+    static unsigned log_map_blocks(unsigned no_blocks, unsigned block_size);
+    // blocks a log-structured disk of no_blocks blocks has for the file system,
+    // the rest holds the maps and gives the cleaner room
+    static unsigned log_capacity(unsigned no_blocks, unsigned block_size);
+    // makes the disk a log of logical blocks: every block but block 0 is written to
+    // the head of a log of segments from block 1 up to start, and read back through
+    // a map saved in the count blocks at start. slots snapshot maps of count blocks
+    // each follow it, those set in the mask used hold one. With load the maps saved
+    // there are read, otherwise the log starts out empty. count 0 writes blocks in
+    // place again. A thread cleans segments in the background while few are free
+    void set_log(unsigned start, unsigned count, unsigned logical, bool load,
+        unsigned slots = 0, unsigned used = 0);
+    bool is_log() { return logBlocks.load(std::memory_order_relaxed) > 0; }
+    // saves the part of the map changed by the writes so far, the blocks they
+    // replaced can then be written over
+    void sync_log();
+    // free and total segments of the log
+    void get_log_segments(unsigned& free, unsigned& total);
+    // makes snapshot slot share the live map as it is and saves it, the blocks
+    // it holds are kept until it is dropped. Copies the page table and writes
+    // every page of the map, O(blocks of the disk). Returns -1 if the slot is taken
+    int take_snapshot(unsigned slot);
+    // forgets snapshot slot, the blocks only it held are freed. Returns -1 while
+    // a view reads it
+    int drop_snapshot(unsigned slot);
+    // blocks held by snapshot slot and by no other map, the space it costs
+    unsigned long snapshot_blocks(unsigned slot);
+    // disk blocks held by snapshots and not by the live map, the room the
+    // file system can not use until they are deleted
+    unsigned long log_pinned();
+    // true if a snapshot slot holds a map
+    bool has_snapshots();
+    // true while a view reads snapshot slot, any snapshot for -1
+    bool has_views(int slot = -1);
     // writes one block to the disk
     int write(unsigned block_no, uint8_t *blk);
     // reads one block from the disk
     int read(unsigned block_no, uint8_t *blk);
+    // writes count consecutive blocks starting at block_no with one seek and flush
+    int write_blocks(unsigned block_no, unsigned count, uint8_t *blks);
+    // reads count consecutive blocks starting at block_no
+    int read_blocks(unsigned block_no, unsigned count, uint8_t *blks);
+    // punches a hole in the disk file over count blocks starting at block_no,
+    // the host frees their space and they read as zeros. Their checksums are
+    // forgotten. Returns -1 if the host file system can not punch holes. A
+    // log-structured disk always forgets the blocks, see set_log()
+    int discard(unsigned block_no, unsigned count);
+    bool can_discard() { return !base && (is_log() || punching.load(std::memory_order_relaxed)); }
+    // bytes of the disk file the host has space allocated for
+    uint64_t get_host_bytes();
 };
 
 #endif // __DISK_H__
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include "fat.h"
+
+Fat::Fat(BlockCache& cache) : cache(cache)
+{
+}
+
+void Fat::mount(unsigned start, unsigned entries, unsigned firstData)
+{
+    this->start = start;
+    this->entries = entries;
+    this->perBlock = cache.get_block_size() / sizeof(int32_t);
+    this->freeHint = firstData;
+    this->firstData = firstData;
+    pages.clear();
+    freed.clear();
+    freeCount = -1;
+    reserved = 0;
+}
+
+unsigned Fat::blocksNeeded(unsigned entries, unsigned block_size)
+{
+    unsigned perBlock = block_size / sizeof(int32_t);
+    return (entries + perBlock - 1) / perBlock;
+}
+
+void Fat::clear()
+{
+    pages.clear();
+    freeCount = -1;
+    std::vector<uint8_t> empty(cache.get_block_size(), 0);
+    for (unsigned i = 0; i < blocks(); i++)
+    {
+        cache.write(start + i, empty.data());
+    }
+}
+
+Fat::Page* Fat::page(unsigned index)
+{
+    unsigned pageNo = index / perBlock;
+    auto found = pages.find(pageNo);
+    if (found != pages.end())
+    {
+        found->second.used = ++clock;
+        return &found->second;
+    }
+
+    //Makes room by handing the least recently used page back to the cache
+    if (pages.size() >= FAT_PAGES)
+    {
+        auto oldest = pages.begin();
+        for (auto it = pages.begin(); it != pages.end(); ++it)
+        {
+            if (it->second.used < oldest->second.used)
+            {
+                oldest = it;
+            }
+        }
+        writePage(oldest->first, oldest->second);
+        pages.erase(oldest);
+    }
+
+    TRACE_SPAN("Fat::loadPage", pageNo);
+    Page& p = pages[pageNo];
+    p.entries.resize(perBlock);
+    if (cache.read(start + pageNo, (uint8_t*)p.entries.data()) == -1)
+    {
+        //Not kept, the next use tries the disk again
+        pages.erase(pageNo);
+        std::cout << "Fat - ERROR: Can't read FAT block " << start + pageNo << "\n";
+        return nullptr;
+    }
+    p.used = ++clock;
+    return &p;
+}
+
+void Fat::writePage(unsigned pageNo, Page& p)
+{
+    if (p.dirty)
+    {
+        cache.write(start + pageNo, (uint8_t*)p.entries.data());
+        p.dirty = false;
+    }
+}
+
+int32_t Fat::get(unsigned index)
+{
+    if (index >= entries)
+    {
+        std::cout << "Fat::get - ERROR: Invalid index (" << index << ")\n";
+        return FAT_EOF;
+    }
+    Page* p = page(index);
+    return p ? p->entries[index % perBlock] : FAT_EOF;
+}
+
+int Fat::set(unsigned index, int32_t value)
+{
+    if (index >= entries)
+    {
+        std::cout << "Fat::set - ERROR: Invalid index (" << index << ")\n";
+        return -1;
+    }
+    Page* found = page(index);
+    if (!found)
+    {
+        return -1;
+    }
+    Page& p = *found;
+    int32_t old = p.entries[index % perBlock];
+    if (value == FAT_FREE && old != FAT_FREE)
+    {
+        freed.push_back(index);
+    }
+    if (freeCount >= 0 && index >= firstData && (old == FAT_FREE) != (value == FAT_FREE))
+    {
+        freeCount += value == FAT_FREE ? 1 : -1;
+    }
+    p.entries[index % perBlock] = value;
+    p.dirty = true;
+    if (value == FAT_FREE && index < freeHint)
+    {
+        freeHint = index;
+    }
+    return 0;
+}
+
+// returns the first free entry, or FAT_EOF if the disk is full
+int Fat::findFree()
+{
+    TRACE_SPAN("Fat::findFree");
+    if (reserved + pinned > 0 && available() == 0)
+    {
+        return FAT_EOF;
+    }
+    unsigned i = freeHint;
+    bool skipped = false;
+    while (i < entries)
+    {
+        //Scans a whole FAT block at a time, one that can not be read is skipped
+        Page* p = page(i);
+        unsigned end = std::min(entries, (unsigned)((i / perBlock + 1) * perBlock));
+        skipped = skipped || !p;
+        for (; i < end && p; i++)
+        {
+            if (p->entries[i % perBlock] == FAT_FREE)
+            {
+                freeHint = i;
+                return i;
+            }
+        }
+        i = end;
+    }
+    if (!skipped)
+    {
+        freeHint = entries;
+    }
+    return FAT_EOF;
+}
+
+// returns the first of count consecutive free entries, or FAT_EOF if there is no such run
+int Fat::findFreeRun(unsigned count)
+{
+    TRACE_SPAN("Fat::findFreeRun");
+    if (reserved + pinned > 0 && available() < count)
+    {
+        return FAT_EOF;
+    }
+    unsigned run = 0;
+    for (unsigned i = std::max(freeHint, firstData); i < entries;)
+    {
+        //A FAT block that can not be read has no free entries
+        Page* p = page(i);
+        unsigned end = std::min(entries, (unsigned)((i / perBlock + 1) * perBlock));
+        for (; i < end; i++)
+        {
+            run = p && p->entries[i % perBlock] == FAT_FREE ? run + 1 : 0;
+            if (run == count)
+            {
+                return i + 1 - count;
+            }
+        }
+    }
+    return FAT_EOF;
+}
+
+unsigned long Fat::available()
+{
+    long count = freeCount;
+    if (count < 0)
+    {
+        //Counted once, set() keeps it up to date from then on. A FAT block
+        //that can not be read counts as full and the count is not kept
+        count = 0;
+        bool complete = true;
+        for (unsigned i = firstData; i < entries;)
+        {
+            Page* p = page(i);
+            unsigned end = std::min(entries, (unsigned)((i / perBlock + 1) * perBlock));
+            complete = complete && p;
+            for (; i < end && p; i++)
+            {
+                count += p->entries[i % perBlock] == FAT_FREE;
+            }
+            i = end;
+        }
+        freeCount = complete ? count : -1;
+    }
+    return (unsigned long)count > reserved + pinned ? count - reserved - pinned : 0;
+}
+
+bool Fat::reserve(unsigned long count)
+{
+    if (available() < count)
+    {
+        return false;
+    }
+    reserved += count;
+    return true;
+}
+
+void Fat::unreserve(unsigned long count)
+{
+    reserved -= std::min(reserved, count);
+}
+
+// writes changed FAT blocks to the cache
+void Fat::flush()
+{
+    for (auto& entry : pages)
+    {
+        writePage(entry.first, entry.second);
+    }
+    if (!freed.empty())
+    {
+        //A block handed out again since it was freed holds data by now
+        std::vector<unsigned> still;
+        for (unsigned index : freed)
+        {
+            if (get(index) == FAT_FREE)
+            {
+                still.push_back(index);
+            }
+        }
+        freed.clear();
+        cache.discard(still);
+    }
+}
@@ -0,0 +1,78 @@
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include "cache.h"
+
+#ifndef __FAT_H__
+#define __FAT_H__
+
+#define FAT_FREE 0
+#define FAT_EOF -1
+
+#define FAT_PAGES 16 // FAT blocks kept decoded in memory
+
+// The FAT with one 32-bit entry per disk block, spread over as many blocks
+// as needed. A FAT block is only read once an entry in it is used, and goes
+// back to the block cache when it is evicted or flushed.
+class Fat {
+private:
+    struct Page {
+        std::vector<int32_t> entries;
+        bool dirty = false;
+        unsigned long used = 0;
+    };
+
+    BlockCache& cache;
+    unsigned start = 0; // first block of the FAT on the disk
+    unsigned entries = 0; // one entry per disk block
+    unsigned perBlock = 0; // entries in one FAT block
+    std::unordered_map<unsigned, Page> pages;
+    unsigned long clock = 0;
+    unsigned freeHint = 0; // no free entry below this one
+    unsigned firstData = 0; // entries below belong to the super block, root and FAT
+    std::vector<unsigned> freed; // entries set free since the last flush, see BlockCache::discard()
+    long freeCount = -1; // free data entries, -1 until it is first needed
+    unsigned long reserved = 0; // free entries set aside by reserve()
+    unsigned long pinned = 0; // free entries the disk has no room for, see pin()
+
+    //Returns the page holding entry index, reading it in if needed, or
+    //nullptr if it can not be read
+    Page* page(unsigned index);
+    void writePage(unsigned pageNo, Page& p);
+
+public:
+    Fat(BlockCache& cache);
+    // uses the FAT starting at block start with one entry per block,
+    // the block size is taken from the cache
+    void mount(unsigned start, unsigned entries, unsigned firstData);
+    // number of FAT blocks needed for entries blocks of block_size bytes
+    static unsigned blocksNeeded(unsigned entries, unsigned block_size);
+    // fills the FAT blocks with free entries
+    void clear();
+    // returns FAT_EOF if the FAT block of the entry can not be read
+    int32_t get(unsigned index);
+    // returns -1 if the FAT block of the entry can not be read, it is not changed
+    int set(unsigned index, int32_t value);
+    // returns the first free entry, or FAT_EOF if the disk is full
+    int findFree();
+    // returns the first of count consecutive free entries, or FAT_EOF if there is no such run
+    int findFreeRun(unsigned count);
+    // free entries that are not reserved or pinned
+    unsigned long available();
+    // sets count free entries aside for data whose blocks are picked later,
+    // findFree() and findFreeRun() leave them to it. Returns false if there are
+    // not that many
+    bool reserve(unsigned long count);
+    // hands reserved entries back, just before they are allocated
+    void unreserve(unsigned long count);
+    // keeps count free entries from being allocated, the blocks old data of a
+    // log-structured disk is kept in for its snapshots
+    void pin(unsigned long count) { pinned = count; }
+    // writes changed FAT blocks to the cache and hands the blocks freed since
+    // the last flush to the cache to discard
+    void flush();
+    unsigned size() { return entries; }
+    unsigned blocks() { return (entries + perBlock - 1) / perBlock; }
+};
+
+#endif // __FAT_H__
@@ -1,11 +1,57 @@
 #include <iostream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
 #include "fs.h"
+#include "check.h"
+#include "compress.h"
 
-void FS::readDirBlock(int block, dir_entry *in, int& numbBlocks)
+//True if length bytes from data are all zero
+static bool allZero(const char *data, size_t length)
 {
-    disk.read(block, (uint8_t*) in);
+    return length == 0 || (data[0] == 0 && memcmp(data, data + 1, length - 1) == 0);
+}
+
+//True if a whole block of text is zeros, so it can be a hole
+static bool zeroBlock(const std::string& text, size_t blockSize)
+{
+    for (size_t at = 0; at + blockSize <= text.size(); at += blockSize)
+    {
+        if (allZero(text.data() + at, blockSize))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int FS::readDir(int block, std::vector<dir_entry>& dir)
+{
+    std::vector<uint8_t> buffer(blockSize);
+    if (cache.read(block, buffer.data()) == -1)
+    {
+        //Left empty, so nothing is found in it
+        std::cout << "ERROR: Can't read directory block " << block << "\n";
+        for (int i = 0; i < dirEntries; i++)
+        {
+            memset(&dir[i], 0, sizeof(dir_entry));
+            dir[i].type = TYPE_EMPTY;
+        }
+        return -1;
+    }
+    memcpy(dir.data(), buffer.data(), dirEntries * sizeof(dir_entry));
+    return 0;
+}
 
-    for (int i = 0; i < 64; i++)
+void FS::readDirBlock(int block, std::vector<dir_entry>& in, int& numbBlocks)
+{
+    readDir(block, in);
+
+    for (int i = 0; i < dirEntries; i++)
     {
         if(in[i].type != TYPE_EMPTY)
         {
@@ -14,55 +60,336 @@ void FS::readDirBlock(int block, dir_entry *in, int& numbBlocks)
     }
 }
 
-void FS::writeDirToDisk(int block, dir_entry *in)
+void FS::writeDirToDisk(int block, std::vector<dir_entry>& in)
+{
+    //The entries do not fill the block exactly, the rest is left zero
+    std::vector<uint8_t> buffer(blockSize, 0);
+    memcpy(buffer.data(), in.data(), dirEntries * sizeof(dir_entry));
+    cache.write(block, buffer.data());
+}
+
+void FS::freeChain(int block)
+{
+    TRACE_SPAN("FS::freeChain");
+    int next;
+    bool counted = !dedup.refs.empty();
+    while (block != FAT_EOF)
+    {
+        next = fat.get(block);
+        if (counted)
+        {
+            //A block another chain still leads to stays, and so does the rest of the chain
+            if (dedup.refs[block] > 1)
+            {
+                dedup.refs[block]--;
+                break;
+            }
+            dedup.refs[block] = 0;
+            auto indexed = dedup.index.find({dedup.prints[block], next});
+            if (indexed != dedup.index.end() && indexed->second == (unsigned)block)
+            {
+                dedup.index.erase(indexed);
+            }
+        }
+        fat.set(block, FAT_FREE);
+        block = next;
+    }
+}
+
+void FS::freeFile(const dir_entry& entry)
 {
-    disk.write(block, (uint8_t*)in);
+    if (entry.flags & FLAG_DELAYED)
+    {
+        //It never got blocks, only its reservation goes
+        auto file = delay.files.find(entry.first_blk);
+        if (file != delay.files.end())
+        {
+            fat.unreserve(file->second.blocks);
+            delay.blocks -= file->second.blocks;
+            delay.files.erase(file);
+        }
+        return;
+    }
+    if (entry.flags & FLAG_SPARSE)
+    {
+        std::vector<int> maps, blocks;
+        chainOf(entry.first_blk, maps);
+        blocksOf(entry, blocks);
+        for (size_t i = maps.size(); i < blocks.size(); i++)
+        {
+            fat.set(blocks[i], FAT_FREE);
+        }
+        freeChain(entry.first_blk);
+        return;
+    }
+    if (!(entry.flags & FLAG_PACKED))
+    {
+        freeChain(entry.first_blk);
+        return;
+    }
+    auto shared = pack.blocks.find(entry.first_blk);
+    if (shared == pack.blocks.end())
+    {
+        return;
+    }
+    unsigned start = entry.flags >> PACK_SHIFT;
+    unsigned units = std::max(1u, (entry.size + PACK_UNIT - 1) / PACK_UNIT);
+    for (unsigned u = start; u < start + units && u < shared->second.taken.size(); u++)
+    {
+        if (shared->second.taken[u])
+        {
+            shared->second.taken[u] = false;
+            shared->second.free++;
+        }
+    }
+    //The last file out frees the block
+    if (shared->second.free == shared->second.taken.size())
+    {
+        fat.set(shared->first, FAT_FREE);
+        pack.blocks.erase(shared);
+    }
 }
 
-void FS::makeDirBlock(dir_entry *in, int numbBlocks, int startIndex)
+void FS::makeDirBlock(std::vector<dir_entry>& in, int startIndex)
 {
-    for (int i = startIndex; i < numbBlocks; i++)
+    for (int i = startIndex; i < (int)in.size(); i++)
     {
         in[i].type = TYPE_EMPTY;
     }
 }
 
-FS::FS()
+void FS::mount()
+{
+    blockSize = sb.block_size;
+    dirEntries = blockSize / sizeof(dir_entry);
+    fat.mount(sb.fat_start, sb.no_blocks, dataStart());
+    workingDirectory.resize(dirEntries);
+    currentBlock = ROOT_BLOCK;
+}
+
+FS::FS(const std::string& image) : disk(image), cache(disk), fat(cache)
 {
-    disk.read(FAT_BLOCK, (uint8_t*)fat);
+    //The super block is at the start of the disk whatever the block size is
+    std::vector<uint8_t> block(cache.get_block_size(), 0);
+    if (disk.get_no_blocks() > 0)
+    {
+        cache.read(SUPER_BLOCK, block.data());
+    }
+    memcpy(&sb, block.data(), sizeof(sb));
 
-    if(fat[ROOT_BLOCK] != FAT_EOF) // no saved FS so make a new start
+    //A log-structured disk file has more blocks than the file system sees
+    unsigned physical = sb.log_map_blocks > 0 ? sb.log_blocks : sb.no_blocks;
+    bool valid = sb.magic == FS_MAGIC && sb.version == FS_VERSION &&
+        Disk::valid_block_size(sb.block_size) && sb.no_blocks <= physical &&
+        (uint64_t)sb.block_size * physical <= disk.get_disk_size();
+    if(!valid) // no saved FS so make a new start
     {
-        makeDirBlock(this->workingDirectory);
-        writeDirToDisk(ROOT_BLOCK, this->workingDirectory);
-        this->format();
+        this->format(disk.get_no_blocks() > 0 ? disk.get_no_blocks() : NO_BLOCKS, BLOCK_SIZE);
     }
     else
     {
-        disk.read(ROOT_BLOCK, (uint8_t*)this->workingDirectory);
+        if (sb.block_size != disk.get_block_size() || physical != disk.get_no_blocks())
+        {
+            cache.drop();
+            disk.set_geometry(physical, sb.block_size);
+        }
+        if (sb.log_map_blocks > 0)
+        {
+            //Every block but the super block is found through the map from here on
+            unsigned used = 0;
+            for (unsigned slot = 0; slot < sb.log_snapshots; slot++)
+            {
+                used |= sb.snapshots[slot].name[0] != '\0' ? 1u << slot : 0;
+            }
+            disk.set_log(sb.log_map, sb.log_map_blocks, sb.no_blocks, true, sb.log_snapshots, used);
+        }
+        mount();
+        if (sb.csum_blocks > 0)
+        {
+            //Read past the cache, the region is only ever written by the disk itself
+            std::vector<uint8_t> region((size_t)sb.csum_blocks * blockSize);
+            cache.get_scheduler().io(IO_READ, sb.csum_start, sb.csum_blocks, region.data());
+            disk.set_checksums(sb.csum_start, sb.csum_blocks, region.data());
+        }
+        if (sb.dedup_blocks > 0)
+        {
+            dedupMount();
+        }
+        if (sb.pack_limit > 0)
+        {
+            packMount();
+        }
+        delayMount();
+        readDir(ROOT_BLOCK, this->workingDirectory);
+
+        //A scrub pass goes on where it was saved, in the background if it was running
+        if (sb.scrub_next > 0 || sb.scrub_running)
+        {
+            scrubState.active = true;
+            scrubState.next = std::min(sb.scrub_next, sb.no_blocks);
+            scrubState.rate = sb.scrub_rate;
+            if (sb.scrub_running)
+            {
+                scrubStart();
+            }
+        }
+    }
+}
+
+FS::FS(FS& live, unsigned slot) : disk(live.disk, slot), cache(disk), fat(cache)
+{
+    //The super block is not part of the snapshot, the geometry is that of the live volume
+    sb = live.sb;
+    readOnly = true;
+    mount();
+    if (sb.dedup_blocks > 0)
+    {
+        dedupMount();
+    }
+    if (sb.pack_limit > 0)
+    {
+        packMount();
     }
+    readDir(ROOT_BLOCK, this->workingDirectory);
 }
 
 FS::~FS()
 {
+    defragStop();
+    scrubStop(true);
+    delayStop();
+    placeDelayed(true);
+    fat.flush();
 }
 
 // formats the disk, i.e., creates an empty file system
 int
-FS::format()
+FS::format(unsigned options)
 {
-    disk.read(ROOT_BLOCK, (uint8_t*)this->workingDirectory);
-    this->currentBlock = ROOT_BLOCK;
-    this->makeDirBlock(this->workingDirectory);
-    disk.write(ROOT_BLOCK, (uint8_t*)this->workingDirectory);
-    for (int i = 2; i < BLOCK_SIZE/2; i++)
+    return format(disk.get_no_blocks(), disk.get_block_size(), options);
+}
+
+// formats the disk with a new geometry, resizing the disk file
+int
+FS::format(unsigned no_blocks, unsigned block_size, unsigned options)
+{
+    ScopeTimer timer(opLatency[OP_FORMAT]);
+    TRACE_SPAN("FS::format");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return -1;
+    }
+    if (disk.has_views())
+    {
+        std::cout << "ERROR: A snapshot of the disk is mounted\n";
+        return -1;
+    }
+    //The files of an unfinished defrag pass are gone, a scrub pass starts over
+    defragState.files.clear();
+    defragState.next = 0;
+    scrubState.next = 0;
+    scrubState.epoch++;
+    scrubState.sinceCheckpoint = 0;
+    {
+        std::lock_guard<std::mutex> scrubHeld(scrubState.lock);
+        scrubState.bad.clear();
+    }
+    if (!Disk::valid_block_size(block_size))
+    {
+        std::cout << "ERROR: Block size must be a power of two from " << MIN_BLOCK_SIZE;
+        std::cout << " to " << MAX_BLOCK_SIZE << "\n";
+        return -1;
+    }
+    if ((options & FORMAT_LOG) && (options & FORMAT_CHECKSUMS))
+    {
+        std::cout << "ERROR: A log-structured disk can not keep checksums\n";
+        return -1;
+    }
+    //The file system of a log-structured disk is smaller, the rest is room for the cleaner and the map
+    unsigned blocks = options & FORMAT_LOG ? Disk::log_capacity(no_blocks, block_size) : no_blocks;
+    unsigned fatBlocks = Fat::blocksNeeded(blocks, block_size);
+    unsigned csumBlocks = options & FORMAT_CHECKSUMS ? Disk::checksum_blocks(blocks, block_size) : 0;
+    unsigned dedupBlocks = options & FORMAT_DEDUP ?
+        ((uint64_t)blocks * sizeof(hash128) + block_size - 1) / block_size : 0;
+    if (no_blocks > INT32_MAX || blocks < FAT_START + fatBlocks + csumBlocks + dedupBlocks + 1)
+    {
+        std::cout << "ERROR: Invalid number of blocks\n";
+        return -1;
+    }
+    if (disk.is_log() || (options & FORMAT_LOG))
+    {
+        //Cached blocks are numbered as the old layout has them
+        cache.drop();
+        disk.set_log(0, 0, 0, false);
+    }
+    if (no_blocks != disk.get_no_blocks() || block_size != disk.get_block_size())
+    {
+        cache.drop();
+        disk.resize(no_blocks, block_size);
+    }
+    else
+    {
+        //A dirty block of the old file system could land in the checksum region
+        cache.sync();
+    }
+
+    sb.magic = FS_MAGIC;
+    sb.version = FS_VERSION;
+    sb.block_size = block_size;
+    sb.no_blocks = blocks;
+    sb.fat_start = FAT_START;
+    sb.fat_blocks = fatBlocks;
+    sb.root_block = ROOT_BLOCK;
+    sb.csum_start = sb.fat_start + fatBlocks;
+    sb.csum_blocks = csumBlocks;
+    sb.scrub_next = 0;
+    sb.scrub_rate = 0;
+    sb.scrub_running = 0;
+    sb.compress = (options & FORMAT_COMPRESS) != 0;
+    sb.dedup_start = sb.csum_start + csumBlocks;
+    sb.dedup_blocks = dedupBlocks;
+    sb.pack_limit = options & FORMAT_PACK ? std::min((unsigned)PACK_LIMIT, block_size / 2) : 0;
+    //The maps of the snapshots follow the live map at the end of the disk
+    sb.log_map_blocks = options & FORMAT_LOG ? Disk::log_map_blocks(no_blocks, block_size) : 0;
+    sb.log_snapshots = sb.log_map_blocks > 0 ? LOG_SNAPSHOTS : 0;
+    sb.log_map = sb.log_map_blocks > 0 ? no_blocks - sb.log_map_blocks * (1 + sb.log_snapshots) : 0;
+    sb.log_blocks = sb.log_map_blocks > 0 ? no_blocks : 0;
+    memset(sb.snapshots, 0, sizeof(sb.snapshots));
+    disk.set_checksums(sb.csum_start, sb.csum_blocks);
+    if (sb.log_map_blocks > 0)
+    {
+        disk.set_log(sb.log_map, sb.log_map_blocks, sb.no_blocks, false, sb.log_snapshots);
+    }
+    writeSuperBlock();
+    mount();
+
+    //The super block, the root, the FAT itself, the checksums and fingerprints are never handed out
+    fat.clear();
+    fat.set(SUPER_BLOCK, FAT_EOF);
+    fat.set(ROOT_BLOCK, FAT_EOF);
+    for (unsigned i = sb.fat_start; i < dataStart(); i++)
     {
-        fat[i] = FAT_FREE;
+        fat.set(i, FAT_EOF);
     }
-    fat[FAT_BLOCK] = FAT_EOF;
-    fat[ROOT_BLOCK] = FAT_EOF;
-    disk.write(FAT_BLOCK, (uint8_t*)fat);
-    makeDirBlock(this->workingDirectory);
+    fat.flush();
+    //The blocks of an older file system take no space on the host any more
+    discardFree();
+
+    //No block has a fingerprint yet, the region may hold those of an older file system
+    dedup.prints.assign(sb.dedup_blocks > 0 ? sb.no_blocks : 0, hash128{0, 0});
+    dedup.dirty.assign(sb.dedup_blocks, true);
+    dedup.refs.assign(dedup.prints.size(), 0);
+    dedup.index.clear();
+    dedupFlush();
+    pack.blocks.clear();
+    pack.last = FAT_EOF;
+    //Delayed files were never written, their reservations went with the FAT
+    delay.files.clear();
+    delay.blocks = 0;
+
+    this->makeDirBlock(this->workingDirectory);
+    writeDirToDisk(ROOT_BLOCK, this->workingDirectory);
     return 0;
 }
 
@@ -71,7 +398,14 @@ FS::format()
 int
 FS::create(std::string filepath)
 {
-    if(this->numbEnteries(this->workingDirectory) > 63)
+    ScopeTimer timer(opLatency[OP_CREATE]);
+    TRACE_SPAN("FS::create");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return 0;
+    }
+    if(this->numbEnteries(this->workingDirectory) >= dirEntries)
     {
         std::cout << "ERROR: dir is full\n";
         return 0;
@@ -82,7 +416,7 @@ FS::create(std::string filepath)
         std::cout << "ERROR: Name too long\n";
         return 0;
     }
-    dir_entry dir[64];
+    std::vector<dir_entry> dir(dirEntries);
     int dirFatId;
     if(this->getDirectory(filepath, dir, dirFatId, false) == -1)
     {
@@ -120,16 +454,16 @@ FS::create(std::string filepath)
         }
     }
 
-    int fileSize = text.size();
-    int block = -1;
-    this->writeToDisk(text, fileSize, block, true);
-    dir[index].size = fileSize;
-    dir[index].first_blk = block;
-    disk.write(FAT_BLOCK, (uint8_t*)fat);
-    disk.write(dirFatId, (uint8_t*) dir);
+    if (storeDelayed(text, dir[index]) == -1)
+    {
+        fat.flush();
+        return 0;
+    }
+    fat.flush();
+    writeDirToDisk(dirFatId, dir);
     if(currentBlock == dirFatId)
     {
-        disk.read(currentBlock, (uint8_t*)this->workingDirectory);
+        readDir(currentBlock, this->workingDirectory);
     }
     return 0;
 }
@@ -138,9 +472,12 @@ FS::create(std::string filepath)
 int
 FS::cat(std::string filepath)
 {
+    ScopeTimer timer(opLatency[OP_CAT]);
+    TRACE_SPAN("FS::cat");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
     bool found = false, rights = false;
     std::string fileText, file;
-    dir_entry dir[64];
+    std::vector<dir_entry> dir(dirEntries);
     int dirFatId;
     if(this->getDirectory(filepath, dir, dirFatId, false) == -1)
     {
@@ -163,7 +500,11 @@ FS::cat(std::string filepath)
             if (access == READ || access == READWRITE || access == 0x07)
             {
                 rights = true;
-                readFromDisk(fileText, i, dir);
+                if (readFromDisk(fileText, i, dir) == -1)
+                {
+                    std::cout << "ERROR: Can't read file\n";
+                    return 0;
+                }
                 std::cout << fileText;
             }
 
@@ -187,12 +528,15 @@ FS::cat(std::string filepath)
 int
 FS::ls()
 {
+    ScopeTimer timer(opLatency[OP_LS]);
+    TRACE_SPAN("FS::ls");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
     std::cout << "Name\tType\tAccess\tSize\n";
     std::string name, type, access, size;
     uint32_t aRights;
 
     int numb = this->numbEnteries(this->workingDirectory);
-    for (int i = 0; i < 64; i++)
+    for (int i = 0; i < dirEntries; i++)
     {
         if (this->workingDirectory[i].type == TYPE_EMPTY)
         {
@@ -249,8 +593,15 @@ FS::ls()
 int
 FS::cp(std::string sourcepath, std::string destpath)
 {
-    dir_entry dir[64];
-    dir_entry destDir[64];
+    ScopeTimer timer(opLatency[OP_CP]);
+    TRACE_SPAN("FS::cp");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return 0;
+    }
+    std::vector<dir_entry> dir(dirEntries);
+    std::vector<dir_entry> destDir(dirEntries);
     int dirFatId;
     if(this->getDirectory(sourcepath, dir, dirFatId, false) == -1)
     {
@@ -322,12 +673,18 @@ FS::cp(std::string sourcepath, std::string destpath)
         }
     }
 
-    //Reads in the text if you have access to the file
+    //Reads in the text if you have access to the file, a sparse file is copied
+    //block by block instead
     std::string fileText;
     int accessRight = dir[index].access_rights;
+    bool sparse = dir[index].flags & FLAG_SPARSE;
     if (accessRight == READ || accessRight == 0x06 || accessRight == 0x07)
     {
-        readFromDisk(fileText, index, dir);
+        if (!sparse && readFromDisk(fileText, index, dir) == -1)
+        {
+            std::cout << "ERROR: Can't read file\n";
+            return 0;
+        }
     }
     else
     {
@@ -337,24 +694,26 @@ FS::cp(std::string sourcepath, std::string destpath)
 
     //Creating the new file for workingdirectory
     int newIndex = numbEnteries(destDir);
-    int block = -1;
     std::string name;
 
     if (directory) name = file;
     else name = destFile;
 
     strcpy(destDir[newIndex].file_name, name.c_str());
-    destDir[newIndex].size = dir[index].size;
     destDir[newIndex].type = dir[index].type;
     destDir[newIndex].access_rights = dir[index].access_rights;
-    writeToDisk(fileText, destDir[newIndex].size, block, true);
-    destDir[newIndex].first_blk = block;
+    int stored = sparse ? copySparse(dir[index], *this, destDir[newIndex]) : storeDelayed(fileText, destDir[newIndex]);
+    if (stored == -1)
+    {
+        fat.flush();
+        return 0;
+    }
 
-    disk.write(dirFatId, (uint8_t*)destDir);
-    disk.write(FAT_BLOCK, (uint8_t*)fat);
+    writeDirToDisk(dirFatId, destDir);
+    fat.flush();
     if ( currentBlock == dirFatId)
     {
-        disk.read(currentBlock, (uint8_t*)this->workingDirectory);
+        readDir(currentBlock, this->workingDirectory);
     }
     return 0;
 }
@@ -364,8 +723,15 @@ FS::cp(std::string sourcepath, std::string destpath)
 int
 FS::mv(std::string sourcepath, std::string destpath)
 {
-    dir_entry dir[64];
-    dir_entry destDir[64];
+    ScopeTimer timer(opLatency[OP_MV]);
+    TRACE_SPAN("FS::mv");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return 0;
+    }
+    std::vector<dir_entry> dir(dirEntries);
+    std::vector<dir_entry> destDir(dirEntries);
     int dirFatId, destFatId;
     if(this->getDirectory(sourcepath, dir, dirFatId, false) == -1)
     {
@@ -436,14 +802,9 @@ FS::mv(std::string sourcepath, std::string destpath)
         }
     }
 
-    //Reads in the text if you have access to the file
-    std::string fileText;
+    //Moving needs access to the file
     int accessRight = dir[index].access_rights;
-    if (accessRight == READ || accessRight == 0x06 || accessRight == 0x07)
-    {
-        readFromDisk(fileText, index, dir);
-    }
-    else
+    if (accessRight != READ && accessRight != 0x06 && accessRight != 0x07)
     {
         std::cout << "ERROR: Access denied\n";
         return 0;
@@ -451,43 +812,29 @@ FS::mv(std::string sourcepath, std::string destpath)
 
     //Creating the new file for workingdirectory
     int newIndex = numbEnteries(destDir);
-    int block = -1;
 
     if (directory || destFile == "/")
     {
-        //Adds file to new directory
-        strcpy(destDir[newIndex].file_name, file.c_str());
-        destDir[newIndex].size = dir[index].size;
-        destDir[newIndex].type = dir[index].type;
-        destDir[newIndex].access_rights = dir[index].access_rights;
-        writeToDisk(fileText, destDir[newIndex].size, block, true);
-        destDir[newIndex].first_blk = block;
-        disk.write(destFatId, (uint8_t*)destDir);
+        //Adds file to new directory, its blocks stay where they are
+        destDir[newIndex] = dir[index];
+        writeDirToDisk(destFatId, destDir);
 
         //Removes file from old directory
         int nrEntries = numbEnteries(dir);
-        int fatIndex, lastPlace = dir[nrEntries-1].first_blk;
         dir[index] = dir[nrEntries-1];
         dir[nrEntries-1].type = TYPE_EMPTY;
-
-        while (lastPlace != FAT_EOF)
-        {
-            fatIndex = fat[lastPlace];
-            fat[lastPlace] = FAT_FREE;
-            lastPlace = fatIndex;
-        }
-        disk.write(dirFatId, (uint8_t*)dir);
+        writeDirToDisk(dirFatId, dir);
     }
     else
     {
         strcpy(dir[index].file_name, destFile.c_str());
-        disk.write(dirFatId, (uint8_t*)dir);
+        writeDirToDisk(dirFatId, dir);
     }
 
-    disk.write(FAT_BLOCK, (uint8_t*)fat);
+    fat.flush();
     if ( currentBlock == dirFatId)
     {
-        disk.read(currentBlock, (uint8_t*)this->workingDirectory);
+        readDir(currentBlock, this->workingDirectory);
     }
     return 0;
 }
@@ -496,7 +843,14 @@ FS::mv(std::string sourcepath, std::string destpath)
 int
 FS::rm(std::string filepath)
 {
-    dir_entry dir[64];
+    ScopeTimer timer(opLatency[OP_RM]);
+    TRACE_SPAN("FS::rm");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return 0;
+    }
+    std::vector<dir_entry> dir(dirEntries);
     int dirFatId;
     if(this->getDirectory(filepath, dir, dirFatId, false) == -1)
     {
@@ -540,40 +894,28 @@ FS::rm(std::string filepath)
             //Removes directory
             getDirectory(filepath, dir, dirFatId, false);
             int nrEntries = numbEnteries(dir);
+            int removed = dir[index].first_blk;
             dir[index] = dir[nrEntries-1];
             dir[nrEntries-1].type = TYPE_EMPTY;
-            int fatIndex, lastPlace = dir[nrEntries-1].first_blk;
-
-            while (lastPlace != FAT_EOF)
-            {
-                fatIndex = fat[lastPlace];
-                fat[lastPlace] = FAT_FREE;
-                lastPlace = fatIndex;
-            }
-            disk.write(dirFatId, (uint8_t*)dir);
+            freeChain(removed);
+            writeDirToDisk(dirFatId, dir);
         }
     }
     else
     {
         //Replaces and removes
         int nrEntries = numbEnteries(dir);
-        int fatIndex, lastPlace = dir[nrEntries-1].first_blk;
+        dir_entry removed = dir[index];
         dir[index] = dir[nrEntries-1];
         dir[nrEntries-1].type = TYPE_EMPTY;
-
-        while (lastPlace != FAT_EOF)
-        {
-            fatIndex = fat[lastPlace];
-            fat[lastPlace] = FAT_FREE;
-            lastPlace = fatIndex;
-        }
-        disk.write(dirFatId, (uint8_t*)dir);
+        freeFile(removed);
+        writeDirToDisk(dirFatId, dir);
     }
 
-    disk.write(FAT_BLOCK, (uint8_t*)fat);
+    fat.flush();
     if ( currentBlock == dirFatId)
     {
-        disk.read(currentBlock, (uint8_t*)this->workingDirectory);
+        readDir(currentBlock, this->workingDirectory);
     }
     return 0;
 }
@@ -583,8 +925,15 @@ FS::rm(std::string filepath)
 int
 FS::append(std::string filepath1, std::string filepath2)
 {
-    dir_entry dir[64];
-    dir_entry destDir[64];
+    ScopeTimer timer(opLatency[OP_APPEND]);
+    TRACE_SPAN("FS::append");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return 0;
+    }
+    std::vector<dir_entry> dir(dirEntries);
+    std::vector<dir_entry> destDir(dirEntries);
     int dirFatId;
     if(this->getDirectory(filepath1, dir, dirFatId, false) == -1)
     {
@@ -656,10 +1005,97 @@ FS::append(std::string filepath1, std::string filepath2)
         return 0;
     }
 
+    //A sparse file gets the other file written at its end, holes and all
+    if (destDir[index2].flags & FLAG_SPARSE)
+    {
+        std::string added;
+        if (readFromDisk(added, index1, dir) == -1)
+        {
+            std::cout << "ERROR: Can't read file\n";
+            return 0;
+        }
+        if ((uint64_t)destDir[index2].size + added.size() > UINT32_MAX)
+        {
+            std::cout << "ERROR: File too large\n";
+            return 0;
+        }
+        writeSparse(destDir[index2], destDir[index2].size, added);
+        writeDirToDisk(dirFatId, destDir);
+        fat.flush();
+        if (currentBlock == dirFatId)
+        {
+            readDir(currentBlock, this->workingDirectory);
+        }
+        return 0;
+    }
+
+    //A delayed file gets the other file added to its data in memory, with
+    //blocks reserved for what it grew by
+    if (destDir[index2].flags & FLAG_DELAYED)
+    {
+        std::string added;
+        auto file = delay.files.find(destDir[index2].first_blk);
+        if (file == delay.files.end() || readFromDisk(added, index1, dir) == -1)
+        {
+            std::cout << "ERROR: Can't read file\n";
+            return 0;
+        }
+        uint64_t size = file->second.data.size() + added.size();
+        if (size > UINT32_MAX)
+        {
+            std::cout << "ERROR: File too large\n";
+            return 0;
+        }
+        unsigned long need = delayBlocks(size);
+        if (need > file->second.blocks)
+        {
+            if (!fat.reserve(need - file->second.blocks))
+            {
+                std::cout << "ERROR: Disk is full\n";
+                return 0;
+            }
+            delay.blocks += need - file->second.blocks;
+            file->second.blocks = need;
+        }
+        file->second.data += added;
+        destDir[index2].size = size;
+        writeDirToDisk(dirFatId, destDir);
+        if (currentBlock == dirFatId)
+        {
+            readDir(currentBlock, this->workingDirectory);
+        }
+        delayStart();
+        return 0;
+    }
+
     //Read and write to files
     std::string fileText;
-    readFromDisk(fileText, index2, destDir);
-    readFromDisk(fileText, index1, dir);
+    if (readFromDisk(fileText, index2, destDir) == -1 || readFromDisk(fileText, index1, dir) == -1)
+    {
+        std::cout << "ERROR: Can't read file\n";
+        return 0;
+    }
+
+    //A compressed stream can not be added to, a deduplicated chain may be
+    //shared with other files and a packed file may have outgrown its units or
+    //its limit, the whole file is stored again
+    if (sb.compress || sb.dedup_blocks > 0 || (destDir[index2].flags & (FLAG_COMPRESSED | FLAG_PACKED)))
+    {
+        dir_entry old = destDir[index2];
+        if (storeFile(fileText, destDir[index2]) == -1)
+        {
+            fat.flush();
+            return 0;
+        }
+        freeFile(old);
+        writeDirToDisk(dirFatId, destDir);
+        fat.flush();
+        if (currentBlock == dirFatId)
+        {
+            readDir(currentBlock, this->workingDirectory);
+        }
+        return 0;
+    }
 
     int count = 0, temp = 0;
     std::string fixedText;
@@ -669,25 +1105,27 @@ FS::append(std::string filepath1, std::string filepath2)
 
     while (lastBlock != FAT_EOF)
     {
-        fixedText = fileText.substr(4096 * count, 4096);
-        disk.write(lastBlock, (uint8_t*)fixedText.c_str());
-        lastBlock = fat[lastBlock];
-        fileSize -= 4096;
+        fixedText = fileText.substr(blockSize * count, blockSize);
+        fixedText.resize(blockSize);
+        cache.write(lastBlock, (uint8_t*)fixedText.c_str());
+        temp = lastBlock;
+        lastBlock = fat.get(lastBlock);
+        fileSize -= blockSize;
         count++;
     }
 
-    //If the file needs more blocks
+    //If the file needs more blocks they are linked after the last one
     if (fileSize > 0)
     {
         writeToDisk(fileText, fileSize, temp, false);
     }
 
-    disk.write(dirFatId, (uint8_t*)destDir);
-    disk.write(FAT_BLOCK, (uint8_t*)fat);
+    writeDirToDisk(dirFatId, destDir);
+    fat.flush();
 
     if (currentBlock == dirFatId)
     {
-        disk.read(currentBlock, (uint8_t*)this->workingDirectory);
+        readDir(currentBlock, this->workingDirectory);
     }
     return 0;
 }
@@ -697,13 +1135,20 @@ FS::append(std::string filepath1, std::string filepath2)
 int
 FS::mkdir(std::string dirpath)
 {
-    if(this->numbEnteries(this->workingDirectory) > 63)
+    ScopeTimer timer(opLatency[OP_MKDIR]);
+    TRACE_SPAN("FS::mkdir");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return 0;
+    }
+    if(this->numbEnteries(this->workingDirectory) >= dirEntries)
     {
         std::cout << "ERROR: dir is full\n";
         return 0;
     }
     std::string name = this->getFile(dirpath);
-    dir_entry dir[64];
+    std::vector<dir_entry> dir(dirEntries);
     int dirFatId;
     bool fromRoot = dirpath[0] == '/';
     if(this->getDirectory(dirpath, dir, dirFatId, false) == -1)
@@ -713,7 +1158,7 @@ FS::mkdir(std::string dirpath)
     }
 
     int num = this->numbEnteries(dir);
-    if(num > 64)
+    if(num >= dirEntries)
     {
         std::cout << "ERROR: Directory full\n";
         return 0;
@@ -729,20 +1174,18 @@ FS::mkdir(std::string dirpath)
     
     dir[num].type = TYPE_DIR;
     dir[num].access_rights = READWRITE;
+    dir[num].flags = 0;
     strcpy(dir[num].file_name, name.c_str());
 
-    int freeFat = -1;
-    for (int i = 2; i < BLOCK_SIZE/2; i++)
+    int freeFat = fat.findFree();
+    if (freeFat == FAT_EOF)
     {
-        if(fat[i] == FAT_FREE)
-        {
-            freeFat = i;
-            break;
-        }
+        std::cout << "ERROR: Disk is full\n";
+        return 0;
     }
 
-    fat[freeFat] = FAT_EOF;
-    dir_entry folder[64];
+    fat.set(freeFat, FAT_EOF);
+    std::vector<dir_entry> folder(dirEntries);
     this->makeDirBlock(folder);
     dir[num].first_blk = freeFat;
     folder[0].type = TYPE_DIR;
@@ -751,14 +1194,14 @@ FS::mkdir(std::string dirpath)
     strcpy(folder[0].file_name, nname.c_str());
 
     this->writeDirToDisk(freeFat, folder);
-    disk.write(FAT_BLOCK, (uint8_t*)fat);
+    fat.flush();
     this->writeDirToDisk(dirFatId, dir);
-    dir_entry test[64];
+    std::vector<dir_entry> test(dirEntries);
     int np;
     this->readDirBlock(freeFat, test, np);
     if(currentBlock == dirFatId)
     {
-        disk.read(currentBlock, (uint8_t*)this->workingDirectory);
+        readDir(currentBlock, this->workingDirectory);
     }
     return 0;
 }
@@ -767,13 +1210,16 @@ FS::mkdir(std::string dirpath)
 int
 FS::cd(std::string dirpath)
 {
-    dir_entry dir[64];
+    ScopeTimer timer(opLatency[OP_CD]);
+    TRACE_SPAN("FS::cd");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    std::vector<dir_entry> dir(dirEntries);
     if(this->getDirectory(dirpath, dir, this->currentBlock, true) == -1)
     {
         std::cout << "ERROR: no directory found\n";
-        return 0;
+        return -1;
     }
-    for (int i = 0; i < 64; i++)
+    for (int i = 0; i < dirEntries; i++)
     {
         this->workingDirectory[i] = dir[i];
     }
@@ -785,11 +1231,23 @@ FS::cd(std::string dirpath)
 int
 FS::pwd()
 {
+    ScopeTimer timer(opLatency[OP_PWD]);
+    TRACE_SPAN("FS::pwd");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    std::cout << cwd() << "\n";
+    return 0;
+}
+
+// returns the full path of the current directory
+std::string
+FS::cwd()
+{
+    std::lock_guard<std::recursive_mutex> held(fsLock);
     bool inRoot = false;
     int lastDirFatId, newDirFatId = this->currentBlock;
     std::vector<std::string> path;
-    dir_entry dir[64];
-    for (int i = 0; i < 64; i++)
+    std::vector<dir_entry> dir(dirEntries);
+    for (int i = 0; i < dirEntries; i++)
     {
         dir[i] = this->workingDirectory[i];
     }
@@ -802,34 +1260,26 @@ FS::pwd()
         } 
         else
         {
-            for (int i = 0; i < 64; i++)
+            for (int i = 0; i < dirEntries; i++)
             {
-                if(dir[i].first_blk == (uint16_t)newDirFatId)
+                if(dir[i].first_blk == (uint32_t)newDirFatId)
                 {
                     path.push_back(dir[i].file_name);
                     newDirFatId = lastDirFatId;
                     look.append("/..");
-                    i = 100;
+                    break;
                 }
             }
         }
     }
 
+    std::string full;
     for (int i = path.size(); i > 0;)
     {
         i--;
-        std::cout << "/" << path[i];
+        full += "/" + path[i];
     }
-    if(path.size() > 0)
-    {
-        std::cout << "\n";
-    }
-    else
-    {
-        std::cout << "/\n";
-    }
-
-    return 0;
+    return path.size() > 0 ? full : "/";
 }
 
 // chmod <accessrights> <filepath> changes the access rights for the
@@ -837,23 +1287,30 @@ FS::pwd()
 int
 FS::chmod(std::string accessrights, std::string filepath)
 {
+    ScopeTimer timer(opLatency[OP_CHMOD]);
+    TRACE_SPAN("FS::chmod");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return 0;
+    }
     std::string name = this->getFile(filepath);
-    dir_entry dir[64];
+    std::vector<dir_entry> dir(dirEntries);
     int dirFatId;
     if(this->getDirectory(filepath, dir, dirFatId, false) == -1)
     {
         std::cout << "ERROR: No dir found\n";
         return 0;
     }
-    for (int i = 0; i < 64; i++)
+    for (int i = 0; i < dirEntries; i++)
     {
         if(strcmp(dir[i].file_name, name.c_str()) == 0)
         {
             dir[i].access_rights = stoi(accessrights);
-            disk.write(dirFatId, (uint8_t*)dir);
+            writeDirToDisk(dirFatId, dir);
             if(currentBlock == dirFatId)
             {
-                disk.read(currentBlock, (uint8_t*)this->workingDirectory);
+                readDir(currentBlock, this->workingDirectory);
             }
             return 0;
         }
@@ -862,80 +1319,3102 @@ FS::chmod(std::string accessrights, std::string filepath)
     return 0;
 }
 
-void FS::writeToDisk(std::string fileText, int fileSize, int &FirstBlock, bool firstAdd)
+// opens the file <filepath> to be read and written at byte offsets, returns
+// a handle or -1 if there is no such file
+int
+FS::open(std::string filepath)
 {
-    std::string fixedText;
-    int lastBlock, count = 0;
-
-    for (int i = 2; i < BLOCK_SIZE/2; i++)
+    ScopeTimer timer(opLatency[OP_OPEN]);
+    TRACE_SPAN("FS::open");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    std::vector<dir_entry> dir(dirEntries);
+    int dirFatId;
+    if (getDirectory(filepath, dir, dirFatId, false) == -1)
+    {
+        std::cout << "ERROR: No dir found\n";
+        return -1;
+    }
+    std::string file = getFile(filepath);
+    for (int i = 0; i < numbEnteries(dir); i++)
     {
-        if (fat[i] == FAT_FREE)
+        if (dir[i].file_name == file)
         {
-            if (firstAdd)
-            {
-                FirstBlock = i;
-                fixedText = fileText.substr(4096 * count, 4096);
-                disk.write(i, (uint8_t*)fixedText.c_str());
-
-                count++;
-                firstAdd = true;
-            }
-            else
+            if (dir[i].type == TYPE_DIR)
             {
-                //Adding to new disk block if file was too big
-                fat[lastBlock] = i;
-                fixedText = fileText.substr(4096 * count, 4096);
-                disk.write(i, (uint8_t*)fixedText.c_str());
-                count++;
+                std::cout << "ERROR: Can't be a directory\n";
+                return -1;
             }
-
-            //Checking if file is bigger than disk block
-            fileSize -= 4096;
-
-            if (fileSize <= 0)
+            Handle handle;
+            handle.dirBlock = dirFatId;
+            handle.name = file;
+            for (size_t h = 0; h < handles.size(); h++)
             {
-                fat[i] = FAT_EOF;
-                break;
+                if (handles[h].dirBlock == -1)
+                {
+                    handles[h] = handle;
+                    return h;
+                }
             }
-
-            lastBlock = i;
+            handles.push_back(handle);
+            return handles.size() - 1;
         }
     }
+    std::cout << "ERROR: File not found\n";
+    return -1;
 }
 
-//Reads from the disk
-void FS::readFromDisk(std::string& fileText, int fileIndex, dir_entry* dir)
+int
+FS::close(int handle)
 {
-    char* buffer;
-    int lastPlace = dir[fileIndex].first_blk;
-
-    while (lastPlace != FAT_EOF)
+    ScopeTimer timer(opLatency[OP_CLOSE]);
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (handle < 0 || handle >= (int)handles.size() || handles[handle].dirBlock == -1)
     {
-        buffer = new char[BLOCK_SIZE];
-        disk.read(lastPlace, (uint8_t*)buffer);
-        fileText.append(buffer);
-        delete[] buffer;
-        lastPlace = fat[lastPlace];
+        std::cout << "ERROR: Bad handle\n";
+        return -1;
     }
+    handles[handle].dirBlock = -1;
+    return 0;
 }
 
-int FS::numbEnteries(dir_entry* dir)
+int FS::handleEntry(int handle, std::vector<dir_entry>& dir)
 {
-    int nr = 0;
-    for (int i = 0; i < 64; i++)
+    if (handle < 0 || handle >= (int)handles.size() || handles[handle].dirBlock == -1)
     {
-        if(dir[i].type != TYPE_EMPTY)
+        std::cout << "ERROR: Bad handle\n";
+        return -1;
+    }
+    if (readDir(handles[handle].dirBlock, dir) == -1)
+    {
+        return -1;
+    }
+    for (int i = 0; i < dirEntries; i++)
+    {
+        if (dir[i].type == TYPE_FILE && dir[i].file_name == handles[handle].name)
         {
-            nr++;
+            return i;
         }
     }
-    return nr;
+    std::cout << "ERROR: File not found\n";
+    return -1;
 }
 
-std::string FS::getFile(std::string path)
+// reads up to length bytes at offset into data, holes read as zeros. Returns
+// the number of bytes read or -1
+long
+FS::pread(int handle, uint64_t offset, size_t length, std::string& data)
+{
+    ScopeTimer timer(opLatency[OP_READ]);
+    TRACE_SPAN("FS::pread");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    std::vector<dir_entry> dir(dirEntries);
+    int index = handleEntry(handle, dir);
+    if (index == -1)
+    {
+        return -1;
+    }
+    if (!(dir[index].access_rights == READ || dir[index].access_rights == READWRITE ||
+        dir[index].access_rights == 0x07))
+    {
+        std::cout << "ERROR: Access denied\n";
+        return -1;
+    }
+    data.clear();
+    if (offset >= dir[index].size)
+    {
+        return 0;
+    }
+    length = std::min((uint64_t)length, dir[index].size - offset);
+    if (readRange(dir[index], offset, length, data) == -1)
+    {
+        std::cout << "ERROR: Can't read file\n";
+        return -1;
+    }
+    return length;
+}
+
+// writes data at offset, the file becomes sparse and writing past its end
+// leaves a hole. Returns the number of bytes written or -1
+long
+FS::pwrite(int handle, uint64_t offset, const std::string& data)
+{
+    ScopeTimer timer(opLatency[OP_WRITE]);
+    TRACE_SPAN("FS::pwrite");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return -1;
+    }
+    std::vector<dir_entry> dir(dirEntries);
+    int index = handleEntry(handle, dir);
+    if (index == -1)
+    {
+        return -1;
+    }
+    if (!(dir[index].access_rights == WRITE || dir[index].access_rights == READWRITE ||
+        dir[index].access_rights == 0x07))
+    {
+        std::cout << "ERROR: Access denied\n";
+        return -1;
+    }
+    if (offset + data.size() > UINT32_MAX)
+    {
+        std::cout << "ERROR: File too large\n";
+        return -1;
+    }
+    if (makeSparse(dir[index]) == -1)
+    {
+        fat.flush();
+        return -1;
+    }
+    int written = writeSparse(dir[index], offset, data);
+    int dirBlock = handles[handle].dirBlock;
+    writeDirToDisk(dirBlock, dir);
+    fat.flush();
+    if (currentBlock == dirBlock)
+    {
+        readDir(currentBlock, this->workingDirectory);
+    }
+    return written == -1 ? -1 : (long)data.size();
+}
+
+// truncate <filepath> <size> cuts the file to size bytes or grows it with a
+// hole, the file becomes sparse
+int
+FS::truncate(std::string filepath, uint64_t size)
+{
+    ScopeTimer timer(opLatency[OP_TRUNCATE]);
+    TRACE_SPAN("FS::truncate");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return -1;
+    }
+    std::vector<dir_entry> dir(dirEntries);
+    int dirFatId;
+    if (getDirectory(filepath, dir, dirFatId, false) == -1)
+    {
+        std::cout << "ERROR: No dir found\n";
+        return 0;
+    }
+    std::string file = getFile(filepath);
+    int index = -1;
+    for (int i = 0; i < numbEnteries(dir); i++)
+    {
+        if (dir[i].file_name == file && dir[i].type == TYPE_FILE)
+        {
+            index = i;
+            break;
+        }
+    }
+    if (index == -1)
+    {
+        std::cout << "ERROR: File not found\n";
+        return 0;
+    }
+    if (!(dir[index].access_rights == WRITE || dir[index].access_rights == READWRITE ||
+        dir[index].access_rights == 0x07))
+    {
+        std::cout << "ERROR: Access denied\n";
+        return 0;
+    }
+    if (size > UINT32_MAX)
+    {
+        std::cout << "ERROR: File too large\n";
+        return 0;
+    }
+    if (makeSparse(dir[index]) == 0)
+    {
+        resizeSparse(dir[index], size);
+        writeDirToDisk(dirFatId, dir);
+    }
+    fat.flush();
+    if (currentBlock == dirFatId)
+    {
+        readDir(currentBlock, this->workingDirectory);
+    }
+    return 0;
+}
+
+// prealloc <filepath> <bytes> reserves the blocks for the first bytes of the
+// file without writing them, creating the file if there is none
+int
+FS::fallocate(std::string filepath, uint64_t bytes)
+{
+    ScopeTimer timer(opLatency[OP_PREALLOC]);
+    TRACE_SPAN("FS::fallocate");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return 0;
+    }
+    if (bytes > UINT32_MAX)
+    {
+        std::cout << "ERROR: File too large\n";
+        return 0;
+    }
+    std::vector<dir_entry> dir(dirEntries);
+    int dirFatId;
+    if (getDirectory(filepath, dir, dirFatId, false) == -1)
+    {
+        std::cout << "ERROR: No dir found\n";
+        return 0;
+    }
+    std::string file = getFile(filepath);
+    int index = -1;
+    for (int i = 0; i < numbEnteries(dir); i++)
+    {
+        if (dir[i].file_name == file)
+        {
+            if (dir[i].type == TYPE_DIR)
+            {
+                std::cout << "ERROR: Can't be a directory\n";
+                return 0;
+            }
+            index = i;
+            break;
+        }
+    }
+
+    bool created = index == -1;
+    if (created)
+    {
+        index = numbEnteries(dir);
+        if (file.length() > 55)
+        {
+            std::cout << "ERROR: Name too long\n";
+            return 0;
+        }
+        if (index >= dirEntries)
+        {
+            std::cout << "ERROR: dir is full\n";
+            return 0;
+        }
+        strcpy(dir[index].file_name, file.c_str());
+        dir[index].type = TYPE_FILE;
+        dir[index].access_rights = READWRITE;
+        if (storeSparse("", dir[index]) == -1)
+        {
+            fat.flush();
+            return 0;
+        }
+    }
+    else if (!(dir[index].access_rights == WRITE || dir[index].access_rights == READWRITE ||
+        dir[index].access_rights == 0x07))
+    {
+        std::cout << "ERROR: Access denied\n";
+        return 0;
+    }
+    else if (makeSparse(dir[index]) == -1)
+    {
+        fat.flush();
+        return 0;
+    }
+
+    if (reserveSparse(dir[index], bytes) == -1 && created)
+    {
+        //A file made for the space it could not have goes again
+        freeFile(dir[index]);
+        fat.flush();
+        return 0;
+    }
+    writeDirToDisk(dirFatId, dir);
+    fat.flush();
+    if (currentBlock == dirFatId)
+    {
+        readDir(currentBlock, this->workingDirectory);
+    }
+    return 0;
+}
+
+// get <filepath> <hostpath> writes the file to a file outside the disk, the
+// holes of a sparse file stay holes there
+int
+FS::get(std::string filepath, std::string hostpath)
+{
+    ScopeTimer timer(opLatency[OP_GET]);
+    TRACE_SPAN("FS::get");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    std::vector<dir_entry> dir(dirEntries);
+    int dirFatId;
+    if (getDirectory(filepath, dir, dirFatId, false) == -1)
+    {
+        std::cout << "ERROR: No dir found\n";
+        return 0;
+    }
+    std::string file = getFile(filepath);
+    int index = -1;
+    for (int i = 0; i < numbEnteries(dir); i++)
+    {
+        if (dir[i].file_name == file && dir[i].type == TYPE_FILE)
+        {
+            index = i;
+            break;
+        }
+    }
+    if (index == -1)
+    {
+        std::cout << "ERROR: File not found\n";
+        return 0;
+    }
+    if (!(dir[index].access_rights == READ || dir[index].access_rights == READWRITE ||
+        dir[index].access_rights == 0x07))
+    {
+        std::cout << "ERROR: Access denied\n";
+        return 0;
+    }
+    int fd = ::open(hostpath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        std::cout << "ERROR: Can't write " << hostpath << "\n";
+        return 0;
+    }
+
+    //Runs of blocks that are not all zeros are written, the rest is left to
+    //the host file system as holes
+    const dir_entry& entry = dir[index];
+    size_t batch = (size_t)XFER_BLOCKS * blockSize;
+    bool failed = false;
+    for (uint64_t at = 0; at < entry.size && !failed; at += batch)
+    {
+        std::string data;
+        size_t length = std::min((uint64_t)batch, entry.size - at);
+        if (readRange(entry, at, length, data) == -1)
+        {
+            std::cout << "ERROR: Can't read file\n";
+            failed = true;
+            break;
+        }
+        size_t start = 0;
+        while (start < length && !failed)
+        {
+            size_t end = start;
+            while (end < length && !allZero(data.data() + end, std::min((size_t)blockSize, length - end)))
+            {
+                end += std::min((size_t)blockSize, length - end);
+            }
+            if (end > start && ::pwrite(fd, data.data() + start, end - start, at + start) != (ssize_t)(end - start))
+            {
+                std::cout << "ERROR: Can't write " << hostpath << "\n";
+                failed = true;
+            }
+            start = end + (end < length ? std::min((size_t)blockSize, length - end) : 0);
+        }
+    }
+    if (!failed && ::ftruncate(fd, entry.size) == -1)
+    {
+        std::cout << "ERROR: Can't write " << hostpath << "\n";
+    }
+    ::close(fd);
+    return 0;
+}
+
+// put <hostpath> <filepath> stores a file from outside the disk as a new file,
+// its blocks of zeros are not written
+int
+FS::put(std::string hostpath, std::string filepath)
+{
+    ScopeTimer timer(opLatency[OP_PUT]);
+    TRACE_SPAN("FS::put");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return 0;
+    }
+    std::ifstream in(hostpath, std::ios::binary);
+    if (!in.is_open())
+    {
+        std::cout << "ERROR: Can't read " << hostpath << "\n";
+        return 0;
+    }
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (text.size() > UINT32_MAX)
+    {
+        std::cout << "ERROR: File too large\n";
+        return 0;
+    }
+    std::string name = getFile(filepath);
+    if (name.length() > 55)
+    {
+        std::cout << "ERROR: Name too long\n";
+        return 0;
+    }
+    std::vector<dir_entry> dir(dirEntries);
+    int dirFatId;
+    if (getDirectory(filepath, dir, dirFatId, false) == -1)
+    {
+        std::cout << "ERROR: No dir found\n";
+        return 0;
+    }
+    int index = numbEnteries(dir);
+    if (index >= dirEntries)
+    {
+        std::cout << "ERROR: dir is full\n";
+        return 0;
+    }
+    for (int i = 0; i < index; i++)
+    {
+        if (dir[i].file_name == name)
+        {
+            std::cout << "ERROR: File already exists\n";
+            return 0;
+        }
+    }
+    strcpy(dir[index].file_name, name.c_str());
+    dir[index].type = TYPE_FILE;
+    dir[index].access_rights = READWRITE;
+    if (storeFile(text, dir[index]) == -1)
+    {
+        fat.flush();
+        return 0;
+    }
+    fat.flush();
+    writeDirToDisk(dirFatId, dir);
+    if (currentBlock == dirFatId)
+    {
+        readDir(currentBlock, this->workingDirectory);
+    }
+    return 0;
+}
+
+// copies the file <sourcepath> on this volume to <destpath> on the volume dest,
+// the data goes from one cache to the other XFER_BLOCKS blocks at a time
+int
+FS::copyTo(std::string sourcepath, FS& dest, std::string destpath)
+{
+    ScopeTimer timer(opLatency[OP_COPYTO]);
+    TRACE_SPAN("FS::copyTo");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    std::lock_guard<std::recursive_mutex> destHeld(dest.fsLock);
+    if (!dest.writable())
+    {
+        return -1;
+    }
+    std::vector<dir_entry> dir(dirEntries);
+    std::vector<dir_entry> destDir(dest.dirEntries);
+    int dirFatId, destFatId;
+    if(this->getDirectory(sourcepath, dir, dirFatId, false) == -1 ||
+        dest.getDirectory(destpath, destDir, destFatId, false) == -1)
+    {
+        std::cout << "ERROR: No dir found\n";
+        return -1;
+    }
+    std::string file = getFile(sourcepath);
+    std::string destFile = dest.getFile(destpath);
+
+    //Making sure the first file exists
+    int index = -1;
+    for (int i = 0; i < numbEnteries(dir); i++)
+    {
+        if (dir[i].file_name == file)
+        {
+            if (dir[i].type == TYPE_DIR)
+            {
+                std::cout << "ERROR: The first needs to be a file\n";
+                return -1;
+            }
+            index = i;
+            break;
+        }
+    }
+    if (index == -1)
+    {
+        std::cout << "ERROR: Could not find file\n";
+        return -1;
+    }
+    int accessRight = dir[index].access_rights;
+    if (!(accessRight == READ || accessRight == 0x06 || accessRight == 0x07))
+    {
+        std::cout << "ERROR: Access denied\n";
+        return -1;
+    }
+
+    //Seeing if the destination is a file or directory
+    std::string name = destFile;
+    for (int i = 0; i < dest.numbEnteries(destDir); i++)
+    {
+        if (destDir[i].file_name == destFile)
+        {
+            if (destDir[i].type == TYPE_FILE)
+            {
+                std::cout << "ERROR: File already exists\n";
+                return -1;
+            }
+            dest.getDirectory(destpath, destDir, destFatId, true);
+            name = file;
+            break;
+        }
+    }
+    if (destFile == "/")
+    {
+        name = file;
+    }
+    int newIndex = dest.numbEnteries(destDir);
+    for (int i = 0; i < newIndex; i++)
+    {
+        if (destDir[i].file_name == name)
+        {
+            std::cout << "ERROR: File already exists\n";
+            return -1;
+        }
+    }
+    if (newIndex >= dest.dirEntries)
+    {
+        std::cout << "ERROR: dir is full\n";
+        return -1;
+    }
+
+    std::vector<uint8_t> batch;
+    std::vector<unsigned> blocks;
+    //A compressed stream is copied as it is, it does not depend on the block size
+    int source = dir[index].first_blk;
+    long stored = storedSize(dir[index]);
+    if (stored < 0)
+    {
+        std::cout << "ERROR: Can't read file\n";
+        return -1;
+    }
+    uint64_t remaining = stored;
+    int first = FAT_EOF, last = FAT_EOF;
+    size_t used = 0;
+    bool full = false, failed = false, done = false;
+    if (dir[index].flags & FLAG_SPARSE)
+    {
+        //Only the blocks that are not holes go over
+        if (copySparse(dir[index], dest, destDir[newIndex]) == -1)
+        {
+            dest.fat.flush();
+            return -1;
+        }
+        done = true;
+    }
+    else if ((dir[index].flags & (FLAG_PACKED | FLAG_DELAYED)) || dir[index].size <= dest.sb.pack_limit)
+    {
+        //A small file is packed the way the destination packs it, or not at all.
+        //A delayed file has nothing on the disk to copy from
+        std::string text;
+        if (readFromDisk(text, index, dir) == -1)
+        {
+            std::cout << "ERROR: Can't read file\n";
+            return -1;
+        }
+        if (dest.storeFile(text, destDir[newIndex]) == -1)
+        {
+            dest.fat.flush();
+            return -1;
+        }
+        done = true;
+    }
+    else if (dest.sb.dedup_blocks > 0)
+    {
+        //Sharing blocks with the destination needs the whole file at once
+        std::string stream;
+        if (readChain(source, remaining, stream) == -1)
+        {
+            std::cout << "ERROR: Can't read file\n";
+            return -1;
+        }
+        first = dest.writeDedup(stream);
+        dest.dedupFlush();
+        if (first == FAT_EOF)
+        {
+            dest.fat.flush();
+            return -1;
+        }
+    }
+    else
+    {
+        //Reads a batch of the source chain and writes it as whole blocks of the
+        //destination, the two block sizes do not have to match
+        do
+        {
+            blocks.clear();
+            for (int b = source; b != FAT_EOF && blocks.size() < XFER_BLOCKS &&
+                (uint64_t)blocks.size() * blockSize < remaining; b = fat.get(b))
+            {
+                blocks.push_back(b);
+            }
+            source = blocks.empty() ? FAT_EOF : fat.get(blocks.back());
+            cache.prefetch(blocks);
+
+            batch.resize(used + blocks.size() * blockSize);
+            for (size_t i = 0; i < blocks.size() && !failed; i++)
+            {
+                failed = cache.read(blocks[i], batch.data() + used + i * blockSize) == -1;
+            }
+            if (failed)
+            {
+                break;
+            }
+            size_t length = std::min(remaining, (uint64_t)blocks.size() * blockSize);
+            remaining -= length;
+            used += length;
+
+            //Whatever does not fill a destination block waits for the next batch
+            bool end = remaining == 0 || source == FAT_EOF;
+            size_t written = 0;
+            while (used - written >= (size_t)dest.blockSize || (end && (written < used || first == FAT_EOF)))
+            {
+                int block = dest.fat.findFree();
+                if (block == FAT_EOF)
+                {
+                    full = true;
+                    break;
+                }
+                dest.fat.set(block, FAT_EOF);
+                if (first == FAT_EOF)
+                {
+                    first = block;
+                }
+                else
+                {
+                    dest.fat.set(last, block);
+                }
+                last = block;
+
+                size_t chunk = std::min(used - written, (size_t)dest.blockSize);
+                std::vector<uint8_t> out(dest.blockSize, 0);
+                memcpy(out.data(), batch.data() + written, chunk);
+                dest.cache.write(block, out.data());
+                written += chunk;
+            }
+            batch.erase(batch.begin(), batch.begin() + written);
+            used -= written;
+        } while (!full && remaining > 0 && source != FAT_EOF);
+    }
+
+    if (full || failed)
+    {
+        std::cout << (full ? "ERROR: Disk is full\n" : "ERROR: Can't read file\n");
+        if (first != FAT_EOF)
+        {
+            dest.freeChain(first);
+        }
+        dest.fat.flush();
+        return -1;
+    }
+
+    strcpy(destDir[newIndex].file_name, name.c_str());
+    destDir[newIndex].type = dir[index].type;
+    destDir[newIndex].access_rights = dir[index].access_rights;
+    if (!done)
+    {
+        destDir[newIndex].size = dir[index].size;
+        destDir[newIndex].flags = dir[index].flags;
+        destDir[newIndex].first_blk = first;
+    }
+    dest.writeDirToDisk(destFatId, destDir);
+    dest.fat.flush();
+    if (dest.currentBlock == destFatId)
+    {
+        dest.readDir(dest.currentBlock, dest.workingDirectory);
+    }
+    return 0;
+}
+
+// sync gives every delayed file its blocks and writes all dirty blocks to the disk
+int
+FS::sync()
+{
+    TRACE_SPAN("FS::sync");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    placeDelayed(true);
+    if (cache.sync() == -1)
+    {
+        std::cout << "ERROR: Can't write every block to the disk, they stay dirty\n";
+        return -1;
+    }
+    return 0;
+}
+
+// snapshot create|list|delete [<name>]
+int
+FS::snapshot(std::string mode, std::string name)
+{
+    ScopeTimer timer(opLatency[OP_SNAPSHOT]);
+    TRACE_SPAN("FS::snapshot");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (mode == "list")
+    {
+        //What a snapshot holds on its own is counted on the disk
+        cache.sync();
+        std::cout << "Name\tCreated\t\t\tBlocks\tOwn\n";
+        for (unsigned slot = 0; slot < sb.log_snapshots; slot++)
+        {
+            snapshot_entry& s = sb.snapshots[slot];
+            if (s.name[0] == '\0')
+            {
+                continue;
+            }
+            time_t created = s.created;
+            char when[32];
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&created));
+            //Own blocks are the ones the live volume changed since, what deleting it frees
+            std::cout << s.name << "\t" << when << "\t" << s.blocks << "\t" << disk.snapshot_blocks(slot) << "\n";
+        }
+        return 0;
+    }
+    if (mode != "create" && mode != "delete")
+    {
+        return -1;
+    }
+    if (!writable())
+    {
+        return -1;
+    }
+    if (!disk.is_log() || sb.log_snapshots == 0)
+    {
+        std::cout << "ERROR: Snapshots need a disk formatted with -l\n";
+        return -1;
+    }
+    if (name.empty() || name.size() >= SNAPSHOT_NAME)
+    {
+        std::cout << "ERROR: Name must be 1 to " << SNAPSHOT_NAME - 1 << " characters\n";
+        return -1;
+    }
+    int found = -1, free = -1;
+    for (unsigned slot = 0; slot < sb.log_snapshots; slot++)
+    {
+        if (sb.snapshots[slot].name == name)
+        {
+            found = slot;
+        }
+        else if (sb.snapshots[slot].name[0] == '\0' && free == -1)
+        {
+            free = slot;
+        }
+    }
+
+    if (mode == "delete")
+    {
+        if (found == -1)
+        {
+            std::cout << "ERROR: No snapshot " << name << "\n";
+            return -1;
+        }
+        if (disk.has_views(found))
+        {
+            std::cout << "ERROR: Snapshot " << name << " is mounted\n";
+            return -1;
+        }
+        //The super block stops naming it first, a crash in between leaves its map unused
+        memset(&sb.snapshots[found], 0, sizeof(snapshot_entry));
+        writeSuperBlock();
+        cache.sync();
+        disk.drop_snapshot(found);
+        return 0;
+    }
+
+    if (found != -1)
+    {
+        std::cout << "ERROR: Snapshot " << name << " exists\n";
+        return -1;
+    }
+    if (free == -1)
+    {
+        std::cout << "ERROR: There is room for " << sb.log_snapshots << " snapshots\n";
+        return -1;
+    }
+    //Everything the volume holds goes to the disk, the snapshot is the map as it is then
+    placeDelayed(true);
+    fat.flush();
+    dedupFlush();
+    cache.sync();
+    if (disk.take_snapshot(free) == -1)
+    {
+        return -1;
+    }
+    snapshot_entry& s = sb.snapshots[free];
+    strncpy(s.name, name.c_str(), SNAPSHOT_NAME - 1);
+    s.created = (uint32_t)time(nullptr);
+    s.blocks = sb.no_blocks - fat.available();
+    writeSuperBlock();
+    cache.sync();
+    return 0;
+}
+
+// returns the slot of the snapshot name to mount, or -1
+int
+FS::findSnapshot(const std::string& name)
+{
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    for (unsigned slot = 0; slot < sb.log_snapshots; slot++)
+    {
+        if (sb.snapshots[slot].name == name)
+        {
+            return slot;
+        }
+    }
+    std::cout << "ERROR: No snapshot " << name << "\n";
+    return -1;
+}
+
+// trim punches every free block out of the disk file
+int
+FS::trim()
+{
+    TRACE_SPAN("FS::trim");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (!writable())
+    {
+        return 0;
+    }
+    if (!disk.can_discard())
+    {
+        std::cout << "ERROR: The disk file can not have holes punched in it\n";
+        return 0;
+    }
+    uint64_t before = disk.get_host_bytes();
+    unsigned long blocks = discardFree();
+    cache.sync();
+    uint64_t after = disk.get_host_bytes();
+    std::cout << "trimmed " << blocks << " free blocks, " << format_bytes(before > after ? before - after : 0)
+        << " given back to the host\n";
+    return 0;
+}
+
+unsigned long FS::discardFree()
+{
+    std::vector<unsigned> blocks;
+    for (unsigned b = dataStart(); b < sb.no_blocks; b++)
+    {
+        if (fat.get(b) == FAT_FREE)
+        {
+            blocks.push_back(b);
+        }
+    }
+    cache.discard(blocks);
+    return blocks.size();
+}
+
+// stats prints the disk, cache and operation counters, stats --reset clears them
+int
+FS::stats(bool reset)
+{
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (reset)
+    {
+        disk.get_stats().reset();
+        disk.get_device().reset();
+        cache.get_stats().reset();
+        cache.get_scheduler().reset_stats();
+        for (Histogram& h : opLatency)
+        {
+            h.reset();
+        }
+        dedup.written = 0;
+        dedup.found = 0;
+        std::lock_guard<std::mutex> scrubHeld(scrubState.lock);
+        scrubState.verified = 0;
+        scrubState.passes = 0;
+        return 0;
+    }
+
+    std::cout << "Disk " << disk.get_name() << "\n";
+    disk.get_stats().print(std::cout);
+    if (disk.get_device().active())
+    {
+        std::cout << "Device\n";
+        disk.get_device().print(std::cout);
+    }
+    std::cout << "Cache\n";
+    cache.get_stats().print(std::cout);
+    std::cout << "  dirty " << cache.get_dirty() << "\n";
+    std::cout << "Scheduler\n";
+    cache.get_scheduler().print(std::cout);
+    {
+        std::lock_guard<std::mutex> scrubHeld(scrubState.lock);
+        if (scrubState.verified > 0 || !scrubState.bad.empty())
+        {
+            std::cout << "Scrub\n";
+            std::cout << "  verified " << scrubState.verified << "  passes " << scrubState.passes
+                << "  bad " << scrubState.bad.size() << "\n";
+            if (!scrubState.bad.empty())
+            {
+                std::cout << "  bad blocks";
+                for (size_t i = 0; i < scrubState.bad.size() && i < SCRUB_LIST; i++)
+                {
+                    std::cout << " " << scrubState.bad[i];
+                }
+                std::cout << (scrubState.bad.size() > SCRUB_LIST ? " ...\n" : "\n");
+            }
+        }
+    }
+    if (sb.dedup_blocks > 0)
+    {
+        std::lock_guard<std::recursive_mutex> held(fsLock);
+        std::cout << "Dedup\n";
+        char line[160];
+        unsigned long blocks = dedup.written + dedup.found;
+        snprintf(line, sizeof(line), "  blocks written %lu  found stored %lu (%.1f%%)  indexed %zu\n",
+            dedup.written, dedup.found, blocks > 0 ? 100.0 * dedup.found / blocks : 0.0, dedup.index.size());
+        std::cout << line;
+    }
+    std::cout << "Operations\n";
+    const char* names[OP_COUNT] = {
+        "format", "create", "cat", "ls", "cp", "mv", "rm", "append",
+        "mkdir", "cd", "pwd", "chmod", "copyto", "defrag", "scrub",
+        "read", "write", "truncate", "prealloc", "open", "close", "get", "put", "snapshot"
+    };
+    for (int i = 0; i < OP_COUNT; i++)
+    {
+        if (opLatency[i].get_count() > 0)
+        {
+            std::cout << "  " << names[i] << std::string(9 - strlen(names[i]), ' ');
+            opLatency[i].print(std::cout);
+        }
+    }
+    return 0;
+}
+
+// record <file> logs every block request that reaches the disk to file,
+// record off stops it
+int
+FS::record(std::string path)
+{
+    if (path == "off")
+    {
+        disk.stop_recording();
+        return 0;
+    }
+    return disk.start_recording(path);
+}
+
+// device <none|hdd|ssd> [key=value ...] puts a simulated device latency model
+// under the disk, device without arguments prints the model in use
+int
+FS::device(const std::vector<std::string>& args)
+{
+    if (args.empty())
+    {
+        std::cout << "Device\n";
+        disk.get_device().print(std::cout);
+        return 0;
+    }
+    return disk.get_device().configure(args);
+}
+
+// defrag [<blocks/s>] moves every file onto consecutive blocks and reports the
+// fragmentation before and after, defrag start [<blocks/s>] does the same in the
+// background, defrag stop pauses it and defrag status reports how far it got.
+// A stopped pass carries on where it was the next time defrag runs
+int
+FS::defrag(std::string mode, unsigned rate)
+{
+    ScopeTimer timer(opLatency[OP_DEFRAG]);
+    TRACE_SPAN("FS::defrag");
+    if (mode == "stop")
+    {
+        defragStop();
+        return 0;
+    }
+    if (mode == "status")
+    {
+        std::lock_guard<std::recursive_mutex> held(fsLock);
+        frag_report now;
+        fragmentation(now);
+        std::cout << "defrag " << (defragState.running ? "running" :
+            defragState.next < defragState.files.size() ? "stopped" : "idle");
+        if (!defragState.files.empty())
+        {
+            std::cout << ", file " << defragState.next << " of " << defragState.files.size()
+                << ", " << defragState.moved << " blocks moved, " << defragState.relocated
+                << " files relocated, " << defragState.noRoom << " without room, "
+                << defragState.shared << " shared";
+        }
+        std::cout << "\n";
+        if (!defragState.files.empty())
+        {
+            std::cout << "before  ";
+            defragState.before.print(std::cout);
+        }
+        std::cout << "now     ";
+        now.print(std::cout);
+        return 0;
+    }
+    if (!writable())
+    {
+        return -1;
+    }
+    if (mode != "" && mode != "start")
+    {
+        return -1;
+    }
+    if (defragState.running)
+    {
+        std::cout << "ERROR: defrag is running in the background\n";
+        return 0;
+    }
+    if (defragState.worker.joinable())
+    {
+        defragState.worker.join();
+    }
+
+    {
+        std::lock_guard<std::recursive_mutex> held(fsLock);
+        defragState.rate = rate;
+        defragState.stop = false;
+        if (defragState.next >= defragState.files.size())
+        {
+            defragBegin();
+        }
+    }
+    if (mode == "start")
+    {
+        defragState.running = true;
+        defragState.worker = std::thread([this] {
+            Tracer::name_thread("defrag");
+            defragRun();
+            defragState.running = false;
+        });
+        return 0;
+    }
+
+    defragRun();
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    frag_report after;
+    fragmentation(after);
+    std::cout << "before  ";
+    defragState.before.print(std::cout);
+    std::cout << "after   ";
+    after.print(std::cout);
+    std::cout << defragState.moved << " blocks moved, " << defragState.relocated << " files relocated";
+    if (defragState.noRoom > 0)
+    {
+        std::cout << ", " << defragState.noRoom << " files without a long enough free run";
+    }
+    if (defragState.shared > 0)
+    {
+        std::cout << ", " << defragState.shared << " files sharing blocks left in place";
+    }
+    std::cout << "\n";
+    return 0;
+}
+
+// scrub [start|stop|status] [<blocks/s>] reads back every block in use to find
+// blocks that can not be read or fail their checksum
+int
+FS::scrub(std::string mode, unsigned rate)
+{
+    ScopeTimer timer(opLatency[OP_SCRUB]);
+    TRACE_SPAN("FS::scrub");
+    if (mode == "stop")
+    {
+        scrubStop(false);
+        return 0;
+    }
+    if (mode == "status")
+    {
+        std::lock_guard<std::recursive_mutex> held(fsLock);
+        std::lock_guard<std::mutex> scrubHeld(scrubState.lock);
+        std::cout << "scrub " << (scrubState.running ? "running" : scrubState.active ? "stopped" : "idle");
+        if (scrubState.active)
+        {
+            std::cout << ", block " << scrubState.next << " of " << sb.no_blocks;
+        }
+        std::cout << ", " << scrubState.passes << " passes, " << scrubState.verified << " blocks verified, "
+            << scrubState.bad.size() << " bad\n";
+        scrubPrintBad();
+        return 0;
+    }
+    if (!writable())
+    {
+        return -1;
+    }
+    if (mode != "" && mode != "start")
+    {
+        return -1;
+    }
+    if (scrubState.running)
+    {
+        std::cout << "ERROR: scrub is running in the background\n";
+        return 0;
+    }
+    if (scrubState.worker.joinable())
+    {
+        scrubState.worker.join();
+    }
+
+    {
+        std::lock_guard<std::recursive_mutex> held(fsLock);
+        scrubState.rate = rate;
+        scrubState.stop = false;
+        if (!scrubState.active)
+        {
+            scrubState.active = true;
+            scrubState.next = 0;
+            std::lock_guard<std::mutex> scrubHeld(scrubState.lock);
+            scrubState.bad.clear();
+        }
+    }
+    if (mode == "start")
+    {
+        std::lock_guard<std::recursive_mutex> held(fsLock);
+        scrubCheckpoint(true);
+        scrubStart();
+        return 0;
+    }
+
+    unsigned long verified = scrubState.verified;
+    scrubRun();
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    std::lock_guard<std::mutex> scrubHeld(scrubState.lock);
+    std::cout << scrubState.verified - verified << " blocks verified, " << scrubState.bad.size() << " bad\n";
+    scrubPrintBad();
+    return 0;
+}
+
+void frag_report::print(std::ostream& out)
+{
+    char line[128];
+    snprintf(line, sizeof(line), "files %u  fragmented %u (%.1f%%)  blocks %lu  extents %lu (%.2f per file)\n",
+        files, fragmented, files > 0 ? 100.0 * fragmented / files : 0.0, blocks, extents,
+        files > 0 ? (double)extents / files : 0.0);
+    out << line;
+}
+
+void FS::walkTree(int block, const std::string& path,
+    const std::function<void(int, const std::string&, dir_entry&)>& visit)
+{
+    std::vector<std::pair<int, std::string>> pending(1, std::make_pair(block, path));
+    std::vector<int> seen(1, block);
+    std::vector<dir_entry> dir(dirEntries);
+    while (!pending.empty())
+    {
+        std::pair<int, std::string> current = pending.back();
+        pending.pop_back();
+        //What is below a directory that can not be read is left out
+        if (readDir(current.first, dir) == -1)
+        {
+            continue;
+        }
+        for (int i = 0; i < dirEntries; i++)
+        {
+            if (dir[i].type == TYPE_EMPTY || strcmp(dir[i].file_name, "..") == 0)
+            {
+                continue;
+            }
+            visit(current.first, current.second, dir[i]);
+            //A damaged disk may link a directory twice
+            if (dir[i].type == TYPE_DIR &&
+                std::find(seen.begin(), seen.end(), (int)dir[i].first_blk) == seen.end())
+            {
+                seen.push_back(dir[i].first_blk);
+                std::string sub = current.second == "/" ? "/" : current.second + "/";
+                pending.push_back(std::make_pair((int)dir[i].first_blk, sub + dir[i].file_name));
+            }
+        }
+    }
+}
+
+void FS::chainOf(int block, std::vector<int>& blocks)
+{
+    blocks.clear();
+    //A chain never has more blocks than the disk, a longer one loops
+    while (block != FAT_EOF && block != FAT_FREE && (unsigned)block < sb.no_blocks &&
+        blocks.size() < sb.no_blocks)
+    {
+        blocks.push_back(block);
+        block = fat.get(block);
+    }
+}
+
+void FS::blocksOf(const dir_entry& entry, std::vector<int>& blocks)
+{
+    if (entry.type == TYPE_FILE && (entry.flags & FLAG_DELAYED))
+    {
+        blocks.clear();
+        return;
+    }
+    chainOf(entry.first_blk, blocks);
+    if (!(entry.flags & FLAG_SPARSE))
+    {
+        return;
+    }
+    size_t perMap = blockSize / sizeof(uint32_t);
+    uint64_t count = ((uint64_t)entry.size + blockSize - 1) / blockSize;
+    size_t maps = blocks.size();
+    std::vector<uint32_t> map(perMap);
+    for (size_t m = 0; m < maps && m * perMap < count; m++)
+    {
+        if (cache.read(blocks[m], (uint8_t*)map.data()) == -1)
+        {
+            continue;
+        }
+        for (size_t i = 0; i < perMap && m * perMap + i < count; i++)
+        {
+            uint32_t block = map[i] & ~MAP_UNWRITTEN;
+            if (block != 0 && block < sb.no_blocks)
+            {
+                blocks.push_back(block);
+            }
+        }
+    }
+}
+
+void FS::fragmentation(frag_report& report)
+{
+    report = frag_report();
+    std::vector<int> blocks;
+    walkTree(ROOT_BLOCK, "/", [&](int, const std::string&, dir_entry& entry) {
+        if (entry.type != TYPE_FILE)
+        {
+            return;
+        }
+        blocksOf(entry, blocks);
+        unsigned long extents = blocks.empty() ? 0 : 1;
+        for (size_t i = 1; i < blocks.size(); i++)
+        {
+            if (blocks[i] != blocks[i - 1] + 1)
+            {
+                extents++;
+            }
+        }
+        report.files++;
+        report.blocks += blocks.size();
+        report.extents += extents;
+        if (extents > 1)
+        {
+            report.fragmented++;
+        }
+    });
+}
+
+void FS::defragBegin()
+{
+    defragState.files.clear();
+    defragState.next = 0;
+    defragState.moved = 0;
+    defragState.relocated = 0;
+    defragState.noRoom = 0;
+    defragState.shared = 0;
+    //Delayed files get their blocks first, the pass starts from where they went
+    placeDelayed(true);
+    fragmentation(defragState.before);
+    walkTree(ROOT_BLOCK, "/", [this](int, const std::string& path, dir_entry& entry) {
+        //The blocks of a sparse file are found through its map, they stay where they are
+        if (entry.type == TYPE_FILE && !(entry.flags & (FLAG_SPARSE | FLAG_DELAYED)))
+        {
+            defragState.files.push_back(std::make_pair(path, std::string(entry.file_name)));
+        }
+    });
+}
+
+bool FS::defragRun()
+{
+    while (true)
+    {
+        unsigned long moved;
+        {
+            std::lock_guard<std::recursive_mutex> held(fsLock);
+            {
+                std::lock_guard<std::mutex> stopHeld(defragState.lock);
+                if (defragState.stop)
+                {
+                    return false;
+                }
+            }
+            if (defragState.next >= defragState.files.size())
+            {
+                return true;
+            }
+            moved = defragState.moved;
+            std::pair<std::string, std::string> file = defragState.files[defragState.next];
+            defragFile(file.first, file.second);
+            defragState.next++;
+            moved = defragState.moved - moved;
+        }
+
+        //Throttled by sleeping off the time the moved blocks are worth, without the lock
+        if (defragState.rate > 0 && moved > 0)
+        {
+            std::unique_lock<std::mutex> stopHeld(defragState.lock);
+            defragState.wake.wait_for(stopHeld, std::chrono::microseconds(moved * 1000000 / defragState.rate),
+                [this] { return defragState.stop; });
+        }
+    }
+}
+
+void FS::defragFile(const std::string& dirPath, const std::string& name)
+{
+    TRACE_SPAN("FS::defragFile");
+    //The file may have been moved or removed since the pass started
+    std::vector<dir_entry> dir(dirEntries);
+    int dirBlock;
+    if (getDirectory(dirPath, dir, dirBlock, true) == -1)
+    {
+        return;
+    }
+    int index = -1;
+    for (int i = 0; i < dirEntries; i++)
+    {
+        if (dir[i].type == TYPE_FILE && dir[i].file_name == name)
+        {
+            index = i;
+            break;
+        }
+    }
+    if (index == -1 || (dir[index].flags & (FLAG_SPARSE | FLAG_DELAYED)))
+    {
+        return;
+    }
+
+    std::vector<int> blocks;
+    chainOf(dir[index].first_blk, blocks);
+    bool contiguous = true;
+    for (size_t i = 1; i < blocks.size(); i++)
+    {
+        if (blocks[i] != blocks[i - 1] + 1)
+        {
+            contiguous = false;
+            break;
+        }
+    }
+    if (contiguous)
+    {
+        return;
+    }
+    for (int block : blocks)
+    {
+        //Moving a shared block would take it from the other files
+        if (!dedup.refs.empty() && dedup.refs[block] > 1)
+        {
+            defragState.shared++;
+            return;
+        }
+    }
+    int run = fat.findFreeRun(blocks.size());
+    if (run == FAT_EOF)
+    {
+        defragState.noRoom++;
+        return;
+    }
+
+    //The copy and its chain reach the disk before the entry points at them,
+    //and the old chain is freed only after, so a crash loses no data
+    std::vector<uint8_t> buffer(blockSize);
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        //A block that fails its checksum is left where it is, a copy would pass
+        if (cache.read(blocks[i], buffer.data()) == -1)
+        {
+            for (size_t j = 0; j < i; j++)
+            {
+                fat.set(run + j, FAT_FREE);
+            }
+            return;
+        }
+        cache.write(run + i, buffer.data());
+        fat.set(run + i, i + 1 < blocks.size() ? run + i + 1 : FAT_EOF);
+        dedupPrint(run + i, buffer.data());
+    }
+    dedupFlush();
+    fat.flush();
+    cache.sync();
+
+    dir[index].first_blk = run;
+    writeDirToDisk(dirBlock, dir);
+    cache.sync();
+    freeChain(blocks[0]);
+    dedupAdd(run);
+    fat.flush();
+    if (currentBlock == dirBlock)
+    {
+        readDir(currentBlock, this->workingDirectory);
+    }
+    defragState.moved += blocks.size();
+    defragState.relocated++;
+}
+
+void FS::defragStop()
+{
+    {
+        std::lock_guard<std::mutex> stopHeld(defragState.lock);
+        defragState.stop = true;
+    }
+    defragState.wake.notify_all();
+    if (defragState.worker.joinable())
+    {
+        defragState.worker.join();
+    }
+}
+
+void FS::scrubStart()
+{
+    scrubState.running = true;
+    scrubState.worker = std::thread([this] {
+        Tracer::name_thread("scrub");
+        scrubRun();
+        scrubState.running = false;
+    });
+}
+
+bool FS::scrubRun()
+{
+    std::vector<uint8_t> buffer;
+    std::vector<unsigned> bad;
+    while (true)
+    {
+        unsigned start, count = 0;
+        unsigned long epoch;
+        {
+            std::lock_guard<std::recursive_mutex> held(fsLock);
+            {
+                std::lock_guard<std::mutex> stopHeld(scrubState.lock);
+                if (scrubState.stop)
+                {
+                    return false;
+                }
+            }
+            //Free blocks are skipped a bounded number at a time, so the lock is not held long
+            unsigned limit = std::min(sb.no_blocks, scrubState.next + SCRUB_SCAN);
+            while (scrubState.next < limit && fat.get(scrubState.next) == FAT_FREE)
+            {
+                scrubState.next++;
+            }
+            if (scrubState.next >= sb.no_blocks)
+            {
+                scrubState.active = false;
+                scrubState.next = 0;
+                {
+                    std::lock_guard<std::mutex> scrubHeld(scrubState.lock);
+                    scrubState.passes++;
+                }
+                scrubCheckpoint(false);
+                return true;
+            }
+            start = scrubState.next;
+            while (count < SCRUB_BATCH && start + count < limit && fat.get(start + count) != FAT_FREE)
+            {
+                count++;
+            }
+            scrubState.next = start + count;
+            epoch = scrubState.epoch;
+            buffer.resize((size_t)count * blockSize);
+        }
+        if (count == 0)
+        {
+            continue;
+        }
+
+        //Read without the lock and behind every other request, straight from
+        //the disk since a cached copy would not show what is wrong with it
+        IoScheduler& sched = cache.get_scheduler();
+        bad.clear();
+        if (sched.io(IO_READ, start, count, buffer.data(), true) == -1)
+        {
+            //One block at a time to find the ones that fail
+            for (unsigned i = 0; i < count; i++)
+            {
+                if (sched.io(IO_READ, start + i, 1, buffer.data(), true) == -1)
+                {
+                    bad.push_back(start + i);
+                }
+            }
+        }
+
+        {
+            std::lock_guard<std::recursive_mutex> held(fsLock);
+            if (epoch != scrubState.epoch)
+            {
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> scrubHeld(scrubState.lock);
+                scrubState.verified += count;
+                scrubState.bad.insert(scrubState.bad.end(), bad.begin(), bad.end());
+            }
+            scrubState.sinceCheckpoint += count;
+            if (scrubState.sinceCheckpoint >= SCRUB_CHECKPOINT)
+            {
+                scrubState.sinceCheckpoint = 0;
+                scrubCheckpoint(scrubState.running);
+            }
+        }
+
+        //Throttled by sleeping off the time the blocks are worth, without the lock
+        if (scrubState.rate > 0)
+        {
+            std::unique_lock<std::mutex> stopHeld(scrubState.lock);
+            scrubState.wake.wait_for(stopHeld, std::chrono::microseconds((uint64_t)count * 1000000 / scrubState.rate),
+                [this] { return scrubState.stop; });
+        }
+    }
+}
+
+void FS::scrubStop(bool resume)
+{
+    bool running = scrubState.running;
+    {
+        std::lock_guard<std::mutex> stopHeld(scrubState.lock);
+        scrubState.stop = true;
+    }
+    scrubState.wake.notify_all();
+    if (scrubState.worker.joinable())
+    {
+        scrubState.worker.join();
+    }
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    scrubCheckpoint(resume && running);
+}
+
+void FS::scrubCheckpoint(bool running)
+{
+    uint32_t next = scrubState.active ? scrubState.next : 0;
+    uint32_t rate = scrubState.active ? scrubState.rate : 0;
+    uint32_t state = scrubState.active && running ? 1 : 0;
+    if (sb.scrub_next == next && sb.scrub_rate == rate && sb.scrub_running == state)
+    {
+        return;
+    }
+    sb.scrub_next = next;
+    sb.scrub_rate = rate;
+    sb.scrub_running = state;
+    writeSuperBlock();
+}
+
+void FS::scrubPrintBad()
+{
+    if (scrubState.bad.empty())
+    {
+        return;
+    }
+    std::vector<std::string> owners(scrubState.bad.size());
+    walkTree(ROOT_BLOCK, "/", [&](int, const std::string& path, dir_entry& entry) {
+        std::vector<int> blocks;
+        blocksOf(entry, blocks);
+        for (int block : blocks)
+        {
+            for (size_t i = 0; i < scrubState.bad.size(); i++)
+            {
+                if (scrubState.bad[i] == (unsigned)block)
+                {
+                    owners[i] = (path == "/" ? "/" : path + "/") + entry.file_name;
+                }
+            }
+        }
+    });
+    for (size_t i = 0; i < scrubState.bad.size(); i++)
+    {
+        std::cout << "  bad block " << scrubState.bad[i];
+        if (!owners[i].empty())
+        {
+            std::cout << " in " << owners[i] << "\n";
+        }
+        else
+        {
+            std::cout << (scrubState.bad[i] < dataStart() ? " in the metadata\n" : " in no file\n");
+        }
+    }
+}
+
+//Returns false and says so on a read-only snapshot, otherwise takes the room
+//snapshots hold off the free space before a change
+bool FS::writable()
+{
+    if (readOnly)
+    {
+        std::cout << "ERROR: The volume is a read-only snapshot\n";
+        return false;
+    }
+    //Old data snapshots hold takes room in the log the FAT does not know of. Every
+    //dirty or freed block not yet written back may leave another copy behind, near
+    //full they are written back to know for sure
+    if (disk.is_log())
+    {
+        fat.pin(disk.log_pinned());
+        if (disk.has_snapshots())
+        {
+            unsigned long unsettled = cache.get_dirty() + cache.get_discards();
+            if (fat.available() <= unsettled)
+            {
+                cache.sync();
+                fat.pin(disk.log_pinned());
+            }
+            else
+            {
+                fat.pin(disk.log_pinned() + unsettled);
+            }
+        }
+    }
+    return true;
+}
+
+void FS::writeSuperBlock()
+{
+    //Also written by format before the new geometry is mounted
+    std::vector<uint8_t> block(sb.block_size, 0);
+    memcpy(block.data(), &sb, sizeof(sb));
+    cache.write(SUPER_BLOCK, block.data());
+}
+
+// fsinfo reports used and free blocks, the largest free extent, how many extents
+// the files are in, the most fragmented files and a map of block usage
+int
+FS::fsinfo()
+{
+    TRACE_SPAN("FS::fsinfo");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    char line[160];
+    unsigned metadata = dataStart();
+
+    //Free space straight from the FAT
+    unsigned cells = FSINFO_MAP_COLS * FSINFO_MAP_ROWS;
+    unsigned perCell = (sb.no_blocks + cells - 1) / cells;
+    std::vector<unsigned> cellUsed((sb.no_blocks + perCell - 1) / perCell, 0);
+    unsigned long freeBlocks = 0, freeExtents = 0;
+    unsigned run = 0, largest = 0, largestAt = 0;
+    for (unsigned i = 0; i < sb.no_blocks; i++)
+    {
+        if (fat.get(i) == FAT_FREE)
+        {
+            freeBlocks++;
+            if (run++ == 0)
+            {
+                freeExtents++;
+            }
+            if (run > largest)
+            {
+                largest = run;
+                largestAt = i + 1 - run;
+            }
+        }
+        else
+        {
+            run = 0;
+            cellUsed[i / perCell]++;
+        }
+    }
+
+    //Files and directories from the tree
+    unsigned dirs = 1;
+    unsigned long dirBlocks = 1, fileBlocks = 0;
+    unsigned compressed = 0;
+    unsigned long packedBlocks = 0, plainBlocks = 0; // blocks of compressed files as they are and would be
+    unsigned packed = 0;
+    unsigned long packedBytes = 0, sharedBlocks = 0; // of packed files and the blocks they share
+    unsigned sparse = 0;
+    unsigned long sparseBlocks = 0, sparseSpan = 0; // blocks sparse files take and would as chains
+    unsigned delayed = 0;
+    unsigned long delayedBytes = 0; // of files that have no blocks yet
+    std::vector<bool> inFile(sb.no_blocks, false);
+    unsigned long distinct = 0; // file blocks counted once however many files share them
+    std::vector<std::pair<unsigned long, std::string>> files; // extents and path
+    std::vector<int> blocks;
+    walkTree(ROOT_BLOCK, "/", [&](int, const std::string& path, dir_entry& entry) {
+        if (entry.type == TYPE_DIR)
+        {
+            dirs++;
+            dirBlocks++;
+            return;
+        }
+        if (entry.flags & FLAG_PACKED)
+        {
+            packed++;
+            packedBytes += entry.size;
+            if (entry.first_blk < sb.no_blocks && !inFile[entry.first_blk])
+            {
+                inFile[entry.first_blk] = true;
+                distinct++;
+                sharedBlocks++;
+            }
+            files.push_back(std::make_pair(1ul, (path == "/" ? "/" : path + "/") + entry.file_name));
+            return;
+        }
+        if (entry.flags & FLAG_DELAYED)
+        {
+            delayed++;
+            delayedBytes += entry.size;
+            return;
+        }
+        blocksOf(entry, blocks);
+        unsigned long extents = blocks.empty() ? 0 : 1;
+        for (size_t i = 1; i < blocks.size(); i++)
+        {
+            if (blocks[i] != blocks[i - 1] + 1)
+            {
+                extents++;
+            }
+        }
+        fileBlocks += blocks.size();
+        for (int block : blocks)
+        {
+            if (!inFile[block])
+            {
+                inFile[block] = true;
+                distinct++;
+            }
+        }
+        if (entry.flags & FLAG_SPARSE)
+        {
+            sparse++;
+            sparseBlocks += blocks.size();
+            sparseSpan += std::max(1ul, ((unsigned long)entry.size + blockSize - 1) / blockSize);
+        }
+        if (entry.flags & FLAG_COMPRESSED)
+        {
+            compressed++;
+            packedBlocks += blocks.size();
+            plainBlocks += std::max(1ul, ((unsigned long)entry.size + blockSize - 1) / blockSize);
+        }
+        files.push_back(std::make_pair(extents, (path == "/" ? "/" : path + "/") + entry.file_name));
+    });
+
+    unsigned long used = sb.no_blocks - freeBlocks;
+    std::cout << "Disk " << disk.get_name() << ", " << sb.no_blocks << " blocks of " << blockSize << " bytes";
+    std::cout << (sb.csum_blocks > 0 ? ", checksummed" : "") << (sb.compress ? ", compressed" : "")
+        << (sb.dedup_blocks > 0 ? ", deduplicated" : "") << (sb.pack_limit > 0 ? ", packed" : "")
+        << (sb.log_map_blocks > 0 ? ", log-structured\n" : "\n");
+    snprintf(line, sizeof(line), "  used %lu (%.1f%%)  free %lu (%.1f%%)\n", used,
+        100.0 * used / sb.no_blocks, freeBlocks, 100.0 * freeBlocks / sb.no_blocks);
+    std::cout << line;
+    std::cout << "  host " << format_bytes(disk.get_host_bytes()) << " of " << format_bytes(disk.get_disk_size())
+        << " allocated" << (disk.can_discard() ? "\n" : ", freed blocks are not punched out\n");
+    std::cout << "  metadata " << metadata << "  directories " << dirs << " in " << dirBlocks
+        << " blocks  files " << files.size() << " in " << distinct << " blocks\n";
+    if (used > metadata + dirBlocks + distinct)
+    {
+        std::cout << "  unreachable " << used - metadata - dirBlocks - distinct << "\n";
+    }
+    //Blocks of packed files are shared by design, only chains count here
+    unsigned long chained = distinct - sharedBlocks;
+    if (fileBlocks > chained)
+    {
+        snprintf(line, sizeof(line), "  shared %lu blocks of files are stored once, %lu saved (%.1f%%)\n",
+            fileBlocks, fileBlocks - chained, 100.0 * (fileBlocks - chained) / fileBlocks);
+        std::cout << line;
+    }
+    if (packed > 0)
+    {
+        snprintf(line, sizeof(line), "  packed %u files of %lu bytes in %lu blocks, %lu blocks saved\n",
+            packed, packedBytes, sharedBlocks, packed - sharedBlocks);
+        std::cout << line;
+    }
+    if (sparse > 0)
+    {
+        snprintf(line, sizeof(line), "  sparse %u files of %lu blocks in %lu blocks with their maps\n",
+            sparse, sparseSpan, sparseBlocks);
+        std::cout << line;
+    }
+    if (delayed > 0)
+    {
+        snprintf(line, sizeof(line), "  delayed %u files of %lu bytes wait for their blocks, %lu reserved\n",
+            delayed, delayedBytes, delay.blocks);
+        std::cout << line;
+    }
+    if (disk.is_log())
+    {
+        unsigned freeSegments = 0, segments = 0;
+        disk.get_log_segments(freeSegments, segments);
+        snprintf(line, sizeof(line), "  log %u of %u segments of %u blocks free, %u blocks on the disk\n",
+            freeSegments, segments, LOG_SEGMENT_BLOCKS, sb.log_blocks);
+        std::cout << line;
+        unsigned snapshots = 0;
+        unsigned long own = 0;
+        for (unsigned slot = 0; slot < sb.log_snapshots; slot++)
+        {
+            if (sb.snapshots[slot].name[0] != '\0')
+            {
+                snapshots++;
+                own += disk.snapshot_blocks(slot);
+            }
+        }
+        if (snapshots > 0)
+        {
+            snprintf(line, sizeof(line), "  snapshots %u hold %lu blocks the volume no longer uses\n", snapshots, own);
+            std::cout << line;
+        }
+    }
+    if (compressed > 0)
+    {
+        snprintf(line, sizeof(line), "  compressed %u files in %lu blocks, %lu uncompressed (%.1f%% saved)\n",
+            compressed, packedBlocks, plainBlocks, 100.0 * (plainBlocks - packedBlocks) / plainBlocks);
+        std::cout << line;
+    }
+    std::cout << "  free extents " << freeExtents << "  largest " << largest;
+    if (largest > 0)
+    {
+        std::cout << " at block " << largestAt;
+    }
+    std::cout << " (" << format_bytes((uint64_t)largest * blockSize) << ")\n";
+
+    //Files by number of extents, in powers of two
+    std::cout << "Extents per file\n";
+    std::vector<unsigned> buckets;
+    for (auto& f : files)
+    {
+        unsigned b = 0;
+        while (f.first > (1ul << b))
+        {
+            b++;
+        }
+        if (b >= buckets.size())
+        {
+            buckets.resize(b + 1, 0);
+        }
+        buckets[b]++;
+    }
+    for (unsigned b = 0; b < buckets.size(); b++)
+    {
+        std::string range = b < 2 ? std::to_string(b + 1) :
+            std::to_string((1ul << (b - 1)) + 1) + "-" + std::to_string(1ul << b);
+        unsigned bar = files.empty() ? 0 : (buckets[b] * 40 + files.size() - 1) / files.size();
+        snprintf(line, sizeof(line), "  %-11s %6u  %s\n", range.c_str(), buckets[b], std::string(bar, '#').c_str());
+        std::cout << line;
+    }
+
+    std::sort(files.begin(), files.end(), [](const std::pair<unsigned long, std::string>& a,
+        const std::pair<unsigned long, std::string>& b) { return a.first > b.first; });
+    if (!files.empty() && files[0].first > 1)
+    {
+        std::cout << "Most fragmented\n";
+        for (size_t i = 0; i < files.size() && i < FSINFO_WORST && files[i].first > 1; i++)
+        {
+            snprintf(line, sizeof(line), "  %6lu  %s\n", files[i].first, files[i].second.c_str());
+            std::cout << line;
+        }
+    }
+
+    //One character per cell, darker the more of its blocks are used
+    const char shades[] = " .:-=+*#%@";
+    std::cout << "Block map, " << perCell << " blocks per cell, ' ' free to '@' full\n";
+    for (unsigned row = 0; row * FSINFO_MAP_COLS < cellUsed.size(); row++)
+    {
+        snprintf(line, sizeof(line), "  %8u |", row * FSINFO_MAP_COLS * perCell);
+        std::string map = line;
+        for (unsigned col = 0; col < FSINFO_MAP_COLS && row * FSINFO_MAP_COLS + col < cellUsed.size(); col++)
+        {
+            unsigned cell = row * FSINFO_MAP_COLS + col;
+            unsigned size = std::min(perCell, sb.no_blocks - cell * perCell);
+            unsigned taken = cellUsed[cell];
+            map += taken == 0 ? shades[0] : shades[1 + (taken * 9 - 1) / size];
+        }
+        std::cout << map << "|\n";
+    }
+    return 0;
+}
+
+// fsck checks every directory entry and FAT chain on threads threads (0 for one per
+// core) and reports what is wrong, fsck -r also repairs it. Returns the number of
+// problems found
+int
+FS::fsck(bool repair, unsigned threads)
+{
+    TRACE_SPAN("FS::fsck");
+    std::lock_guard<std::recursive_mutex> held(fsLock);
+    if (repair && !writable())
+    {
+        return 0;
+    }
+    //What is still delayed is checked where it is going to be
+    placeDelayed(true);
+    Checker checker(*this, threads);
+    return checker.run(repair);
+}
+
+// When firstAdd is false the text is added to a file, FirstBlock is then the
+// last block of that file and the last fileSize bytes of fileText are written
+int FS::writeToDisk(std::string fileText, int fileSize, int &FirstBlock, bool firstAdd, bool contiguous)
+{
+    TRACE_SPAN("FS::writeToDisk");
+    std::string fixedText;
+    int lastBlock = FirstBlock, count = 0;
+    int offset = firstAdd ? 0 : fileText.size() - fileSize;
+    int run = firstAdd && contiguous && fileSize > blockSize ?
+        fat.findFreeRun((fileSize + blockSize - 1) / blockSize) : FAT_EOF;
+
+    do
+    {
+        int block = run != FAT_EOF ? run + count : fat.findFree();
+        if (block == FAT_EOF)
+        {
+            std::cout << "ERROR: Disk is full\n";
+            return -1;
+        }
+        fat.set(block, FAT_EOF);
+
+        if (firstAdd)
+        {
+            FirstBlock = block;
+            firstAdd = false;
+        }
+        else
+        {
+            //Adding to new disk block if file was too big
+            fat.set(lastBlock, block);
+        }
+        fixedText = fileText.substr(offset + blockSize * count, blockSize);
+        fixedText.resize(blockSize);
+        cache.write(block, (uint8_t*)fixedText.c_str());
+        count++;
+
+        //Checking if file is bigger than disk block
+        fileSize -= blockSize;
+        lastBlock = block;
+    } while (fileSize > 0);
+    return 0;
+}
+
+int FS::storeFile(const std::string& text, dir_entry& entry, bool contiguous)
+{
+    if (text.size() <= sb.pack_limit)
+    {
+        return packFile(text, entry);
+    }
+    if (text.size() > (size_t)blockSize && zeroBlock(text, blockSize))
+    {
+        return storeSparse(text, entry);
+    }
+    const std::string *data = &text;
+    std::string stream;
+    uint16_t flags = 0;
+    if (sb.compress)
+    {
+        stream = compress_file(text);
+        if ((stream.size() + blockSize - 1) / blockSize < (text.size() + blockSize - 1) / blockSize)
+        {
+            data = &stream;
+            flags = FLAG_COMPRESSED;
+        }
+    }
+
+    int block = -1;
+    if (sb.dedup_blocks > 0)
+    {
+        block = writeDedup(*data);
+        dedupFlush();
+    }
+    else if (writeToDisk(*data, data->size(), block, true, contiguous) == -1)
+    {
+        if (block != -1)
+        {
+            freeChain(block);
+        }
+        block = FAT_EOF;
+    }
+    if (block == FAT_EOF)
+    {
+        return -1;
+    }
+    entry.size = text.size();
+    entry.first_blk = block;
+    entry.flags = flags;
+    return 0;
+}
+
+int FS::storeDelayed(const std::string& text, dir_entry& entry)
+{
+    unsigned long need = delayBlocks(text.size());
+    if (!fat.reserve(need))
+    {
+        //Too little room to promise it, the blocks are taken now if there are any
+        return storeFile(text, entry);
+    }
+    uint32_t key = delay.next++;
+    delay.files[key] = Delay::File{text, need, std::chrono::steady_clock::now()};
+    delay.blocks += need;
+    entry.size = text.size();
+    entry.first_blk = key;
+    entry.flags = FLAG_DELAYED;
+    delayStart();
+    return 0;
+}
+
+unsigned long FS::delayBlocks(uint64_t size)
+{
+    unsigned long blocks = std::max((uint64_t)1, (size + blockSize - 1) / blockSize);
+    //A file stored sparse has a hole of at least a block, its map may need more than that
+    return size > (uint64_t)blockSize ? blocks + mapBlocks(size) - 1 : blocks;
+}
+
+void FS::placeDelayed(bool all)
+{
+    if (delay.files.empty())
+    {
+        return;
+    }
+    auto due = std::chrono::steady_clock::now() - std::chrono::milliseconds(DELAY_EXPIRE_MS);
+    auto ready = [&](const dir_entry& entry) {
+        if (entry.type != TYPE_FILE || !(entry.flags & FLAG_DELAYED))
+        {
+            return delay.files.end();
+        }
+        auto file = delay.files.find(entry.first_blk);
+        return file != delay.files.end() && (all || file->second.since <= due) ? file : delay.files.end();
+    };
+    if (!all && std::none_of(delay.files.begin(), delay.files.end(),
+        [&](const std::pair<const uint32_t, Delay::File>& file) { return file.second.since <= due; }))
+    {
+        return;
+    }
+    TRACE_SPAN("FS::placeDelayed");
+
+    //The directories are written once each, however many of their files are placed
+    std::vector<int> dirs;
+    walkTree(ROOT_BLOCK, "/", [&](int dirBlock, const std::string&, dir_entry& entry) {
+        if (ready(entry) != delay.files.end() && std::find(dirs.begin(), dirs.end(), dirBlock) == dirs.end())
+        {
+            dirs.push_back(dirBlock);
+        }
+    });
+    std::vector<dir_entry> dir(dirEntries);
+    for (int dirBlock : dirs)
+    {
+        if (readDir(dirBlock, dir) == -1)
+        {
+            continue;
+        }
+        for (dir_entry& entry : dir)
+        {
+            auto file = ready(entry);
+            if (file == delay.files.end())
+            {
+                continue;
+            }
+            //The reservation becomes the blocks themselves, the whole file is known
+            //now so it can have one run
+            fat.unreserve(file->second.blocks);
+            delay.blocks -= file->second.blocks;
+            file->second.blocks = 0;
+            if (storeFile(file->second.data, entry, true) == 0)
+            {
+                delay.files.erase(file);
+            }
+        }
+        writeDirToDisk(dirBlock, dir);
+    }
+    fat.flush();
+    if (std::find(dirs.begin(), dirs.end(), currentBlock) != dirs.end())
+    {
+        readDir(currentBlock, this->workingDirectory);
+    }
+}
+
+void FS::delayMount()
+{
+    TRACE_SPAN("FS::delayMount");
+    std::vector<int> dirs;
+    walkTree(ROOT_BLOCK, "/", [&](int dirBlock, const std::string&, dir_entry& entry) {
+        if (entry.type == TYPE_FILE && (entry.flags & FLAG_DELAYED) &&
+            std::find(dirs.begin(), dirs.end(), dirBlock) == dirs.end())
+        {
+            dirs.push_back(dirBlock);
+        }
+    });
+    std::vector<dir_entry> dir(dirEntries);
+    for (int dirBlock : dirs)
+    {
+        if (readDir(dirBlock, dir) == -1)
+        {
+            continue;
+        }
+        //From the back, so the last entry that takes the place of a removed one was seen
+        for (int i = dirEntries - 1; i >= 0; i--)
+        {
+            if (dir[i].type != TYPE_FILE || !(dir[i].flags & FLAG_DELAYED))
+            {
+                continue;
+            }
+            //The name is all that is left, the data was only ever in memory
+            std::cout << "Delayed file " << dir[i].file_name << " was never written, it is left empty\n";
+            if (storeFile(std::string(), dir[i]) == -1)
+            {
+                int last = dirEntries - 1;
+                while (last > i && dir[last].type == TYPE_EMPTY)
+                {
+                    last--;
+                }
+                dir[i] = dir[last];
+                dir[last].type = TYPE_EMPTY;
+            }
+        }
+        writeDirToDisk(dirBlock, dir);
+    }
+    if (!dirs.empty())
+    {
+        fat.flush();
+    }
+}
+
+void FS::delayStart()
+{
+    if (!delay.worker.joinable())
+    {
+        delay.stop = false;
+        delay.worker = std::thread(&FS::delayRun, this);
+    }
+    if (delay.blocks > DELAY_MAX_BLOCKS)
+    {
+        std::lock_guard<std::mutex> held(delay.lock);
+        delay.urgent = true;
+        delay.wake.notify_one();
+    }
+}
+
+void FS::delayRun()
+{
+    std::unique_lock<std::mutex> held(delay.lock);
+    while (!delay.stop)
+    {
+        delay.wake.wait_for(held, std::chrono::milliseconds(FLUSH_INTERVAL_MS),
+            [this] { return delay.stop || delay.urgent; });
+        if (delay.stop)
+        {
+            break;
+        }
+        bool all = delay.urgent;
+        delay.urgent = false;
+        //Never waits for the file system lock holding its own, see delayStart()
+        held.unlock();
+        {
+            std::lock_guard<std::recursive_mutex> fsHeld(fsLock);
+            placeDelayed(all);
+        }
+        held.lock();
+    }
+}
+
+void FS::delayStop()
+{
+    {
+        std::lock_guard<std::mutex> held(delay.lock);
+        delay.stop = true;
+        delay.wake.notify_one();
+    }
+    if (delay.worker.joinable())
+    {
+        delay.worker.join();
+    }
+}
+
+int FS::packFile(const std::string& data, dir_entry& entry)
+{
+    TRACE_SPAN("FS::packFile");
+    unsigned perBlock = blockSize / PACK_UNIT;
+    unsigned need = std::max((size_t)1, (data.size() + PACK_UNIT - 1) / PACK_UNIT);
+    std::vector<uint8_t> buffer(blockSize);
+    int block = FAT_EOF;
+    unsigned start = 0;
+    //Takes the first run of need free units of a block that can be read
+    auto fits = [&](std::map<unsigned, Pack::Shared>::iterator shared) {
+        if (shared == pack.blocks.end() || shared->second.free < need)
+        {
+            return false;
+        }
+        unsigned run = 0;
+        for (unsigned u = 0; u < perBlock; u++)
+        {
+            run = shared->second.taken[u] ? 0 : run + 1;
+            if (run == need)
+            {
+                if (cache.read(shared->first, buffer.data()) == -1)
+                {
+                    return false;
+                }
+                block = shared->first;
+                start = u + 1 - need;
+                return true;
+            }
+        }
+        return false;
+    };
+    //Files written one after the other go together, they are often read together
+    if (!fits(pack.blocks.find(pack.last)))
+    {
+        auto shared = pack.blocks.begin();
+        while (shared != pack.blocks.end() && !fits(shared))
+        {
+            shared++;
+        }
+    }
+    if (block == FAT_EOF)
+    {
+        block = fat.findFree();
+        if (block == FAT_EOF)
+        {
+            std::cout << "ERROR: Disk is full\n";
+            return -1;
+        }
+        fat.set(block, FAT_EOF);
+        pack.blocks[block] = Pack::Shared{std::vector<bool>(perBlock, false), perBlock};
+        std::fill(buffer.begin(), buffer.end(), 0);
+    }
+
+    memcpy(buffer.data() + start * PACK_UNIT, data.data(), data.size());
+    cache.write(block, buffer.data());
+    Pack::Shared& shared = pack.blocks[block];
+    for (unsigned u = start; u < start + need; u++)
+    {
+        shared.taken[u] = true;
+    }
+    shared.free -= need;
+    pack.last = block;
+    entry.size = data.size();
+    entry.first_blk = block;
+    entry.flags = FLAG_PACKED | start << PACK_SHIFT;
+    return 0;
+}
+
+void FS::packMount()
+{
+    TRACE_SPAN("FS::packMount");
+    unsigned perBlock = blockSize / PACK_UNIT;
+    pack.blocks.clear();
+    pack.last = FAT_EOF;
+    walkTree(ROOT_BLOCK, "/", [&](int, const std::string&, dir_entry& entry) {
+        if (entry.type != TYPE_FILE || !(entry.flags & FLAG_PACKED) || entry.first_blk >= sb.no_blocks)
+        {
+            return;
+        }
+        auto shared = pack.blocks.find(entry.first_blk);
+        if (shared == pack.blocks.end())
+        {
+            shared = pack.blocks.insert(std::make_pair(entry.first_blk,
+                Pack::Shared{std::vector<bool>(perBlock, false), perBlock})).first;
+        }
+        unsigned start = entry.flags >> PACK_SHIFT;
+        unsigned units = std::max(1u, (entry.size + PACK_UNIT - 1) / PACK_UNIT);
+        for (unsigned u = start; u < start + units && u < perBlock; u++)
+        {
+            if (!shared->second.taken[u])
+            {
+                shared->second.taken[u] = true;
+                shared->second.free--;
+            }
+        }
+    });
+}
+
+int FS::writeDedup(const std::string& data)
+{
+    TRACE_SPAN("FS::writeDedup");
+    size_t count = std::max((size_t)1, (data.size() + blockSize - 1) / blockSize);
+    std::vector<std::vector<uint8_t>> blocks(count, std::vector<uint8_t>(blockSize, 0));
+    std::vector<hash128> prints(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t at = i * blockSize;
+        memcpy(blocks[i].data(), data.data() + at, std::min((size_t)blockSize, data.size() - std::min(at, data.size())));
+        prints[i] = hash128_of(blocks[i].data(), blockSize);
+    }
+
+    //The blocks stored already are the end of the chain, a new block has nothing
+    //leading to it yet so every block before it is new too. This holds one
+    //reference to head, the first block of the chain so far
+    int head = FAT_EOF;
+    size_t fresh = count;
+    std::vector<uint8_t> stored(blockSize);
+    while (fresh > 0)
+    {
+        auto found = dedup.index.find({prints[fresh - 1], head});
+        if (found == dedup.index.end())
+        {
+            break;
+        }
+        //The fingerprint only finds the block, the data decides
+        int shared = found->second;
+        if (dedup.refs[shared] == 0 || fat.get(shared) != head || cache.read(shared, stored.data()) == -1 ||
+            stored != blocks[fresh - 1])
+        {
+            break;
+        }
+        dedup.refs[shared]++;
+        if (head != FAT_EOF)
+        {
+            dedup.refs[head]--;
+        }
+        head = shared;
+        fresh--;
+    }
+    dedup.found += count - fresh;
+
+    //The new blocks go front to back like any other chain, the last one leads to head
+    int first = FAT_EOF, last = FAT_EOF;
+    for (size_t i = 0; i < fresh; i++)
+    {
+        int block = fat.findFree();
+        if (block == FAT_EOF)
+        {
+            std::cout << "ERROR: Disk is full\n";
+            if (first != FAT_EOF)
+            {
+                freeChain(first);
+            }
+            if (head != FAT_EOF)
+            {
+                freeChain(head);
+            }
+            return FAT_EOF;
+        }
+        fat.set(block, FAT_EOF);
+        if (last == FAT_EOF)
+        {
+            first = block;
+        }
+        else
+        {
+            fat.set(last, block);
+            dedup.index[{prints[i - 1], block}] = last;
+        }
+        cache.write(block, blocks[i].data());
+        dedup.refs[block] = 1;
+        dedup.prints[block] = prints[i];
+        dedup.dirty[(size_t)block * sizeof(hash128) / blockSize] = true;
+        last = block;
+    }
+    dedup.written += fresh;
+    if (last == FAT_EOF)
+    {
+        return head;
+    }
+    fat.set(last, head);
+    dedup.index[{prints[fresh - 1], head}] = last;
+    return first;
+}
+
+void FS::dedupMount()
+{
+    TRACE_SPAN("FS::dedupMount");
+    dedup.prints.assign(sb.no_blocks, hash128{0, 0});
+    dedup.dirty.assign(sb.dedup_blocks, false);
+    std::vector<uint8_t> block(blockSize);
+    size_t perBlock = blockSize / sizeof(hash128);
+    for (unsigned i = 0; i < sb.dedup_blocks; i++)
+    {
+        cache.read(sb.dedup_start + i, block.data());
+        size_t count = std::min(perBlock, (size_t)sb.no_blocks - i * perBlock);
+        memcpy(&dedup.prints[i * perBlock], block.data(), count * sizeof(hash128));
+    }
+
+    //Every block a FAT entry or a file entry points at
+    dedup.refs.assign(sb.no_blocks, 0);
+    for (unsigned b = dataStart(); b < sb.no_blocks; b++)
+    {
+        int next = fat.get(b);
+        if (next != FAT_EOF && next != FAT_FREE && (unsigned)next < sb.no_blocks)
+        {
+            dedup.refs[next]++;
+        }
+    }
+    walkTree(ROOT_BLOCK, "/", [this](int, const std::string&, dir_entry& entry) {
+        //A shared block of packed files is never deduplicated, its files free it
+        if (entry.type == TYPE_FILE && !(entry.flags & (FLAG_PACKED | FLAG_DELAYED)) && entry.first_blk < sb.no_blocks)
+        {
+            dedup.refs[entry.first_blk]++;
+        }
+        //Nor are the blocks of a sparse file, its map is written in place
+        if (entry.type == TYPE_FILE && (entry.flags & FLAG_SPARSE))
+        {
+            std::vector<int> maps;
+            chainOf(entry.first_blk, maps);
+            for (int block : maps)
+            {
+                dedup.refs[block] = 0;
+            }
+        }
+    });
+
+    dedup.index.clear();
+    for (unsigned b = dataStart(); b < sb.no_blocks; b++)
+    {
+        if (dedup.refs[b] > 0 && dedup.prints[b] != hash128{0, 0})
+        {
+            dedup.index[{dedup.prints[b], fat.get(b)}] = b;
+        }
+    }
+}
+
+void FS::dedupPrint(unsigned block, const uint8_t *data)
+{
+    if (sb.dedup_blocks > 0)
+    {
+        dedup.prints[block] = hash128_of(data, blockSize);
+        dedup.dirty[(size_t)block * sizeof(hash128) / blockSize] = true;
+    }
+}
+
+void FS::dedupAdd(int first)
+{
+    if (sb.dedup_blocks == 0)
+    {
+        return;
+    }
+    for (int block = first; block != FAT_EOF; block = fat.get(block))
+    {
+        dedup.refs[block] = 1;
+        dedup.index[{dedup.prints[block], fat.get(block)}] = block;
+    }
+}
+
+void FS::dedupFlush()
+{
+    size_t perBlock = blockSize / sizeof(hash128);
+    std::vector<uint8_t> block(blockSize);
+    for (unsigned i = 0; i < dedup.dirty.size(); i++)
+    {
+        if (!dedup.dirty[i])
+        {
+            continue;
+        }
+        std::fill(block.begin(), block.end(), 0);
+        size_t count = std::min(perBlock, (size_t)sb.no_blocks - i * perBlock);
+        memcpy(block.data(), &dedup.prints[i * perBlock], count * sizeof(hash128));
+        cache.write(sb.dedup_start + i, block.data());
+        dedup.dirty[i] = false;
+    }
+}
+
+//Reads from the disk
+int FS::readFromDisk(std::string& fileText, int fileIndex, std::vector<dir_entry>& dir)
+{
+    TRACE_SPAN("FS::readFromDisk");
+    return readFile(dir[fileIndex], fileText);
+}
+
+int FS::readFile(const dir_entry& entry, std::string& text)
+{
+    if (entry.flags & FLAG_DELAYED)
+    {
+        //Left on the disk by a crash its data is gone, see Checker
+        auto file = delay.files.find(entry.first_blk);
+        if (file == delay.files.end())
+        {
+            return -1;
+        }
+        text.append(file->second.data);
+        return 0;
+    }
+    if (entry.flags & FLAG_SPARSE)
+    {
+        return readSparse(entry, 0, entry.size, text);
+    }
+    if (entry.flags & FLAG_PACKED)
+    {
+        //No readahead, the rest of the block belongs to other files
+        std::vector<char> buffer(blockSize);
+        size_t at = (size_t)(entry.flags >> PACK_SHIFT) * PACK_UNIT;
+        if (at + entry.size > (size_t)blockSize ||
+            cache.read(entry.first_blk, (uint8_t*)buffer.data()) == -1)
+        {
+            return -1;
+        }
+        text.append(buffer.data() + at, entry.size);
+        return 0;
+    }
+    if (!(entry.flags & FLAG_COMPRESSED))
+    {
+        return readChain(entry.first_blk, entry.size, text);
+    }
+    long stored = storedSize(entry);
+    std::string stream;
+    if (stored < 0 || readChain(entry.first_blk, stored, stream) == -1)
+    {
+        return -1;
+    }
+    return decompress_file(stream, entry.size, text);
+}
+
+int FS::readRange(const dir_entry& entry, uint64_t offset, size_t length, std::string& text)
+{
+    if (entry.flags & FLAG_SPARSE)
+    {
+        return readSparse(entry, offset, length, text);
+    }
+    if (entry.flags & (FLAG_COMPRESSED | FLAG_PACKED | FLAG_DELAYED))
+    {
+        std::string whole;
+        if (readFile(entry, whole) == -1)
+        {
+            return -1;
+        }
+        text.append(whole, offset, length);
+        return 0;
+    }
+    //Only the chain from the block offset falls in is read
+    int block = entry.first_blk;
+    for (uint64_t skip = offset / blockSize; skip > 0 && block != FAT_EOF; skip--)
+    {
+        block = fat.get(block);
+    }
+    size_t start = offset % blockSize;
+    std::string blocks;
+    if (readChain(block, start + length, blocks) == -1)
+    {
+        return -1;
+    }
+    text.append(blocks, start, length);
+    return 0;
+}
+
+unsigned long FS::mapBlocks(uint64_t size)
+{
+    unsigned long perMap = blockSize / sizeof(uint32_t);
+    unsigned long blocks = (size + blockSize - 1) / blockSize;
+    return std::max(1ul, (blocks + perMap - 1) / perMap);
+}
+
+int FS::growMap(std::vector<int>& maps, unsigned long count)
+{
+    std::vector<uint8_t> zeros(blockSize, 0);
+    size_t had = maps.size();
+    while (maps.size() < count)
+    {
+        int block = fat.findFree();
+        if (block == FAT_EOF)
+        {
+            std::cout << "ERROR: Disk is full\n";
+            for (size_t i = had; i < maps.size(); i++)
+            {
+                fat.set(maps[i], FAT_FREE);
+            }
+            if (had > 0)
+            {
+                fat.set(maps[had - 1], FAT_EOF);
+            }
+            maps.resize(had);
+            return -1;
+        }
+        fat.set(block, FAT_EOF);
+        cache.write(block, zeros.data());
+        if (!maps.empty())
+        {
+            fat.set(maps.back(), block);
+        }
+        maps.push_back(block);
+    }
+    return 0;
+}
+
+int FS::readSparse(const dir_entry& entry, uint64_t offset, size_t length, std::string& text)
+{
+    TRACE_SPAN("FS::readSparse");
+    size_t perMap = blockSize / sizeof(uint32_t);
+    std::vector<int> maps;
+    chainOf(entry.first_blk, maps);
+    std::vector<uint32_t> map(perMap);
+    std::vector<char> buffer(blockSize);
+    std::vector<unsigned> fetch;
+    uint64_t end = offset + length;
+    uint64_t fetched = 0; // logical blocks up to here were handed to the prefetcher
+    size_t start = text.size();
+    size_t loaded = SIZE_MAX;
+    for (uint64_t l = offset / blockSize; l * blockSize < end; l++)
+    {
+        size_t m = l / perMap;
+        if (m != loaded)
+        {
+            if (m >= maps.size() || cache.read(maps[m], (uint8_t*)map.data()) == -1)
+            {
+                text.resize(start);
+                return -1;
+            }
+            loaded = m;
+        }
+        //The data blocks ahead in this map block are fetched RA_MAX_BLOCKS at a time
+        if (l >= fetched)
+        {
+            fetch.clear();
+            fetched = std::min((uint64_t)(m + 1) * perMap, l + RA_MAX_BLOCKS);
+            for (uint64_t f = l; f < fetched && f * blockSize < end; f++)
+            {
+                if (map[f % perMap] != 0 && map[f % perMap] < sb.no_blocks)
+                {
+                    fetch.push_back(map[f % perMap]);
+                }
+            }
+            if (fetch.size() > 1)
+            {
+                cache.prefetch(fetch);
+            }
+        }
+        uint64_t from = std::max(offset, l * blockSize);
+        size_t piece = std::min(end, (l + 1) * blockSize) - from;
+        uint32_t block = map[l % perMap];
+        if (block == 0 || (block & MAP_UNWRITTEN))
+        {
+            text.append(piece, '\0');
+            continue;
+        }
+        if (block >= sb.no_blocks || cache.read(block, (uint8_t*)buffer.data()) == -1)
+        {
+            text.resize(start);
+            return -1;
+        }
+        text.append(buffer.data() + (from - l * blockSize), piece);
+    }
+    return 0;
+}
+
+int FS::writeSparse(dir_entry& entry, uint64_t offset, const std::string& data)
+{
+    TRACE_SPAN("FS::writeSparse");
+    size_t perMap = blockSize / sizeof(uint32_t);
+    uint64_t end = offset + data.size();
+    std::vector<int> maps;
+    chainOf(entry.first_blk, maps);
+    //The map grows first, a block is never written without a place in it
+    if (growMap(maps, mapBlocks(std::max((uint64_t)entry.size, end))) == -1)
+    {
+        return -1;
+    }
+    std::vector<uint32_t> map(perMap);
+    std::vector<uint8_t> buffer(blockSize);
+    size_t loaded = SIZE_MAX;
+    bool dirty = false;
+    uint64_t written = 0;
+    int result = 0;
+    for (uint64_t l = offset / blockSize; l * blockSize < end; l++)
+    {
+        size_t m = l / perMap;
+        if (m != loaded)
+        {
+            if (dirty)
+            {
+                cache.write(maps[loaded], (uint8_t*)map.data());
+                dirty = false;
+            }
+            if (cache.read(maps[m], (uint8_t*)map.data()) == -1)
+            {
+                std::cout << "ERROR: Can't read file\n";
+                result = -1;
+                break;
+            }
+            loaded = m;
+        }
+        uint64_t from = std::max(offset, l * blockSize);
+        size_t piece = std::min(end, (l + 1) * blockSize) - from;
+        const char *source = data.data() + (from - offset);
+        uint32_t& block = map[l % perMap];
+        //A hole or a reserved block holds zeros, writing zeros leaves it as it is
+        bool empty = block == 0 || (block & MAP_UNWRITTEN);
+        if (empty && allZero(source, piece))
+        {
+            written = from + piece;
+            continue;
+        }
+        if (block == 0)
+        {
+            int fresh = fat.findFree();
+            if (fresh == FAT_EOF)
+            {
+                std::cout << "ERROR: Disk is full\n";
+                result = -1;
+                break;
+            }
+            fat.set(fresh, FAT_EOF);
+            block = fresh;
+        }
+        if (empty)
+        {
+            std::fill(buffer.begin(), buffer.end(), 0);
+            block &= ~MAP_UNWRITTEN;
+            dirty = true;
+        }
+        else if (piece < (size_t)blockSize && cache.read(block, buffer.data()) == -1)
+        {
+            std::cout << "ERROR: Can't read file\n";
+            result = -1;
+            break;
+        }
+        memcpy(buffer.data() + (from - l * blockSize), source, piece);
+        cache.write(block, buffer.data());
+        written = from + piece;
+    }
+    if (dirty)
+    {
+        cache.write(maps[loaded], (uint8_t*)map.data());
+    }
+    entry.size = std::max((uint64_t)entry.size, written);
+    if (result == -1)
+    {
+        //Map blocks grown for what was not written go again
+        resizeSparse(entry, entry.size);
+    }
+    return result;
+}
+
+int FS::resizeSparse(dir_entry& entry, uint64_t size)
+{
+    TRACE_SPAN("FS::resizeSparse");
+    size_t perMap = blockSize / sizeof(uint32_t);
+    std::vector<int> maps;
+    chainOf(entry.first_blk, maps);
+    unsigned long need = mapBlocks(size);
+    if (growMap(maps, need) == -1)
+    {
+        return -1;
+    }
+    if (size < entry.size)
+    {
+        //Blocks past the new end are freed, the rest of the last one is zeroed
+        uint64_t keep = (size + blockSize - 1) / blockSize;
+        std::vector<uint32_t> map(perMap);
+        std::vector<uint8_t> buffer(blockSize);
+        for (size_t m = keep / perMap; m < maps.size(); m++)
+        {
+            if (cache.read(maps[m], (uint8_t*)map.data()) == -1)
+            {
+                continue;
+            }
+            bool dirty = false;
+            for (size_t i = 0; i < perMap; i++)
+            {
+                if (m * perMap + i >= keep && map[i] != 0)
+                {
+                    if ((map[i] & ~MAP_UNWRITTEN) < sb.no_blocks)
+                    {
+                        fat.set(map[i] & ~MAP_UNWRITTEN, FAT_FREE);
+                    }
+                    map[i] = 0;
+                    dirty = true;
+                }
+            }
+            if (dirty)
+            {
+                cache.write(maps[m], (uint8_t*)map.data());
+            }
+        }
+        size_t tail = size % blockSize;
+        if (tail > 0 && cache.read(maps[(keep - 1) / perMap], (uint8_t*)map.data()) == 0)
+        {
+            uint32_t last = map[(keep - 1) % perMap];
+            if (last != 0 && last < sb.no_blocks && cache.read(last, buffer.data()) == 0)
+            {
+                std::fill(buffer.begin() + tail, buffer.end(), 0);
+                cache.write(last, buffer.data());
+            }
+        }
+    }
+    if (maps.size() > need)
+    {
+        fat.set(maps[need - 1], FAT_EOF);
+        freeChain(maps[need]);
+    }
+    entry.size = size;
+    return 0;
+}
+
+int FS::storeSparse(const std::string& text, dir_entry& entry)
+{
+    std::vector<int> maps;
+    if (growMap(maps, 1) == -1)
+    {
+        return -1;
+    }
+    dir_entry sparse = entry;
+    sparse.first_blk = maps[0];
+    sparse.size = 0;
+    sparse.flags = FLAG_SPARSE;
+    if (writeSparse(sparse, 0, text) == -1)
+    {
+        freeFile(sparse);
+        return -1;
+    }
+    entry.size = text.size();
+    entry.first_blk = sparse.first_blk;
+    entry.flags = FLAG_SPARSE;
+    return 0;
+}
+
+int FS::makeSparse(dir_entry& entry)
+{
+    if (entry.flags & FLAG_SPARSE)
+    {
+        return 0;
+    }
+    if (!(entry.flags & (FLAG_COMPRESSED | FLAG_PACKED | FLAG_DELAYED)) && sb.dedup_blocks == 0)
+    {
+        //A chain of its own keeps its blocks as the data blocks, only the map is new
+        size_t perMap = blockSize / sizeof(uint32_t);
+        uint64_t blocks = (entry.size + blockSize - 1) / blockSize;
+        std::vector<int> chain, maps;
+        chainOf(entry.first_blk, chain);
+        if (growMap(maps, mapBlocks(entry.size)) == -1)
+        {
+            return -1;
+        }
+        std::vector<uint32_t> map(perMap);
+        for (size_t m = 0; m < maps.size(); m++)
+        {
+            std::fill(map.begin(), map.end(), 0);
+            for (size_t i = 0; i < perMap && m * perMap + i < std::min(blocks, (uint64_t)chain.size()); i++)
+            {
+                map[i] = chain[m * perMap + i];
+            }
+            cache.write(maps[m], (uint8_t*)map.data());
+        }
+        for (size_t l = 0; l < chain.size(); l++)
+        {
+            fat.set(chain[l], l < blocks ? FAT_EOF : FAT_FREE);
+        }
+        entry.first_blk = maps[0];
+        entry.flags = FLAG_SPARSE;
+        return 0;
+    }
+    std::string text;
+    if (readFile(entry, text) == -1)
+    {
+        std::cout << "ERROR: Can't read file\n";
+        return -1;
+    }
+    dir_entry old = entry;
+    if (storeSparse(text, entry) == -1)
+    {
+        return -1;
+    }
+    freeFile(old);
+    return 0;
+}
+
+int FS::reserveSparse(dir_entry& entry, uint64_t bytes)
+{
+    TRACE_SPAN("FS::reserveSparse");
+    size_t perMap = blockSize / sizeof(uint32_t);
+    uint64_t count = (bytes + blockSize - 1) / blockSize;
+    uint64_t size = std::max((uint64_t)entry.size, bytes);
+    std::vector<int> maps;
+    chainOf(entry.first_blk, maps);
+    if (growMap(maps, mapBlocks(size)) == -1)
+    {
+        return -1;
+    }
+    std::vector<uint32_t> map(perMap);
+    unsigned long holes = 0;
+    for (size_t m = 0; m * perMap < count; m++)
+    {
+        cache.read(maps[m], (uint8_t*)map.data());
+        for (size_t i = 0; i < perMap && m * perMap + i < count; i++)
+        {
+            holes += map[i] == 0;
+        }
+    }
+
+    //One run for all of them where the disk has it, else the first free blocks
+    std::vector<int> blocks;
+    int run = holes > 1 ? fat.findFreeRun(holes) : FAT_EOF;
+    for (unsigned long k = 0; k < holes; k++)
+    {
+        int block = run != FAT_EOF ? run + (int)k : fat.findFree();
+        if (block == FAT_EOF)
+        {
+            std::cout << "ERROR: Disk is full\n";
+            for (int taken : blocks)
+            {
+                fat.set(taken, FAT_FREE);
+            }
+            resizeSparse(entry, entry.size);
+            return -1;
+        }
+        fat.set(block, FAT_EOF);
+        blocks.push_back(block);
+    }
+    size_t next = 0;
+    for (size_t m = 0; m * perMap < count && next < blocks.size(); m++)
+    {
+        cache.read(maps[m], (uint8_t*)map.data());
+        bool dirty = false;
+        for (size_t i = 0; i < perMap && m * perMap + i < count; i++)
+        {
+            if (map[i] == 0)
+            {
+                map[i] = blocks[next++] | MAP_UNWRITTEN;
+                dirty = true;
+            }
+        }
+        if (dirty)
+        {
+            cache.write(maps[m], (uint8_t*)map.data());
+        }
+    }
+    entry.size = size;
+    return 0;
+}
+
+int FS::copySparse(const dir_entry& entry, FS& dest, dir_entry& copy)
+{
+    TRACE_SPAN("FS::copySparse");
+    std::vector<int> destMaps;
+    if (dest.growMap(destMaps, 1) == -1)
+    {
+        return -1;
+    }
+    copy.first_blk = destMaps[0];
+    copy.size = 0;
+    copy.flags = FLAG_SPARSE;
+
+    //Runs of data blocks go over XFER_BLOCKS at a time, holes are skipped
+    size_t perMap = blockSize / sizeof(uint32_t);
+    uint64_t blocks = (entry.size + blockSize - 1) / blockSize;
+    std::vector<int> maps;
+    chainOf(entry.first_blk, maps);
+    std::vector<uint32_t> map(perMap);
+    uint64_t runStart = 0, runLength = 0;
+    bool failed = false;
+    auto flushRun = [&]()
+    {
+        if (runLength == 0 || failed)
+        {
+            return;
+        }
+        uint64_t from = runStart * blockSize;
+        std::string data;
+        if (readSparse(entry, from, std::min(runLength * blockSize, entry.size - from), data) == -1)
+        {
+            std::cout << "ERROR: Can't read file\n";
+            failed = true;
+        }
+        else if (dest.writeSparse(copy, from, data) == -1)
+        {
+            failed = true;
+        }
+        runLength = 0;
+    };
+    for (uint64_t l = 0; l < blocks && !failed; l++)
+    {
+        if (l % perMap == 0 && (l / perMap >= maps.size() ||
+            cache.read(maps[l / perMap], (uint8_t*)map.data()) == -1))
+        {
+            std::cout << "ERROR: Can't read file\n";
+            failed = true;
+            break;
+        }
+        //A reserved block that was never written is copied as a hole
+        bool data = map[l % perMap] != 0 && !(map[l % perMap] & MAP_UNWRITTEN);
+        if (!data || runLength == XFER_BLOCKS)
+        {
+            flushRun();
+        }
+        if (data)
+        {
+            runStart = runLength == 0 ? l : runStart;
+            runLength++;
+        }
+    }
+    flushRun();
+    if (failed || dest.resizeSparse(copy, entry.size) == -1)
+    {
+        dest.freeFile(copy);
+        return -1;
+    }
+    return 0;
+}
+
+long FS::storedSize(const dir_entry& entry)
+{
+    if (!(entry.flags & FLAG_COMPRESSED))
+    {
+        return entry.size;
+    }
+    //The stream says how long it is in its header at the start of the first block
+    std::vector<uint8_t> first(blockSize);
+    if (cache.read(entry.first_blk, first.data()) == -1)
+    {
+        return -1;
+    }
+    size_t stored = compressed_size(first.data(), first.size());
+    return stored > 0 ? (long)stored : -1;
+}
+
+int FS::readChain(int block, long bytes, std::string& text)
+{
+    std::vector<char> buffer(blockSize);
+    int lastPlace = block;
+    long remaining = bytes;
+    bool fileStart = true;
+
+    while (lastPlace != FAT_EOF && remaining > 0)
+    {
+        readAhead(lastPlace, fileStart);
+        fileStart = false;
+        if (cache.read(lastPlace, (uint8_t*)buffer.data()) == -1)
+        {
+            return -1;
+        }
+        int length = std::min(remaining, (long)blockSize);
+        text.append(buffer.data(), length);
+        remaining -= length;
+        lastPlace = fat.get(lastPlace);
+    }
+    //A chain that ends early has a FAT block that could not be read
+    return remaining > 0 ? -1 : 0;
+}
+
+void FS::readAhead(int block, bool fileStart)
+{
+    if (fileStart)
+    {
+        ra.window = RA_MIN_BLOCKS;
+        ra.ahead = block;
+        ra.inFlight = 0;
+    }
+    else if (block == ra.next)
+    {
+        if (ra.inFlight > 0)
+        {
+            ra.inFlight--;
+        }
+        else
+        {
+            ra.ahead = block;
+        }
+    }
+    else
+    {
+        //Jumped somewhere else in the chain, shrink and wait until it is sequential again
+        ra.window = std::max(ra.window / 2, (unsigned)RA_MIN_BLOCKS);
+        ra.ahead = block;
+        ra.inFlight = 0;
+        ra.next = fat.get(block);
+        return;
+    }
+    ra.next = fat.get(block);
+
+    //Refill when the reader has used up half of what was prefetched
+    if (ra.inFlight > ra.window / 2)
+    {
+        return;
+    }
+    if (!fileStart)
+    {
+        ra.window = std::min(ra.window * 2, (unsigned)RA_MAX_BLOCKS);
+    }
+
+    std::vector<unsigned> blocks;
+    int next = ra.ahead;
+    while (ra.inFlight + blocks.size() < ra.window)
+    {
+        next = fat.get(next);
+        if (next == FAT_EOF)
+        {
+            break;
+        }
+        blocks.push_back(next);
+        ra.ahead = next;
+    }
+    if (!blocks.empty())
+    {
+        ra.inFlight += blocks.size();
+        cache.prefetch(blocks);
+    }
+}
+
+int FS::numbEnteries(std::vector<dir_entry>& dir)
+{
+    int nr = 0;
+    for (int i = 0; i < dirEntries; i++)
+    {
+        if(dir[i].type != TYPE_EMPTY)
+        {
+            nr++;
+        }
+    }
+    return nr;
+}
+
+std::string FS::getFile(std::string path)
 {
     //Only looking for the filename
-    char text[path.size()];
+    char text[path.size() + 1];
     strcpy(text, path.c_str());
     std::vector <std::string> directories;
     std::string directory;
@@ -968,10 +4447,11 @@ std::string FS::getFile(std::string path)
     return directory;
 }
 
-int FS::getDirectory(std::string path, dir_entry* dir, int& newBlock, bool cd)
+int FS::getDirectory(std::string path, std::vector<dir_entry>& dir, int& newBlock, bool cd)
 {
+    TRACE_SPAN("FS::getDirectory");
     //Dividing the path into strings
-    char text[path.size()];
+    char text[path.size() + 1];
     strcpy(text, path.c_str());
     std::vector <std::string> directories;
     std::string directory;
@@ -1004,19 +4484,12 @@ int FS::getDirectory(std::string path, dir_entry* dir, int& newBlock, bool cd)
         }
     }
 
-    //dir_entry dirs[64];
-    if(fromRoot)
-    {
-        disk.read(ROOT_BLOCK, (uint8_t*)dir);
-        newBlock = 0;
-    }
-    else
+    //The working directory is read from the cache as well, a change to a
+    //directory that could not be read would wipe it on the disk
+    newBlock = fromRoot ? ROOT_BLOCK : this->currentBlock;
+    if (readDir(newBlock, dir) == -1)
     {
-        for (int i = 0; i < 64; i++)
-        {
-            dir[i] = workingDirectory[i];
-            newBlock = this->currentBlock;
-        }
+        return -1;
     }
     
     //If the file is in the same directory
@@ -1026,7 +4499,8 @@ int FS::getDirectory(std::string path, dir_entry* dir, int& newBlock, bool cd)
     }
 
     bool found = false;
-    int count = this->numbEnteries(this->workingDirectory);
+    //Empty entries never match, so every entry is looked at
+    int count = dirEntries;
     for (int i = 0; i < directories.size(); i++)
     {
         found = false;
@@ -1035,9 +4509,12 @@ int FS::getDirectory(std::string path, dir_entry* dir, int& newBlock, bool cd)
             if(strcmp(dir[j].file_name, directories[i].c_str()) == 0 && dir[j].type == TYPE_DIR)
             {
                 newBlock = dir[j].first_blk;
-                disk.read(dir[j].first_blk, (uint8_t*)dir);                
+                if (readDir(dir[j].first_blk, dir) == -1)
+                {
+                    return -1;
+                }
                 found = true;
-                count = 64;
+                count = dirEntries;
                 break;
             }
         }
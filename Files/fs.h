@@ -2,16 +2,60 @@
 #include <cstdint>
 #include <cstring>
 #include <vector>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <map>
 #include "disk.h"
+#include "cache.h"
+#include "fat.h"
+#include "hash128.h"
 #include "string"
 
 #ifndef __FS_H__
 #define __FS_H__
 
-#define ROOT_BLOCK 0
-#define FAT_BLOCK 1
-#define FAT_FREE 0
-#define FAT_EOF -1
+#define SUPER_BLOCK 0
+#define ROOT_BLOCK 1
+#define FAT_START 2
+
+#define FS_MAGIC 0x33544146 // "FAT3"
+#define FS_VERSION 1
+
+#define RA_MIN_BLOCKS 4 // readahead window when a file starts being read
+#define RA_MAX_BLOCKS 64 // the window doubles up to this while reads stay sequential
+#define XFER_BLOCKS 64 // blocks moved per batch when copying between volumes
+#define DEFRAG_RATE 0 // blocks the defragmenter moves per second, 0 for no limit
+#define FSINFO_WORST 10 // most fragmented files listed by fsinfo
+#define FSINFO_MAP_COLS 64 // size of the fsinfo block usage map
+#define FSINFO_MAP_ROWS 16
+#define SCRUB_RATE 1024 // blocks the scrubber reads back per second, 0 for no limit
+#define SCRUB_BATCH 16 // neighbouring blocks read with one request
+#define SCRUB_SCAN 4096 // FAT entries looked at per step when skipping free blocks
+#define SCRUB_CHECKPOINT 1024 // blocks read between saving the position of a pass
+#define SCRUB_LIST 16 // bad blocks listed by stats
+#define PACK_LIMIT 1024 // largest file packed into a shared block, at most half a block
+#define PACK_UNIT 64 // packed files take whole units of the shared block
+#define DELAY_EXPIRE_MS 1000 // delayed files older than this are given their blocks
+#define DELAY_MAX_BLOCKS 1024 // reserved blocks of delayed files before all of them are given theirs
+
+#define FLAG_COMPRESSED 0x0001 // the chain holds the file as a stream from compress_file()
+#define FLAG_PACKED 0x0002 // the file is part of the shared block at first_blk, see FS::Pack
+#define PACK_SHIFT 6 // flags of a packed file hold the unit it starts at from this bit up
+#define FLAG_SPARSE 0x0004 // first_blk is the chain of a block map, see FS::readSparse()
+#define MAP_UNWRITTEN 0x80000000u // in a block map, a block fallocate() reserved that reads as zeros
+#define FLAG_DELAYED 0x0008 // the file has no blocks yet, first_blk is the key of its data in FS::Delay
+
+#define FORMAT_CHECKSUMS 0x01 // options of format()
+#define FORMAT_COMPRESS 0x02
+#define FORMAT_DEDUP 0x04
+#define FORMAT_PACK 0x08
+#define FORMAT_LOG 0x10
+
+#define SNAPSHOT_NAME 24 // bytes of a snapshot name with the terminating zero
 
 #define TYPE_FILE 0
 #define TYPE_DIR 1
@@ -21,42 +65,356 @@
 #define EXECUTE 0x01
 #define READWRITE 0x06
 
+// operations that have their own latency histogram
+enum FsOp {
+    OP_FORMAT, OP_CREATE, OP_CAT, OP_LS,
+    OP_CP, OP_MV, OP_RM, OP_APPEND,
+    OP_MKDIR, OP_CD, OP_PWD,
+    OP_CHMOD, OP_COPYTO, OP_DEFRAG, OP_SCRUB,
+    OP_READ, OP_WRITE, OP_TRUNCATE, OP_PREALLOC,
+    OP_OPEN, OP_CLOSE, OP_GET, OP_PUT, OP_SNAPSHOT,
+    OP_COUNT
+};
+
+// a snapshot of a log-structured disk, its map is kept in the slot of the same
+// index after the live map, see Disk::take_snapshot()
+struct snapshot_entry {
+    char name[SNAPSHOT_NAME]; // empty for a free slot
+    uint32_t created; // seconds since the epoch
+    uint32_t blocks; // blocks in use when it was taken
+};
+
+// stored in the first block, describes the layout of the rest of the disk
+struct super_block {
+    uint32_t magic; // FS_MAGIC
+    uint32_t version; // FS_VERSION
+    uint32_t block_size; // size of a block in bytes
+    uint32_t no_blocks; // number of blocks on the disk
+    uint32_t fat_start; // first block of the FAT
+    uint32_t fat_blocks; // number of blocks the FAT spans
+    uint32_t root_block; // block of the root directory
+    uint32_t csum_start; // first block of the block checksums, see Disk::set_checksums()
+    uint32_t csum_blocks; // 0 on a disk without checksums
+    uint32_t scrub_next; // block an unfinished scrub pass goes on from
+    uint32_t scrub_rate; // blocks/s of that pass
+    uint32_t scrub_running; // 1 if the pass was running, it goes on when the disk is mounted again
+    uint32_t compress; // 1 if new files are stored compressed
+    uint32_t dedup_start; // first block of the block fingerprints, see FS::Dedup
+    uint32_t dedup_blocks; // 0 on a disk without deduplication
+    uint32_t pack_limit; // files up to this many bytes are packed, 0 on a disk without packing
+    uint32_t log_map; // first block of the map of a log-structured disk, see Disk::set_log()
+    uint32_t log_map_blocks; // 0 on a disk written in place
+    uint32_t log_blocks; // blocks of the disk file, no_blocks are those of the log
+    uint32_t log_snapshots; // snapshot slots after the map, 0 on a disk without room for them
+    snapshot_entry snapshots[LOG_SNAPSHOTS];
+};
+
+// how scattered the file chains are, see fragmentation()
+struct frag_report {
+    unsigned files = 0;
+    unsigned fragmented = 0; // files in more than one extent
+    unsigned long blocks = 0; // blocks in files
+    unsigned long extents = 0; // runs of consecutive blocks in files
+
+    void print(std::ostream& out);
+};
+
+// a block can be shared when it holds the same data and is followed by the same chain
+struct dedup_key {
+    hash128 print;
+    int32_t next;
+
+    bool operator==(const dedup_key& other) const { return print == other.print && next == other.next; }
+};
+
+struct dedup_key_hash {
+    size_t operator()(const dedup_key& key) const { return key.print.lo ^ (uint32_t)key.next; }
+};
+
 struct dir_entry {
     char file_name[56]; // name of the file / sub-directory
     uint32_t size; // size of the file in bytes
-    uint16_t first_blk; // index in the FAT for the first block of the file
+    uint32_t first_blk; // index in the FAT for the first block of the file
     uint8_t type; // directory (1) or file (0) or empty(2)
     uint8_t access_rights; // read (0x04), write (0x02), execute (0x01)
+    uint16_t flags; // FLAG_* bits, from PACK_SHIFT up the unit a packed file starts at
 };
 
 class FS {
+    friend class Checker;
 private:
-    dir_entry workingDirectory[64];
-    int currentBlock = 0;
+    std::vector<dir_entry> workingDirectory;
+    int currentBlock = ROOT_BLOCK;
+    bool readOnly = false; // a view of a snapshot, see FS(FS&, unsigned)
     
     Disk disk;
-    // size of a FAT entry is 2 bytes
-    int16_t fat[BLOCK_SIZE/2];
+    // every block access goes through the cache, the disk is written in the background
+    BlockCache cache;
+    super_block sb;
+    // taken from the super block when the disk is mounted
+    int blockSize;
+    int dirEntries; // entries in a directory block
+    // 32-bit FAT, its blocks are read in when they are needed
+    Fat fat;
+
+    // readahead state of the chain that is being read
+    struct ReadAhead {
+        int next = FAT_EOF; // block a sequential reader asks for next
+        int ahead = FAT_EOF; // last block handed to the cache to prefetch
+        unsigned inFlight = 0; // prefetched blocks the reader has not reached yet
+        unsigned window = RA_MIN_BLOCKS;
+    } ra;
+
+    // latency of every public operation, see stats()
+    Histogram opLatency[OP_COUNT];
+
+    // held by every public operation, the defragmenter runs alongside the shell
+    std::recursive_mutex fsLock;
+
+    // defragmenter state, a pass can be stopped and picked up again later
+    struct Defrag {
+        std::thread worker;
+        std::atomic<bool> running{false};
+        bool stop = false;
+        std::mutex lock; // guards stop
+        std::condition_variable wake; // cuts the throttle sleep short on stop
+        unsigned rate = DEFRAG_RATE;
+        // the files of this pass as directory path and name, looked up again when their turn comes
+        std::vector<std::pair<std::string, std::string>> files;
+        size_t next = 0; // next file of the pass
+        frag_report before; // taken when the pass started
+        unsigned long moved = 0; // blocks moved in this pass
+        unsigned relocated = 0; // files made contiguous
+        unsigned noRoom = 0; // files left as they were, no free run was long enough
+        unsigned shared = 0; // files left as they were, they share blocks with other files
+    } defragState;
+
+    // scrubber state, the position of a pass is kept in the super block
+    struct Scrub {
+        std::thread worker;
+        std::atomic<bool> running{false};
+        bool stop = false;
+        std::mutex lock; // guards stop and the counters below it
+        std::condition_variable wake; // cuts the throttle sleep short on stop
+        unsigned rate = SCRUB_RATE;
+        bool active = false; // a pass was started and has not finished
+        unsigned next = 0; // next block of the pass
+        unsigned long epoch = 0; // formats so far, blocks read before one are not counted
+        unsigned long sinceCheckpoint = 0; // blocks read since the position was saved
+        unsigned long verified = 0; // blocks read back
+        unsigned long passes = 0; // passes finished
+        std::vector<unsigned> bad; // blocks of this pass that could not be read or failed their checksum
+    } scrubState;
 
-    //Reads from block returns 64 dir_entries and number of taken blocks
-    void readDirBlock(int block, dir_entry* in, int& numbBlocks); 
+    // deduplication state. A FAT block points to the one after it, so chains can
+    // only share their ends: a block is shared with everything after it, and a
+    // file is written from its last block to its first to find them. Only the
+    // fingerprints are kept on the disk, the rest is rebuilt at mount
+    struct Dedup {
+        std::vector<hash128> prints; // of every block written to a file, zero for none
+        std::vector<bool> dirty; // blocks of the fingerprint region to write back
+        // FAT entries and directory entries pointing at each block, a block is
+        // freed when the last one goes
+        std::vector<uint32_t> refs;
+        std::unordered_map<dedup_key, unsigned, dedup_key_hash> index; // blocks in files by data and next block
+        unsigned long written = 0; // blocks written to files
+        unsigned long found = 0; // blocks that were stored already
+    } dedup;
+
+    // small file packing state. A file of up to sb.pack_limit bytes takes
+    // PACK_UNIT pieces of a block it shares with other small files instead of
+    // a block of its own. The shared blocks are ordinary one-block chains, which
+    // of their units are taken is rebuilt at mount
+    struct Pack {
+        struct Shared {
+            std::vector<bool> taken; // units of the block in use
+            unsigned free;
+        };
+        std::map<unsigned, Shared> blocks;
+        int last = FAT_EOF; // block the last file went to, the next one tries it first
+    } pack;
+
+    // files opened with open(). An entry moves when another one is removed, so
+    // a handle keeps the directory and name and looks the file up every time
+    struct Handle {
+        int dirBlock = -1; // -1 for a closed handle
+        std::string name;
+    };
+    std::vector<Handle> handles;
+
+    // delayed allocation state. A file created, copied or appended to while it
+    // is delayed keeps its data here, with blocks reserved for it in the FAT but
+    // none picked. Its blocks are picked when the data is written back, when the
+    // whole file is known and can go to one run: by the worker once the file is
+    // DELAY_EXPIRE_MS old or DELAY_MAX_BLOCKS are reserved, and by sync(). A
+    // file removed before then never reaches the disk
+    struct Delay {
+        struct File {
+            std::string data;
+            unsigned long blocks; // reserved for it
+            std::chrono::steady_clock::time_point since; // first written
+        };
+        std::map<uint32_t, File> files;
+        uint32_t next = 1; // key of the next delayed file
+        unsigned long blocks = 0; // reserved for all of them
+        std::thread worker;
+        bool stop = false;
+        bool urgent = false; // too much is reserved, every file is written back
+        std::mutex lock; // guards stop and urgent
+        std::condition_variable wake;
+    } delay;
+
+    //Reads the dir_entries stored in block, returns -1 and leaves dir empty
+    //if the block can not be read
+    int readDir(int block, std::vector<dir_entry>& dir);
+    //Reads from block returns its dir_entries and number of taken blocks
+    void readDirBlock(int block, std::vector<dir_entry>& in, int& numbBlocks); 
     //Writes a block of dir_enteries to the disk
-    void writeDirToDisk(int block, dir_entry* in);
-    //Makes a block of 64 dir_entries with all dirs empty
-    void makeDirBlock(dir_entry* in, int numbBlocks = 64, int startIndex = 0); 
+    void writeDirToDisk(int block, std::vector<dir_entry>& in);
+    //Makes a block of dir_entries with all dirs empty
+    void makeDirBlock(std::vector<dir_entry>& in, int startIndex = 0); 
+    //Marks every block of the chain starting at block as free
+    void freeChain(int block);
+    //Frees the chain of a file, or its units of a shared block if it is packed
+    void freeFile(const dir_entry& entry);
+    //Takes the geometry from the super block and opens the FAT
+    void mount();
+    //First block files can use, the blocks before hold the super block, root, FAT,
+    //checksums and fingerprints
+    unsigned dataStart() { return sb.fat_start + sb.fat_blocks + sb.csum_blocks + sb.dedup_blocks; }
+    //Hands every free block to the cache to discard, returns how many there are
+    unsigned long discardFree();
+    //Calls visit with the path of the directory and the entry for every entry below the
+    //directory at block, skipping "..", every directory is visited once
+    void walkTree(int block, const std::string& path,
+        const std::function<void(int, const std::string&, dir_entry&)>& visit);
+    //Lists the blocks of the chain starting at block
+    void chainOf(int block, std::vector<int>& blocks);
+    void fragmentation(frag_report& report);
+    //Starts a new defrag pass over every file on the disk
+    void defragBegin();
+    //Works through the pass until it is done or stopped, returns true when it is done
+    bool defragRun();
+    //Moves the chain of one file to a free run of consecutive blocks
+    void defragFile(const std::string& dirPath, const std::string& name);
+    void defragStop();
+    void scrubStart();
+    //Reads back blocks of the pass until it is done or stopped, returns true when it is done
+    bool scrubRun();
+    //With resume set a running pass goes on when the disk is mounted again
+    void scrubStop(bool resume);
+    //Saves the position of the pass in the super block
+    void scrubCheckpoint(bool running);
+    //Prints the bad blocks of the pass and what they belong to
+    void scrubPrintBad();
+    void writeSuperBlock();
+    //Returns false and says so on a read-only snapshot, otherwise takes the room
+    //snapshots hold off the free space before a change
+    bool writable();
 
-    void writeToDisk(std::string fileText, int fileSize, int &FirstBlock, bool firstAdd);
-    void readFromDisk(std::string& fileText, int fileIndex, dir_entry* dir);
-    int numbEnteries(dir_entry* dir);
+    //Returns -1 if the disk filled up, the blocks written so far stay in the chain.
+    //With contiguous set a new chain is taken from one free run where there is one
+    int writeToDisk(std::string fileText, int fileSize, int &FirstBlock, bool firstAdd, bool contiguous = false);
+    //Writes text to a new chain and sets the size, first block and flags of entry,
+    //packed if the volume packs and it is small enough, compressed if the volume
+    //compresses and that takes fewer blocks. Returns -1 and leaves entry as it was
+    //if the disk is full
+    int storeFile(const std::string& text, dir_entry& entry, bool contiguous = false);
+    //Keeps text as the data of a delayed file and reserves its blocks, stores it
+    //right away if they can not be reserved
+    int storeDelayed(const std::string& text, dir_entry& entry);
+    //Blocks to reserve for a file of size bytes, enough however storeFile() stores it
+    unsigned long delayBlocks(uint64_t size);
+    //Stores the delayed files that are old enough, or all of them, and points
+    //their entries at their blocks
+    void placeDelayed(bool all);
+    //Starts the worker that writes delayed files back if it is not running
+    void delayStart();
+    //Turns the delayed files a run ended before placing into empty files, as fsck
+    //would, their keys would otherwise name delayed files of this run
+    void delayMount();
+    void delayRun();
+    void delayStop();
+    //Puts data in free units of a shared block, a new one if none has room
+    int packFile(const std::string& data, dir_entry& entry);
+    //Finds the units of the shared blocks the packed files take
+    void packMount();
 
-    int getDirectory(std::string path, dir_entry* dir, int& newBlock, bool cd = false);
+    // A sparse file has a block map instead of a chain of data: first_blk is a
+    // chain of map blocks holding the block of every block of the file, 0 for a
+    // hole. A hole reads as zeros without going to the disk, the data blocks are
+    // chains of one block. Bytes past the size in the last block are zero. A
+    // block reserved by fallocate() has MAP_UNWRITTEN set and reads as zeros
+    // too until it is first written.
+    //Map blocks a sparse file of size bytes has
+    unsigned long mapBlocks(uint64_t size);
+    //Links zeroed map blocks to maps until it has count, on a full disk it is
+    //left as it was and -1 returned
+    int growMap(std::vector<int>& maps, unsigned long count);
+    //Appends length bytes from offset of a sparse file to text
+    int readSparse(const dir_entry& entry, uint64_t offset, size_t length, std::string& text);
+    //Writes data at offset of a sparse file, blocks of zeros over holes stay holes.
+    //Returns -1 if the disk filled up, the size then covers what was written
+    int writeSparse(dir_entry& entry, uint64_t offset, const std::string& data);
+    //Grows or shrinks a sparse file, freeing the blocks past the new end
+    int resizeSparse(dir_entry& entry, uint64_t size);
+    //Stores text as a new sparse file, its blocks of zeros become holes
+    int storeSparse(const std::string& text, dir_entry& entry);
+    //Turns a file into a sparse file with the same data
+    int makeSparse(dir_entry& entry);
+    //Reserves a block for every hole in the first bytes of a sparse file, in one
+    //run where the disk has one, and grows it to cover them
+    int reserveSparse(dir_entry& entry, uint64_t bytes);
+    //Copies a sparse file to a new sparse file of dest, skipping its holes
+    int copySparse(const dir_entry& entry, FS& dest, dir_entry& copy);
+    //Appends the whole file to text
+    int readFile(const dir_entry& entry, std::string& text);
+    //Appends length bytes from offset of a file to text
+    int readRange(const dir_entry& entry, uint64_t offset, size_t length, std::string& text);
+    //Lists every block a file takes: its chain, its shared block or its map and data blocks
+    void blocksOf(const dir_entry& entry, std::vector<int>& blocks);
+    //Finds the file of an open handle, returns its index in dir or -1
+    int handleEntry(int handle, std::vector<dir_entry>& dir);
+    //Writes data as a new chain that shares every block it can, returns its
+    //first block or FAT_EOF if the disk is full
+    int writeDedup(const std::string& data);
+    //Reads the fingerprints and counts the references to every block
+    void dedupMount();
+    //Remembers the fingerprint of a block about to be written to a file
+    void dedupPrint(unsigned block, const uint8_t *data);
+    //Makes a chain written past writeDedup() a candidate for sharing
+    void dedupAdd(int first);
+    //Writes changed fingerprints to the cache
+    void dedupFlush();
+    //Returns -1 if a block of the file could not be read or it does not decompress
+    int readFromDisk(std::string& fileText, int fileIndex, std::vector<dir_entry>& dir);
+    //Appends the first bytes bytes of the chain starting at block to text
+    int readChain(int block, long bytes, std::string& text);
+    //Bytes the chain of a file holds, the size of its stream if it is compressed,
+    //-1 if that stream can not be read
+    long storedSize(const dir_entry& entry);
+    //Tells the readahead about a block being read, prefetches further down the chain while reads are sequential
+    void readAhead(int block, bool fileStart);
+    int numbEnteries(std::vector<dir_entry>& dir);
+
+    int getDirectory(std::string path, std::vector<dir_entry>& dir, int& newBlock, bool cd = false);
     std::string getFile(std::string path);
 
 public:
-    FS();
+    FS(const std::string& image = DISKNAME);
+    // mounts snapshot slot of live read-only, see findSnapshot(). The snapshot
+    // can not be deleted while it is mounted
+    FS(FS& live, unsigned slot);
     ~FS();
     // formats the disk, i.e., creates an empty file system
-    int format();
+    int format(unsigned options = 0);
+    // formats the disk with a new geometry, resizing the disk file. With FORMAT_CHECKSUMS
+    // in options every block is checksummed and verified when it is read, with
+    // FORMAT_COMPRESS files are stored compressed when that saves blocks and with
+    // FORMAT_DEDUP a block with the same data as one already stored is shared,
+    // with FORMAT_PACK files of up to PACK_LIMIT bytes share blocks. With FORMAT_LOG
+    // every write goes to the head of a log, the disk has fewer blocks for files
+    int format(unsigned no_blocks, unsigned block_size, unsigned options = 0);
     // create <filepath> creates a new file on the disk, the data content is
     // written on the following rows (ended with an empty row)
     int create(std::string filepath);
@@ -76,6 +434,9 @@ public:
     // append <filepath1> <filepath2> appends the contents of file <filepath1> to
     // the end of file <filepath2>. The file <filepath1> is unchanged.
     int append(std::string filepath1, std::string filepath2);
+    // copies the file <sourcepath> on this volume to <destpath> on the volume dest,
+    // the data goes from one cache to the other XFER_BLOCKS blocks at a time
+    int copyTo(std::string sourcepath, FS& dest, std::string destpath);
 
     // mkdir <dirpath> creates a new sub-directory with the name <dirpath>
     // in the current directory
@@ -85,10 +446,77 @@ public:
     // pwd prints the full path, i.e., from the root directory, to the current
     // directory, including the current directory name
     int pwd();
+    // returns the full path of the current directory
+    std::string cwd();
 
     // chmod <accessrights> <filepath> changes the access rights for the
     // file <filepath> to <accessrights>.
     int chmod(std::string accessrights, std::string filepath);
+
+    // opens the file <filepath> to be read and written at byte offsets, returns
+    // a handle or -1 if there is no such file
+    int open(std::string filepath);
+    int close(int handle);
+    // reads up to length bytes at offset into data, holes read as zeros. Returns
+    // the number of bytes read or -1
+    long pread(int handle, uint64_t offset, size_t length, std::string& data);
+    // writes data at offset, the file becomes sparse and writing past its end
+    // leaves a hole. Returns the number of bytes written or -1
+    long pwrite(int handle, uint64_t offset, const std::string& data);
+    // truncate <filepath> <size> cuts the file to size bytes or grows it with a
+    // hole, the file becomes sparse
+    int truncate(std::string filepath, uint64_t size);
+    // prealloc <filepath> <bytes> reserves the blocks for the first bytes of the
+    // file without writing them, creating the file if there is none. They are
+    // taken in one run where there is one, read as zeros and are filled in
+    // place by pwrite. The size grows to cover them
+    int fallocate(std::string filepath, uint64_t bytes);
+    // get <filepath> <hostpath> writes the file to a file outside the disk, the
+    // holes of a sparse file stay holes there
+    int get(std::string filepath, std::string hostpath);
+    // put <hostpath> <filepath> stores a file from outside the disk as a new file,
+    // its blocks of zeros are not written
+    int put(std::string hostpath, std::string filepath);
+
+    // sync gives every delayed file its blocks and writes all dirty blocks to the disk
+    int sync();
+    // snapshot create <name> freezes the whole volume as it is now without copying
+    // a block, the live volume writes what it changes to new blocks of the log.
+    // It is not O(1): the snapshot gets a copy of the map's page table and the
+    // whole map is written to its slot, so it costs time in the disk size.
+    // snapshot list shows the snapshots and the blocks only each of them holds,
+    // snapshot delete <name> frees those. Needs a disk formatted with FORMAT_LOG
+    int snapshot(std::string mode, std::string name = "");
+    // returns the slot of the snapshot name to mount, or -1
+    int findSnapshot(const std::string& name);
+    // trim punches every free block out of the disk file, blocks freed from now
+    // on are punched out as the cache writes back the FAT that frees them
+    int trim();
+
+    // stats prints the disk, cache and operation counters, stats --reset clears them
+    int stats(bool reset = false);
+    // record <file> logs every block request that reaches the disk to file,
+    // record off stops it
+    int record(std::string path);
+    // device <none|hdd|ssd> [key=value ...] puts a simulated device latency model
+    // under the disk, device without arguments prints the model in use
+    int device(const std::vector<std::string>& args);
+    // defrag [<blocks/s>] moves every file onto consecutive blocks and reports the
+    // fragmentation before and after, defrag start [<blocks/s>] does the same in the
+    // background, defrag stop pauses it and defrag status reports how far it got.
+    // A stopped pass carries on where it was the next time defrag runs
+    int defrag(std::string mode = "", unsigned rate = DEFRAG_RATE);
+    // fsinfo reports used and free blocks, the largest free extent, how many extents
+    // the files are in, the most fragmented files and a map of block usage
+    int fsinfo();
+    // scrub [start|stop|status] [<blocks/s>] reads back every block in use to find
+    // blocks that can not be read or fail their checksum before a reader does,
+    // start runs the pass in the background behind all other disk requests
+    int scrub(std::string mode = "", unsigned rate = SCRUB_RATE);
+    // fsck checks every directory entry and FAT chain on threads threads (0 for one per
+    // core) and reports what is wrong, fsck -r also repairs it. Returns the number of
+    // problems found
+    int fsck(bool repair = false, unsigned threads = 0);
 };
 
 #endif // __FS_H__
@@ -0,0 +1,67 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cctype>
+#include "fs.h"
+
+// Checks the file system on an image, see Checker.
+//   fsck [-r] [-j <threads>] [<image>]
+// -r  repairs what is wrong instead of only reporting it
+// -j  walks the directory tree on that many threads, one per core by default
+// Exits with 0 when the image is clean or was repaired, 1 when problems were
+// left, 2 when the image holds no file system.
+
+static void usage()
+{
+    std::cout << "Usage: fsck [-r] [-j <threads>] [<image>]\n";
+}
+
+int
+main(int argc, char **argv)
+{
+    std::string image = DISKNAME;
+    bool repair = false;
+    unsigned threads = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-r")
+        {
+            repair = true;
+        }
+        else if (arg == "-j" && i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+        {
+            threads = std::stoul(argv[++i]);
+        }
+        else if (arg[0] != '-')
+        {
+            image = arg;
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    //FS formats a disk without a file system, so the super block is looked at first
+    std::ifstream in(image, std::ios::binary);
+    super_block sb;
+    if (!in.read((char*)&sb, sizeof(sb)) || sb.magic != FS_MAGIC || sb.version != FS_VERSION ||
+        !Disk::valid_block_size(sb.block_size))
+    {
+        std::cout << "ERROR: " << image << " holds no file system\n";
+        return 2;
+    }
+    in.close();
+
+    FS fs(image);
+    std::cout << "fsck " << image << "\n";
+    int found = fs.fsck(repair, threads);
+    if (found > 0 && repair)
+    {
+        //Checked again to tell whether the repair got everything
+        found = fs.fsck(false, threads);
+    }
+    return found > 0 ? 1 : 0;
+}
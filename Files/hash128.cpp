@@ -0,0 +1,210 @@
+#include <cstring>
+#include "hash128.h"
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <immintrin.h>
+#define HASH128_X86
+#endif
+
+#define HASH_LANES 8
+#define HASH_STRIPE 64 // bytes taken by the lanes in one step
+#define HASH_SCRAMBLE 16 // stripes between scrambles of the lanes
+#define PRIME32_1 0x9e3779b1u
+#define PRIME64_1 0x9e3779b185ebca87ULL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+
+// random constants, the data of each lane is mixed with its own
+alignas(32) static const uint64_t stripeKeys[HASH_LANES] = {
+    0x2cb0f69f4abea221ULL, 0x9417034723148989ULL, 0xdd555950609dfe03ULL, 0xdbafb150deb12800ULL,
+    0x7e789b2e6c442cb6ULL, 0xf41e5636c7e4f8c4ULL, 0x0959d150f8fba7e4ULL, 0xa97316f13cdb9eeaULL
+};
+alignas(32) static const uint64_t scrambleKeys[HASH_LANES] = {
+    0x74cd8258f9520068ULL, 0x55c74a62e116868bULL, 0xd2f4c799a2023cbdULL, 0xdf98cb79a37b51b9ULL,
+    0x396f5885524f3905ULL, 0xaf1d56386ca3b276ULL, 0xa9ffbe6b5104e85aULL, 0x6bd0c51b9fd533b3ULL
+};
+static const uint64_t loKeys[HASH_LANES] = {
+    0x980ce91c50ab4b56ULL, 0x28ac395780fe62c5ULL, 0x768912e3a6bcedc7ULL, 0x50b3e8c9332c7c88ULL,
+    0xce3bbfe520bd47daULL, 0xcba6c8e8e0bb7c4fULL, 0xbf194db8434a346dULL, 0x7d8f2a7b60416d7fULL
+};
+static const uint64_t hiKeys[HASH_LANES] = {
+    0x0849d1f6e0e10a5eULL, 0x7654b590d064e22fULL, 0x16d1da9507df3af2ULL, 0xf63aef1089ea30e4ULL,
+    0x9ade6673cc6c522bULL, 0x4c75bc274e37087cULL, 0xd35e12b49f51f27bULL, 0x22ddf2ffcee481eaULL
+};
+
+// takes stripes stripes of data into the lanes, scrambling after every
+// HASH_SCRAMBLE of them counted from first
+typedef void (*stripes_fn)(uint64_t *acc, const uint8_t *data, size_t stripes, size_t first);
+
+static void stripesScalar(uint64_t *acc, const uint8_t *data, size_t stripes, size_t first)
+{
+    for (size_t s = 0; s < stripes; s++)
+    {
+        for (int i = 0; i < HASH_LANES; i++)
+        {
+            uint64_t value;
+            memcpy(&value, data + s * HASH_STRIPE + i * 8, 8);
+            uint64_t key = value ^ stripeKeys[i];
+            acc[i ^ 1] += value;
+            acc[i] += (key & 0xffffffff) * (key >> 32);
+        }
+        if ((first + s + 1) % HASH_SCRAMBLE == 0)
+        {
+            for (int i = 0; i < HASH_LANES; i++)
+            {
+                acc[i] = ((acc[i] ^ (acc[i] >> 47)) ^ scrambleKeys[i]) * PRIME32_1;
+            }
+        }
+    }
+}
+
+#ifdef HASH128_X86
+//Two lanes in each register, the multiply takes the low 32 bits of each lane
+static void stripesSse2(uint64_t *acc, const uint8_t *data, size_t stripes, size_t first)
+{
+    __m128i lanes[4], keys[4], scramble[4];
+    const __m128i prime = _mm_set1_epi32(PRIME32_1);
+    for (int j = 0; j < 4; j++)
+    {
+        lanes[j] = _mm_loadu_si128((const __m128i*)(acc + 2 * j));
+        keys[j] = _mm_load_si128((const __m128i*)(stripeKeys + 2 * j));
+        scramble[j] = _mm_load_si128((const __m128i*)(scrambleKeys + 2 * j));
+    }
+    for (size_t s = 0; s < stripes; s++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            __m128i value = _mm_loadu_si128((const __m128i*)(data + s * HASH_STRIPE + 16 * j));
+            __m128i key = _mm_xor_si128(value, keys[j]);
+            __m128i product = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+            __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+            lanes[j] = _mm_add_epi64(lanes[j], _mm_add_epi64(swapped, product));
+        }
+        if ((first + s + 1) % HASH_SCRAMBLE == 0)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                __m128i a = _mm_xor_si128(_mm_xor_si128(lanes[j], _mm_srli_epi64(lanes[j], 47)), scramble[j]);
+                __m128i low = _mm_mul_epu32(a, prime);
+                __m128i high = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+                lanes[j] = _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+            }
+        }
+    }
+    for (int j = 0; j < 4; j++)
+    {
+        _mm_storeu_si128((__m128i*)(acc + 2 * j), lanes[j]);
+    }
+}
+
+//The same with four lanes in each register
+__attribute__((target("avx2")))
+static void stripesAvx2(uint64_t *acc, const uint8_t *data, size_t stripes, size_t first)
+{
+    __m256i lanes[2], keys[2], scramble[2];
+    const __m256i prime = _mm256_set1_epi32(PRIME32_1);
+    for (int j = 0; j < 2; j++)
+    {
+        lanes[j] = _mm256_loadu_si256((const __m256i*)(acc + 4 * j));
+        keys[j] = _mm256_load_si256((const __m256i*)(stripeKeys + 4 * j));
+        scramble[j] = _mm256_load_si256((const __m256i*)(scrambleKeys + 4 * j));
+    }
+    for (size_t s = 0; s < stripes; s++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            __m256i value = _mm256_loadu_si256((const __m256i*)(data + s * HASH_STRIPE + 32 * j));
+            __m256i key = _mm256_xor_si256(value, keys[j]);
+            __m256i product = _mm256_mul_epu32(key, _mm256_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+            __m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+            lanes[j] = _mm256_add_epi64(lanes[j], _mm256_add_epi64(swapped, product));
+        }
+        if ((first + s + 1) % HASH_SCRAMBLE == 0)
+        {
+            for (int j = 0; j < 2; j++)
+            {
+                __m256i a = _mm256_xor_si256(_mm256_xor_si256(lanes[j], _mm256_srli_epi64(lanes[j], 47)), scramble[j]);
+                __m256i low = _mm256_mul_epu32(a, prime);
+                __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+                lanes[j] = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+            }
+        }
+    }
+    for (int j = 0; j < 2; j++)
+    {
+        _mm256_storeu_si256((__m256i*)(acc + 4 * j), lanes[j]);
+    }
+}
+#endif
+
+static stripes_fn choose()
+{
+#ifdef HASH128_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return stripesAvx2;
+    }
+    return stripesSse2;
+#else
+    return stripesScalar;
+#endif
+}
+
+//Multiplies to 128 bits and folds the halves together
+static uint64_t mulFold(uint64_t a, uint64_t b)
+{
+    unsigned __int128 product = (unsigned __int128)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static uint64_t fold(const uint64_t *acc, const uint64_t *keys, uint64_t start)
+{
+    uint64_t h = start;
+    for (int i = 0; i < HASH_LANES; i += 2)
+    {
+        h += mulFold(acc[i] ^ keys[i], acc[i + 1] ^ keys[i + 1]);
+    }
+    h ^= h >> 37;
+    h *= 0x165667919e3779f9ULL;
+    return h ^ (h >> 32);
+}
+
+static hash128 hash(stripes_fn stripes, const uint8_t *data, size_t length)
+{
+    uint64_t acc[HASH_LANES] = {
+        PRIME32_1, PRIME64_1, PRIME64_2, 0x165667b19e3779f9ULL,
+        0x85ebca77c2b2ae63ULL, 0x27d4eb2f165667c5ULL, 0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL
+    };
+    size_t full = length / HASH_STRIPE;
+    stripes(acc, data, full, 0);
+    if (length % HASH_STRIPE != 0)
+    {
+        //The last bytes are padded with zeros, the length tells them apart
+        uint8_t last[HASH_STRIPE] = {0};
+        memcpy(last, data + full * HASH_STRIPE, length % HASH_STRIPE);
+        stripes(acc, last, 1, full);
+    }
+    hash128 h;
+    h.lo = fold(acc, loKeys, length * PRIME64_1);
+    h.hi = fold(acc, hiKeys, ~(length * PRIME64_2));
+    return h;
+}
+
+hash128 hash128_of(const uint8_t *data, size_t length)
+{
+    static const stripes_fn impl = choose();
+    return hash(impl, data, length);
+}
+
+hash128 hash128_scalar(const uint8_t *data, size_t length)
+{
+    return hash(stripesScalar, data, length);
+}
+
+const char *hash128_impl()
+{
+#ifdef HASH128_X86
+    return choose() == stripesAvx2 ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
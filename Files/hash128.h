@@ -0,0 +1,27 @@
+#include <cstdint>
+#include <cstddef>
+
+#ifndef __HASH128_H__
+#define __HASH128_H__
+
+// 128-bit fingerprint of a block of data
+struct hash128 {
+    uint64_t lo;
+    uint64_t hi;
+
+    bool operator==(const hash128& other) const { return lo == other.lo && hi == other.hi; }
+    bool operator!=(const hash128& other) const { return !(*this == other); }
+};
+
+// A fast non-cryptographic hash built like XXH3: eight 64-bit lanes take a
+// 64-byte stripe at a time with one 32x32->64 multiply each, are scrambled
+// every 1 KiB and folded into 128 bits at the end. The lanes map straight onto
+// SSE2 and AVX2 registers, which are used when the CPU has them. Every version
+// gives the same result, fingerprints are kept on the disk.
+hash128 hash128_of(const uint8_t *data, size_t length);
+// the plain C++ version, for comparison
+hash128 hash128_scalar(const uint8_t *data, size_t length);
+// name of the version hash128_of uses, "avx2", "sse2" or "scalar"
+const char *hash128_impl();
+
+#endif // __HASH128_H__
@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include "iosched.h"
+
+IoScheduler::IoScheduler(Disk& disk) : disk(disk)
+{
+    dispatcher = std::thread(&IoScheduler::dispatchLoop, this);
+}
+
+IoScheduler::~IoScheduler()
+{
+    {
+        std::lock_guard<std::mutex> held(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    dispatcher.join();
+}
+
+// queues a request and returns at once
+void IoScheduler::submit(io_request& r)
+{
+    r.queued = std::chrono::steady_clock::now();
+    r.done = false;
+    r.result = 0;
+    submitted.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> held(lock);
+    queue.push_back(&r);
+    wake.notify_one();
+}
+
+// waits until the request has been served, returns its result
+int IoScheduler::wait(io_request& r)
+{
+    std::unique_lock<std::mutex> held(lock);
+    finished.wait(held, [&r] { return r.done; });
+    return r.result;
+}
+
+// queues a request and waits for it
+int IoScheduler::io(uint8_t op, unsigned block_no, unsigned count, uint8_t* data, bool idle)
+{
+    io_request r;
+    r.op = op;
+    r.block_no = block_no;
+    r.count = count;
+    r.data = data;
+    r.idle = idle;
+    submit(r);
+    return wait(r);
+}
+
+size_t IoScheduler::pick()
+{
+    //Requests past their deadline first, the queue is in arrival order
+    auto now = std::chrono::steady_clock::now();
+    for (uint8_t op : {IO_READ, IO_WRITE})
+    {
+        auto deadline = std::chrono::milliseconds(op == IO_READ ? IOSCHED_READ_EXPIRE_MS : IOSCHED_WRITE_EXPIRE_MS);
+        for (size_t i = 0; i < queue.size(); i++)
+        {
+            if (queue[i]->op == op && !queue[i]->idle)
+            {
+                if (now - queue[i]->queued >= deadline)
+                {
+                    expired.fetch_add(1, std::memory_order_relaxed);
+                    return i;
+                }
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < queue.size(); i++)
+    {
+        if (queue[i]->idle)
+        {
+            if (now - queue[i]->queued >= std::chrono::milliseconds(IOSCHED_IDLE_EXPIRE_MS))
+            {
+                expired.fetch_add(1, std::memory_order_relaxed);
+                return i;
+            }
+            break;
+        }
+    }
+
+    //Then the next block up from the head, reads before writes, idle requests
+    //only when there is nothing else
+    bool idle = true;
+    uint8_t op = IO_WRITE;
+    for (io_request* r : queue)
+    {
+        idle = idle && r->idle;
+    }
+    for (io_request* r : queue)
+    {
+        if (r->idle == idle && r->op == IO_READ)
+        {
+            op = IO_READ;
+            break;
+        }
+    }
+    size_t ahead = queue.size(), behind = queue.size();
+    for (size_t i = 0; i < queue.size(); i++)
+    {
+        if (queue[i]->op != op || queue[i]->idle != idle)
+        {
+            continue;
+        }
+        size_t& best = queue[i]->block_no >= head ? ahead : behind;
+        if (best == queue.size() || queue[i]->block_no < queue[best]->block_no)
+        {
+            best = i;
+        }
+    }
+    size_t chosen = ahead != queue.size() ? ahead : behind;
+    //Going ahead of a waiting idle request does not count
+    size_t oldest = 0;
+    while (queue[oldest]->idle != idle)
+    {
+        oldest++;
+    }
+    if (chosen != oldest)
+    {
+        reordered.fetch_add(1, std::memory_order_relaxed);
+    }
+    return chosen;
+}
+
+void IoScheduler::dispatchLoop()
+{
+    Tracer::name_thread("iosched");
+    std::vector<io_request*> group;
+    std::vector<uint8_t> buffer;
+    std::unique_lock<std::mutex> held(lock);
+    while (true)
+    {
+        wake.wait(held, [this] { return stopping || !queue.empty(); });
+        if (queue.empty())
+        {
+            break;
+        }
+
+        //Idle requests alone wait for the disk to go quiet, a request coming in wakes us early
+        bool idle = true;
+        for (io_request* r : queue)
+        {
+            idle = idle && r->idle;
+        }
+        auto now = std::chrono::steady_clock::now();
+        auto quiet = lastBusy + std::chrono::milliseconds(IOSCHED_IDLE_WAIT_MS);
+        if (idle && !stopping && now < quiet &&
+            now - queue[0]->queued < std::chrono::milliseconds(IOSCHED_IDLE_EXPIRE_MS))
+        {
+            wake.wait_until(held, quiet);
+            continue;
+        }
+
+        size_t chosen = pick();
+        group.assign(1, queue[chosen]);
+        queue.erase(queue.begin() + chosen);
+        unsigned start = group[0]->block_no;
+        unsigned end = start + group[0]->count;
+
+        //Takes along queued requests of the same kind that continue the run on either side
+        bool grew = true;
+        while (grew && end - start < IOSCHED_MAX_MERGE)
+        {
+            grew = false;
+            for (size_t i = 0; i < queue.size(); i++)
+            {
+                io_request* r = queue[i];
+                if (r->op != group[0]->op || r->idle != group[0]->idle ||
+                    end - start + r->count > IOSCHED_MAX_MERGE)
+                {
+                    continue;
+                }
+                if (r->block_no == end || r->block_no + r->count == start)
+                {
+                    if (r->block_no == end)
+                    {
+                        group.push_back(r);
+                        end += r->count;
+                    }
+                    else
+                    {
+                        group.insert(group.begin(), r);
+                        start = r->block_no;
+                    }
+                    queue.erase(queue.begin() + i);
+                    merged.fetch_add(1, std::memory_order_relaxed);
+                    grew = true;
+                    break;
+                }
+            }
+        }
+        head = end;
+        held.unlock();
+
+        uint8_t op = group[0]->op;
+        unsigned blockSize = disk.get_block_size();
+        uint8_t* data = group[0]->data;
+        if (group.size() > 1)
+        {
+            buffer.resize((size_t)(end - start) * blockSize);
+            data = buffer.data();
+            size_t offset = 0;
+            for (io_request* r : group)
+            {
+                if (op == IO_WRITE)
+                {
+                    memcpy(data + offset, r->data, (size_t)r->count * blockSize);
+                }
+                offset += (size_t)r->count * blockSize;
+            }
+        }
+        int result = op == IO_WRITE ? disk.write_blocks(start, end - start, data) :
+            disk.read_blocks(start, end - start, data);
+        dispatched.fetch_add(1, std::memory_order_relaxed);
+        for (io_request* r : group)
+        {
+            r->result = result;
+        }
+        if (group.size() > 1 && result == -1)
+        {
+            //The failure may be in the blocks of only some of them, each one
+            //is tried on its own and gets its own result
+            for (io_request* r : group)
+            {
+                r->result = op == IO_WRITE ? disk.write_blocks(r->block_no, r->count, r->data) :
+                    disk.read_blocks(r->block_no, r->count, r->data);
+                dispatched.fetch_add(1, std::memory_order_relaxed);
+            }
+            retried.fetch_add(group.size(), std::memory_order_relaxed);
+        }
+        else if (group.size() > 1 && op == IO_READ)
+        {
+            size_t offset = 0;
+            for (io_request* r : group)
+            {
+                memcpy(r->data, data + offset, (size_t)r->count * blockSize);
+                offset += (size_t)r->count * blockSize;
+            }
+        }
+
+        held.lock();
+        if (!group[0]->idle)
+        {
+            lastBusy = std::chrono::steady_clock::now();
+        }
+        for (io_request* r : group)
+        {
+            r->done = true;
+        }
+        finished.notify_all();
+    }
+}
+
+void IoScheduler::reset_stats()
+{
+    submitted = 0;
+    dispatched = 0;
+    merged = 0;
+    reordered = 0;
+    expired = 0;
+    retried = 0;
+}
+
+void IoScheduler::print(std::ostream& out)
+{
+    out << "  submitted " << submitted << "  dispatched " << dispatched
+        << "  merged " << merged << "  reordered " << reordered
+        << "  expired " << expired;
+    if (retried > 0)
+    {
+        out << "  retried " << retried;
+    }
+    out << "\n";
+}
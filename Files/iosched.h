@@ -0,0 +1,77 @@
+#include <iostream>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "disk.h"
+
+#ifndef __IOSCHED_H__
+#define __IOSCHED_H__
+
+#define IOSCHED_READ_EXPIRE_MS 50 // a read waiting this long is served next
+#define IOSCHED_WRITE_EXPIRE_MS 500 // same for writes, keeps reads from starving them
+#define IOSCHED_MAX_MERGE 256 // blocks sent to the disk as one merged request
+#define IOSCHED_IDLE_WAIT_MS 10 // idle requests wait until no other request was served for this long
+#define IOSCHED_IDLE_EXPIRE_MS 2000 // and are served anyway once they waited this long
+
+// one queued request, it must stay alive until wait() returned
+struct io_request {
+    uint8_t op; // IO_READ or IO_WRITE
+    unsigned block_no;
+    unsigned count;
+    uint8_t* data; // count blocks
+    bool idle; // background work that gives way to every other request
+    std::chrono::steady_clock::time_point queued;
+    bool done;
+    int result;
+};
+
+// Elevator in front of the disk. Queued requests are served in C-SCAN order,
+// rising block numbers from where the last request ended and then around
+// from the lowest again. Reads go before writes so a reader waiting on a
+// cache miss is not stuck behind a write-back, unless a request has waited
+// past its deadline. Requests of the same kind on neighbouring blocks are
+// merged into one disk request, if that fails each of them is tried on its
+// own. One thread does all the disk access.
+// Idle requests, like the scrubber's, are served only when nothing else is
+// queued and the disk has been quiet for IOSCHED_IDLE_WAIT_MS.
+class IoScheduler {
+private:
+    Disk& disk;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    std::vector<io_request*> queue; // in arrival order
+    unsigned head = 0; // block after the last request served
+    std::chrono::steady_clock::time_point lastBusy; // when the last request that is not idle was served
+    bool stopping = false;
+    std::thread dispatcher;
+
+    std::atomic<uint64_t> submitted{0};
+    std::atomic<uint64_t> dispatched{0}; // requests sent to the disk
+    std::atomic<uint64_t> merged{0}; // requests that went along with another one
+    std::atomic<uint64_t> reordered{0}; // served before an older request
+    std::atomic<uint64_t> expired{0}; // served because their deadline passed
+    std::atomic<uint64_t> retried{0}; // tried on their own after the merged request failed
+
+    void dispatchLoop();
+    //Returns the position in the queue of the request to serve next
+    size_t pick();
+
+public:
+    IoScheduler(Disk& disk);
+    ~IoScheduler();
+    // queues a request and returns at once
+    void submit(io_request& r);
+    // waits until the request has been served, returns its result
+    int wait(io_request& r);
+    // queues a request and waits for it
+    int io(uint8_t op, unsigned block_no, unsigned count, uint8_t* data, bool idle = false);
+    void reset_stats();
+    void print(std::ostream& out);
+};
+
+#endif // __IOSCHED_H__
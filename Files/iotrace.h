@@ -0,0 +1,30 @@
+#include <cstdint>
+
+#ifndef __IOTRACE_H__
+#define __IOTRACE_H__
+
+#define IOTRACE_MAGIC 0x43525442 // "BTRC"
+#define IOTRACE_VERSION 1
+#define IOTRACE_BUFFER 4096 // records collected before they are written to the trace file
+
+#define IO_READ 0
+#define IO_WRITE 1
+
+// start of a block I/O trace file, the records follow it
+struct iotrace_header {
+    uint32_t magic; // IOTRACE_MAGIC
+    uint32_t version; // IOTRACE_VERSION
+    uint32_t block_size; // geometry of the disk when recording started
+    uint32_t no_blocks;
+};
+
+// one request that reached the disk, 16 bytes
+struct iotrace_record {
+    uint64_t time; // nanoseconds since recording started
+    uint32_t block_no; // first block of the request
+    uint16_t count; // number of consecutive blocks
+    uint8_t op; // IO_READ or IO_WRITE
+    uint8_t reserved;
+};
+
+#endif // __IOTRACE_H__
@@ -5,7 +5,8 @@
 int
 main(int argc, char **argv)
 {
-    Shell shell;
+    // the disk image can be given as the first argument
+    Shell shell(argc > 1 ? argv[1] : DISKNAME);
     shell.run();
     return 0;
 }
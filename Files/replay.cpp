@@ -0,0 +1,219 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "disk.h"
+#include "cache.h"
+#include "iotrace.h"
+
+#define REPLAY_IMAGE "replay.bin"
+
+// Replays a block I/O trace recorded with 'record <file>' in the shell.
+//   replay <tracefile> [-i <image>] [-c <cache_blocks>] [-d <device>] [-t]
+// -i  replays against image instead of a scratch replay.bin of the traced size
+// -c  goes through a BlockCache of that many blocks instead of straight to the disk
+// -d  simulates a device, e.g. hdd or ssd,qd=4,mode=virtual (see DeviceModel::configure)
+// -t  keeps the time between requests as recorded instead of replaying flat out
+// Writes store a pattern made from the block number so every run does the same.
+
+static void usage()
+{
+    std::cout << "Usage: replay <tracefile> [-i <image>] [-c <cache_blocks>] [-d <device>] [-t]\n";
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        usage();
+        return 1;
+    }
+    std::string tracePath = argv[1];
+    std::string image = REPLAY_IMAGE;
+    bool scratch = true;
+    unsigned cacheBlocks = 0;
+    bool timed = false;
+    std::vector<std::string> device;
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-i" && i + 1 < argc)
+        {
+            image = argv[++i];
+            scratch = false;
+        }
+        else if (arg == "-c" && i + 1 < argc)
+        {
+            cacheBlocks = std::stoul(argv[++i]);
+        }
+        else if (arg == "-d" && i + 1 < argc)
+        {
+            std::string spec = argv[++i];
+            size_t start = 0, comma;
+            while ((comma = spec.find(',', start)) != std::string::npos)
+            {
+                device.push_back(spec.substr(start, comma - start));
+                start = comma + 1;
+            }
+            device.push_back(spec.substr(start));
+        }
+        else if (arg == "-t")
+        {
+            timed = true;
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    std::ifstream trace(tracePath, std::ios::binary);
+    iotrace_header header;
+    if (!trace.read((char*)&header, sizeof(header)) || header.magic != IOTRACE_MAGIC ||
+        header.version != IOTRACE_VERSION || !Disk::valid_block_size(header.block_size))
+    {
+        std::cout << "ERROR: " << tracePath << " is not a block I/O trace\n";
+        return 1;
+    }
+    std::vector<iotrace_record> records;
+    iotrace_record r;
+    uint64_t traced = 0;
+    while (trace.read((char*)&r, sizeof(r)))
+    {
+        records.push_back(r);
+        traced += r.count;
+    }
+
+    if (scratch)
+    {
+        std::remove(image.c_str());
+    }
+    Disk disk(image, header.no_blocks, header.block_size);
+    if (disk.get_no_blocks() != header.no_blocks || disk.get_block_size() != header.block_size)
+    {
+        if (scratch)
+        {
+            disk.resize(header.no_blocks, header.block_size);
+        }
+        else
+        {
+            disk.set_geometry(disk.get_disk_size() / header.block_size, header.block_size);
+        }
+    }
+
+    if (!device.empty() && disk.get_device().configure(device) != 0)
+    {
+        usage();
+        if (scratch)
+        {
+            std::remove(image.c_str());
+        }
+        return 1;
+    }
+
+    Histogram readLatency, writeLatency, syncLatency;
+    std::vector<uint8_t> buffer;
+    {
+        std::unique_ptr<BlockCache> cache;
+        if (cacheBlocks > 0)
+        {
+            cache = std::unique_ptr<BlockCache>(new BlockCache(disk, cacheBlocks));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (iotrace_record& rec : records)
+        {
+            if (rec.block_no >= disk.get_no_blocks() || rec.count > disk.get_no_blocks() - rec.block_no)
+            {
+                continue;
+            }
+            if (timed)
+            {
+                std::this_thread::sleep_until(start + std::chrono::nanoseconds(rec.time));
+            }
+            buffer.resize((size_t)rec.count * header.block_size);
+            if (rec.op == IO_WRITE)
+            {
+                for (unsigned i = 0; i < rec.count; i++)
+                {
+                    memset(buffer.data() + (size_t)i * header.block_size, (rec.block_no + i) & 0xff, header.block_size);
+                }
+            }
+
+            ScopeTimer timer(rec.op == IO_WRITE ? writeLatency : readLatency);
+            for (unsigned i = 0; cache && i < rec.count; i++)
+            {
+                uint8_t* blk = buffer.data() + (size_t)i * header.block_size;
+                if (rec.op == IO_WRITE)
+                {
+                    cache->write(rec.block_no + i, blk);
+                }
+                else
+                {
+                    cache->read(rec.block_no + i, blk);
+                }
+            }
+            if (!cache)
+            {
+                if (rec.op == IO_WRITE)
+                {
+                    disk.write_blocks(rec.block_no, rec.count, buffer.data());
+                }
+                else
+                {
+                    disk.read_blocks(rec.block_no, rec.count, buffer.data());
+                }
+            }
+        }
+        if (cache)
+        {
+            ScopeTimer timer(syncLatency);
+            cache->sync();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "trace " << tracePath << ": " << records.size() << " requests, "
+            << traced << " blocks of " << header.block_size << " bytes\n";
+        std::cout << "backend " << image;
+        if (cache)
+        {
+            std::cout << " behind a " << cacheBlocks << " block cache";
+        }
+        std::cout << (timed ? ", timed" : ", as fast as possible") << "\n";
+        char line[128];
+        snprintf(line, sizeof(line), "elapsed %.3f ms, %.0f requests/s, %.1f MiB/s\n",
+            seconds * 1e3, seconds > 0 ? records.size() / seconds : 0.0,
+            seconds > 0 ? traced * header.block_size / seconds / (1 << 20) : 0.0);
+        std::cout << line;
+        std::cout << "read   ";
+        readLatency.print(std::cout);
+        std::cout << "write  ";
+        writeLatency.print(std::cout);
+        if (cache)
+        {
+            std::cout << "sync   ";
+            syncLatency.print(std::cout);
+            cache->get_stats().print(std::cout);
+        }
+        std::cout << "disk\n";
+        disk.get_stats().print(std::cout);
+        if (disk.get_device().active())
+        {
+            std::cout << "device\n";
+            disk.get_device().print(std::cout);
+        }
+    }
+
+    if (scratch)
+    {
+        std::remove(image.c_str());
+    }
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include <cctype>
 #include "shell.h"
 #include "fs.h"
 
@@ -9,11 +10,12 @@ std::string commands_str[] = {
     "format", "create", "cat", "ls",
     "cp", "mv", "rm", "append",
     "mkdir", "cd", "pwd",
-    "chmod",
+    "chmod", "truncate", "prealloc", "get", "put", "mount", "umount", "stats", "trace", "record", "device",
+    "defrag", "scrub", "sync", "trim", "snapshot", "fsinfo", "fsck",
     "help", "quit"
 };
 
-Shell::Shell()
+Shell::Shell(const std::string& image) : filesystem(image), rootImage(image), current(&filesystem)
 {
     std::cout << "Starting shell...\n";
 }
@@ -21,6 +23,95 @@ Shell::Shell()
 Shell::~Shell()
 {
     std::cout << "Exiting shell...\n";
+    // a snapshot is mounted after its volume and reads through its disk,
+    // so the volumes are unmounted in the reverse order
+    while (!mounts.empty())
+        mounts.pop_back();
+}
+
+FS&
+Shell::volume(std::string& path)
+{
+    if (path.empty() || path[0] != '/')
+        return *current;
+    for (mount_point& m : mounts) {
+        if (path.compare(0, m.prefix.size(), m.prefix) == 0 &&
+            (path.size() == m.prefix.size() || path[m.prefix.size()] == '/')) {
+            path = path.size() == m.prefix.size() ? "/" : path.substr(m.prefix.size());
+            return *m.fs;
+        }
+    }
+    return filesystem;
+}
+
+std::string
+Shell::prefixOf(FS& fs)
+{
+    for (mount_point& m : mounts) {
+        if (m.fs.get() == &fs)
+            return m.prefix;
+    }
+    return "";
+}
+
+int
+Shell::mount(std::string image, std::string prefix, FS* live, int slot)
+{
+    if (prefix.size() < 2 || prefix[0] != '/' || prefix.find('/', 1) != std::string::npos) {
+        std::cout << "ERROR: Mount point must be a name directly under /\n";
+        return -1;
+    }
+    if (image == rootImage) {
+        std::cout << "ERROR: " << image << " is already mounted at /\n";
+        return -1;
+    }
+    for (mount_point& m : mounts) {
+        if (m.prefix == prefix || m.image == image) {
+            std::cout << "ERROR: " << m.image << " is already mounted at " << m.prefix << "\n";
+            return -1;
+        }
+    }
+    mount_point m;
+    m.prefix = prefix;
+    m.image = image;
+    m.fs = std::unique_ptr<FS>(live ? new FS(*live, slot) : new FS(image));
+    mounts.push_back(std::move(m));
+    return 0;
+}
+
+int
+Shell::umount(std::string prefix)
+{
+    for (auto it = mounts.begin(); it != mounts.end(); ++it) {
+        if (it->prefix == prefix) {
+            // a mounted snapshot reads through the disk of its volume
+            for (mount_point& m : mounts) {
+                if (m.image.compare(0, it->image.size() + 1, it->image + "@") == 0) {
+                    std::cout << "ERROR: Snapshot " << m.image << " is mounted at " << m.prefix << "\n";
+                    return -1;
+                }
+            }
+            if (current == it->fs.get()) {
+                current = &filesystem;
+                currentPrefix.clear();
+            }
+            // the volume writes everything back when it is destroyed
+            mounts.erase(it);
+            return 0;
+        }
+    }
+    std::cout << "ERROR: Nothing is mounted at " << prefix << "\n";
+    return -1;
+}
+
+int
+Shell::copy(FS& source, std::string sourcepath, FS& dest, std::string destpath, bool move)
+{
+    if (source.copyTo(sourcepath, dest, destpath) != 0)
+        return 0; // the error has been printed already
+    if (move)
+        return source.rm(sourcepath);
+    return 0;
 }
 
 void
@@ -66,12 +157,28 @@ Shell::run()
         }
 
         if (cmd == "format") {
-            if (cmd_line.size() != 1) {
-                std::cout << "Usage: format\n";
+            // -c keeps a checksum of every block, -z stores files compressed,
+            // -d stores blocks with the same data once, -p packs small files together,
+            // -l writes every block to the head of a log
+            unsigned options = 0;
+            while (cmd_line.size() > 1 && (cmd_line[1] == "-c" || cmd_line[1] == "-z" ||
+                cmd_line[1] == "-d" || cmd_line[1] == "-p" || cmd_line[1] == "-l")) {
+                options |= cmd_line[1] == "-c" ? FORMAT_CHECKSUMS : cmd_line[1] == "-z" ? FORMAT_COMPRESS :
+                    cmd_line[1] == "-d" ? FORMAT_DEDUP : cmd_line[1] == "-p" ? FORMAT_PACK : FORMAT_LOG;
+                cmd_line.erase(cmd_line.begin() + 1);
+            }
+            if (cmd_line.size() > 3 ||
+                (cmd_line.size() > 1 && cmd_line[1].find_first_not_of("0123456789") != std::string::npos) ||
+                (cmd_line.size() > 2 && cmd_line[2].find_first_not_of("0123456789") != std::string::npos)) {
+                std::cout << "Usage: format [-c] [-z] [-d] [-p] [-l] [<no_blocks> [<block_size>]]\n";
                 continue;
             }
             // check return value so everything is ok
-            ret_val = filesystem.format();
+            if (cmd_line.size() == 1)
+                ret_val = current->format(options);
+            else
+                ret_val = current->format(std::stoul(cmd_line[1]),
+                    cmd_line.size() == 3 ? std::stoul(cmd_line[2]) : BLOCK_SIZE, options);
             if (ret_val) {
                 std::cout << "Error: format failed, error code " << ret_val << std::endl;
             }
@@ -85,7 +192,8 @@ Shell::run()
             arg1 = cmd_line[1];
             std::cout << "Enter data. Empty line to end.\n";
             // check return value so everything is ok
-            ret_val = filesystem.create(arg1);
+            FS& fs = volume(arg1);
+            ret_val = fs.create(arg1);
             if (ret_val) {
                 std::cout << "Error: create " << arg1;
                 std::cout << " failed, error code " << ret_val << std::endl;
@@ -99,7 +207,8 @@ Shell::run()
             }
             arg1 = cmd_line[1];
             // check return value so everything is ok
-            ret_val = filesystem.cat(arg1);
+            FS& fs = volume(arg1);
+            ret_val = fs.cat(arg1);
             if (ret_val) {
                 std::cout << "Error: cat " << arg1;
                 std::cout << " failed, error code " << ret_val << std::endl;
@@ -112,7 +221,7 @@ Shell::run()
                 continue;
             }
             // check return value so everything is ok
-            ret_val = filesystem.ls();
+            ret_val = current->ls();
             if (ret_val) {
                 std::cout << "Error: ls failed, error code " << ret_val << std::endl;
             }
@@ -126,7 +235,12 @@ Shell::run()
             arg1 = cmd_line[1];
             arg2 = cmd_line[2];
             // check return value so everything is ok
-            ret_val = filesystem.cp(arg1, arg2);
+            FS& source = volume(arg1);
+            FS& dest = volume(arg2);
+            if (&source == &dest)
+                ret_val = source.cp(arg1, arg2);
+            else
+                ret_val = copy(source, arg1, dest, arg2, false);
             if (ret_val) {
                 std::cout << "Error: cp " << arg1 << " " << arg2;
                 std::cout << " failed, error code " << ret_val << std::endl;
@@ -141,7 +255,12 @@ Shell::run()
             arg1 = cmd_line[1];
             arg2 = cmd_line[2];
             // check return value so everything is ok
-            ret_val = filesystem.mv(arg1, arg2);
+            FS& source = volume(arg1);
+            FS& dest = volume(arg2);
+            if (&source == &dest)
+                ret_val = source.mv(arg1, arg2);
+            else
+                ret_val = copy(source, arg1, dest, arg2, true);
             if (ret_val) {
                 std::cout << "Error: mv " << arg1 << " " << arg2;
                 std::cout << " failed, error code " << ret_val << std::endl;
@@ -155,7 +274,8 @@ Shell::run()
             }
             arg1 = cmd_line[1];
             // check return value so everything is ok
-            ret_val = filesystem.rm(arg1);
+            FS& fs = volume(arg1);
+            ret_val = fs.rm(arg1);
             if (ret_val) {
                 std::cout << "Error: rm " << arg1;
                 std::cout << " failed, error code " << ret_val << std::endl;
@@ -170,7 +290,13 @@ Shell::run()
             arg1 = cmd_line[1];
             arg2 = cmd_line[2];
             // check return value so everything is ok
-            ret_val = filesystem.append(arg1, arg2);
+            FS& source = volume(arg1);
+            FS& dest = volume(arg2);
+            if (&source != &dest) {
+                std::cout << "Error: append between volumes is not supported\n";
+                continue;
+            }
+            ret_val = source.append(arg1, arg2);
             if (ret_val) {
                 std::cout << "Error: append " << arg1 << " " << arg2;
                 std::cout << " failed, error code " << ret_val << std::endl;
@@ -184,7 +310,8 @@ Shell::run()
             }
             arg1 = cmd_line[1];
             // check return value so everything is ok
-            ret_val = filesystem.mkdir(arg1);
+            FS& fs = volume(arg1);
+            ret_val = fs.mkdir(arg1);
             if (ret_val) {
                 std::cout << "Error: mkdir " << arg1;
                 std::cout << " failed, error code " << ret_val << std::endl;
@@ -198,11 +325,17 @@ Shell::run()
             }
             arg1 = cmd_line[1];
             // check return value so everything is ok
-            ret_val = filesystem.cd(arg1);
+            FS& fs = volume(arg1);
+            ret_val = fs.cd(arg1);
             if (ret_val) {
                 std::cout << "Error: cd " << arg1;
                 std::cout << " failed, error code " << ret_val << std::endl;
             }
+            // the shell only moves to another volume once cd got there
+            else if (&fs != current) {
+                current = &fs;
+                currentPrefix = prefixOf(fs);
+            }
         }
 
         else if (cmd == "pwd") {
@@ -211,7 +344,13 @@ Shell::run()
                 continue;
             }
             // check return value so everything is ok
-            ret_val = filesystem.pwd();
+            if (currentPrefix.empty()) {
+                ret_val = current->pwd();
+            } else {
+                std::string path = current->cwd();
+                std::cout << currentPrefix << (path == "/" ? "" : path) << "\n";
+                ret_val = 0;
+            }
             if (ret_val) {
                 std::cout << "Error: pwd failed, error code " << ret_val << std::endl;
             }
@@ -225,19 +364,264 @@ Shell::run()
             arg1 = cmd_line[1];
             arg2 = cmd_line[2];
             // check return value so everything is ok
-            ret_val = filesystem.chmod(arg1, arg2);
+            FS& fs = volume(arg2);
+            ret_val = fs.chmod(arg1, arg2);
             if (ret_val) {
                 std::cout << "Error: chmod " << arg1 << " " << arg2;
                 std::cout << " failed, error code " << ret_val << std::endl;
             }
         }
 
+        else if (cmd == "truncate") {
+            if (cmd_line.size() != 3 || !isdigit((unsigned char)cmd_line[2][0])) {
+                std::cout << "Usage: truncate <filepath> <size>\n";
+                continue;
+            }
+            arg1 = cmd_line[1];
+            FS& fs = volume(arg1);
+            ret_val = fs.truncate(arg1, std::stoull(cmd_line[2]));
+            if (ret_val) {
+                std::cout << "Error: truncate failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "prealloc") {
+            if (cmd_line.size() != 3 || !isdigit((unsigned char)cmd_line[2][0])) {
+                std::cout << "Usage: prealloc <filepath> <bytes>\n";
+                continue;
+            }
+            arg1 = cmd_line[1];
+            FS& fs = volume(arg1);
+            ret_val = fs.fallocate(arg1, std::stoull(cmd_line[2]));
+            if (ret_val) {
+                std::cout << "Error: prealloc failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "get") {
+            if (cmd_line.size() != 3) {
+                std::cout << "Usage: get <filepath> <hostpath>\n";
+                continue;
+            }
+            arg1 = cmd_line[1];
+            FS& fs = volume(arg1);
+            ret_val = fs.get(arg1, cmd_line[2]);
+            if (ret_val) {
+                std::cout << "Error: get failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "put") {
+            if (cmd_line.size() != 3) {
+                std::cout << "Usage: put <hostpath> <filepath>\n";
+                continue;
+            }
+            arg2 = cmd_line[2];
+            FS& fs = volume(arg2);
+            ret_val = fs.put(cmd_line[1], arg2);
+            if (ret_val) {
+                std::cout << "Error: put failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "mount") {
+            if (cmd_line.size() == 1) {
+                std::cout << rootImage << " on /\n";
+                for (mount_point& m : mounts)
+                    std::cout << m.image << " on " << m.prefix << "\n";
+                continue;
+            }
+            if (cmd_line.size() != 3) {
+                std::cout << "Usage: mount [<image> <mountpoint>]\n";
+                continue;
+            }
+            arg1 = cmd_line[1];
+            arg2 = cmd_line[2];
+            // check return value so everything is ok
+            ret_val = mount(arg1, arg2);
+            if (ret_val) {
+                std::cout << "Error: mount " << arg1 << " " << arg2;
+                std::cout << " failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "umount") {
+            if (cmd_line.size() != 2) {
+                std::cout << "Usage: umount <mountpoint>\n";
+                continue;
+            }
+            arg1 = cmd_line[1];
+            // check return value so everything is ok
+            ret_val = umount(arg1);
+            if (ret_val) {
+                std::cout << "Error: umount " << arg1;
+                std::cout << " failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "stats") {
+            if (cmd_line.size() > 2 || (cmd_line.size() == 2 && cmd_line[1] != "--reset")) {
+                std::cout << "Usage: stats [--reset]\n";
+                continue;
+            }
+            bool reset = cmd_line.size() == 2;
+            if (!reset)
+                std::cout << "Volume /\n";
+            ret_val = filesystem.stats(reset);
+            for (mount_point& m : mounts) {
+                if (!reset)
+                    std::cout << "Volume " << m.prefix << "\n";
+                ret_val |= m.fs->stats(reset);
+            }
+            if (ret_val) {
+                std::cout << "Error: stats failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "trace") {
+            if (cmd_line.size() == 2 && (cmd_line[1] == "on" || cmd_line[1] == "off")) {
+                Tracer::enable(cmd_line[1] == "on");
+            } else if (cmd_line.size() == 2 && cmd_line[1] == "clear") {
+                Tracer::clear();
+            } else if (cmd_line.size() == 3 && cmd_line[1] == "dump") {
+                arg1 = cmd_line[2];
+                // check return value so everything is ok
+                ret_val = Tracer::dump(arg1);
+                if (ret_val) {
+                    std::cout << "Error: trace dump " << arg1;
+                    std::cout << " failed, error code " << ret_val << std::endl;
+                }
+            } else {
+                std::cout << "Usage: trace on|off|clear|dump <file>\n";
+            }
+        }
+
+        else if (cmd == "record") {
+            if (cmd_line.size() != 2) {
+                std::cout << "Usage: record <tracefile>|off\n";
+                continue;
+            }
+            arg1 = cmd_line[1];
+            // check return value so everything is ok
+            ret_val = current->record(arg1);
+            if (ret_val) {
+                std::cout << "Error: record " << arg1;
+                std::cout << " failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "device") {
+            std::vector<std::string> args(cmd_line.begin() + 1, cmd_line.end());
+            // check return value so everything is ok
+            ret_val = current->device(args);
+            if (ret_val) {
+                std::cout << "Usage: device [none|hdd|ssd [seek=<ms>] [fullseek=<ms>] [rpm=<n>] "
+                    "[read=<us>] [write=<us>] [qd=<n>] [rate=<MB/s>] [mode=sleep|virtual]]\n";
+            }
+        }
+
+        else if (cmd == "defrag") {
+            std::string mode;
+            size_t next = 1;
+            if (cmd_line.size() > 1 && !isdigit((unsigned char)cmd_line[1][0]))
+                mode = cmd_line[next++];
+            unsigned rate = DEFRAG_RATE;
+            bool valid = cmd_line.size() <= next + 1;
+            if (valid && cmd_line.size() == next + 1) {
+                valid = (mode == "" || mode == "start") && isdigit((unsigned char)cmd_line[next][0]);
+                if (valid)
+                    rate = std::stoul(cmd_line[next]);
+            }
+            // check return value so everything is ok
+            ret_val = valid ? current->defrag(mode, rate) : -1;
+            if (ret_val) {
+                std::cout << "Usage: defrag [start|stop|status] [<blocks/s>]\n";
+            }
+        }
+
+        else if (cmd == "scrub") {
+            std::string mode;
+            size_t next = 1;
+            if (cmd_line.size() > 1 && !isdigit((unsigned char)cmd_line[1][0]))
+                mode = cmd_line[next++];
+            unsigned rate = SCRUB_RATE;
+            bool valid = cmd_line.size() <= next + 1;
+            if (valid && cmd_line.size() == next + 1) {
+                valid = (mode == "" || mode == "start") && isdigit((unsigned char)cmd_line[next][0]);
+                if (valid)
+                    rate = std::stoul(cmd_line[next]);
+            }
+            // check return value so everything is ok
+            ret_val = valid ? current->scrub(mode, rate) : -1;
+            if (ret_val) {
+                std::cout << "Usage: scrub [start|stop|status] [<blocks/s>]\n";
+            }
+        }
+
+        else if (cmd == "sync") {
+            current->sync();
+        }
+
+        else if (cmd == "trim") {
+            current->trim();
+        }
+
+        else if (cmd == "snapshot") {
+            // snapshots of the current volume, mount-ro mounts one read-only
+            bool named = cmd_line.size() == 3 && (cmd_line[1] == "create" || cmd_line[1] == "delete");
+            bool listed = cmd_line.size() == 2 && cmd_line[1] == "list";
+            bool mounted = cmd_line.size() == 4 && cmd_line[1] == "mount-ro";
+            if (!named && !listed && !mounted) {
+                std::cout << "Usage: snapshot create|delete <name>, snapshot list, snapshot mount-ro <name> <mountpoint>\n";
+                std::cout << "create copies no data block but writes the whole block map, its time grows with the disk size\n";
+                continue;
+            }
+            if (mounted) {
+                int slot = current->findSnapshot(cmd_line[2]);
+                if (slot == -1)
+                    continue;
+                std::string image = rootImage;
+                for (mount_point& m : mounts) {
+                    if (m.fs.get() == current)
+                        image = m.image;
+                }
+                ret_val = mount(image + "@" + cmd_line[2], cmd_line[3], current, slot);
+            }
+            else
+                ret_val = current->snapshot(cmd_line[1], named ? cmd_line[2] : "");
+            if (ret_val) {
+                std::cout << "Error: snapshot " << cmd_line[1] << " failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "fsinfo") {
+            current->fsinfo();
+        }
+
+        else if (cmd == "fsck") {
+            bool repair = false, valid = true;
+            unsigned threads = 0;
+            for (size_t i = 1; i < cmd_line.size() && valid; i++) {
+                if (cmd_line[i] == "-r")
+                    repair = true;
+                else if (cmd_line[i] == "-j" && i + 1 < cmd_line.size() && isdigit((unsigned char)cmd_line[i + 1][0]))
+                    threads = std::stoul(cmd_line[++i]);
+                else
+                    valid = false;
+            }
+            if (!valid) {
+                std::cout << "Usage: fsck [-r] [-j <threads>]\n";
+                continue;
+            }
+            current->fsck(repair, threads);
+        }
+
         else if (cmd == "quit")
             running = false;
 
         else if (cmd == "help") {
             std::cout << "Available commands:\n";
-            std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, chmod, help, quit\n";
+            std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, chmod, truncate, prealloc, get, put, mount, umount, stats, trace, record, device, defrag, scrub, sync, trim, snapshot, fsinfo, fsck, help, quit\n";
         }
 
         else if (cmd == "") {
@@ -246,7 +630,7 @@ Shell::run()
 
         else {
             std::cout << "Available commands:\n";
-            std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, chmod, help, quit\n";
+            std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, chmod, truncate, prealloc, get, put, mount, umount, stats, trace, record, device, defrag, scrub, sync, trim, snapshot, fsinfo, fsck, help, quit\n";
         }
     }
 }
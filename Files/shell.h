@@ -1,14 +1,38 @@
 #include <iostream>
+#include <memory>
+#include <vector>
 #include "fs.h"
 
 #ifndef __SHELL_H__
 #define __SHELL_H__
 
+// a disk image mounted under a path prefix
+struct mount_point {
+    std::string prefix; // "/name", absolute paths starting with it go to this volume
+    std::string image; // "<image>@<name>" for a snapshot of image
+    std::unique_ptr<FS> fs;
+};
+
 class Shell {
 private:
-    FS filesystem;
+    FS filesystem; // the volume mounted at "/"
+    std::string rootImage;
+    std::vector<mount_point> mounts;
+    // the volume relative paths, ls and pwd refer to, and its prefix
+    FS* current;
+    std::string currentPrefix;
+
+    //Returns the volume path is on and strips the mount prefix from path
+    FS& volume(std::string& path);
+    //Returns the prefix of the volume fs
+    std::string prefixOf(FS& fs);
+    //Mounts image, or snapshot slot of live read-only under the name image
+    int mount(std::string image, std::string prefix, FS* live = nullptr, int slot = -1);
+    int umount(std::string prefix);
+    //cp and mv between two volumes, the file is streamed from one disk to the other
+    int copy(FS& source, std::string sourcepath, FS& dest, std::string destpath, bool move);
 public:
-    Shell();
+    Shell(const std::string& image = DISKNAME);
     ~Shell();
     void run();
 };
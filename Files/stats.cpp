@@ -0,0 +1,174 @@
+#include <cstdio>
+#include <algorithm>
+#include "stats.h"
+
+Histogram::Histogram()
+{
+    reset();
+}
+
+uint64_t Histogram::value(unsigned bucket)
+{
+    if (bucket < HIST_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    unsigned exponent = bucket / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+    unsigned shift = exponent - HIST_SUB_BITS;
+    uint64_t lowest = (uint64_t)(HIST_SUB_BUCKETS + bucket % HIST_SUB_BUCKETS) << shift;
+    return lowest + ((1ULL << shift) >> 1);
+}
+
+uint64_t Histogram::mean()
+{
+    uint64_t n = get_count();
+    return n == 0 ? 0 : sum.load(std::memory_order_relaxed) / n;
+}
+
+// the latency percent of the recorded values are at or below
+uint64_t Histogram::percentile(double percent)
+{
+    uint64_t n = get_count();
+    if (n == 0)
+    {
+        return 0;
+    }
+    uint64_t wanted = (uint64_t)(percent / 100.0 * n + 0.5);
+    if (wanted == 0)
+    {
+        wanted = 1;
+    }
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= wanted)
+        {
+            //The middle of the bucket can be above anything that was recorded
+            return std::min(value(i), get_max());
+        }
+    }
+    return get_max();
+}
+
+void Histogram::reset()
+{
+    for (unsigned i = 0; i < HIST_BUCKETS; i++)
+    {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+static std::string format_ns(uint64_t ns)
+{
+    char text[32];
+    if (ns < 1000)
+    {
+        snprintf(text, sizeof(text), "%lluns", (unsigned long long)ns);
+    }
+    else if (ns < 1000000)
+    {
+        snprintf(text, sizeof(text), "%.1fus", ns / 1e3);
+    }
+    else
+    {
+        snprintf(text, sizeof(text), "%.2fms", ns / 1e6);
+    }
+    return text;
+}
+
+// prints count, mean, p50, p99 and max on one line
+void Histogram::print(std::ostream& out)
+{
+    out << "count " << get_count()
+        << "  mean " << format_ns(mean())
+        << "  p50 " << format_ns(percentile(50))
+        << "  p99 " << format_ns(percentile(99))
+        << "  max " << format_ns(get_max()) << "\n";
+}
+
+void DiskStats::reset()
+{
+    reads = 0;
+    writes = 0;
+    bytesRead = 0;
+    bytesWritten = 0;
+    flushes = 0;
+    checksumErrors = 0;
+    discards = 0;
+    bytesDiscarded = 0;
+    segmentsCleaned = 0;
+    blocksCleaned = 0;
+    readLatency.reset();
+    writeLatency.reset();
+}
+
+void DiskStats::print(std::ostream& out)
+{
+    out << "  reads " << reads << " (" << format_bytes(bytesRead) << ")"
+        << "  writes " << writes << " (" << format_bytes(bytesWritten) << ")"
+        << "  flushes " << flushes;
+    if (checksumErrors > 0)
+        out << "  checksum errors " << checksumErrors;
+    if (discards > 0)
+        out << "  discards " << discards << " (" << format_bytes(bytesDiscarded) << ")";
+    if (segmentsCleaned > 0)
+        out << "  cleaned " << segmentsCleaned << " segments (" << blocksCleaned << " blocks moved)";
+    out << "\n";
+    out << "  read latency   ";
+    readLatency.print(out);
+    out << "  write latency  ";
+    writeLatency.print(out);
+}
+
+void CacheStats::reset()
+{
+    hits = 0;
+    misses = 0;
+    prefetched = 0;
+    evicted = 0;
+    writeBacks = 0;
+    writeErrors = 0;
+    discarded = 0;
+}
+
+void CacheStats::print(std::ostream& out)
+{
+    uint64_t reads = hits + misses;
+    char rate[16];
+    snprintf(rate, sizeof(rate), "%.1f%%", reads == 0 ? 0.0 : 100.0 * hits / reads);
+    out << "  hits " << hits << "  misses " << misses << "  hit rate " << rate << "\n";
+    out << "  prefetched " << prefetched << "  evicted " << evicted
+        << "  written back " << writeBacks;
+    if (discarded > 0)
+        out << "  discarded " << discarded;
+    if (writeErrors > 0)
+        out << "  write errors " << writeErrors;
+    out << "\n";
+}
+
+// prints bytes as B, KiB, MiB or GiB
+std::string format_bytes(uint64_t bytes)
+{
+    const char* units[] = {"B", "KiB", "MiB", "GiB"};
+    double size = bytes;
+    unsigned unit = 0;
+    while (size >= 1024 && unit < 3)
+    {
+        size /= 1024;
+        unit++;
+    }
+    char text[32];
+    if (unit == 0)
+    {
+        snprintf(text, sizeof(text), "%llu B", (unsigned long long)bytes);
+    }
+    else
+    {
+        snprintf(text, sizeof(text), "%.1f %s", size, units[unit]);
+    }
+    return text;
+}
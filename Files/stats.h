@@ -0,0 +1,107 @@
+#include <iostream>
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <chrono>
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#define HIST_SUB_BITS 4 // 16 linear buckets per power of two, values are kept within ~6%
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+// Latency histogram in nanoseconds with log-linear buckets like HdrHistogram.
+// Recording is a few relaxed atomic adds, so it can stay on all the time and
+// be shared between threads.
+class Histogram {
+private:
+    std::atomic<uint64_t> buckets[HIST_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+
+    static unsigned bucket(uint64_t ns)
+    {
+        if (ns < HIST_SUB_BUCKETS)
+        {
+            return (unsigned)ns;
+        }
+        unsigned exponent = 63 - __builtin_clzll(ns);
+        unsigned sub = (ns >> (exponent - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1);
+        return (exponent - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + sub;
+    }
+    // middle of the values that end up in bucket
+    static uint64_t value(unsigned bucket);
+
+public:
+    Histogram();
+    void record(uint64_t ns)
+    {
+        buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t seen = max.load(std::memory_order_relaxed);
+        while (ns > seen && !max.compare_exchange_weak(seen, ns, std::memory_order_relaxed));
+    }
+    uint64_t get_count() { return count.load(std::memory_order_relaxed); }
+    uint64_t get_max() { return max.load(std::memory_order_relaxed); }
+    uint64_t mean();
+    // the latency percent of the recorded values are at or below
+    uint64_t percentile(double percent);
+    void reset();
+    // prints count, mean, p50, p99 and max on one line
+    void print(std::ostream& out);
+};
+
+// Times the enclosing scope into a histogram
+class ScopeTimer {
+private:
+    Histogram& hist;
+    std::chrono::steady_clock::time_point start;
+public:
+    ScopeTimer(Histogram& hist) : hist(hist), start(std::chrono::steady_clock::now()) {}
+    ~ScopeTimer()
+    {
+        hist.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+};
+
+// Counters of one disk, updated on every request that reaches the disk file
+struct DiskStats {
+    std::atomic<uint64_t> reads{0}; // read requests, one or more blocks each
+    std::atomic<uint64_t> writes{0};
+    std::atomic<uint64_t> bytesRead{0};
+    std::atomic<uint64_t> bytesWritten{0};
+    std::atomic<uint64_t> flushes{0};
+    std::atomic<uint64_t> checksumErrors{0}; // reads that failed the block checksum
+    std::atomic<uint64_t> discards{0}; // holes punched in the disk file
+    std::atomic<uint64_t> bytesDiscarded{0};
+    std::atomic<uint64_t> segmentsCleaned{0}; // log segments emptied by moving their blocks
+    std::atomic<uint64_t> blocksCleaned{0};
+    Histogram readLatency;
+    Histogram writeLatency;
+
+    void reset();
+    void print(std::ostream& out);
+};
+
+// Counters of one block cache
+struct CacheStats {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0}; // reads that had to wait for the disk
+    std::atomic<uint64_t> prefetched{0}; // blocks read in by the readahead thread
+    std::atomic<uint64_t> evicted{0};
+    std::atomic<uint64_t> writeBacks{0}; // dirty blocks written to the disk
+    std::atomic<uint64_t> writeErrors{0}; // write-backs the disk failed, the block stays dirty
+    std::atomic<uint64_t> discarded{0}; // freed blocks dropped and punched out of the disk
+
+    void reset();
+    void print(std::ostream& out);
+};
+
+// prints bytes as B, KiB, MiB or GiB
+std::string format_bytes(uint64_t bytes);
+
+#endif // __STATS_H__
@@ -0,0 +1,132 @@
+#include <fstream>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "test_helpers.h"
+
+static int failures = 0;
+
+void check(bool ok, const std::string& what)
+{
+    std::cout << (ok ? "PASS: " : "FAIL: ") << what << std::endl;
+    failures += !ok;
+}
+
+int checks_failed()
+{
+    return failures;
+}
+
+std::string lines(char fill, int count)
+{
+    std::string text;
+    for (int i = 0; i < count; i++)
+    {
+        text += std::string(63, fill) + "\n";
+    }
+    return text;
+}
+
+void createFile(FS& fs, const std::string& path, char fill, int count)
+{
+    //create reads the file from std::cin up to an empty line
+    std::istringstream input(lines(fill, count) + "\n");
+    std::streambuf* saved = std::cin.rdbuf(input.rdbuf());
+    fs.create(path);
+    std::cin.rdbuf(saved);
+}
+
+std::string catOf(FS& fs, const std::string& path)
+{
+    std::string out;
+    captured(out, [&] { return fs.cat(path); });
+    return out;
+}
+
+unsigned long counter(FS& fs, bool stats, const std::string& label)
+{
+    std::string out;
+    captured(out, [&] { return stats ? fs.stats() : fs.fsinfo(); });
+    size_t at = out.find(label);
+    return at == std::string::npos ? 0 : std::stoul(out.substr(at + label.size()));
+}
+
+std::string readAt(FS& fs, const std::string& path, uint64_t offset, size_t length)
+{
+    std::string data;
+    int handle = fs.open(path);
+    if (handle == -1 || fs.pread(handle, offset, length, data) == -1)
+    {
+        data.clear();
+    }
+    fs.close(handle);
+    return data;
+}
+
+long writeAt(FS& fs, const std::string& path, uint64_t offset, const std::string& data)
+{
+    int handle = fs.open(path);
+    long written = handle == -1 ? -1 : fs.pwrite(handle, offset, data);
+    fs.close(handle);
+    return written;
+}
+
+void imageIO(const std::string& image, bool write, uint64_t at, void* data, size_t count)
+{
+    std::fstream file(image, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekg(at);
+    if (write)
+    {
+        file.write((char*)data, count);
+    }
+    else
+    {
+        file.read((char*)data, count);
+    }
+}
+
+uint32_t firstBlock(const std::string& image, const std::string& name)
+{
+    super_block sb;
+    imageIO(image, false, 0, &sb, sizeof(sb));
+    std::vector<dir_entry> root(sb.block_size / sizeof(dir_entry));
+    imageIO(image, false, (uint64_t)sb.root_block * sb.block_size, root.data(), root.size() * sizeof(dir_entry));
+    for (dir_entry& entry : root)
+    {
+        if (entry.type == TYPE_FILE && name == entry.file_name)
+        {
+            return entry.first_blk;
+        }
+    }
+    return 0;
+}
+
+int inChild(std::function<int()> body)
+{
+    std::cout.flush();
+    pid_t child = fork();
+    if (child == 0)
+    {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, 1);
+        //A write past the file limit fails instead of killing the child
+        signal(SIGXFSZ, SIG_IGN);
+        _exit(body());
+    }
+    int status = 0;
+    if (child == -1 || waitpid(child, &status, 0) == -1 || !WIFEXITED(status))
+    {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+void fileLimit(rlim_t bytes)
+{
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    limit.rlim_cur = bytes;
+    setrlimit(RLIMIT_FSIZE, &limit);
+}
@@ -0,0 +1,55 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <sys/resource.h>
+#include "fs.h"
+
+#ifndef __TEST_HELPERS_H__
+#define __TEST_HELPERS_H__
+
+// checks shared by test6 and the tests after it
+
+// prints whether ok held, see checks_failed()
+void check(bool ok, const std::string& what);
+// number of checks that did not hold, the test exits with 1 if it is not 0
+int checks_failed();
+
+// runs call with std::cout going to out, returns what call returned
+template <typename F>
+int captured(std::string& out, F call)
+{
+    std::stringstream text;
+    std::streambuf* saved = std::cout.rdbuf(text.rdbuf());
+    int ret = call();
+    std::cout.rdbuf(saved);
+    out = text.str();
+    return ret;
+}
+
+// text of count lines of 63 times the letter fill
+std::string lines(char fill, int count);
+// creates path holding count lines of the letter fill
+void createFile(FS& fs, const std::string& path, char fill, int count);
+// what cat prints for path
+std::string catOf(FS& fs, const std::string& path);
+// the number after label in what stats, or fsinfo if stats is false, prints, 0 if it is not there
+unsigned long counter(FS& fs, bool stats, const std::string& label);
+// returns length bytes of path from offset, or "" if it can not be read
+std::string readAt(FS& fs, const std::string& path, uint64_t offset, size_t length);
+// writes data to path at offset, returns the bytes written or -1
+long writeAt(FS& fs, const std::string& path, uint64_t offset, const std::string& data);
+// reads or writes count bytes at byte offset at of the disk file image, no FS may have it open
+void imageIO(const std::string& image, bool write, uint64_t at, void* data, size_t count);
+// first block of the file name in the root directory of the disk file image, 0 if it is not there
+uint32_t firstBlock(const std::string& image, const std::string& name);
+
+// runs body in a child process that prints nothing, returns what body
+// returned (0 to 255) or -1 if the child did not exit
+int inChild(std::function<int()> body);
+// writes to files past bytes fail from now on, the limit goes up again with
+// RLIM_INFINITY. Only for inChild(), it applies to the whole process
+void fileLimit(rlim_t bytes);
+
+#endif // __TEST_HELPERS_H__
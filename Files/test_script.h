@@ -8,7 +8,7 @@ class Shell {
 private:
     FS filesystem;
 public:
-    Shell();
+    Shell(const std::string& image = DISKNAME);
     ~Shell();
     void run();
 };
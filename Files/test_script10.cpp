@@ -0,0 +1,126 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test10.bin"
+
+// what failingDisk() found
+#define SYNC_FAILED 0x01
+#define STAYED_DIRTY 0x02
+#define ERRORS_COUNTED 0x04
+#define SYNC_RETRIED 0x08
+
+//Returns whether the root directory in the disk file has an entry name, the
+//file system may have the image open
+static bool onDisk(const std::string& name)
+{
+    super_block sb;
+    imageIO(TEST_IMAGE, false, 0, &sb, sizeof(sb));
+    std::vector<dir_entry> root(sb.block_size / sizeof(dir_entry));
+    imageIO(TEST_IMAGE, false, (uint64_t)sb.root_block * sb.block_size, root.data(), root.size() * sizeof(dir_entry));
+    for (dir_entry& entry : root)
+    {
+        if (entry.type == TYPE_FILE && name == entry.file_name)
+            return true;
+    }
+    return false;
+}
+
+//Creates g while the disk file can not be written, syncs, lets it be written
+//again and syncs once more. Returns what it found
+static int failingDisk()
+{
+    FS fs(TEST_IMAGE);
+    int found = 0;
+    fileLimit(0);
+    createFile(fs, "g", 'g', 128);
+    found |= fs.sync() == -1 ? SYNC_FAILED : 0;
+    found |= counter(fs, true, "  dirty ") > 0 ? STAYED_DIRTY : 0;
+    found |= counter(fs, true, "write errors ") > 0 ? ERRORS_COUNTED : 0;
+    fileLimit(RLIM_INFINITY);
+    found |= fs.sync() == 0 && counter(fs, true, "  dirty ") == 0 ? SYNC_RETRIED : 0;
+    return found;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 10 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        fs.sync();
+        std::cout << "Creating f1, it stays in the cache until it expires..." << std::endl;
+        fs.stats(true);
+        createFile(fs, "f1", 'a', 128);
+        check(counter(fs, true, "  dirty ") > 0, "the blocks of f1 are dirty in the cache");
+        check(counter(fs, true, "written back ") == 0, "nothing is written back yet");
+        check(!onDisk("f1"), "f1 is not in the root directory on the disk yet");
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(DIRTY_EXPIRE_MS + 4 * FLUSH_INTERVAL_MS));
+        check(counter(fs, true, "  dirty ") == 0, "the flusher wrote the expired blocks back");
+        check(counter(fs, true, "written back ") > 0, "stats counts the blocks written back");
+        check(onDisk("f1"), "f1 is in the root directory on the disk");
+        PRINTDIV2;
+
+        std::cout << "Creating f2 and syncing..." << std::endl;
+        createFile(fs, "f2", 'b', 128);
+        check(fs.sync() == 0 && counter(fs, true, "  dirty ") == 0, "sync writes every dirty block back");
+        check(onDisk("f2"), "f2 is in the root directory on the disk");
+    }
+    PRINTDIV2;
+
+    std::cout << "Creating g while the disk file can not be written..." << std::endl;
+    int found = inChild(failingDisk);
+    check(found != -1, "the child that can not write the disk file ran");
+    found = found == -1 ? 0 : found;
+    check(found & SYNC_FAILED, "sync fails");
+    check(found & STAYED_DIRTY, "the blocks that were not written stay dirty");
+    check(found & ERRORS_COUNTED, "stats counts the write errors");
+    check(found & SYNC_RETRIED, "the next sync writes them once the disk file can be written");
+    PRINTDIV2;
+
+    std::cout << "Mounting the disk again..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        check(catOf(fs, "f1") == lines('a', 128), "f1 reads back");
+        check(catOf(fs, "f2") == lines('b', 128), "f2 reads back");
+        check(catOf(fs, "g") == lines('g', 128), "g reads back");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 10 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
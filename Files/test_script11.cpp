@@ -0,0 +1,123 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include <sys/stat.h>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test11.bin"
+#define BIG_LINES (64 * 200) // 200 blocks
+
+//Host space the disk file takes, in bytes
+static uint64_t hostBytes()
+{
+    struct stat image;
+    return stat(TEST_IMAGE, &image) == 0 ? (uint64_t)image.st_blocks * 512 : 0;
+}
+
+// what the disk file says about a file, the file system may have it open
+struct on_disk {
+    bool listed = false; // the root directory has it
+    uint32_t first = 0; // its first block
+    int32_t fat = FAT_FREE; // the FAT entry of its first block
+    bool zeros = false; // its first block reads as zeros
+};
+
+//Looks name up in the disk file, or the first block first if it is not 0
+static on_disk lookUp(const std::string& name, uint32_t first = 0)
+{
+    on_disk found;
+    super_block sb;
+    imageIO(TEST_IMAGE, false, 0, &sb, sizeof(sb));
+    std::vector<dir_entry> root(sb.block_size / sizeof(dir_entry));
+    imageIO(TEST_IMAGE, false, (uint64_t)sb.root_block * sb.block_size, root.data(), root.size() * sizeof(dir_entry));
+    for (dir_entry& entry : root)
+    {
+        if (entry.type == TYPE_FILE && name == entry.file_name)
+        {
+            found.listed = true;
+            first = first == 0 ? entry.first_blk : first;
+        }
+    }
+    found.first = first;
+    imageIO(TEST_IMAGE, false, (uint64_t)sb.fat_start * sb.block_size + first * 4, &found.fat, 4);
+    std::vector<char> block(sb.block_size);
+    imageIO(TEST_IMAGE, false, (uint64_t)first * sb.block_size, block.data(), block.size());
+    found.zeros = std::vector<char>(sb.block_size, 0) == block;
+    return found;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 11 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        fs.sync();
+        uint64_t empty = hostBytes();
+        std::cout << "Writing big of 200 blocks and removing it..." << std::endl;
+        createFile(fs, "big", 'a', BIG_LINES);
+        fs.sync();
+        uint64_t full = hostBytes();
+        check(full >= empty + 200 * BLOCK_SIZE, "big takes host space");
+        fs.rm("big");
+        fs.sync();
+        check(hostBytes() <= empty + 8 * BLOCK_SIZE, "rm gives the host space back");
+        check(catOf(fs, "big").find("ERROR") != std::string::npos, "big is gone");
+        PRINTDIV2;
+
+        std::cout << "Removing f1 and waiting for the flusher, less than the dirty blocks take to expire..." << std::endl;
+        createFile(fs, "f1", 'b', 128);
+        fs.sync();
+        on_disk before = lookUp("f1");
+        check(before.listed && !before.zeros && before.fat != FAT_FREE, "f1 is on the disk");
+        fs.rm("f1");
+        std::this_thread::sleep_for(std::chrono::milliseconds(3 * FLUSH_INTERVAL_MS));
+        on_disk after = lookUp("f1", before.first);
+        check(after.zeros, "the first block of f1 is punched");
+        check(!after.listed && after.fat == FAT_FREE, "the directory and FAT that free it are on the disk");
+        PRINTDIV2;
+
+        std::cout << "Trimming the free blocks..." << std::endl;
+        std::string out;
+        fs.stats(true);
+        captured(out, [&] { return fs.trim(); });
+        check(out.find("trimmed ") != std::string::npos, "trim punches the free blocks");
+        check(counter(fs, true, "discards ") > 0, "stats counts the discards");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 11 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
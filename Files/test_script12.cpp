@@ -0,0 +1,98 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test12.bin"
+#define RUN_BLOCKS 10 // blocks of f, written back as merged requests
+#define GOOD_BLOCKS 4 // blocks of f before the file limit
+
+//A slow device keeps the scheduler busy with the first write while the
+//others queue up and are merged
+static const std::vector<std::string> SLOW_DEVICE = {"ssd", "write=20000"};
+
+static uint32_t first = 0; // first block of f
+
+//Rewrites f in place with the disk file limited to its first GOOD_BLOCKS blocks.
+//Returns the write errors stats counted, or 255 if f was not written in the end
+static int limitedRewrite()
+{
+    FS fs(TEST_IMAGE);
+    fs.device(SLOW_DEVICE);
+    fs.stats(true);
+    fileLimit((rlim_t)(first + GOOD_BLOCKS) * BLOCK_SIZE);
+    writeAt(fs, "f", 0, std::string(RUN_BLOCKS * BLOCK_SIZE, 'z'));
+    fs.sync();
+    int errors = counter(fs, true, "write errors ");
+    fileLimit(RLIM_INFINITY);
+    return fs.sync() == 0 ? errors : 255;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 12 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        fs.sync();
+        std::cout << "Writing f of " << RUN_BLOCKS << " blocks back in one go..." << std::endl;
+        createFile(fs, "x", 'x', 1);
+        fs.device(SLOW_DEVICE);
+        fs.stats(true);
+        createFile(fs, "f", 'a', 64 * RUN_BLOCKS);
+        check(fs.sync() == 0, "sync");
+        first = firstBlock(TEST_IMAGE, "f");
+        unsigned long submitted = counter(fs, true, "submitted ");
+        unsigned long dispatched = counter(fs, true, "dispatched ");
+        check(counter(fs, true, "merged ") > 0, "neighbouring blocks are merged");
+        check(dispatched < submitted, "fewer requests reach the disk than were queued");
+        //The first pwrite gives f its block map in the block x leaves, before
+        //the blocks of f. The rewrite then stays in place
+        fs.rm("x");
+        writeAt(fs, "f", 0, "a");
+        fs.sync();
+    }
+    PRINTDIV2;
+
+    std::cout << "Rewriting f with the disk file ending after its first " << GOOD_BLOCKS << " blocks..." << std::endl;
+    int errors = inChild(limitedRewrite);
+    check(errors == RUN_BLOCKS - GOOD_BLOCKS, "only the blocks past the end fail, the blocks merged with them are written");
+    {
+        FS fs(TEST_IMAGE);
+        check(catOf(fs, "f") == std::string(RUN_BLOCKS * BLOCK_SIZE, 'z'), "f reads back as it was rewritten");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 12 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
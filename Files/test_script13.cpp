@@ -0,0 +1,66 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test13.bin"
+#define BIG_BLOCKS 200
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 13 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        createFile(fs, "big", 'a', 64 * BIG_BLOCKS);
+        createFile(fs, "small", 'b', 64 * 4);
+    }
+
+    std::cout << "Reading big of " << BIG_BLOCKS << " blocks with nothing cached..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        fs.stats(true);
+        check(catOf(fs, "big") == lines('a', 64 * BIG_BLOCKS), "big reads back");
+        unsigned long prefetched = counter(fs, true, "prefetched ");
+        check(prefetched > BIG_BLOCKS / 2, "most of big is prefetched");
+        check(prefetched <= BIG_BLOCKS, "nothing past the end of big is prefetched");
+        check(counter(fs, true, "  hits ") > BIG_BLOCKS / 4, "the reader finds the prefetched blocks in the cache");
+        PRINTDIV2;
+
+        std::cout << "Reading small of 4 blocks..." << std::endl;
+        fs.stats(true);
+        check(catOf(fs, "small") == lines('b', 64 * 4), "small reads back");
+        check(counter(fs, true, "prefetched ") < 4, "only the rest of small is prefetched");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 13 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
@@ -0,0 +1,73 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test14.bin"
+#define TEST_BLOCKS 70000 // more than a 16-bit FAT entry can point at
+#define TEST_BLOCK_SIZE 1024
+#define FILL_BLOCKS 66000 // reserved by fill so f lands above block 65535
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 14 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    std::cout << "Formatting a disk of " << TEST_BLOCKS << " blocks and filling it past block 65535..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        check(fs.format(TEST_BLOCKS, TEST_BLOCK_SIZE) == 0, "format the disk");
+        check(fs.fallocate("fill", (uint64_t)FILL_BLOCKS * TEST_BLOCK_SIZE) == 0, "reserve the low blocks for fill");
+        createFile(fs, "f", 'a', 128);
+    }
+    super_block sb;
+    imageIO(TEST_IMAGE, false, 0, &sb, sizeof(sb));
+    check(sb.no_blocks == TEST_BLOCKS, "the super block has the size of the disk");
+    check(sb.fat_blocks == TEST_BLOCKS * 4 / TEST_BLOCK_SIZE + 1, "the FAT takes a 32-bit entry for every block");
+    uint32_t first = firstBlock(TEST_IMAGE, "f");
+    check(first > 65535, "f starts above block 65535");
+    int32_t next = 0;
+    imageIO(TEST_IMAGE, false, (uint64_t)sb.fat_start * TEST_BLOCK_SIZE + first * 4, &next, 4);
+    check(next == (int32_t)first + 1, "its FAT entry points at the next block");
+    PRINTDIV2;
+
+    std::cout << "Mounting the disk again..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        check(catOf(fs, "f") == lines('a', 128), "f reads back");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+        unsigned long used = counter(fs, false, "used ");
+        check(fs.rm("fill") == 0, "rm fill");
+        check(used - counter(fs, false, "used ") >= FILL_BLOCKS, "the blocks of fill are freed");
+        check(catOf(fs, "f") == lines('a', 128), "f still reads back");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 14 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
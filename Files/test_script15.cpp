@@ -0,0 +1,96 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test15.bin"
+#define SHELL_IMAGE "test15s.bin" // given to the shell on its command line
+
+//Size of the disk file path in bytes, 0 if there is none
+static uint64_t fileSize(const std::string& path)
+{
+    struct stat image;
+    return stat(path.c_str(), &image) == 0 ? (uint64_t)image.st_size : 0;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 15 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    std::cout << "Formatting " << TEST_IMAGE << " with 512 blocks of 8192 bytes..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        check(fs.format(512, 8192) == 0, "format 512 8192");
+        check(fileSize(TEST_IMAGE) == 512 * 8192, "the disk file has the new size");
+        createFile(fs, "f", 'a', 300);
+        check(captured(out, [&] { return fs.format(512, 3000); }) != 0, "a block size that is no power of two is refused");
+        check(catOf(fs, "f") == lines('a', 300), "the refused format leaves the disk as it was");
+    }
+    super_block sb;
+    imageIO(TEST_IMAGE, false, 0, &sb, sizeof(sb));
+    check(sb.no_blocks == 512 && sb.block_size == 8192, "the super block has the geometry");
+    PRINTDIV2;
+
+    std::cout << "Mounting the disk again..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        check(catOf(fs, "f") == lines('a', 300), "f reads back with the geometry of the super block");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+        check(fs.format(4096, 1024) == 0, "format 4096 1024");
+        check(fileSize(TEST_IMAGE) == 4096 * 1024, "the disk file shrinks to the new size");
+        createFile(fs, "g", 'b', 300);
+    }
+    {
+        FS fs(TEST_IMAGE);
+        check(catOf(fs, "f").find("ERROR") != std::string::npos, "f is gone after the format");
+        check(catOf(fs, "g") == lines('b', 300), "g reads back");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "Starting the shell on " << SHELL_IMAGE << "..." << std::endl;
+    std::remove(SHELL_IMAGE);
+    FILE* shell = popen("./filesystem " SHELL_IMAGE " > /dev/null", "w");
+    check(shell != nullptr, "the shell starts");
+    if (shell != nullptr)
+    {
+        fputs("format 100 2048\ncreate f\nhello\n\nquit\n", shell);
+        check(pclose(shell) == 0, "the shell quits without an error");
+        check(fileSize(SHELL_IMAGE) == 100 * 2048, "the shell formats the disk file it was given");
+        FS fs(SHELL_IMAGE);
+        check(catOf(fs, "f") == "hello\n", "the file the shell wrote reads back");
+    }
+    std::remove(SHELL_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 15 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
@@ -0,0 +1,90 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test16.bin"
+#define OTHER_IMAGE "test16a.bin" // a second volume with another geometry
+#define SHELL_OUT "test16.out" // what the shell prints
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 16 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    std::remove(OTHER_IMAGE);
+    std::cout << "Copying between two volumes open at once..." << std::endl;
+    {
+        FS a(TEST_IMAGE);
+        FS b(OTHER_IMAGE);
+        a.format();
+        b.format(512, 1024);
+        createFile(a, "f", 'a', 300);
+        check(a.copyTo("f", b, "f") == 0, "copy f to the other volume");
+        check(catOf(b, "f") == lines('a', 300), "the copy reads back on a volume of another block size");
+        check(catOf(a, "f") == lines('a', 300), "the original stays");
+        check(captured(out, [&] { return a.copyTo("f", b, "f"); }) != 0, "a copy onto a file that is there is refused");
+        check(catOf(b, "f") == lines('a', 300), "the file that is there stays");
+        check(captured(out, [&] { return a.copyTo("none", b, "g"); }) != 0, "a copy of a file that is not there fails");
+    }
+    PRINTDIV2;
+
+    std::cout << "Mounting the second volume in the shell, copying and moving to it..." << std::endl;
+    FILE* shell = popen("./filesystem " TEST_IMAGE " > " SHELL_OUT, "w");
+    check(shell != nullptr, "the shell starts");
+    if (shell != nullptr)
+    {
+        fputs("create g\nhello\n\nmount " OTHER_IMAGE " /a\nmount\ncp g /a/g1\nmv g /a/g2\ncat /a/g2\nls\n"
+            "umount /a\nquit\n", shell);
+        check(pclose(shell) == 0, "the shell quits without an error");
+        std::ifstream file(SHELL_OUT);
+        std::stringstream printed;
+        printed << file.rdbuf();
+        out = printed.str();
+        check(out.find(OTHER_IMAGE " on /a") != std::string::npos, "mount lists the second volume");
+        check(out.find("ERROR") == std::string::npos && out.find("Error") == std::string::npos, "no command fails");
+        check(out.find("hello") != std::string::npos, "cat reads the moved file through the mount point");
+    }
+    {
+        FS a(TEST_IMAGE);
+        FS b(OTHER_IMAGE);
+        check(catOf(a, "g").find("ERROR") != std::string::npos, "mv takes g off the first volume");
+        check(catOf(b, "g1") == "hello\n" && catOf(b, "g2") == "hello\n", "cp and mv leave g on the second volume");
+        check(a.fsck() == 0 && b.fsck() == 0, "fsck finds both disks clean");
+    }
+    std::remove(TEST_IMAGE);
+    std::remove(OTHER_IMAGE);
+    std::remove(SHELL_OUT);
+    PRINTDIV2;
+
+    std::cout << "... Task 16 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
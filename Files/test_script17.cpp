@@ -0,0 +1,82 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test17.bin" // the benchmark formats it and removes it again
+#define BENCH_OUT "test17.json"
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 17 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Running the benchmark on " << TEST_IMAGE << "..." << std::endl;
+    check(std::system("./bench " TEST_IMAGE " > " BENCH_OUT) == 0, "the benchmark runs to the end");
+    std::ifstream file(BENCH_OUT);
+    std::stringstream printed;
+    printed << file.rdbuf();
+    std::string json = printed.str();
+    check(json.compare(0, 2, "{\n") == 0 && json.size() > 2 && json.compare(json.size() - 2, 2, "}\n") == 0 &&
+        json.find("\"results\": [") != std::string::npos, "it prints a JSON object with the results");
+    check(json.find("\"image\": \"" TEST_IMAGE "\"") != std::string::npos, "it names the disk file it ran on");
+    struct stat image;
+    check(stat(TEST_IMAGE, &image) != 0, "it removes the disk file again");
+    PRINTDIV2;
+
+    std::cout << "Checking the results..." << std::endl;
+    std::vector<std::string> ops = {"create", "cat", "cp", "append", "mv", "rm", "mkdir", "cd", "ls", "pwd",
+        "pread", "pwrite", "truncate", "fallocate", "get", "sync"};
+    for (const std::string& op : ops)
+    {
+        check(json.find("\"op\": \"" + op + "\"") != std::string::npos, op + " is measured");
+    }
+    unsigned results = 0, empty = 0;
+    std::istringstream text(json);
+    std::string line;
+    while (std::getline(text, line))
+    {
+        if (line.find("\"scenario\": ") == std::string::npos)
+            continue;
+        results++;
+        size_t count = line.find("\"count\": ");
+        size_t rate = line.find("\"ops_per_sec\": ");
+        if (count == std::string::npos || rate == std::string::npos ||
+            std::stoul(line.substr(count + 9)) == 0 || std::stod(line.substr(rate + 15)) <= 0)
+            empty++;
+    }
+    check(results > ops.size(), "every scenario has its results");
+    check(empty == 0, "every result counts its operations and their rate");
+    std::remove(BENCH_OUT);
+    PRINTDIV2;
+
+    std::cout << "... Task 17 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
@@ -0,0 +1,115 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test18.bin"
+
+//The line of text that starts with label
+static std::string lineOf(const std::string& text, const std::string& label)
+{
+    size_t at = text.find("\n" + label);
+    if (at == std::string::npos)
+        return "";
+    return text.substr(at + 1, text.find('\n', at + 1) - at - 1);
+}
+
+//Nanoseconds of the time after label in line, as the stats print it, e.g. "1.5us"
+static double timeAfter(const std::string& line, const std::string& label)
+{
+    size_t at = line.find(label);
+    if (at == std::string::npos)
+        return -1;
+    std::istringstream text(line.substr(at + label.size()));
+    double value = 0;
+    std::string unit;
+    text >> value >> unit;
+    return unit == "ms" ? value * 1e6 : unit == "us" ? value * 1e3 : value;
+}
+
+//Whether the percentiles of a latency line grow from p50 to max
+static bool ordered(const std::string& line)
+{
+    double p50 = timeAfter(line, "p50 "), p99 = timeAfter(line, "p99 "), max = timeAfter(line, "max ");
+    return p50 > 0 && p50 <= p99 && p99 <= max;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 18 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        createFile(fs, "x", 'x', 640);
+        createFile(fs, "y", 'y', 640);
+    }
+    {
+        FS fs(TEST_IMAGE);
+        std::cout << "Reading two files from the disk, creating three and syncing..." << std::endl;
+        catOf(fs, "x");
+        catOf(fs, "y");
+        for (char fill = 'a'; fill < 'd'; fill++)
+            createFile(fs, std::string(1, fill), fill, 640);
+        fs.sync();
+        captured(out, [&] { return fs.stats(); });
+        std::cout << out;
+        check(lineOf(out, "  create   count 3 ") != "", "create is counted three times");
+        check(lineOf(out, "  cat      count 2 ") != "", "cat is counted twice");
+        check(lineOf(out, "  mkdir ") == "", "operations that did not run are left out");
+        //Taken from the same output as the histograms, a read ahead may still come in
+        std::string disk = lineOf(out, "  reads ");
+        unsigned long reads = std::stoul(disk.substr(8));
+        unsigned long writes = std::stoul(disk.substr(disk.find("writes ") + 7));
+        check(writes > 0 && reads > 0, "the disk counts its reads and writes");
+        check(lineOf(out, "  write latency  count " + std::to_string(writes) + " ") != "",
+            "every write is in the write latency histogram");
+        check(lineOf(out, "  read latency   count " + std::to_string(reads) + " ") != "",
+            "every read is in the read latency histogram");
+        check(ordered(lineOf(out, "  write latency ")) && ordered(lineOf(out, "  read latency ")) &&
+            ordered(lineOf(out, "  create ")), "the percentiles grow from p50 to max");
+        check(counter(fs, true, "  misses ") > 0 && counter(fs, true, "submitted ") > 0,
+            "the cache and the scheduler count their requests");
+        PRINTDIV2;
+
+        std::cout << "Resetting the counters..." << std::endl;
+        fs.stats(true);
+        captured(out, [&] { return fs.stats(); });
+        check(lineOf(out, "  reads 0 (0 B)  writes 0 (0 B)") != "", "the disk counters are cleared");
+        check(lineOf(out, "  write latency  count 0 ") != "", "the histograms are cleared");
+        check(out.compare(out.size() - 11, 11, "Operations\n") == 0, "no operation is left");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 18 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "trace.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test19.bin"
+#define TRACE_FILE "test19.json"
+
+//Dumps what was traced and returns it
+static std::string dumped()
+{
+    Tracer::dump(TRACE_FILE);
+    std::ifstream file(TRACE_FILE);
+    std::stringstream json;
+    json << file.rdbuf();
+    return json.str();
+}
+
+//Number of times text holds part
+static unsigned occurrences(const std::string& text, const std::string& part)
+{
+    unsigned count = 0;
+    for (size_t at = text.find(part); at != std::string::npos; at = text.find(part, at + 1))
+        count++;
+    return count;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 19 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        fs.sync();
+        std::cout << "Tracing create and cat until the flusher writes f back..." << std::endl;
+        Tracer::clear();
+        Tracer::enable(true);
+        createFile(fs, "f", 'a', 128);
+        catOf(fs, "f");
+        std::this_thread::sleep_for(std::chrono::milliseconds(DIRTY_EXPIRE_MS + 4 * FLUSH_INTERVAL_MS));
+        Tracer::enable(false);
+        std::string json = dumped();
+        std::string start = "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+        check(json.compare(0, start.size(), start) == 0 &&
+            json.compare(json.size() - 4, 4, "\n]}\n") == 0, "the dump is a Chrome trace");
+        check(occurrences(json, "{\"name\": \"FS::create\", \"ph\": \"X\"") == 1, "create is one span");
+        check(occurrences(json, "{\"name\": \"FS::cat\", \"ph\": \"X\"") == 1, "cat is one span");
+        check(json.find("{\"name\": \"Disk::write_blocks\", \"ph\": \"X\"") != std::string::npos &&
+            json.find("\"args\": {\"block\": ") != std::string::npos, "the disk writes are spans with their block");
+        check(json.find("\"args\": {\"name\": \"flusher\"}") != std::string::npos, "the flusher thread that wrote it back is named");
+        check(json.find("\"dur\": -") == std::string::npos, "no span ends before it starts");
+        PRINTDIV2;
+
+        std::cout << "Creating g with tracing off, then clearing..." << std::endl;
+        createFile(fs, "g", 'b', 128);
+        check(occurrences(dumped(), "\"FS::create\"") == 1, "nothing is traced while tracing is off");
+        Tracer::clear();
+        check(dumped().find("\"FS::") == std::string::npos, "clear forgets the spans");
+    }
+    std::remove(TEST_IMAGE);
+    std::remove(TRACE_FILE);
+    PRINTDIV2;
+
+    std::cout << "... Task 19 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
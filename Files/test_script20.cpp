@@ -0,0 +1,125 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "iotrace.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test20.bin"
+#define TRACE_FILE "test20.trace"
+#define REPLAY_IMAGE "test20r.bin" // the replay writes to it
+#define REPLAY_OUT "test20.out" // what the replay prints
+
+//Runs replay with args, returns its exit code and what it printed in out
+static int replay(const std::string& args, std::string& out)
+{
+    int status = std::system(("./replay " + args + " > " REPLAY_OUT).c_str());
+    std::ifstream file(REPLAY_OUT);
+    std::stringstream printed;
+    printed << file.rdbuf();
+    out = printed.str();
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 20 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    std::remove(TRACE_FILE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        createFile(fs, "x", 'x', 640);
+    }
+    std::cout << "Recording a cat of x and the creation of f..." << std::endl;
+    unsigned long reads = 0, writes = 0;
+    {
+        FS fs(TEST_IMAGE);
+        fs.stats(true);
+        check(fs.record(TRACE_FILE) == 0, "record starts");
+        catOf(fs, "x");
+        createFile(fs, "f", 'a', 640);
+        fs.sync();
+        fs.record("off");
+        reads = counter(fs, true, "  reads ");
+        writes = counter(fs, true, "writes ");
+    }
+    std::ifstream trace(TRACE_FILE, std::ios::binary);
+    iotrace_header header;
+    check(trace.read((char*)&header, sizeof(header)) && header.magic == IOTRACE_MAGIC &&
+        header.version == IOTRACE_VERSION, "the trace starts with its header");
+    check(header.block_size == BLOCK_SIZE && header.no_blocks == NO_BLOCKS, "the header has the geometry of the disk");
+    std::vector<iotrace_record> records;
+    iotrace_record record;
+    unsigned long traced = 0, tracedReads = 0, tracedWrites = 0;
+    while (trace.read((char*)&record, sizeof(record)))
+    {
+        records.push_back(record);
+        traced += record.count;
+        (record.op == IO_READ ? tracedReads : tracedWrites)++;
+    }
+    check(tracedReads == reads && tracedWrites == writes, "every request that reached the disk is recorded");
+    check(traced >= 20, "the blocks of x and f are in it");
+    PRINTDIV2;
+
+    std::cout << "Replaying the trace twice..." << std::endl;
+    std::remove(REPLAY_IMAGE);
+    check(replay(TRACE_FILE " -i " REPLAY_IMAGE, out) == 0, "replay runs");
+    //The requests the disk saw, the latencies differ from run to run
+    std::string first = out.substr(out.find("\n  reads "));
+    first.erase(first.find('\n', 1));
+    std::string summary = "trace " TRACE_FILE ": " + std::to_string(records.size()) + " requests, " +
+        std::to_string(traced) + " blocks of " + std::to_string(BLOCK_SIZE) + " bytes\n";
+    check(out.find(summary) != std::string::npos, "it replays every request");
+    check(out.find("  reads " + std::to_string(reads) + " ") != std::string::npos &&
+        out.find("  writes " + std::to_string(writes) + " ") != std::string::npos,
+        "the disk sees as many requests as were recorded");
+    uint32_t block = firstBlock(TEST_IMAGE, "f");
+    uint8_t data[2] = {0, 0};
+    imageIO(REPLAY_IMAGE, false, (uint64_t)block * BLOCK_SIZE + 10, data, 2);
+    check(data[0] == (block & 0xff) && data[1] == (block & 0xff), "a written block holds the pattern of its number");
+    check(replay(TRACE_FILE, out) == 0, "replay runs on a scratch disk file");
+    check(out.find(first) != std::string::npos, "both runs do the same");
+    struct stat scratch;
+    check(stat("replay.bin", &scratch) != 0, "the scratch disk file is removed");
+    check(replay(TEST_IMAGE, out) == 1 && out.find("is not a block I/O trace") != std::string::npos,
+        "a file that is no trace is refused");
+    std::remove(TEST_IMAGE);
+    std::remove(TRACE_FILE);
+    std::remove(REPLAY_IMAGE);
+
+    PRINTDIV2;
+
+    std::cout << "... Task 20 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
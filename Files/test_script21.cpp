@@ -0,0 +1,98 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "device.h"
+#include "iotrace.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test21.bin"
+#define SLOW_WRITE_US 20000 // every write of the slow SSD takes this long
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 21 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Modelling an SSD without delaying the requests..." << std::endl;
+    DeviceModel ssd;
+    check(ssd.configure({"ssd", "read=100", "write=300", "qd=4", "rate=1000", "mode=virtual"}) == 0, "configure the SSD");
+    //Transfer at 1000 MB/s is a byte per ns, plus the latency of every round of 4 blocks
+    check(ssd.access(IO_READ, 7, 1, 4096, 1000) == 4096 + 100000, "a read of a block pays one read latency");
+    check(ssd.access(IO_WRITE, 7, 8, 4096, 1000) == 8 * 4096 + 2 * 300000, "a write of 8 blocks pays two write latencies");
+    check(captured(out, [&] { return ssd.configure({"ssd", "qd=0"}); }) == -1, "a queue depth of 0 is refused");
+    check(captured(out, [&] { return ssd.configure({"tape"}); }) == -1 && out.find("Unknown device tape") != std::string::npos,
+        "an unknown device is refused");
+    check(ssd.get_profile().queueDepth == 4, "a refused setting leaves the profile as it was");
+    std::ostringstream printed;
+    ssd.print(printed);
+    check(printed.str().find("requests 2  seeks 0  modelled time 0.737 ms") != std::string::npos,
+        "the model counts the requests and their time");
+    PRINTDIV2;
+
+    std::cout << "Modelling an HDD..." << std::endl;
+    DeviceModel hdd;
+    check(hdd.configure({"hdd", "mode=virtual"}) == 0, "configure the HDD");
+    uint64_t first = hdd.access(IO_READ, 0, 1, 4096, 100000);
+    uint64_t next = hdd.access(IO_READ, 1, 1, 4096, 100000);
+    uint64_t near = hdd.access(IO_READ, 100, 1, 4096, 100000);
+    uint64_t far = hdd.access(IO_READ, 90000, 1, 4096, 100000);
+    check(first == next, "reading on where the last request ended pays no seek");
+    check(near > 4 * next, "a jump pays a seek and half a rotation");
+    check(far > near, "a longer jump seeks longer");
+    printed.str("");
+    hdd.print(printed);
+    check(printed.str().find("seeks 2 ") != std::string::npos, "the jumps are counted as seeks");
+    PRINTDIV2;
+
+    std::cout << "Putting a slow SSD under a disk..." << std::endl;
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        fs.sync();
+        check(fs.device({"ssd", "write=" + std::to_string(SLOW_WRITE_US)}) == 0, "device ssd write=20000");
+        fs.stats(true);
+        createFile(fs, "f", 'a', 128);
+        auto start = std::chrono::steady_clock::now();
+        fs.sync();
+        auto took = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        check(took.count() >= SLOW_WRITE_US, "sync waits for the slow writes");
+        check(counter(fs, true, "  requests ") > 0, "stats shows the requests the device served");
+        check(fs.device({"none"}) == 0, "device none");
+        captured(out, [&] { return fs.stats(); });
+        check(out.find("Device\n") == std::string::npos, "stats leaves the device out once it is gone");
+        check(catOf(fs, "f") == lines('a', 128), "f reads back");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 21 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
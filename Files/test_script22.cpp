@@ -0,0 +1,127 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test22.bin"
+#define ROUNDS 6 // blocks appended to a and b in turns
+
+//Creates a, b and c of a block each and appends c to a and b in turns, so
+//the blocks of a and b alternate on the disk
+static void fragment(FS& fs)
+{
+    createFile(fs, "a", 'a', 64);
+    createFile(fs, "b", 'b', 64);
+    createFile(fs, "c", 'c', 64);
+    fs.sync();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        fs.append("c", "a");
+        fs.append("c", "b");
+        fs.sync();
+    }
+}
+
+//Whether a and b hold what fragment() wrote
+static bool intact(FS& fs)
+{
+    std::string text;
+    for (int i = 0; i < ROUNDS; i++)
+        text += lines('c', 64);
+    return catOf(fs, "a") == lines('a', 64) + text && catOf(fs, "b") == lines('b', 64) + text;
+}
+
+//Number of runs of consecutive blocks in the chain of name in the disk file
+static unsigned extents(const std::string& name)
+{
+    super_block sb;
+    imageIO(TEST_IMAGE, false, 0, &sb, sizeof(sb));
+    std::vector<int32_t> fat(sb.no_blocks);
+    imageIO(TEST_IMAGE, false, (uint64_t)sb.fat_start * sb.block_size, fat.data(), fat.size() * 4);
+    unsigned runs = 1;
+    for (int32_t b = firstBlock(TEST_IMAGE, name); fat[b] != FAT_EOF; b = fat[b])
+        runs += fat[b] != b + 1;
+    return runs;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 22 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    std::cout << "Growing a and b in turns..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        fragment(fs);
+    }
+    check(extents("a") > ROUNDS && extents("b") > ROUNDS, "the blocks of a and b alternate");
+    {
+        FS fs(TEST_IMAGE);
+        std::cout << "Defragmenting..." << std::endl;
+        captured(out, [&] { return fs.defrag(); });
+        std::cout << out;
+        check(out.find("before  files 3  fragmented 2 ") != std::string::npos, "defrag finds a and b fragmented");
+        check(out.find("after   files 3  fragmented 0 ") != std::string::npos, "no file is fragmented after it");
+        check(intact(fs), "a and b read back");
+    }
+    check(extents("a") == 1 && extents("b") == 1, "a and b are on consecutive blocks on the disk");
+    PRINTDIV2;
+
+    std::cout << "Defragmenting slowly in the background and stopping..." << std::endl;
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        fragment(fs);
+        check(fs.defrag("start", 2) == 0, "defrag start at 2 blocks/s");
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        check(intact(fs), "a and b read back while defrag runs");
+        check(captured(out, [&] { return fs.defrag("start"); }) == 0 && out.find("is running in the background") != std::string::npos,
+            "a second pass is refused while one runs");
+        fs.defrag("stop");
+        captured(out, [&] { return fs.defrag("status"); });
+        check(out.compare(0, 15, "defrag stopped,") == 0, "defrag status reports the pass stopped");
+        check(intact(fs), "a and b read back after the stop");
+        std::cout << "Carrying on..." << std::endl;
+        captured(out, [&] { return fs.defrag(); });
+        check(out.find("after   files 3  fragmented 0 ") != std::string::npos, "the stopped pass is finished");
+        check(intact(fs), "a and b read back");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    check(extents("a") == 1 && extents("b") == 1, "a and b are on consecutive blocks on the disk");
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 22 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
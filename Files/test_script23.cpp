@@ -0,0 +1,103 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test23.bin"
+
+//The line of text that starts with label
+static std::string lineOf(const std::string& text, const std::string& label)
+{
+    size_t at = text.find("\n" + label);
+    if (at == std::string::npos)
+        return "";
+    return text.substr(at + 1, text.find('\n', at + 1) - at - 1);
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 23 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        std::cout << "Reporting an empty disk..." << std::endl;
+        captured(out, [&] { return fs.fsinfo(); });
+        check(lineOf(out, "  used ") == "  used 4 (0.2%)  free 2044 (99.8%)", "only the metadata is used");
+        check(lineOf(out, "  metadata ") == "  metadata 4  directories 1 in 1 blocks  files 0 in 0 blocks",
+            "the blocks are broken down by use");
+        check(lineOf(out, "  free extents ") == "  free extents 1  largest 2044 at block 4 (8.0 MiB)",
+            "the free space is one extent");
+        PRINTDIV2;
+
+        std::cout << "Writing big, mid and end and removing mid..." << std::endl;
+        createFile(fs, "big", 'a', 64 * 100);
+        fs.sync();
+        createFile(fs, "mid", 'b', 64 * 10);
+        fs.sync();
+        createFile(fs, "end", 'c', 64 * 10);
+        fs.sync();
+        fs.rm("mid");
+        fs.sync();
+        captured(out, [&] { return fs.fsinfo(); });
+        std::cout << out;
+        check(lineOf(out, "  used ") == "  used 114 (5.6%)  free 1934 (94.4%)", "big and end are used");
+        check(lineOf(out, "  free extents ") == "  free extents 2  largest 1924 at block 124 (7.5 MiB)",
+            "the hole mid leaves is a second free extent");
+        check(lineOf(out, "  1 ") == "  1                2  " + std::string(40, '#'), "both files are one extent");
+        check(out.find("Most fragmented") == std::string::npos, "no file is listed as fragmented");
+        check(lineOf(out, "         0 |") == "         0 |" + std::string(52, '@') + std::string(5, ' ') +
+            std::string(5, '@') + std::string(2, ' ') + "|", "the block map shows the hole");
+        check(lineOf(out, "Block map, ") == "Block map, 2 blocks per cell, ' ' free to '@' full", "a cell is 2 blocks");
+        PRINTDIV2;
+
+        std::cout << "Growing a and b in turns..." << std::endl;
+        createFile(fs, "a", 'a', 64);
+        createFile(fs, "b", 'b', 64);
+        fs.sync();
+        for (int i = 0; i < 6; i++)
+        {
+            fs.append("end", "a");
+            fs.append("end", "b");
+            fs.sync();
+        }
+        captured(out, [&] { return fs.fsinfo(); });
+        std::cout << out;
+        //a takes the hole mid left and then a run of end after b each round
+        check(lineOf(out, "  5-8 ") == "  5-8              2  " + std::string(20, '#'), "a and b count as files of 5 to 8 extents");
+        check(lineOf(out, "Most fragmented") != "" && lineOf(out, "       8  ") == "       8  /a" &&
+            lineOf(out, "       7  ") == "       7  /b", "a and b are listed as the most fragmented, a first");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 23 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
@@ -0,0 +1,102 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test24.bin" // the test damages it while no FS has it open
+#define SLOW_RATE 50 // blocks/s, the background pass takes seconds
+
+//Returns the second block of the file name in the root directory of the image
+static uint32_t secondBlock(const std::string& name)
+{
+    super_block sb;
+    imageIO(TEST_IMAGE, false, 0, &sb, sizeof(sb));
+    int32_t next = 0;
+    imageIO(TEST_IMAGE, false, (uint64_t)sb.fat_start * sb.block_size + firstBlock(TEST_IMAGE, name) * 4, &next, 4);
+    return next;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 24 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format(NO_BLOCKS, BLOCK_SIZE, FORMAT_CHECKSUMS);
+        createFile(fs, "f1", 'a', 192);
+        createFile(fs, "f2", 'b', 192);
+        createFile(fs, "big", 'c', 64 * 300);
+    }
+    uint32_t block = secondBlock("f1");
+    char flipped = 'z';
+    imageIO(TEST_IMAGE, true, (uint64_t)block * BLOCK_SIZE + 100, &flipped, 1);
+
+    std::cout << "Scrubbing a disk with a damaged block of f1..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        captured(out, [&] { return fs.scrub(); });
+        std::cout << out;
+        check(out.find("blocks verified, 1 bad\n") != std::string::npos, "scrub finds one bad block");
+        check(out.find("  bad block " + std::to_string(block) + " in /f1\n") != std::string::npos,
+            "it names the block and the file it belongs to");
+        check(counter(fs, true, "  verified ") > 300, "stats counts the blocks verified");
+        check(catOf(fs, "f2") == lines('b', 192), "f2 still reads back");
+    }
+    PRINTDIV2;
+
+    std::cout << "Scrubbing slowly in the background and mounting the disk again..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        check(fs.scrub("start", SLOW_RATE) == 0, "scrub start");
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        captured(out, [&] { return fs.scrub("status"); });
+        check(out.compare(0, 20, "scrub running, block") == 0, "scrub status reports the pass running");
+        check(catOf(fs, "f2") == lines('b', 192), "f2 reads back while the pass runs");
+    }
+    {
+        FS fs(TEST_IMAGE);
+        captured(out, [&] { return fs.scrub("status"); });
+        check(out.compare(0, 20, "scrub running, block") == 0, "the pass goes on after the mount");
+        fs.scrub("stop");
+        captured(out, [&] { return fs.scrub("status"); });
+        check(out.compare(0, 20, "scrub stopped, block") == 0, "scrub stop stops it");
+        captured(out, [&] { return fs.scrub(); });
+        captured(out, [&] { return fs.scrub("status"); });
+        check(out.compare(0, 20, "scrub idle, 1 passes") == 0, "scrub finishes the stopped pass");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 24 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
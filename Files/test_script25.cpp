@@ -0,0 +1,109 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "compress.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test25.bin"
+#define HOST_FILE "test25.host" // random bytes put on the disk
+#define TEXT_BLOCKS 50
+
+//Whether data comes back the same from lz_compress and lz_decompress
+static bool roundTrip(const std::string& data, size_t& packed)
+{
+    std::vector<uint8_t> out(lz_bound(data.size()));
+    packed = lz_compress((const uint8_t*)data.data(), data.size(), out.data());
+    std::vector<uint8_t> back(data.size() + 1);
+    long size = lz_decompress(out.data(), packed, back.data(), back.size());
+    return size == (long)data.size() && std::string((char*)back.data(), size) == data;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 25 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Compressing and decompressing..." << std::endl;
+    std::mt19937 random(25);
+    std::string noise(8 * BLOCK_SIZE, '\0');
+    for (char& c : noise)
+        c = (char)random();
+    std::string text = lines('a', 64 * TEXT_BLOCKS);
+    size_t packed = 0;
+    check(roundTrip(text, packed) && packed < text.size() / 50, "text comes back from a fraction of its size");
+    check(roundTrip(noise, packed) && packed <= lz_bound(noise.size()), "random bytes come back within the bound");
+    check(roundTrip("", packed) && roundTrip("abc", packed), "empty and short inputs come back");
+    std::vector<uint8_t> out8(lz_bound(text.size())), back(text.size());
+    packed = lz_compress((const uint8_t*)text.data(), text.size(), out8.data());
+    check(lz_decompress(out8.data(), packed, back.data(), text.size() - 1) == -1, "an output that is too small is refused");
+    check(lz_decompress(out8.data(), packed / 2, back.data(), back.size()) == -1, "a cut stream is refused");
+    std::string stream = compress_file(text);
+    std::string unpacked;
+    check(decompress_file(stream, text.size(), unpacked) == 0 && unpacked == text, "a file stream comes back");
+    PRINTDIV2;
+
+    std::cout << "Storing files on a disk formatted with compression..." << std::endl;
+    std::remove(TEST_IMAGE);
+    {
+        std::ofstream host(HOST_FILE, std::ios::binary);
+        host << noise;
+    }
+    {
+        FS fs(TEST_IMAGE);
+        fs.format(NO_BLOCKS, BLOCK_SIZE, FORMAT_COMPRESS);
+        createFile(fs, "text", 'a', 64 * TEXT_BLOCKS);
+        check(fs.put(HOST_FILE, "noise") == 0, "put random bytes as noise");
+        fs.sync();
+        captured(out, [&] { return fs.fsinfo(); });
+        size_t at = out.find("  compressed 1 files in ");
+        check(at != std::string::npos && std::stoul(out.substr(at + 24)) <= TEXT_BLOCKS / 10 &&
+            out.find(" blocks, " + std::to_string(TEXT_BLOCKS) + " uncompressed", at) != std::string::npos,
+            "text takes a fraction of its blocks, noise is stored as it is");
+        check(catOf(fs, "text") == text, "text reads back");
+        check(readAt(fs, "noise", 0, noise.size() + 1) == noise, "noise reads back");
+        check(readAt(fs, "text", 20000, 100) == text.substr(20000, 100), "a piece from the middle of text reads back");
+        check(fs.cp("text", "copy") == 0 && fs.append("text", "copy") == 0, "cp text copy and append text to it");
+        check(catOf(fs, "copy") == text + text, "copy reads back");
+    }
+    std::cout << "Mounting the disk again..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        check(catOf(fs, "text") == text && catOf(fs, "copy") == text + text, "the compressed files read back");
+        check(readAt(fs, "noise", 0, noise.size() + 1) == noise, "noise reads back");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    std::remove(TEST_IMAGE);
+    std::remove(HOST_FILE);
+    PRINTDIV2;
+
+    std::cout << "... Task 25 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
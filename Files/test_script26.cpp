@@ -0,0 +1,127 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "hash128.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test26.bin"
+#define HOST_FILE "test26.host" // put reads the files with a common tail from here
+#define FILE_LINES (64 * 64) // 64 blocks
+#define TAIL_BLOCKS 16 // blocks at the end of g1 and g2 that are the same
+
+//Writes a block of fill and then the common tail to the host file
+static void hostFile(char fill, const std::string& tail)
+{
+    std::ofstream host(HOST_FILE, std::ios::binary);
+    host << std::string(BLOCK_SIZE, fill) << tail;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 26 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Fingerprinting blocks with " << hash128_impl() << "..." << std::endl;
+    std::mt19937 random(26);
+    std::vector<uint8_t> data(100000);
+    for (uint8_t& byte : data)
+        byte = (uint8_t)random();
+    bool same = true;
+    for (size_t length : {0, 1, 63, 64, 65, 1000, 1024, 4096, 100000})
+    {
+        same = same && hash128_of(data.data(), length) == hash128_scalar(data.data(), length);
+    }
+    check(same, "every version gives the fingerprint of the plain one");
+    hash128 before = hash128_of(data.data(), BLOCK_SIZE);
+    data[BLOCK_SIZE / 2] ^= 1;
+    check(hash128_of(data.data(), BLOCK_SIZE) != before, "a changed bit changes the fingerprint");
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    std::string tail((const char*)data.data(), TAIL_BLOCKS * BLOCK_SIZE);
+    std::string f2 = lines('a', FILE_LINES).replace(100, 7, "changed");
+    {
+        FS fs(TEST_IMAGE);
+        fs.format(NO_BLOCKS, BLOCK_SIZE, FORMAT_DEDUP);
+        std::cout << "Copying f1 of 64 blocks twice..." << std::endl;
+        createFile(fs, "f1", 'a', FILE_LINES);
+        fs.sync();
+        unsigned long used = counter(fs, false, "used ");
+        fs.stats(true);
+        check(fs.cp("f1", "f2") == 0 && fs.cp("f1", "f3") == 0, "cp f1 f2 and cp f1 f3");
+        fs.sync();
+        check(counter(fs, false, "used ") - used <= 2, "the copies take no blocks of their own");
+        check(counter(fs, true, "found stored ") >= 128, "stats counts the blocks found stored");
+        captured(out, [&] { return fs.fsinfo(); });
+        check(out.find("  shared 192 blocks of files are stored once, 128 saved") != std::string::npos,
+            "fsinfo reports the blocks saved");
+        PRINTDIV2;
+
+        std::cout << "Putting g1 and g2, which only have their last 16 blocks in common..." << std::endl;
+        used = counter(fs, false, "used ");
+        hostFile('x', tail);
+        check(fs.put(HOST_FILE, "g1") == 0, "put g1");
+        hostFile('y', tail);
+        check(fs.put(HOST_FILE, "g2") == 0, "put g2");
+        fs.sync();
+        check(counter(fs, false, "used ") - used <= TAIL_BLOCKS + 2 + 2, "g2 shares the tail of g1");
+        check(catOf(fs, "g1") == std::string(BLOCK_SIZE, 'x') + tail, "g1 reads back");
+        check(catOf(fs, "g2") == std::string(BLOCK_SIZE, 'y') + tail, "g2 reads back");
+        PRINTDIV2;
+
+        std::cout << "Changing and removing files that share blocks..." << std::endl;
+        check(writeAt(fs, "f2", 100, "changed") == 7, "pwrite into f2");
+        check(catOf(fs, "f2") == f2, "f2 reads back changed");
+        check(catOf(fs, "f1") == lines('a', FILE_LINES) && catOf(fs, "f3") == lines('a', FILE_LINES),
+            "f1 and f3 stay as they were");
+        check(fs.append("f1", "f3") == 0, "append f1 to f3");
+        check(catOf(fs, "f3") == lines('a', 2 * FILE_LINES), "f3 reads back");
+        check(fs.rm("f1") == 0 && catOf(fs, "f3") == lines('a', 2 * FILE_LINES), "rm f1 leaves f3 whole");
+        check(fs.rm("g1") == 0 && catOf(fs, "g2") == std::string(BLOCK_SIZE, 'y') + tail, "rm g1 leaves g2 whole");
+        check(fs.fsck() == 0, "fsck accepts the shared chains");
+    }
+    std::cout << "Mounting the disk again..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        unsigned long used = counter(fs, false, "used ");
+        check(fs.cp("g2", "g3") == 0 && fs.sync() == 0 && counter(fs, false, "used ") - used <= 2, "the index is built again at mount");
+        check(fs.rm("g2") == 0 && catOf(fs, "g3") == std::string(BLOCK_SIZE, 'y') + tail,
+            "the references are counted again at mount");
+        check(catOf(fs, "f2") == f2 && catOf(fs, "f3") == lines('a', 2 * FILE_LINES), "f2 and f3 read back");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    std::remove(TEST_IMAGE);
+    std::remove(HOST_FILE);
+    PRINTDIV2;
+
+    std::cout << "... Task 26 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test27.bin"
+#define SMALL_FILES 48 // of 1 to 16 lines, 64 to 1024 bytes
+
+//Name and lines of small file i
+static std::string smallName(int i) { return "s" + std::to_string(i); }
+static int smallLines(int i) { return 1 + i % 16; }
+
+//Whether every small file from first on reads back
+static bool smallRead(FS& fs, int first)
+{
+    for (int i = first; i < SMALL_FILES; i++)
+    {
+        if (catOf(fs, smallName(i)) != lines('a' + i % 26, smallLines(i)))
+            return false;
+    }
+    return true;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 27 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    unsigned long bytes = 0;
+    for (int i = 0; i < SMALL_FILES; i++)
+    {
+        bytes += smallLines(i) * 64;
+    }
+    {
+        FS fs(TEST_IMAGE);
+        fs.format(NO_BLOCKS, BLOCK_SIZE, FORMAT_PACK);
+        fs.sync();
+        unsigned long empty = counter(fs, false, "used ");
+        std::cout << "Creating " << SMALL_FILES << " small files of " << bytes << " bytes..." << std::endl;
+        for (int i = 0; i < SMALL_FILES; i++)
+        {
+            createFile(fs, smallName(i), 'a' + i % 26, smallLines(i));
+        }
+        fs.sync();
+        unsigned long blocks = (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        check(counter(fs, false, "used ") - empty <= blocks + 2, "the small files share blocks");
+        captured(out, [&] { return fs.fsinfo(); });
+        check(out.find("  packed " + std::to_string(SMALL_FILES) + " files of " + std::to_string(bytes) + " bytes in ") !=
+            std::string::npos, "fsinfo reports the packed files");
+        check(smallRead(fs, 0), "the small files read back");
+        PRINTDIV2;
+
+        std::cout << "Growing and removing small files..." << std::endl;
+        createFile(fs, "big", 'z', 17);
+        fs.sync();
+        captured(out, [&] { return fs.fsinfo(); });
+        check(out.find("  packed " + std::to_string(SMALL_FILES) + " files") != std::string::npos,
+            "a file past the limit is not packed");
+        check(fs.append("s15", "s0") == 0, "append s15 to s0, past the limit");
+        check(catOf(fs, "s0") == lines('a', 1) + lines('p', 16), "s0 reads back");
+        check(fs.cp("s1", "copy") == 0 && catOf(fs, "copy") == lines('b', 2), "cp s1 copy");
+        check(fs.mv("s2", "moved") == 0 && catOf(fs, "moved") == lines('c', 3), "mv s2 moved");
+        fs.sync();
+        captured(out, [&] { return fs.fsinfo(); });
+        check(out.find("  packed " + std::to_string(SMALL_FILES) + " files") != std::string::npos,
+            "s0 leaves the shared block and copy joins it");
+        check(smallRead(fs, 3) && catOf(fs, "big") == lines('z', 17), "the other files read back");
+        for (int i = 3; i < SMALL_FILES; i++)
+        {
+            fs.rm(smallName(i));
+        }
+        fs.rm("s1");
+        fs.rm("copy");
+        fs.rm("moved");
+        fs.sync();
+        check(counter(fs, false, "used ") - empty <= 2 + 1, "the last file out frees the shared blocks");
+        PRINTDIV2;
+
+        std::cout << "Creating the small files again..." << std::endl;
+        fs.rm("s0");
+        for (int i = 0; i < SMALL_FILES; i++)
+        {
+            createFile(fs, smallName(i), 'a' + i % 26, smallLines(i));
+        }
+    }
+    std::cout << "Mounting the disk again..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        check(smallRead(fs, 0), "the small files read back");
+        createFile(fs, "late", 'q', 8);
+        fs.sync();
+        check(catOf(fs, "late") == lines('q', 8) && smallRead(fs, 0), "a file packed after the mount takes free units only");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 27 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
@@ -0,0 +1,124 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test28.bin"
+#define STREAM_BLOCKS 20 // blocks each streamed file gets, one at a time in turns
+
+//Writes STREAM_BLOCKS blocks to files a and b in turns, syncing after each pair
+static void stream(FS& fs, const std::string& a, const std::string& b)
+{
+    int first = fs.open(a), second = fs.open(b);
+    for (int i = 0; i < STREAM_BLOCKS; i++)
+    {
+        fs.pwrite(first, (uint64_t)i * BLOCK_SIZE, std::string(BLOCK_SIZE, a[0]));
+        fs.pwrite(second, (uint64_t)i * BLOCK_SIZE, std::string(BLOCK_SIZE, b[0]));
+        fs.sync();
+    }
+    fs.close(first);
+    fs.close(second);
+}
+
+//The line of text that starts with label
+static std::string lineOf(const std::string& text, const std::string& label)
+{
+    size_t at = text.find("\n" + label);
+    if (at == std::string::npos)
+        return "";
+    return text.substr(at + 1, text.find('\n', at + 1) - at - 1);
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+    const std::string zeros(STREAM_BLOCKS * BLOCK_SIZE, '\0');
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 28 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        fs.sync();
+        std::cout << "Reserving a and b and writing them in turns..." << std::endl;
+        unsigned long used = counter(fs, false, "used ");
+        fs.fallocate("a", STREAM_BLOCKS * BLOCK_SIZE);
+        fs.fallocate("b", STREAM_BLOCKS * BLOCK_SIZE);
+        fs.sync();
+        unsigned long reserved = counter(fs, false, "used ");
+        check(reserved - used >= 2 * STREAM_BLOCKS, "prealloc takes the blocks");
+        check(readAt(fs, "a", 0, zeros.size() + 1) == zeros, "a reads as zeros of the size reserved");
+        stream(fs, "a", "b");
+        check(counter(fs, false, "used ") == reserved, "the writes fill the reserved blocks");
+        check(readAt(fs, "a", 0, zeros.size() + 1) == std::string(zeros.size(), 'a'), "a reads back");
+        check(readAt(fs, "b", 0, zeros.size() + 1) == std::string(zeros.size(), 'b'), "b reads back");
+        captured(out, [&] { return fs.fsinfo(); });
+        check(lineOf(out, "  1 ") == "  1                2  " + std::string(40, '#'), "a and b are one extent each");
+        PRINTDIV2;
+
+        std::cout << "Writing c and d in turns without reserving them..." << std::endl;
+        createFile(fs, "c", 'c', 0);
+        createFile(fs, "d", 'd', 0);
+        stream(fs, "c", "d");
+        captured(out, [&] { return fs.fsinfo(); });
+        check(lineOf(out, "Most fragmented") != "" && out.find("  /c\n") != std::string::npos &&
+            out.find("  /d\n") != std::string::npos && out.find("  /a\n") == std::string::npos,
+            "c and d are fragmented, a is not");
+        PRINTDIV2;
+
+        std::cout << "Reserving more than the disk has..." << std::endl;
+        used = counter(fs, false, "used ");
+        captured(out, [&] { return fs.fallocate("huge", (uint64_t)NO_BLOCKS * BLOCK_SIZE); });
+        check(out.find("ERROR") != std::string::npos, "prealloc reports the error");
+        fs.sync();
+        check(counter(fs, false, "used ") == used, "no block stays taken");
+        check(catOf(fs, "huge").find("ERROR") != std::string::npos, "the file made for it is gone");
+        PRINTDIV2;
+
+        std::cout << "Reserving blocks past the end of a..." << std::endl;
+        fs.fallocate("a", 2 * STREAM_BLOCKS * BLOCK_SIZE);
+        check(writeAt(fs, "a", STREAM_BLOCKS * BLOCK_SIZE + 10, "tail") == 4, "pwrite into the new blocks of a");
+    }
+    std::cout << "Mounting the disk again..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        std::string data = readAt(fs, "a", 0, 2 * zeros.size() + 1);
+        check(data.size() == 2 * zeros.size() && data.compare(0, zeros.size(), std::string(zeros.size(), 'a')) == 0,
+            "a keeps its size and data");
+        check(data.compare(zeros.size(), 10, zeros, 0, 10) == 0 && data.compare(zeros.size() + 10, 4, "tail") == 0 &&
+            data.compare(zeros.size() + 14, zeros.size() - 14, zeros, 14, zeros.size() - 14) == 0,
+            "the reserved blocks read as zeros around what was written");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 28 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
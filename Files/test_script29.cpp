@@ -0,0 +1,155 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test29.bin" // the test marks an entry delayed while no FS has it open
+#define SHORT_LIVED 16 // files created and removed before they are given blocks
+
+//The line of text that starts with label
+static std::string lineOf(const std::string& text, const std::string& label)
+{
+    size_t at = text.find("\n" + label);
+    if (at == std::string::npos)
+        return "";
+    return text.substr(at + 1, text.find('\n', at + 1) - at - 1);
+}
+
+//Marks the entry name in the root directory of the image delayed and frees its
+//chain, as a crash before its blocks were picked would leave it
+static bool markDelayed(const std::string& name)
+{
+    super_block sb;
+    imageIO(TEST_IMAGE, false, 0, &sb, sizeof(sb));
+    std::vector<dir_entry> root(sb.block_size / sizeof(dir_entry));
+    imageIO(TEST_IMAGE, false, (uint64_t)sb.root_block * sb.block_size, root.data(), root.size() * sizeof(dir_entry));
+    for (size_t i = 0; i < root.size(); i++)
+    {
+        if (root[i].type == TYPE_FILE && name == root[i].file_name)
+        {
+            root[i].flags = FLAG_DELAYED;
+            int32_t block = root[i].first_blk, free = FAT_FREE;
+            while (block != FAT_EOF)
+            {
+                uint64_t at = (uint64_t)sb.fat_start * sb.block_size + block * 4;
+                imageIO(TEST_IMAGE, false, at, &block, 4);
+                imageIO(TEST_IMAGE, true, at, &free, 4);
+            }
+            imageIO(TEST_IMAGE, true, (uint64_t)sb.root_block * sb.block_size + i * sizeof(dir_entry),
+                &root[i], sizeof(dir_entry));
+            return true;
+        }
+    }
+    return false;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 29 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        fs.sync();
+        std::cout << "Creating f, it waits for its blocks..." << std::endl;
+        unsigned long used = counter(fs, false, "used ");
+        createFile(fs, "f", 'a', 64 * 8);
+        captured(out, [&] { return fs.fsinfo(); });
+        check(lineOf(out, "  delayed ") == "  delayed 1 files of 32768 bytes wait for their blocks, 8 reserved",
+            "fsinfo reports f and the blocks reserved for it");
+        check(counter(fs, false, "used ") == used, "f has no blocks yet");
+        check(catOf(fs, "f") == lines('a', 64 * 8), "f reads back from memory");
+        std::this_thread::sleep_for(std::chrono::milliseconds(DELAY_EXPIRE_MS + 4 * FLUSH_INTERVAL_MS));
+        captured(out, [&] { return fs.fsinfo(); });
+        check(lineOf(out, "  delayed ") == "" && counter(fs, false, "used ") == used + 8,
+            "f is given its blocks once it expires");
+        check(catOf(fs, "f") == lines('a', 64 * 8), "f reads back from the disk");
+        PRINTDIV2;
+
+        std::cout << "Creating and removing " << SHORT_LIVED << " files before they are given blocks..." << std::endl;
+        fs.sync();
+        fs.stats(true);
+        for (int i = 0; i < SHORT_LIVED; i++)
+        {
+            createFile(fs, "t" + std::to_string(i), 't', 64 * 4);
+            fs.rm("t" + std::to_string(i));
+        }
+        fs.sync();
+        check(counter(fs, true, "written back ") <= 2, "only the directory and FAT reach the disk");
+        check(counter(fs, false, "used ") == used + 8, "the files took no blocks");
+        PRINTDIV2;
+
+        std::cout << "Growing a and b in turns..." << std::endl;
+        createFile(fs, "a", 'a', 64);
+        createFile(fs, "b", 'b', 64);
+        createFile(fs, "x", 'x', 64);
+        for (int i = 0; i < 6; i++)
+        {
+            fs.append("x", "a");
+            fs.append("x", "b");
+        }
+        fs.sync();
+        captured(out, [&] { return fs.fsinfo(); });
+        check(lineOf(out, "  1 ") == "  1                4  " + std::string(40, '#') && lineOf(out, "Most fragmented") == "",
+            "a and b are one extent each");
+        check(catOf(fs, "a") == lines('a', 64) + lines('x', 64 * 6), "a reads back");
+        check(catOf(fs, "b") == lines('b', 64) + lines('x', 64 * 6), "b reads back");
+        PRINTDIV2;
+
+        std::cout << "Creating g, unmounting before it expires..." << std::endl;
+        createFile(fs, "g", 'g', 64 * 3);
+    }
+    {
+        FS fs(TEST_IMAGE);
+        check(catOf(fs, "g") == lines('g', 64 * 3), "unmount gives g its blocks");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    PRINTDIV2;
+
+    std::cout << "Mounting a disk a crash left g delayed on..." << std::endl;
+    check(markDelayed("g"), "mark g delayed in the disk file");
+    std::string g;
+    int problems = captured(out, [&] {
+        FS fs(TEST_IMAGE);
+        g = catOf(fs, "g");
+        return fs.fsck();
+    });
+    check(out.find("Delayed file g was never written, it is left empty") != std::string::npos, "the mount reports g");
+    check(g.empty() || g == "\n", "g is left empty");
+    check(problems == 0, "fsck finds the disk clean");
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 29 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
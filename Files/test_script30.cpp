@@ -0,0 +1,173 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test30.bin"
+#define TEST_BLOCKS 512 // a small log, so the churn makes the cleaner move blocks
+#define APPEND_FILES 16
+#define APPENDS 128 // appends to files picked at random, synced every APPEND_SYNC
+#define APPEND_SYNC 8
+#define CHURN 300 // rewrites of files picked at random
+#define CHURN_FILES 24
+
+//Appends to files picked at random on a disk formatted with options and
+//returns the seeks the modelled disk made
+static unsigned long appendSeeks(unsigned options)
+{
+    std::remove(TEST_IMAGE);
+    FS fs(TEST_IMAGE);
+    fs.format(TEST_BLOCKS, BLOCK_SIZE, options);
+    for (int f = 0; f < APPEND_FILES; f++)
+    {
+        createFile(fs, "k" + std::to_string(f), 'a', 16);
+    }
+    createFile(fs, "one", 'b', 1);
+    fs.sync();
+    fs.device({"hdd"});
+    fs.stats(true);
+    uint64_t seed = 30;
+    for (int i = 1; i <= APPENDS; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        fs.append("one", "k" + std::to_string((seed >> 33) % APPEND_FILES));
+        if (i % APPEND_SYNC == 0)
+            fs.sync();
+    }
+    unsigned long seeks = counter(fs, true, "  seeks ");
+    fs.device({"none"});
+    return seeks;
+}
+
+//Rewrites files picked at random, each a seed apart, syncing after each
+static void churn(FS& fs, uint64_t& seed, int count)
+{
+    std::string out;
+    for (int i = 0; i < count; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        std::string name = "c" + std::to_string((seed >> 33) % CHURN_FILES);
+        captured(out, [&] { return fs.rm(name); });
+        createFile(fs, name, 'a' + (seed >> 40) % 26, 64 * (1 + (seed >> 45) % 4));
+        fs.sync();
+    }
+}
+
+//Whether every file the churn from seed left reads back
+static bool churned(FS& fs, uint64_t seed, int count)
+{
+    std::vector<std::string> expected(CHURN_FILES);
+    for (int i = 0; i < count; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        expected[(seed >> 33) % CHURN_FILES] = lines('a' + (seed >> 40) % 26, 64 * (1 + (seed >> 45) % 4));
+    }
+    for (int f = 0; f < CHURN_FILES; f++)
+    {
+        if (!expected[f].empty() && catOf(fs, "c" + std::to_string(f)) != expected[f])
+            return false;
+    }
+    return true;
+}
+
+//Churns, syncs and then creates a file it never syncs before it exits
+static int crashed()
+{
+    FS fs(TEST_IMAGE);
+    uint64_t seed = 300;
+    churn(fs, seed, CHURN / 3);
+    createFile(fs, "lost", 'l', 64);
+    return 0;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 30 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        check(captured(out, [&] { return fs.format(TEST_BLOCKS, BLOCK_SIZE, FORMAT_LOG | FORMAT_CHECKSUMS); }) == -1 &&
+            out.find("can not keep checksums") != std::string::npos, "format refuses checksums on a log");
+        check(fs.format(TEST_BLOCKS, BLOCK_SIZE, FORMAT_LOG) == 0, "format a log of 512 blocks");
+        captured(out, [&] { return fs.fsinfo(); });
+        check(out.find("  log 7 of 7 segments of 64 blocks free, 512 blocks on the disk") != std::string::npos,
+            "fsinfo reports the segments of the log, the super block and map take the rest");
+        check(counter(fs, false, "used ") + counter(fs, false, "free ") < TEST_BLOCKS,
+            "the file system leaves room in the log for the cleaner");
+    }
+    PRINTDIV2;
+
+    std::cout << "Appending to files picked at random on a modelled hard disk..." << std::endl;
+    unsigned long inPlace = appendSeeks(0), logged = appendSeeks(FORMAT_LOG);
+    std::cout << inPlace << " seeks in place, " << logged << " seeks as a log" << std::endl;
+    check(logged * 2 < inPlace, "the log makes less than half the seeks");
+    PRINTDIV2;
+
+    std::cout << "Rewriting files picked at random " << CHURN << " times so the cleaner moves blocks..." << std::endl;
+    std::remove(TEST_IMAGE);
+    uint64_t seed = 30;
+    {
+        FS fs(TEST_IMAGE);
+        fs.format(TEST_BLOCKS, BLOCK_SIZE, FORMAT_LOG);
+        fs.stats(true);
+        churn(fs, seed, CHURN);
+        check(counter(fs, true, " segments (") > 0, "the cleaner moved blocks");
+        check(churned(fs, 30, CHURN), "the files read back");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    std::cout << "Mounting the disk again..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        check(churned(fs, 30, CHURN), "the map of the log is read back");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    PRINTDIV2;
+
+    std::cout << "Exiting without unmounting after a sync..." << std::endl;
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format(TEST_BLOCKS, BLOCK_SIZE, FORMAT_LOG);
+    }
+    check(inChild(crashed) == 0, "the child churns and exits");
+    {
+        FS fs(TEST_IMAGE);
+        check(churned(fs, 300, CHURN / 3), "what was synced reads back");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+        createFile(fs, "after", 'z', 64 * 4);
+        check(catOf(fs, "after") == lines('z', 64 * 4), "the log can be written again");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 30 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
@@ -37,7 +37,7 @@ std::string commands_str[] = {
     "help", "quit"
 };
 
-Shell::Shell()
+Shell::Shell(const std::string& image) : filesystem(image)
 {
     std::cout << "Creating and starting shell...\n";
 }
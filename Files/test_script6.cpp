@@ -0,0 +1,115 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test6.bin" // the test damages it while no FS has it open
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+    int ret_val = 0;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 6 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing fsck on a damaged disk..." << std::endl;
+    std::cout << "Creating f1 and f2 of three blocks each..." << std::endl;
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+        createFile(fs, "f1", 'a', 192);
+        createFile(fs, "f2", 'b', 192);
+        fs.sync();
+        ret_val = captured(out, [&] { return fs.fsck(); });
+        check(ret_val == 0 && out.find("clean") != std::string::npos, "fsck finds a new disk clean");
+    }
+
+    std::cout << "Linking the end of f1 into f2 and leaking a free block..." << std::endl;
+    super_block sb;
+    imageIO(TEST_IMAGE, false, 0, &sb, sizeof(sb));
+    std::vector<dir_entry> root(sb.block_size / sizeof(dir_entry));
+    imageIO(TEST_IMAGE, false, (uint64_t)sb.root_block * sb.block_size, root.data(), root.size() * sizeof(dir_entry));
+    uint32_t first1 = 0, first2 = 0;
+    for (dir_entry& entry : root)
+    {
+        if (entry.type == TYPE_FILE && strcmp(entry.file_name, "f1") == 0)
+            first1 = entry.first_blk;
+        if (entry.type == TYPE_FILE && strcmp(entry.file_name, "f2") == 0)
+            first2 = entry.first_blk;
+    }
+    uint64_t fat = (uint64_t)sb.fat_start * sb.block_size;
+    int32_t next = 0, last = first1;
+    for (imageIO(TEST_IMAGE, false, fat + last * 4, &next, 4); next != FAT_EOF; imageIO(TEST_IMAGE, false, fat + last * 4, &next, 4))
+        last = next;
+    imageIO(TEST_IMAGE, true, fat + last * 4, &first2, 4);
+    int32_t eof = FAT_EOF, leak = sb.no_blocks - 1;
+    imageIO(TEST_IMAGE, true, fat + leak * 4, &eof, 4);
+
+    {
+        FS fs(TEST_IMAGE);
+        std::cout << "fsck..." << std::endl;
+        std::cout << "Expected output:" << std::endl;
+        std::cout << "  /f1: size does not match its 6 blocks" << std::endl;
+        std::cout << "  /f2: cross-linked at block " << first2 << std::endl;
+        std::cout << "  1 blocks in use by no file or directory" << std::endl;
+        std::cout << "Actual output:" << std::endl;
+        ret_val = captured(out, [&] { return fs.fsck(); });
+        std::cout << out;
+        check(ret_val >= 2, "fsck counts the cross-link and the leak");
+        check(out.find("cross-linked at block " + std::to_string(first2)) != std::string::npos,
+            "fsck reports the block both chains share");
+        check(out.find("1 blocks in use by no file or directory") != std::string::npos,
+            "fsck reports the leaked block");
+
+        std::cout << "fsck -r..." << std::endl;
+        ret_val = captured(out, [&] { return fs.fsck(true); });
+        std::cout << out;
+        check(out.find("repaired") != std::string::npos, "fsck -r repairs the disk");
+        ret_val = captured(out, [&] { return fs.fsck(); });
+        check(ret_val == 0 && out.find("clean") != std::string::npos, "fsck finds the repaired disk clean");
+        captured(out, [&] { return fs.cat("f2"); });
+        check(out.size() >= 192 * 64 && out.find_first_not_of("b\n") == std::string::npos,
+            "f2 reads back whole after the repair");
+    }
+
+    std::cout << "Mounting the repaired disk again..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        ret_val = captured(out, [&] { return fs.fsck(); });
+        check(ret_val == 0 && out.find("clean") != std::string::npos, "the repair reached the disk");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 6 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
@@ -0,0 +1,218 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "iotrace.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test7.bin" // the test damages it while no FS has it open
+#define TRACE_FILE "test7.trace"
+
+//Returns the second block of the file name in the root directory of the image
+static uint32_t secondBlock(const std::string& name)
+{
+    super_block sb;
+    imageIO(TEST_IMAGE, false, 0, &sb, sizeof(sb));
+    std::vector<dir_entry> root(sb.block_size / sizeof(dir_entry));
+    imageIO(TEST_IMAGE, false, (uint64_t)sb.root_block * sb.block_size, root.data(), root.size() * sizeof(dir_entry));
+    for (dir_entry& entry : root)
+    {
+        if (entry.type == TYPE_FILE && name == entry.file_name)
+        {
+            int32_t next = 0;
+            imageIO(TEST_IMAGE, false, (uint64_t)sb.fat_start * sb.block_size + entry.first_blk * 4, &next, 4);
+            return next;
+        }
+    }
+    return 0;
+}
+
+//Returns the first block of the entry name of any type in the root directory of the image
+static uint32_t entryBlock(const std::string& name)
+{
+    super_block sb;
+    imageIO(TEST_IMAGE, false, 0, &sb, sizeof(sb));
+    std::vector<dir_entry> root(sb.block_size / sizeof(dir_entry));
+    imageIO(TEST_IMAGE, false, (uint64_t)sb.root_block * sb.block_size, root.data(), root.size() * sizeof(dir_entry));
+    for (dir_entry& entry : root)
+    {
+        if (entry.type != TYPE_EMPTY && name == entry.file_name)
+            return entry.first_blk;
+    }
+    return 0;
+}
+
+//Returns the block requests recorded in the trace file
+static std::vector<iotrace_record> traced()
+{
+    std::vector<iotrace_record> records;
+    std::ifstream trace(TRACE_FILE, std::ios::binary);
+    iotrace_header header;
+    iotrace_record record;
+    trace.read((char*)&header, sizeof(header));
+    while (trace.read((char*)&record, sizeof(record)))
+    {
+        records.push_back(record);
+    }
+    return records;
+}
+
+//Formats the image with options, writes f1 and f2 and changes a byte of the second
+//block of f1 on the disk. Returns that block
+static uint32_t damaged(unsigned options)
+{
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format(NO_BLOCKS, BLOCK_SIZE, options);
+        createFile(fs, "f1", 'a', 192);
+        createFile(fs, "f2", 'b', 192);
+    }
+    uint32_t block = secondBlock("f1");
+    char flipped = 'z';
+    imageIO(TEST_IMAGE, true, (uint64_t)block * BLOCK_SIZE + 100, &flipped, 1);
+    return block;
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 7 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing a damaged block without checksums..." << std::endl;
+    damaged(0);
+    {
+        FS fs(TEST_IMAGE);
+        captured(out, [&] { return fs.cat("f1"); });
+        check(out.find('z') != std::string::npos, "cat returns the damaged data as it is");
+    }
+    PRINTDIV2;
+
+    std::cout << "Testing a damaged block on a disk formatted with checksums..." << std::endl;
+    uint32_t block = damaged(FORMAT_CHECKSUMS);
+    {
+        FS fs(TEST_IMAGE);
+        std::cout << "cat(f1)..." << std::endl;
+        std::cout << "Expected output:" << std::endl;
+        std::cout << "Disk::read_blocks - ERROR: Checksum mismatch in block " << block << " (or Disk::read)" << std::endl;
+        std::cout << "ERROR: Can't read file" << std::endl;
+        std::cout << "Actual output:" << std::endl;
+        captured(out, [&] { return fs.cat("f1"); });
+        std::cout << out;
+        check(out.find("Checksum mismatch in block " + std::to_string(block)) != std::string::npos,
+            "the disk names the block that fails its checksum");
+        check(out.find("ERROR: Can't read file") != std::string::npos, "cat reports an error");
+        check(out.find(std::string(63, 'a')) == std::string::npos && out.find('z') == std::string::npos,
+            "cat returns none of the data");
+        captured(out, [&] { return fs.cat("f2"); });
+        check(out.size() >= 192 * 64 && out.find_first_not_of("b\n") == std::string::npos,
+            "the other file still reads back whole");
+    }
+    PRINTDIV2;
+
+    std::cout << "Testing the order a block and its checksum are written back in..." << std::endl;
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format(NO_BLOCKS, BLOCK_SIZE, FORMAT_CHECKSUMS);
+        createFile(fs, "f1", 'a', 192);
+    }
+    block = entryBlock("f1");
+    super_block sb;
+    imageIO(TEST_IMAGE, false, 0, &sb, sizeof(sb));
+    {
+        FS fs(TEST_IMAGE);
+        check(fs.record(TRACE_FILE) == 0, "record the block requests");
+        writeAt(fs, "f1", 0, std::string(BLOCK_SIZE, 'c'));
+        check(fs.sync() == 0, "sync");
+        fs.record("off");
+    }
+    //Where the first block of f1 is written and where the region is written
+    //before and after it
+    long data = -1, sumsBefore = -1, sumsAfter = -1;
+    std::vector<iotrace_record> records = traced();
+    for (long i = 0; i < (long)records.size(); i++)
+    {
+        iotrace_record& r = records[i];
+        if (r.op != IO_WRITE)
+            continue;
+        if (block - r.block_no < r.count)
+            data = i;
+        else if (r.block_no < sb.csum_start + sb.csum_blocks && sb.csum_start < r.block_no + r.count)
+            (data == -1 ? sumsBefore : sumsAfter) = i;
+    }
+    check(data != -1, "the first block of f1 is written");
+    check(sumsBefore != -1, "its old checksum is cleared on the disk before it");
+    check(sumsAfter != -1, "its new checksum is written after it");
+    {
+        FS fs(TEST_IMAGE);
+        captured(out, [&] { return fs.cat("f1"); });
+        check(out.compare(0, BLOCK_SIZE, std::string(BLOCK_SIZE, 'c')) == 0 && out.find("ERROR") == std::string::npos,
+            "f1 reads back as it was rewritten");
+    }
+    std::remove(TRACE_FILE);
+    PRINTDIV2;
+
+    std::cout << "Testing a directory block that fails its checksum..." << std::endl;
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format(NO_BLOCKS, BLOCK_SIZE, FORMAT_CHECKSUMS);
+        fs.mkdir("d");
+        createFile(fs, "d/f3", 'd', 128);
+    }
+    block = entryBlock("d");
+    char saved, flipped = 'z';
+    imageIO(TEST_IMAGE, false, (uint64_t)block * BLOCK_SIZE + 100, &saved, 1);
+    imageIO(TEST_IMAGE, true, (uint64_t)block * BLOCK_SIZE + 100, &flipped, 1);
+    {
+        FS fs(TEST_IMAGE);
+        captured(out, [&] { return fs.cat("d/f3"); });
+        check(out.find("Can't read directory block " + std::to_string(block)) != std::string::npos,
+            "cat names the directory block that can not be read");
+        check(out.find(std::string(63, 'd')) == std::string::npos, "cat returns none of the data");
+        check(captured(out, [&] { return fs.fsck(true); }) > 0, "fsck -r finds a problem");
+        check(out.find("/d: directory block " + std::to_string(block) + " can not be read") != std::string::npos,
+            "fsck reports the directory");
+        check(out.find("freed 0 blocks") != std::string::npos, "fsck -r frees none of the blocks below it");
+    }
+    imageIO(TEST_IMAGE, true, (uint64_t)block * BLOCK_SIZE + 100, &saved, 1);
+    {
+        FS fs(TEST_IMAGE);
+        check(catOf(fs, "d/f3") == lines('d', 128), "once the block is readable again d/f3 reads back");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "... Task 7 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test8.bin"
+#define HOST_FILE "test8.host" // get writes a file out here and put reads it back in
+#define HOLE (1 << 20) // bytes of the hole in the sparse file
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+    const std::string zeros(HOLE, '\0');
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 8 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    std::remove(HOST_FILE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format();
+
+        std::cout << "Testing holes, f1 gets a block written past a hole..." << std::endl;
+        createFile(fs, "f1", 'a', 1);
+        unsigned long before = counter(fs, false, "used ");
+        check(writeAt(fs, "f1", HOLE, "hello") == 5, "pwrite past the end of f1");
+        std::string data = readAt(fs, "f1", 0, HOLE + 100);
+        check(data.size() == HOLE + 5, "f1 grows to the end of the write");
+        check(data.compare(0, 64, std::string(63, 'a') + "\n") == 0, "the data before the hole stays");
+        check(data.compare(64, HOLE - 64, zeros, 64, HOLE - 64) == 0, "the hole reads as zeros");
+        check(data.compare(HOLE, 5, "hello") == 0, "the data after the hole reads back");
+        check(counter(fs, false, "used ") - before <= 3, "the hole takes no blocks");
+        PRINTDIV2;
+
+        std::cout << "Testing truncate, f2 is shrunk into its last block and grown again..." << std::endl;
+        createFile(fs, "f2", 'c', 192);
+        check(fs.truncate("f2", BLOCK_SIZE + 10) == 0, "truncate f2 to a block and 10 bytes");
+        data = readAt(fs, "f2", 0, 3 * BLOCK_SIZE);
+        check(data.size() == BLOCK_SIZE + 10 && data.find_first_not_of("c\n") == std::string::npos,
+            "f2 keeps the data up to its new size");
+        check(fs.truncate("f2", 3 * BLOCK_SIZE) == 0, "truncate f2 to three blocks");
+        data = readAt(fs, "f2", 0, 4 * BLOCK_SIZE);
+        check(data.size() == 3 * BLOCK_SIZE, "f2 grows to three blocks");
+        check(data.find_first_not_of("c\n") == BLOCK_SIZE + 10, "the data up to the cut stays");
+        check(data.compare(BLOCK_SIZE + 10, 2 * BLOCK_SIZE - 10, zeros, 0, 2 * BLOCK_SIZE - 10) == 0,
+            "the tail of the last block and the new blocks read as zeros");
+        check(fs.truncate("f2", 5) == 0 && readAt(fs, "f2", 0, BLOCK_SIZE).size() == 5, "truncate f2 to 5 bytes");
+        PRINTDIV2;
+
+        std::cout << "Testing cp and get of a sparse file..." << std::endl;
+        before = counter(fs, false, "used ");
+        check(fs.cp("f1", "f3") == 0, "cp f1 f3");
+        check(readAt(fs, "f3", 0, HOLE + 100) == readAt(fs, "f1", 0, HOLE + 100), "f3 reads the same as f1");
+        check(counter(fs, false, "used ") - before <= 3, "the copy keeps the hole");
+        check(fs.get("f1", HOST_FILE) == 0, "get f1 to a host file");
+        struct stat host;
+        check(stat(HOST_FILE, &host) == 0 && host.st_size == HOLE + 5, "the host file has the size of f1");
+        check((uint64_t)host.st_blocks * 512 < HOLE, "the host file keeps the hole");
+        before = counter(fs, false, "used ");
+        check(fs.put(HOST_FILE, "f4") == 0, "put the host file back as f4");
+        check(readAt(fs, "f4", 0, HOLE + 100) == readAt(fs, "f1", 0, HOLE + 100), "f4 reads the same as f1");
+        check(counter(fs, false, "used ") - before <= 3, "put leaves the zeros out");
+    }
+
+    std::cout << "Mounting the disk again..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        std::string data = readAt(fs, "f1", 0, HOLE + 100);
+        check(data.size() == HOLE + 5 && data.compare(HOLE, 5, "hello") == 0 &&
+            data.compare(64, HOLE - 64, zeros, 64, HOLE - 64) == 0, "f1 and its hole are read back from the disk");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    std::remove(TEST_IMAGE);
+    std::remove(HOST_FILE);
+    PRINTDIV2;
+
+    std::cout << "... Task 8 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
@@ -0,0 +1,147 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include "test_script.h"
+#include "test_helpers.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+#define TEST_IMAGE "test9.bin"
+#define TEST_BLOCKS 400 // a small log, so the churn makes the cleaner move blocks
+#define CHURN 200 // rewrites of files picked at random with the snapshot kept, they leave
+                   // segments partly in use for the cleaner to move
+#define CHURN_FILES 24
+#define SHELL_IMAGE "test9a.bin" // mounted by the shell next to the image at /
+#define SHELL_ROOT "test9r.bin"
+
+//Checks that the snapshot s mounted from fs holds the files as they were when it was taken
+static void checkFrozen(FS& fs, const std::string& when)
+{
+    int slot = fs.findSnapshot("s");
+    check(slot != -1, "snapshot s is found " + when);
+    if (slot == -1)
+        return;
+    FS view(fs, slot);
+    for (int f = 0; f < 4; f++)
+    {
+        std::string name = "f" + std::to_string(f);
+        check(catOf(view, name) == lines('a' + f, 128), name + " in the snapshot is as it was " + when);
+    }
+    check(catOf(view, "t").find("ERROR") != std::string::npos, "t is not in the snapshot " + when);
+    check(view.rm("f1") == 0 && catOf(view, "f1") == lines('b', 128), "the snapshot can not be changed " + when);
+}
+
+Shell::Shell(const std::string& image) : filesystem(image)
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string out;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 9 ..." << std::endl;
+    PRINTDIV2;
+
+    std::remove(TEST_IMAGE);
+    {
+        FS fs(TEST_IMAGE);
+        fs.format(TEST_BLOCKS, BLOCK_SIZE, FORMAT_LOG);
+        std::cout << "Creating f0 to f3 of two blocks each and taking snapshot s..." << std::endl;
+        for (int f = 0; f < 4; f++)
+            createFile(fs, "f" + std::to_string(f), 'a' + f, 128);
+        check(fs.snapshot("create", "s") == 0, "snapshot create s");
+        PRINTDIV2;
+
+        std::cout << "Rewriting f0, removing f1, appending to f2 and creating t..." << std::endl;
+        fs.rm("f0");
+        createFile(fs, "f0", 'x', 128);
+        fs.rm("f1");
+        createFile(fs, "t", 'y', 16);
+        fs.append("t", "f2");
+        fs.sync();
+        check(catOf(fs, "f0") == lines('x', 128), "the live f0 is rewritten");
+        check(catOf(fs, "f1").find("ERROR") != std::string::npos, "the live f1 is gone");
+        check(catOf(fs, "f2") == lines('c', 128) + lines('y', 16), "the live f2 is appended to");
+        checkFrozen(fs, "after the changes");
+        PRINTDIV2;
+
+        std::cout << "Rewriting files picked at random " << CHURN << " times so the cleaner moves blocks..." << std::endl;
+        fs.stats(true);
+        uint64_t seed = 7;
+        for (int i = 0; i < CHURN; i++)
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            std::string name = "k" + std::to_string((seed >> 33) % CHURN_FILES);
+            captured(out, [&] { return fs.rm(name); });
+            createFile(fs, name, 'a' + i % 26, 64 * (1 + (seed >> 40) % 4));
+            fs.sync();
+        }
+        check(counter(fs, true, " segments (") > 0, "the cleaner moved blocks");
+        check(catOf(fs, "f3") == lines('d', 128), "f3 the live volume shares with s reads back");
+        checkFrozen(fs, "after the cleaner moved its blocks");
+    }
+    PRINTDIV2;
+
+    std::cout << "Mounting the disk again..." << std::endl;
+    {
+        FS fs(TEST_IMAGE);
+        check(catOf(fs, "f0") == lines('x', 128) && catOf(fs, "f3") == lines('d', 128), "the live files read back");
+        checkFrozen(fs, "after a remount");
+
+        std::cout << "Deleting snapshot s..." << std::endl;
+        unsigned long held = counter(fs, false, "snapshots 1 hold ");
+        check(held > 0, "s holds blocks the live volume no longer uses");
+        check(fs.snapshot("delete", "s") == 0, "snapshot delete s");
+        fs.sync();
+        check(fs.findSnapshot("s") == -1, "s is gone");
+        captured(out, [&] { return fs.fsinfo(); });
+        check(out.find("snapshots ") == std::string::npos, "no blocks are held for snapshots");
+        createFile(fs, "big", 'z', 64 * 100);
+        check(catOf(fs, "big") == lines('z', 64 * 100), "the blocks s held can be written again");
+        check(fs.fsck() == 0, "fsck finds the disk clean");
+    }
+    std::remove(TEST_IMAGE);
+    PRINTDIV2;
+
+    std::cout << "Quitting the shell with a snapshot of a mounted volume still mounted..." << std::endl;
+    std::remove(SHELL_IMAGE);
+    std::remove(SHELL_ROOT);
+    std::string commands = "mount " SHELL_IMAGE " /a\ncd /a\nformat -l 4096\ncreate f1\nhello\n\n"
+        "snapshot create s1\nsnapshot mount-ro s1 /s\ncat /s/f1\nquit\n";
+    FILE* shell = popen("./filesystem " SHELL_ROOT, "w");
+    check(shell != nullptr, "the shell starts");
+    if (shell != nullptr)
+    {
+        fputs(commands.c_str(), shell);
+        check(pclose(shell) == 0, "the shell quits without an error");
+        FS fs(SHELL_IMAGE);
+        check(catOf(fs, "f1") == "hello\n", "the volume the shell unmounted reads back");
+        check(fs.findSnapshot("s1") != -1, "the snapshot the shell took is kept");
+    }
+    std::remove(SHELL_IMAGE);
+    std::remove(SHELL_ROOT);
+    PRINTDIV2;
+
+    std::cout << "... Task 9 done, " << checks_failed() << " checks failed" << std::endl;
+    PRINTDIV;
+    if (checks_failed() > 0)
+        std::exit(1);
+}
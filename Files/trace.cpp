@@ -0,0 +1,125 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+#include "trace.h"
+
+// the events of one thread, only that thread writes to it
+struct TraceRing {
+    trace_event events[TRACE_RING_EVENTS];
+    std::atomic<uint64_t> head{0}; // number of events ever recorded
+    std::atomic<uint64_t> tail{0}; // events before this were cleared
+    unsigned tid;
+    std::string name;
+};
+
+std::atomic<bool> Tracer::on{false};
+
+// rings are kept after their thread exits so its events can still be dumped
+static std::mutex ringsLock;
+static std::vector<TraceRing*> rings;
+static thread_local TraceRing* ring = nullptr;
+static thread_local const char* threadName = nullptr;
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+void Tracer::enable(bool enable)
+{
+    on.store(enable, std::memory_order_relaxed);
+}
+
+void Tracer::clear()
+{
+    std::lock_guard<std::mutex> held(ringsLock);
+    for (TraceRing* r : rings)
+    {
+        r->tail.store(r->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+// names the calling thread in the dump
+void Tracer::name_thread(const char* name)
+{
+    threadName = name;
+    if (ring != nullptr)
+    {
+        std::lock_guard<std::mutex> held(ringsLock);
+        ring->name = name;
+    }
+}
+
+uint64_t Tracer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Tracer::record(const char* name, uint64_t start, uint64_t end, int64_t arg)
+{
+    if (ring == nullptr)
+    {
+        //First span of this thread
+        ring = new TraceRing();
+        std::lock_guard<std::mutex> held(ringsLock);
+        ring->tid = rings.size() + 1;
+        ring->name = threadName != nullptr ? threadName : "thread " + std::to_string(ring->tid);
+        rings.push_back(ring);
+    }
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    trace_event& e = ring->events[head % TRACE_RING_EVENTS];
+    e.name = name;
+    e.start = start;
+    e.duration = end - start;
+    e.arg = arg;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+// writes all rings as Chrome trace JSON, best done while nothing is traced
+int Tracer::dump(const std::string& path)
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+    {
+        std::cout << "ERROR: Can't open " << path << "\n";
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> held(ringsLock);
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+    bool first = true;
+    char line[256];
+    for (TraceRing* r : rings)
+    {
+        snprintf(line, sizeof(line),
+            "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+            r->tid, r->name.c_str());
+        out << (first ? "" : ",\n") << line;
+        first = false;
+
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        uint64_t tail = r->tail.load(std::memory_order_relaxed);
+        if (head - tail > TRACE_RING_EVENTS)
+        {
+            tail = head - TRACE_RING_EVENTS;
+        }
+        for (uint64_t i = tail; i < head; i++)
+        {
+            trace_event& e = r->events[i % TRACE_RING_EVENTS];
+            int n = snprintf(line, sizeof(line),
+                ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f",
+                e.name, r->tid, e.start / 1e3, e.duration / 1e3);
+            if (e.arg >= 0)
+            {
+                snprintf(line + n, sizeof(line) - n, ", \"args\": {\"block\": %lld}}", (long long)e.arg);
+            }
+            else
+            {
+                snprintf(line + n, sizeof(line) - n, "}");
+            }
+            out << line;
+        }
+    }
+    out << "\n]}\n";
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <cstdint>
+#include <string>
+#include <atomic>
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#define TRACE_RING_EVENTS 16384 // events kept per thread, the oldest are overwritten
+
+// one finished span, times are in nanoseconds since the tracer started
+struct trace_event {
+    const char* name; // must be a string literal, only the pointer is stored
+    uint64_t start;
+    uint64_t duration;
+    int64_t arg; // block or page number, -1 if there is none
+};
+
+// Records spans into a ring buffer per thread and writes them out in the
+// Chrome trace event format, which chrome://tracing and Perfetto can open.
+// A thread only touches its own ring, recording takes no lock. While tracing
+// is off a span costs one relaxed load.
+class Tracer {
+private:
+    static std::atomic<bool> on;
+public:
+    static bool enabled() { return on.load(std::memory_order_relaxed); }
+    static void enable(bool enable);
+    // forgets everything recorded so far
+    static void clear();
+    // names the calling thread in the dump
+    static void name_thread(const char* name);
+    static uint64_t now();
+    static void record(const char* name, uint64_t start, uint64_t end, int64_t arg);
+    // writes all rings as Chrome trace JSON, best done while nothing is traced
+    static int dump(const std::string& path);
+};
+
+// Records the enclosing scope as a span if tracing was on when it started
+class TraceSpan {
+private:
+    const char* name;
+    int64_t arg;
+    bool active;
+    uint64_t start = 0;
+public:
+    TraceSpan(const char* name, int64_t arg = -1) : name(name), arg(arg), active(Tracer::enabled())
+    {
+        if (active)
+        {
+            start = Tracer::now();
+        }
+    }
+    ~TraceSpan()
+    {
+        if (active)
+        {
+            Tracer::record(name, start, Tracer::now(), arg);
+        }
+    }
+};
+
+// TRACE_SPAN("name") or TRACE_SPAN("name", block), building with -DNO_TRACE
+// removes the spans altogether
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#ifdef NO_TRACE
+#define TRACE_SPAN(...)
+#else
+#define TRACE_SPAN(...) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(__VA_ARGS__)
+#endif
+
+#endif // __TRACE_H__